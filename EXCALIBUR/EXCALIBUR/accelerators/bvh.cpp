@@ -1,4 +1,7 @@
 ﻿#include "bvh.h"
+#include "../parallel/Parallel.h"
+
+#include <array>
 
 RENDERING_BEGIN
 
@@ -45,6 +48,16 @@ static void RadixSort(std::vector<MortonPrimitive>* v)
     static_assert((nBits % bitsPerPass) == 0,
         "Radix sort bitsPerPass must evenly divide nBits");
     CONSTEXPR int nPasses = nBits / bitsPerPass;
+    CONSTEXPR int nBuckets = 1 << bitsPerPass;
+    CONSTEXPR int bitMask = (1 << bitsPerPass) - 1;
+
+    // 把数组分成若干段，每段由一个任务独立统计与分发
+    // 同一个桶内先放前面段的元素，保证排序是稳定的
+    CONSTEXPR int minChunkSize = 4096;
+    int nChunks = std::max(1, std::min(4 * numSystemCores(),
+        int(v->size() / minChunkSize)));
+    int chunkSize = (v->size() + nChunks - 1) / nChunks;
+    std::vector<std::array<int, nBuckets>> bucketCount(nChunks);
 
     for (int pass = 0; pass < nPasses; ++pass) {
         // Perform one pass of radix sort, sorting _bitsPerPass_ bits
@@ -54,28 +67,40 @@ static void RadixSort(std::vector<MortonPrimitive>* v)
         std::vector<MortonPrimitive>& in = (pass & 1) ? tempVector : *v;
         std::vector<MortonPrimitive>& out = (pass & 1) ? *v : tempVector;
 
-        // Count number of zero bits in array for current radix sort bit
-        CONSTEXPR int nBuckets = 1 << bitsPerPass;
-        int bucketCount[nBuckets] = { 0 };
-        CONSTEXPR int bitMask = (1 << bitsPerPass) - 1;
-        for (const MortonPrimitive& mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            CHECK_GE(bucket, 0);
-            CHECK_LT(bucket, nBuckets);
-            ++bucketCount[bucket];
-        }
+        // 每段统计各个桶中的元素数量
+        parallelFor([&](int64_t chunk) {
+            std::array<int, nBuckets>& count = bucketCount[chunk];
+            count.fill(0);
+            size_t chunkStart = chunk * chunkSize;
+            size_t chunkEnd = std::min(in.size(), chunkStart + chunkSize);
+            for (size_t i = chunkStart; i < chunkEnd; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                CHECK_GE(bucket, 0);
+                CHECK_LT(bucket, nBuckets);
+                ++count[bucket];
+            }
+        }, nChunks);
 
-        // Compute starting index in output array for each bucket
-        int outIndex[nBuckets];
-        outIndex[0] = 0;
-        for (int i = 1; i < nBuckets; ++i)
-            outIndex[i] = outIndex[i - 1] + bucketCount[i - 1];
+        // 前缀和：把计数转换为每段每个桶在输出数组中的起始位置
+        int offset = 0;
+        for (int bucket = 0; bucket < nBuckets; ++bucket) {
+            for (int chunk = 0; chunk < nChunks; ++chunk) {
+                int count = bucketCount[chunk][bucket];
+                bucketCount[chunk][bucket] = offset;
+                offset += count;
+            }
+        }
 
         // Store sorted values in output array
-        for (const MortonPrimitive& mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            out[outIndex[bucket]++] = mp;
-        }
+        parallelFor([&](int64_t chunk) {
+            std::array<int, nBuckets>& outIndex = bucketCount[chunk];
+            size_t chunkStart = chunk * chunkSize;
+            size_t chunkEnd = std::min(in.size(), chunkStart + chunkSize);
+            for (size_t i = chunkStart; i < chunkEnd; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                out[outIndex[bucket]++] = in[i];
+            }
+        }, nChunks);
     }
     // Copy final result from _tempVector_, if needed
     if (nPasses & 1) std::swap(*v, tempVector);
@@ -137,25 +162,135 @@ BVHBuildNode* BVHAccel::recursiveBuild(
     if (numPrimitives == 1)
     {
         // 生成叶子节点
-        int firstPrimOffset = orderedPrims.size();
-        for (int i = start; i < end; ++i)
-        {
-            int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
+        return createLeaf(node, primitiveInfo, start, end, bounds, orderedPrims);
+    }
+
+    // Compute bound of primitive centroids, choose split dimension _dim_
+    AABB3f centroidBounds;
+    for (int i = start; i < end; i++)
+        centroidBounds = unionSet(centroidBounds, primitiveInfo[i].centroid);
+    int dim = centroidBounds.maximumExtent();
+
+    // 所有质心重合，无法继续分割，直接生成叶子节点
+    if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+        return createLeaf(node, primitiveInfo, start, end, bounds, orderedPrims);
+
+    int mid = (start + end) / 2;
+    switch (splitMethod) {
+    case Middle: {
+        // 按质心包围盒的中点分割
+        Float pmid = (centroidBounds.pMin[dim] + centroidBounds.pMax[dim]) / 2;
+        BVHPrimitiveInfo* midPtr = std::partition(
+            &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+            [dim, pmid](const BVHPrimitiveInfo& pi) {
+                return pi.centroid[dim] < pmid;
+            });
+        mid = midPtr - &primitiveInfo[0];
+        // 分割失败时退化为等数量分割
+        if (mid != start && mid != end) break;
+    }
+    case EqualCounts: {
+        // 按质心排序后对半分
+        mid = (start + end) / 2;
+        std::nth_element(&primitiveInfo[start], &primitiveInfo[mid],
+            &primitiveInfo[end - 1] + 1,
+            [dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                return a.centroid[dim] < b.centroid[dim];
+            });
+        break;
+    }
+    case SAH:
+    default: {
+        if (numPrimitives <= 2) {
+            // 图元太少，没必要计算SAH
+            mid = (start + end) / 2;
+            std::nth_element(&primitiveInfo[start], &primitiveInfo[mid],
+                &primitiveInfo[end - 1] + 1,
+                [dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                    return a.centroid[dim] < b.centroid[dim];
+                });
+            break;
         }
-        node->InitLeaf(firstPrimOffset, numPrimitives, bounds);
-        return node;
+
+        // 把图元按质心放入桶中
+        CONSTEXPR int nBuckets = 12;
+        BucketInfo buckets[nBuckets];
+        for (int i = start; i < end; ++i) {
+            int b = nBuckets * centroidBounds.offset(primitiveInfo[i].centroid)[dim];
+            if (b == nBuckets) b = nBuckets - 1;
+            CHECK_GE(b, 0);
+            CHECK_LT(b, nBuckets);
+            buckets[b].count++;
+            buckets[b].bounds = unionSet(buckets[b].bounds, primitiveInfo[i].bounds);
+        }
+
+        // 从左到右、从右到左各扫描一遍，求出每个分割位置的代价
+        // cost = 0.125 + (countL * areaL + countR * areaR) / area
+        // 遍历代价相对求交代价为1/8
+        Float cost[nBuckets - 1];
+        int countBelow = 0;
+        AABB3f boundBelow;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            boundBelow = unionSet(boundBelow, buckets[i].bounds);
+            countBelow += buckets[i].count;
+            cost[i] = countBelow * boundBelow.surfaceArea();
+        }
+        int countAbove = 0;
+        AABB3f boundAbove;
+        for (int i = nBuckets - 1; i >= 1; --i) {
+            boundAbove = unionSet(boundAbove, buckets[i].bounds);
+            countAbove += buckets[i].count;
+            cost[i - 1] += countAbove * boundAbove.surfaceArea();
+        }
+
+        // 找出代价最小的分割位置
+        int minCostSplitBucket = 0;
+        Float minCost = cost[0];
+        for (int i = 1; i < nBuckets - 1; ++i) {
+            if (cost[i] < minCost) {
+                minCost = cost[i];
+                minCostSplitBucket = i;
+            }
+        }
+        Float leafCost = numPrimitives;
+        minCost = 0.125f + minCost / bounds.surfaceArea();
+
+        // 分割代价高于直接生成叶子节点的代价时，生成叶子节点
+        if (numPrimitives > maxPrimsInNode || minCost < leafCost) {
+            BVHPrimitiveInfo* pmid = std::partition(
+                &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+                [=](const BVHPrimitiveInfo& pi) {
+                    int b = nBuckets * centroidBounds.offset(pi.centroid)[dim];
+                    if (b == nBuckets) b = nBuckets - 1;
+                    CHECK_GE(b, 0);
+                    CHECK_LT(b, nBuckets);
+                    return b <= minCostSplitBucket;
+                });
+            mid = pmid - &primitiveInfo[0];
+        } else {
+            return createLeaf(node, primitiveInfo, start, end, bounds, orderedPrims);
+        }
+        break;
     }
-    // 
-    else
-    {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        AABB3f centroidBounds;
-        for (int i = start; i < end; i++)
-            centroidBounds = unionSet(centroidBounds, primitiveInfo[i].bounds);
-        int dim = centroidBounds.maximumExtent();
     }
 
+    node->initInterior(dim,
+        recursiveBuild(arena, primitiveInfo, start, mid, totalNodes, orderedPrims),
+        recursiveBuild(arena, primitiveInfo, mid, end, totalNodes, orderedPrims));
+    return node;
+}
+
+BVHBuildNode* BVHAccel::createLeaf(BVHBuildNode* node,
+    const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+    int start, int end, const AABB3f& bounds,
+    std::vector<std::shared_ptr<Primitive>>& orderedPrims) const
+{
+    int firstPrimOffset = orderedPrims.size();
+    for (int i = start; i < end; ++i) {
+        int primNum = primitiveInfo[i].primitiveNumber;
+        orderedPrims.push_back(primitives[primNum]);
+    }
+    node->InitLeaf(firstPrimOffset, end - start, bounds);
     return node;
 }
 
@@ -164,7 +299,61 @@ BVHBuildNode* BVHAccel::HLBVHBuild(
     int* totalNodes,
     std::vector<std::shared_ptr<Primitive>>& orderedPrims) const
 {
-    return nullptr;
+    // Compute bounding box of all primitive centroids
+    AABB3f bounds;
+    for (const BVHPrimitiveInfo& pi : primitiveInfo)
+        bounds = unionSet(bounds, pi.centroid);
+
+    // 并行计算每个图元质心的Morton码
+    std::vector<MortonPrimitive> mortonPrims(primitiveInfo.size());
+    parallelFor([&](int64_t i) {
+        // 每个维度10位，总共30位
+        CONSTEXPR int mortonBits = 10;
+        CONSTEXPR int mortonScale = 1 << mortonBits;
+        mortonPrims[i].primitiveIndex = primitiveInfo[i].primitiveNumber;
+        Vector3f centroidOffset = bounds.offset(primitiveInfo[i].centroid);
+        mortonPrims[i].mortonCode = EncodeMorton3(centroidOffset * Float(mortonScale));
+    }, primitiveInfo.size(), 512);
+
+    RadixSort(&mortonPrims);
+
+    // 高12位相同的图元划分到同一个treelet中
+    // 每个treelet最多需要2n-1个节点，先在arena中分配好，构建时就不需要加锁了
+    std::vector<LBVHTreelet> treeletsToBuild;
+    for (int start = 0, end = 1; end <= (int)mortonPrims.size(); ++end) {
+        uint32_t mask = 0x3ffc0000;
+        if (end == (int)mortonPrims.size() ||
+            ((mortonPrims[start].mortonCode & mask) !=
+             (mortonPrims[end].mortonCode & mask))) {
+            int nPrimitives = end - start;
+            int maxBVHNodes = 2 * nPrimitives - 1;
+            BVHBuildNode* nodes = arena.alloc<BVHBuildNode>(maxBVHNodes, false);
+            treeletsToBuild.push_back({ start, nPrimitives, nodes });
+            start = end;
+        }
+    }
+
+    // 并行构建各个treelet
+    std::atomic<int> atomicTotal(0), orderedPrimsOffset(0);
+    orderedPrims.resize(primitives.size());
+    parallelFor([&](int64_t i) {
+        int nodesCreated = 0;
+        // 高12位已经用于划分treelet，从剩下的最高位开始
+        const int firstBitIndex = 29 - 12;
+        LBVHTreelet& tr = treeletsToBuild[i];
+        tr.buildNodes = emitLBVH(tr.buildNodes, primitiveInfo, &mortonPrims[tr.startIndex],
+            tr.nPrimitives, &nodesCreated, orderedPrims,
+            &orderedPrimsOffset, firstBitIndex);
+        atomicTotal += nodesCreated;
+    }, treeletsToBuild.size());
+    *totalNodes = atomicTotal;
+
+    // 用SAH把所有treelet组合成最终的BVH
+    std::vector<BVHBuildNode*> finishedTreelets;
+    finishedTreelets.reserve(treeletsToBuild.size());
+    for (LBVHTreelet& treelet : treeletsToBuild)
+        finishedTreelets.push_back(treelet.buildNodes);
+    return buildUpperSAH(arena, finishedTreelets, 0, finishedTreelets.size(), totalNodes);
 }
 
 BVHBuildNode* BVHAccel::emitLBVH(
@@ -173,24 +362,238 @@ BVHBuildNode* BVHAccel::emitLBVH(
     MortonPrimitive* mortonPrims, int nPrimitives, int* totalNodes,
     std::vector<std::shared_ptr<Primitive>>& orderedPrims,
     std::atomic<int>* orderedPrimsOffset, int bitIndex) const {
-    return nullptr;
+    CHECK_GT(nPrimitives, 0);
+    if (bitIndex == -1 || nPrimitives < maxPrimsInNode) {
+        // 所有位都已经用完，或者图元数量足够少，生成叶子节点
+        (*totalNodes)++;
+        BVHBuildNode* node = buildNodes++;
+        AABB3f bounds;
+        int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
+        for (int i = 0; i < nPrimitives; ++i) {
+            int primitiveIndex = mortonPrims[i].primitiveIndex;
+            orderedPrims[firstPrimOffset + i] = primitives[primitiveIndex];
+            bounds = unionSet(bounds, primitiveInfo[primitiveIndex].bounds);
+        }
+        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+        return node;
+    } else {
+        int mask = 1 << bitIndex;
+        // 当前位全部相同，说明所有图元都在分割平面的同一侧，直接跳到下一位
+        if ((mortonPrims[0].mortonCode & mask) ==
+            (mortonPrims[nPrimitives - 1].mortonCode & mask))
+            return emitLBVH(buildNodes, primitiveInfo, mortonPrims, nPrimitives,
+                totalNodes, orderedPrims, orderedPrimsOffset, bitIndex - 1);
+
+        // 二分查找当前位从0变为1的位置
+        int searchStart = 0, searchEnd = nPrimitives - 1;
+        while (searchStart + 1 != searchEnd) {
+            CHECK_NE(searchStart, searchEnd);
+            int mid = (searchStart + searchEnd) / 2;
+            if ((mortonPrims[searchStart].mortonCode & mask) ==
+                (mortonPrims[mid].mortonCode & mask))
+                searchStart = mid;
+            else {
+                CHECK_EQ(mortonPrims[mid].mortonCode & mask,
+                    mortonPrims[searchEnd].mortonCode & mask);
+                searchEnd = mid;
+            }
+        }
+        int splitOffset = searchEnd;
+        CHECK_LE(splitOffset, nPrimitives - 1);
+        CHECK_NE(mortonPrims[splitOffset - 1].mortonCode & mask,
+            mortonPrims[splitOffset].mortonCode & mask);
+
+        // Create and return interior LBVH node
+        (*totalNodes)++;
+        BVHBuildNode* node = buildNodes++;
+        BVHBuildNode* lbvh[2] = {
+            emitLBVH(buildNodes, primitiveInfo, mortonPrims, splitOffset,
+                totalNodes, orderedPrims, orderedPrimsOffset, bitIndex - 1),
+            emitLBVH(buildNodes, primitiveInfo, &mortonPrims[splitOffset],
+                nPrimitives - splitOffset, totalNodes, orderedPrims,
+                orderedPrimsOffset, bitIndex - 1) };
+        // Morton码按x、y、z交替排列，由位的序号可以得到分割轴
+        int axis = bitIndex % 3;
+        node->initInterior(axis, lbvh[0], lbvh[1]);
+        return node;
+    }
 }
 
 BVHBuildNode* BVHAccel::buildUpperSAH(MemoryArena& arena,
     std::vector<BVHBuildNode*>& treeletRoots,
     int start, int end, int* totalNodes) const {
-    return nullptr;
+    CHECK_LT(start, end);
+    int nNodes = end - start;
+    if (nNodes == 1) return treeletRoots[start];
+    (*totalNodes)++;
+    BVHBuildNode* node = arena.alloc<BVHBuildNode>();
+
+    // Compute bounds of all nodes under this HLBVH node
+    AABB3f bounds;
+    for (int i = start; i < end; ++i)
+        bounds = unionSet(bounds, treeletRoots[i]->bounds);
+
+    // Compute bound of HLBVH node centroids, choose split dimension _dim_
+    AABB3f centroidBounds;
+    for (int i = start; i < end; ++i) {
+        Point3f centroid = .5f * treeletRoots[i]->bounds.pMin + .5f * treeletRoots[i]->bounds.pMax;
+        centroidBounds = unionSet(centroidBounds, centroid);
+    }
+    int dim = centroidBounds.maximumExtent();
+    // treelet之间Morton码高位不同，质心不会完全重合
+    CHECK_NE(centroidBounds.pMax[dim], centroidBounds.pMin[dim]);
+
+    // Allocate _BucketInfo_ for SAH partition buckets
+    CONSTEXPR int nBuckets = 12;
+    BucketInfo buckets[nBuckets];
+    auto bucketIndex = [&](const BVHBuildNode* treelet) {
+        Float centroid = (treelet->bounds.pMin[dim] + treelet->bounds.pMax[dim]) * 0.5f;
+        int b = nBuckets * ((centroid - centroidBounds.pMin[dim]) /
+            (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]));
+        if (b == nBuckets) b = nBuckets - 1;
+        CHECK_GE(b, 0);
+        CHECK_LT(b, nBuckets);
+        return b;
+    };
+
+    // Initialize _BucketInfo_ for HLBVH SAH partition buckets
+    for (int i = start; i < end; ++i) {
+        int b = bucketIndex(treeletRoots[i]);
+        buckets[b].count++;
+        buckets[b].bounds = unionSet(buckets[b].bounds, treeletRoots[i]->bounds);
+    }
+
+    // 与recursiveBuild相同，两次扫描求出各个分割位置的代价
+    Float cost[nBuckets - 1];
+    int countBelow = 0;
+    AABB3f boundBelow;
+    for (int i = 0; i < nBuckets - 1; ++i) {
+        boundBelow = unionSet(boundBelow, buckets[i].bounds);
+        countBelow += buckets[i].count;
+        cost[i] = countBelow * boundBelow.surfaceArea();
+    }
+    int countAbove = 0;
+    AABB3f boundAbove;
+    for (int i = nBuckets - 1; i >= 1; --i) {
+        boundAbove = unionSet(boundAbove, buckets[i].bounds);
+        countAbove += buckets[i].count;
+        cost[i - 1] += countAbove * boundAbove.surfaceArea();
+    }
+
+    // Find bucket to split at that minimizes SAH metric
+    int minCostSplitBucket = 0;
+    Float minCost = cost[0];
+    for (int i = 1; i < nBuckets - 1; ++i) {
+        if (cost[i] < minCost) {
+            minCost = cost[i];
+            minCostSplitBucket = i;
+        }
+    }
+
+    // Split nodes and create interior HLBVH SAH node
+    BVHBuildNode** pmid = std::partition(
+        &treeletRoots[start], &treeletRoots[end - 1] + 1,
+        [=](const BVHBuildNode* node) {
+            return bucketIndex(node) <= minCostSplitBucket;
+        });
+    int mid = pmid - &treeletRoots[0];
+    // 所有treelet都落在同一侧时，退化为等数量分割
+    if (mid == start || mid == end) mid = (start + end) / 2;
+    CHECK_GT(mid, start);
+    CHECK_LT(mid, end);
+    node->initInterior(dim,
+        this->buildUpperSAH(arena, treeletRoots, start, mid, totalNodes),
+        this->buildUpperSAH(arena, treeletRoots, mid, end, totalNodes));
+    return node;
 }
 
 int BVHAccel::flattenBVHTree(BVHBuildNode* node, int* offset) {
-    return 1;
+    // 按深度优先顺序展开，第一个子节点紧跟在父节点之后
+    LinearBVHNode* linearNode = &nodes[*offset];
+    linearNode->bounds = node->bounds;
+    int myOffset = (*offset)++;
+    if (node->nPrimitives > 0) {
+        DCHECK(!node->children[0] && !node->children[1]);
+        CHECK_LT(node->nPrimitives, 65536);
+        linearNode->primitivesOffset = node->firstPrimOffset;
+        linearNode->nPrimitives = node->nPrimitives;
+    } else {
+        linearNode->axis = node->splitAxis;
+        linearNode->nPrimitives = 0;
+        flattenBVHTree(node->children[0], offset);
+        linearNode->secondChildOffset = flattenBVHTree(node->children[1], offset);
+    }
+    return myOffset;
 }
 
-bool BVHAccel::intersect(const Ray& r, SurfaceInteraction*) const {
-    return false;
+bool BVHAccel::intersect(const Ray& ray, SurfaceInteraction* isect) const {
+    if (!nodes) return false;
+    bool hit = false;
+    Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+    int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    // 待访问节点栈
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode* node = &nodes[currentNodeIndex];
+        if (node->bounds.intersectP(ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                // 叶子节点，与其中所有图元求交，命中后ray.tMax会被缩短
+                for (int i = 0; i < node->nPrimitives; ++i)
+                    if (primitives[node->primitivesOffset + i]->intersect(ray, isect))
+                        hit = true;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                // 根据射线方向先访问近的子节点，远的子节点压栈
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return hit;
 }
 
-bool BVHAccel::intersectP(const Ray& r) const {
+bool BVHAccel::intersectP(const Ray& ray) const {
+    if (!nodes) return false;
+    Vector3f invDir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+    int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    int nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    while (true) {
+        const LinearBVHNode* node = &nodes[currentNodeIndex];
+        if (node->bounds.intersectP(ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                // 阴影射线只需要找到任意一个交点
+                for (int i = 0; i < node->nPrimitives; ++i) {
+                    if (primitives[node->primitivesOffset + i]->intersectP(ray)) {
+                        return true;
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
     return false;
 }
 
@@ -100,6 +100,10 @@ private:
     BVHBuildNode* buildUpperSAH(MemoryArena& arena,
         std::vector<BVHBuildNode*>& treeletRoots,
         int start, int end, int* totalNodes) const;
+    BVHBuildNode* createLeaf(BVHBuildNode* node,
+        const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+        int start, int end, const AABB3f& bounds,
+        std::vector<std::shared_ptr<Primitive>>& orderedPrims) const;
     int flattenBVHTree(BVHBuildNode* node, int* offset);
 
     const int maxPrimsInNode;
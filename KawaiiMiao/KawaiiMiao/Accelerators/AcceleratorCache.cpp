@@ -0,0 +1,179 @@
+#include "AcceleratorCache.h"
+#include "../Tool/Logger.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+
+RENDER_BEGIN
+
+// Note: bump the version whenever the layout of a cached node type changes
+static constexpr char cacheMagic[8] = { 'K', 'A', 'W', 'A', 'I', 'I', 'A', 'C' };
+static constexpr uint32_t cacheVersion = 1;
+static constexpr size_t cacheAlignment = 64;
+
+struct CacheHeader
+{
+	char m_magic[8];
+	uint32_t m_version;
+	uint32_t m_nSections;
+	uint64_t m_key;
+	// Followed by m_nSections section sizes, then the sections each aligned to cacheAlignment
+};
+
+static size_t alignCacheOffset(size_t offset)
+{
+	return (offset + cacheAlignment - 1) & ~(cacheAlignment - 1);
+}
+
+void CacheHasher::update(const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		m_hash ^= bytes[i];
+		m_hash *= 1099511628211ull;
+	}
+}
+
+std::string AcceleratorCache::m_directory = "";
+
+void AcceleratorCache::setDirectory(const std::string& directory)
+{
+	m_directory = directory;
+	if (m_directory.empty())
+		return;
+
+	if (m_directory.back() != '/' && m_directory.back() != '\\')
+		m_directory += '/';
+
+	std::error_code error;
+	std::filesystem::create_directories(m_directory, error);
+	if (error)
+	{
+		K_WARN("Could not create the cache directory {0}: {1}. Cache disabled.", m_directory, error.message());
+		m_directory.clear();
+	}
+}
+
+std::string AcceleratorCache::entryFilename(const std::string& kind, uint64_t key)
+{
+	std::stringstream ss;
+	ss << m_directory << kind << "_" << std::hex << std::setw(16) << std::setfill('0') << key << ".kcache";
+	return ss.str();
+}
+
+MappedFile::unique_ptr AcceleratorCache::load(const std::string& kind, uint64_t key, std::vector<CacheSection>& sections)
+{
+	sections.clear();
+	if (!isEnabled())
+		return nullptr;
+
+	const std::string filename = entryFilename(kind, key);
+	MappedFile::unique_ptr file(new MappedFile());
+	if (!file->open(filename))
+		return nullptr;
+
+	// Validate the header before trusting any size stored in the file
+	if (file->size() < sizeof(CacheHeader))
+		return nullptr;
+	CacheHeader header;
+	memcpy(&header, file->data(), sizeof(CacheHeader));
+	if (memcmp(header.m_magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.m_version != cacheVersion ||
+		header.m_key != key)
+	{
+		K_WARN("Cache entry {0} is stale or corrupted, rebuilding it", filename);
+		return nullptr;
+	}
+
+	size_t offset = sizeof(CacheHeader) + header.m_nSections * sizeof(uint64_t);
+	if (offset > file->size())
+		return nullptr;
+
+	const char* sizes = file->data() + sizeof(CacheHeader);
+	for (uint32_t i = 0; i < header.m_nSections; ++i)
+	{
+		uint64_t size;
+		memcpy(&size, sizes + i * sizeof(uint64_t), sizeof(uint64_t));
+		offset = alignCacheOffset(offset);
+		if (size > file->size() - glm::min(offset, file->size()))
+		{
+			K_WARN("Cache entry {0} is truncated, rebuilding it", filename);
+			sections.clear();
+			return nullptr;
+		}
+
+		CacheSection section;
+		section.m_data = file->data() + offset;
+		section.m_size = size_t(size);
+		sections.push_back(section);
+		offset += size_t(size);
+	}
+
+	K_INFO("Loaded {0} from cache {1}", kind, filename);
+	return file;
+}
+
+bool AcceleratorCache::store(const std::string& kind, uint64_t key, const std::vector<CacheSection>& sections)
+{
+	if (!isEnabled())
+		return false;
+
+	// Note: the entry is written next to its final name and renamed afterwards,
+	//       so a concurrent render never maps a half-written file
+	const std::string filename = entryFilename(kind, key);
+	const std::string tempFilename = filename + ".tmp";
+	{
+		std::ofstream out(tempFilename, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			K_WARN("Could not write the cache entry {0}", filename);
+			return false;
+		}
+
+		CacheHeader header;
+		memcpy(header.m_magic, cacheMagic, sizeof(cacheMagic));
+		header.m_version = cacheVersion;
+		header.m_nSections = uint32_t(sections.size());
+		header.m_key = key;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+		for (const auto& section : sections)
+		{
+			uint64_t size = section.m_size;
+			out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
+		}
+
+		size_t offset = sizeof(CacheHeader) + sections.size() * sizeof(uint64_t);
+		static const char padding[cacheAlignment] = {};
+		for (const auto& section : sections)
+		{
+			size_t aligned = alignCacheOffset(offset);
+			out.write(padding, aligned - offset);
+			out.write(static_cast<const char*>(section.m_data), section.m_size);
+			offset = aligned + section.m_size;
+		}
+
+		if (!out)
+		{
+			K_WARN("Could not write the cache entry {0}", filename);
+			out.close();
+			std::remove(tempFilename.c_str());
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempFilename, filename, error);
+	if (error)
+	{
+		std::remove(tempFilename.c_str());
+		return false;
+	}
+
+	K_INFO("Stored {0} in cache {1}", kind, filename);
+	return true;
+}
+
+RENDER_END
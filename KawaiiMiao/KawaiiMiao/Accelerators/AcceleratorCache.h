@@ -0,0 +1,57 @@
+#pragma once
+
+#include "../Core/Rendering.h"
+#include "../Tool/MappedFile.h"
+
+RENDER_BEGIN
+
+// 64-bit FNV-1a hash of everything a cached build depends on
+class CacheHasher
+{
+public:
+	void update(const void* data, size_t size);
+	void update(const std::string& value) { update(value.data(), value.size()); }
+
+	template <typename T>
+	void update(const T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "CacheHasher only hashes plain data");
+		update(&value, sizeof(T));
+	}
+
+	uint64_t value() const { return m_hash; }
+
+private:
+	uint64_t m_hash = 14695981039346656037ull;
+};
+
+// One contiguous block of cached data
+struct CacheSection
+{
+	const void* m_data = nullptr;
+	size_t m_size = 0;
+};
+
+// Opt-in on-disk cache of imported meshes and built accelerators.
+// Every entry is a versioned binary file named after its kind and input hash,
+// it is memory-mapped on reload so no parsing or rebuild is needed.
+class AcceleratorCache
+{
+public:
+	// An empty directory disables the cache
+	static void setDirectory(const std::string& directory);
+	static bool isEnabled() { return !m_directory.empty(); }
+
+	// Map the entry of this kind and key, the sections point into the returned mapping.
+	// Returns nullptr if there is no valid entry.
+	static MappedFile::unique_ptr load(const std::string& kind, uint64_t key, std::vector<CacheSection>& sections);
+
+	static bool store(const std::string& kind, uint64_t key, const std::vector<CacheSection>& sections);
+
+private:
+	static std::string entryFilename(const std::string& kind, uint64_t key);
+
+	static std::string m_directory;
+};
+
+RENDER_END
@@ -0,0 +1,509 @@
+#include "BVH.h"
+#include "AcceleratorCache.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Logger.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+RENDER_BEGIN
+
+struct BVHPrimitiveInfo
+{
+	BVHPrimitiveInfo() = default;
+	BVHPrimitiveInfo(size_t primitiveNumber, const Bounds3f& bounds)
+		: m_primitiveNumber(primitiveNumber), m_bounds(bounds),
+		m_centroid(Float(0.5) * bounds.m_pMin + Float(0.5) * bounds.m_pMax) {}
+
+	size_t m_primitiveNumber;
+	Bounds3f m_bounds;
+	Vector3f m_centroid;
+};
+
+struct BVHBuildNode
+{
+	void initLeaf(int first, int n, const Bounds3f& b)
+	{
+		m_firstPrimOffset = first;
+		m_nPrimitives = n;
+		m_bounds = b;
+		m_children[0] = m_children[1] = nullptr;
+	}
+
+	void initInterior(int axis, BVHBuildNode* c0, BVHBuildNode* c1)
+	{
+		m_children[0] = c0;
+		m_children[1] = c1;
+		m_bounds = unionBounds(c0->m_bounds, c1->m_bounds);
+		m_splitAxis = axis;
+		m_nPrimitives = 0;
+	}
+
+	Bounds3f m_bounds;
+	BVHBuildNode* m_children[2];
+	int m_splitAxis, m_firstPrimOffset, m_nPrimitives;
+};
+
+struct BVHBucketInfo
+{
+	int m_count = 0;
+	Bounds3f m_bounds;
+};
+
+BVHAccel::BVHAccel(const std::vector<Primitive::ptr>& primitives, int maxPrimsInNode/* = 4*/,
+	SplitMethod splitMethod/* = SplitMethod::SAH*/) :
+	m_maxPrimsInNode(glm::min(255, maxPrimsInNode)),
+	m_splitMethod(splitMethod),
+	m_primitives(primitives)
+{
+	if (m_primitives.empty())
+		return;
+
+	// Initialize primitive info array for primitives
+	std::vector<BVHPrimitiveInfo> primitiveInfo(m_primitives.size());
+	for (size_t i = 0; i < m_primitives.size(); ++i)
+	{
+		primitiveInfo[i] = { i, m_primitives[i]->worldBound() };
+	}
+
+	// The tree only depends on the build settings and the primitive bounds
+	uint64_t cacheKey = 0;
+	if (AcceleratorCache::isEnabled())
+	{
+		CacheHasher hasher;
+		hasher.update(sizeof(LinearBVHNode));
+		hasher.update(m_maxPrimsInNode);
+		hasher.update(m_splitMethod);
+		for (const auto& info : primitiveInfo)
+		{
+			hasher.update(info.m_bounds);
+		}
+		cacheKey = hasher.value();
+		if (loadFromCache(cacheKey))
+			return;
+	}
+
+	// Build BVH tree for primitives using primitive info
+	MemoryArena arena(1024 * 1024);
+	std::vector<Primitive::ptr> orderedPrims;
+	orderedPrims.reserve(m_primitives.size());
+	BVHBuildNode* root = recursiveBuild(arena, primitiveInfo, 0, m_primitives.size(),
+		&m_totalNodes, orderedPrims);
+
+	// Record where every input primitive ended up, the cache stores this order
+	std::vector<int> primitiveOrder;
+	if (AcceleratorCache::isEnabled())
+	{
+		std::unordered_map<const Primitive*, int> inputIndex;
+		for (size_t i = 0; i < m_primitives.size(); ++i)
+		{
+			inputIndex[m_primitives[i].get()] = i;
+		}
+		primitiveOrder.resize(orderedPrims.size());
+		for (size_t i = 0; i < orderedPrims.size(); ++i)
+		{
+			primitiveOrder[i] = inputIndex[orderedPrims[i].get()];
+		}
+	}
+	m_primitives.swap(orderedPrims);
+
+	// Compute representation of depth-first traversal of BVH tree
+	m_nodes = AllocAligned<LinearBVHNode>(m_totalNodes);
+	int offset = 0;
+	flattenBVHTree(root, &offset);
+	CHECK_EQ(m_totalNodes, offset);
+
+	if (AcceleratorCache::isEnabled())
+	{
+		saveToCache(cacheKey, primitiveOrder);
+	}
+
+	K_INFO("BVH created with {0} nodes for {1} primitives ({2} MB)", m_totalNodes, m_primitives.size(),
+		float(m_totalNodes * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
+}
+
+bool BVHAccel::loadFromCache(uint64_t key)
+{
+	std::vector<CacheSection> sections;
+	MappedFile::unique_ptr file = AcceleratorCache::load("BVH", key, sections);
+	if (!file || sections.size() != 2)
+		return false;
+
+	// Sections: flattened nodes, input index of every ordered primitive
+	const CacheSection& nodes = sections[0];
+	const CacheSection& order = sections[1];
+	if (nodes.m_size == 0 || nodes.m_size % sizeof(LinearBVHNode) != 0 ||
+		order.m_size != m_primitives.size() * sizeof(int))
+		return false;
+
+	// Note: a corrupted cache must not send the traversal out of the arrays,
+	//       the primitive order has to be a permutation and every node in range
+	const int nPrimitives = int(m_primitives.size());
+	const int* primitiveOrder = static_cast<const int*>(order.m_data);
+	std::vector<bool> seen(m_primitives.size(), false);
+	for (int i = 0; i < nPrimitives; ++i)
+	{
+		if (primitiveOrder[i] < 0 || primitiveOrder[i] >= nPrimitives || seen[primitiveOrder[i]])
+			return false;
+		seen[primitiveOrder[i]] = true;
+	}
+
+	const int nNodes = int(nodes.m_size / sizeof(LinearBVHNode));
+	const LinearBVHNode* cachedNodes = static_cast<const LinearBVHNode*>(nodes.m_data);
+	for (int i = 0; i < nNodes; ++i)
+	{
+		const LinearBVHNode& node = cachedNodes[i];
+		if (node.m_nPrimitives > 0)
+		{
+			if (node.m_primitivesOffset < 0 || int64_t(node.m_primitivesOffset) + node.m_nPrimitives > nPrimitives)
+				return false;
+		}
+		else if (node.m_axis >= 3 || node.m_secondChildOffset <= i + 1 || node.m_secondChildOffset >= nNodes)
+		{
+			return false;
+		}
+	}
+
+	std::vector<Primitive::ptr> orderedPrims(m_primitives.size());
+	for (int i = 0; i < nPrimitives; ++i)
+	{
+		orderedPrims[i] = m_primitives[primitiveOrder[i]];
+	}
+	m_primitives.swap(orderedPrims);
+
+	m_totalNodes = nNodes;
+	m_nodes = AllocAligned<LinearBVHNode>(m_totalNodes);
+	memcpy(m_nodes, nodes.m_data, nodes.m_size);
+
+	K_INFO("BVH loaded with {0} nodes for {1} primitives", m_totalNodes, m_primitives.size());
+	return true;
+}
+
+void BVHAccel::saveToCache(uint64_t key, const std::vector<int>& primitiveOrder) const
+{
+	std::vector<CacheSection> sections(2);
+	sections[0].m_data = m_nodes;
+	sections[0].m_size = m_totalNodes * sizeof(LinearBVHNode);
+	sections[1].m_data = primitiveOrder.data();
+	sections[1].m_size = primitiveOrder.size() * sizeof(int);
+	AcceleratorCache::store("BVH", key, sections);
+}
+
+BVHAccel::~BVHAccel()
+{
+	FreeAligned(m_nodes);
+}
+
+Bounds3f BVHAccel::worldBound() const
+{
+	return m_nodes ? m_nodes[0].m_bounds : Bounds3f();
+}
+
+BVHAccel::SplitMethod BVHAccel::parseSplitMethod(const std::string& name)
+{
+	if (name == "SAH")
+		return SplitMethod::SAH;
+	else if (name == "Middle")
+		return SplitMethod::Middle;
+	else if (name == "EqualCounts")
+		return SplitMethod::EqualCounts;
+
+	K_WARN("BVH split method \"{0}\" unknown. Using \"SAH\".", name);
+	return SplitMethod::SAH;
+}
+
+BVHBuildNode* BVHAccel::recursiveBuild(MemoryArena& arena, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+	int start, int end, int* totalNodes, std::vector<Primitive::ptr>& orderedPrims)
+{
+	CHECK_NE(start, end);
+	BVHBuildNode* node = ARENA_ALLOC(arena, BVHBuildNode);
+	++(*totalNodes);
+
+	// Compute bounds of all primitives in BVH node
+	Bounds3f bounds;
+	for (int i = start; i < end; ++i)
+	{
+		bounds = unionBounds(bounds, primitiveInfo[i].m_bounds);
+	}
+
+	int nPrimitives = end - start;
+	if (nPrimitives == 1)
+	{
+		return createLeafNode(node, primitiveInfo, start, end, bounds, orderedPrims);
+	}
+
+	// Compute bound of primitive centroids, choose split dimension
+	Bounds3f centroidBounds;
+	for (int i = start; i < end; ++i)
+	{
+		centroidBounds = unionBounds(centroidBounds, primitiveInfo[i].m_centroid);
+	}
+	int dim = centroidBounds.maximumExtent();
+
+	// Note: all centroids are at the same position, the primitives can't be separated
+	if (centroidBounds.m_pMax[dim] == centroidBounds.m_pMin[dim])
+	{
+		return createLeafNode(node, primitiveInfo, start, end, bounds, orderedPrims);
+	}
+
+	auto centroidLess = [dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) -> bool
+	{
+		return a.m_centroid[dim] < b.m_centroid[dim];
+	};
+
+	int mid = (start + end) / 2;
+	switch (m_splitMethod)
+	{
+	case SplitMethod::Middle:
+	{
+		// Partition primitives through node's midpoint
+		Float pmid = (centroidBounds.m_pMin[dim] + centroidBounds.m_pMax[dim]) / 2;
+		BVHPrimitiveInfo* midPtr = std::partition(&primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+			[dim, pmid](const BVHPrimitiveInfo& pi) { return pi.m_centroid[dim] < pmid; });
+		mid = midPtr - &primitiveInfo[0];
+		if (mid != start && mid != end)
+			break;
+		// Note: for lots of prims with large overlapping bounding boxes, this
+		//       may fail to partition; in that case fall through to EqualCounts.
+	}
+	case SplitMethod::EqualCounts:
+	{
+		// Partition primitives into equally-sized subsets
+		mid = (start + end) / 2;
+		std::nth_element(&primitiveInfo[start], &primitiveInfo[mid], &primitiveInfo[end - 1] + 1, centroidLess);
+		break;
+	}
+	case SplitMethod::SAH:
+	default:
+	{
+		// Partition primitives using approximate SAH
+		if (nPrimitives <= 2)
+		{
+			mid = (start + end) / 2;
+			std::nth_element(&primitiveInfo[start], &primitiveInfo[mid], &primitiveInfo[end - 1] + 1, centroidLess);
+			break;
+		}
+
+		// Allocate bucket info for SAH partition buckets
+		constexpr int nBuckets = 12;
+		BVHBucketInfo buckets[nBuckets];
+		auto bucketIndex = [&](const BVHPrimitiveInfo& pi) -> int
+		{
+			int b = nBuckets * centroidBounds.offset(pi.m_centroid)[dim];
+			if (b == nBuckets)
+				b = nBuckets - 1;
+			DCHECK(b >= 0 && b < nBuckets);
+			return b;
+		};
+
+		// Initialize bucket info for SAH partition buckets
+		for (int i = start; i < end; ++i)
+		{
+			int b = bucketIndex(primitiveInfo[i]);
+			++buckets[b].m_count;
+			buckets[b].m_bounds = unionBounds(buckets[b].m_bounds, primitiveInfo[i].m_bounds);
+		}
+
+		// Note: sweep the buckets from both sides so that the cost of every
+		//       split is computed in linear time instead of quadratic time.
+		Float cost[nBuckets - 1];
+		int countBelow = 0;
+		Bounds3f boundBelow;
+		for (int i = 0; i < nBuckets - 1; ++i)
+		{
+			boundBelow = unionBounds(boundBelow, buckets[i].m_bounds);
+			countBelow += buckets[i].m_count;
+			cost[i] = countBelow * boundBelow.surfaceArea();
+		}
+		int countAbove = 0;
+		Bounds3f boundAbove;
+		for (int i = nBuckets - 1; i >= 1; --i)
+		{
+			boundAbove = unionBounds(boundAbove, buckets[i].m_bounds);
+			countAbove += buckets[i].m_count;
+			cost[i - 1] += countAbove * boundAbove.surfaceArea();
+		}
+
+		// Find bucket to split at that minimizes SAH metric
+		int minCostSplitBucket = 0;
+		Float minCost = cost[0];
+		for (int i = 1; i < nBuckets - 1; ++i)
+		{
+			if (cost[i] < minCost)
+			{
+				minCost = cost[i];
+				minCostSplitBucket = i;
+			}
+		}
+
+		// Note: traversal cost is assumed to be 1/8 of the intersection cost
+		Float leafCost = nPrimitives;
+		minCost = Float(0.125) + minCost / bounds.surfaceArea();
+
+		// Either create leaf or split primitives at selected SAH bucket
+		if (nPrimitives > m_maxPrimsInNode || minCost < leafCost)
+		{
+			BVHPrimitiveInfo* pmid = std::partition(&primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+				[&](const BVHPrimitiveInfo& pi) { return bucketIndex(pi) <= minCostSplitBucket; });
+			mid = pmid - &primitiveInfo[0];
+		}
+		else
+		{
+			return createLeafNode(node, primitiveInfo, start, end, bounds, orderedPrims);
+		}
+		break;
+	}
+	}
+
+	node->initInterior(dim,
+		recursiveBuild(arena, primitiveInfo, start, mid, totalNodes, orderedPrims),
+		recursiveBuild(arena, primitiveInfo, mid, end, totalNodes, orderedPrims));
+	return node;
+}
+
+BVHBuildNode* BVHAccel::createLeafNode(BVHBuildNode* node, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+	int start, int end, const Bounds3f& bounds, std::vector<Primitive::ptr>& orderedPrims) const
+{
+	int firstPrimOffset = orderedPrims.size();
+	for (int i = start; i < end; ++i)
+	{
+		orderedPrims.push_back(m_primitives[primitiveInfo[i].m_primitiveNumber]);
+	}
+	node->initLeaf(firstPrimOffset, end - start, bounds);
+	return node;
+}
+
+int BVHAccel::flattenBVHTree(BVHBuildNode* node, int* offset)
+{
+	LinearBVHNode* linearNode = &m_nodes[*offset];
+	linearNode->m_bounds = node->m_bounds;
+	int myOffset = (*offset)++;
+	if (node->m_nPrimitives > 0)
+	{
+		DCHECK(!node->m_children[0] && !node->m_children[1]);
+		CHECK_LT(node->m_nPrimitives, 65536);
+		linearNode->m_primitivesOffset = node->m_firstPrimOffset;
+		linearNode->m_nPrimitives = node->m_nPrimitives;
+	}
+	else
+	{
+		// Create interior flattened BVH node
+		linearNode->m_axis = node->m_splitAxis;
+		linearNode->m_nPrimitives = 0;
+		flattenBVHTree(node->m_children[0], offset);
+		linearNode->m_secondChildOffset = flattenBVHTree(node->m_children[1], offset);
+	}
+	return myOffset;
+}
+
+bool BVHAccel::hit(const Ray& ray) const
+{
+	if (!m_nodes)
+		return false;
+
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	// Follow ray through BVH nodes to find primitive intersections
+	constexpr int maxTodo = 64;
+	int nodesToVisit[maxTodo];
+	int toVisitOffset = 0, currentNodeIndex = 0;
+	while (true)
+	{
+		const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+		if (node->m_bounds.hit(ray, invDir, dirIsNeg))
+		{
+			if (node->m_nPrimitives > 0)
+			{
+				// Note: shadow rays can terminate at the first occluder found
+				for (int i = 0; i < node->m_nPrimitives; ++i)
+				{
+					if (m_primitives[node->m_primitivesOffset + i]->hit(ray))
+						return true;
+				}
+				if (toVisitOffset == 0)
+					break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			else
+			{
+				// Visit the near child first, push the far child
+				if (dirIsNeg[node->m_axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node->m_secondChildOffset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node->m_secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+		else
+		{
+			if (toVisitOffset == 0)
+				break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+	}
+	return false;
+}
+
+bool BVHAccel::hit(const Ray& ray, HitRecord& record) const
+{
+	if (!m_nodes)
+		return false;
+
+	bool hit = false;
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	// Follow ray through BVH nodes to find primitive intersections
+	constexpr int maxTodo = 64;
+	int nodesToVisit[maxTodo];
+	int toVisitOffset = 0, currentNodeIndex = 0;
+	while (true)
+	{
+		const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+		// Note: ray.m_tMax shrinks on every hit, so far nodes get culled by the slab test
+		if (node->m_bounds.hit(ray, invDir, dirIsNeg))
+		{
+			if (node->m_nPrimitives > 0)
+			{
+				// Intersect ray with primitives in leaf BVH node
+				for (int i = 0; i < node->m_nPrimitives; ++i)
+				{
+					if (m_primitives[node->m_primitivesOffset + i]->hit(ray, record))
+						hit = true;
+				}
+				if (toVisitOffset == 0)
+					break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			else
+			{
+				// Visit the near child first, push the far child
+				if (dirIsNeg[node->m_axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node->m_secondChildOffset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node->m_secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+		else
+		{
+			if (toVisitOffset == 0)
+				break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+	}
+	return hit;
+}
+
+RENDER_END
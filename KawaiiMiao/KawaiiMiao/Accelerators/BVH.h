@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../Core/Rendering.h"
+#include "../Math/KMathUtil.h"
+#include "../Core/Primitive.h"
+
+RENDER_BEGIN
+
+class MemoryArena;
+struct BVHBuildNode;
+struct BVHPrimitiveInfo;
+
+// Compact depth-first node layout: the first child of an interior node
+// immediately follows its parent, so only the second child offset is stored.
+struct LinearBVHNode
+{
+	Bounds3f m_bounds;
+	union
+	{
+		int m_primitivesOffset; // Leaf
+		int m_secondChildOffset; // Interior
+	};
+	uint16_t m_nPrimitives; // 0 -> interior node
+	uint8_t m_axis; // Interior node: xyz
+	uint8_t m_pad[1]; // Ensure 32 byte total size
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
+
+class BVHAccel : public PrimitiveAggregate
+{
+public:
+	typedef std::shared_ptr<BVHAccel> ptr;
+
+	enum class SplitMethod { SAH, Middle, EqualCounts };
+
+	BVHAccel(const std::vector<Primitive::ptr>& primitives, int maxPrimsInNode = 4,
+		SplitMethod splitMethod = SplitMethod::SAH);
+	virtual ~BVHAccel();
+
+	virtual Bounds3f worldBound() const override;
+
+	using PrimitiveAggregate::hit;
+	virtual bool hit(const Ray& ray) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+
+	virtual std::string toString() const override { return "BVHAccel[]"; }
+
+	static SplitMethod parseSplitMethod(const std::string& name);
+
+private:
+	BVHBuildNode* recursiveBuild(MemoryArena& arena, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+		int start, int end, int* totalNodes, std::vector<Primitive::ptr>& orderedPrims);
+	BVHBuildNode* createLeafNode(BVHBuildNode* node, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+		int start, int end, const Bounds3f& bounds, std::vector<Primitive::ptr>& orderedPrims) const;
+	int flattenBVHTree(BVHBuildNode* node, int* offset);
+
+	// On-disk cache of the flattened tree, see AcceleratorCache
+	bool loadFromCache(uint64_t key);
+	void saveToCache(uint64_t key, const std::vector<int>& primitiveOrder) const;
+
+protected:
+	const int m_maxPrimsInNode;
+	const SplitMethod m_splitMethod;
+	std::vector<Primitive::ptr> m_primitives;
+	LinearBVHNode* m_nodes = nullptr;
+	int m_totalNodes = 0;
+};
+
+RENDER_END
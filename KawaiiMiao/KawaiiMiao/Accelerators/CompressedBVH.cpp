@@ -0,0 +1,311 @@
+#include "CompressedBVH.h"
+#include "WideSimd.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Logger.h"
+
+#include <cmath>
+
+RENDER_BEGIN
+
+// Pending subtree or leaf on the traversal stack
+struct CompressedBVHToDo
+{
+	int m_index; // Node index or first primitive offset
+	int m_nPrimitives; // 0 -> interior node
+	float m_tNear;
+};
+
+// Grid spacing 2^exponent, built from the exponent bits so no ldexp is needed while traversing
+static inline float quantizationScale(int exponent)
+{
+	uint32_t bits = uint32_t(exponent + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(float));
+	return scale;
+}
+
+// Pick the grid of one axis and quantize the children bounds on it
+static void quantizeAxis(CompressedBVHNode& node, int axis, const Bounds3f* childBounds, int nChildren)
+{
+	float lo = std::numeric_limits<float>::infinity();
+	float hi = -std::numeric_limits<float>::infinity();
+	for (int i = 0; i < nChildren; ++i)
+	{
+		lo = glm::min(lo, float(childBounds[i].m_pMin[axis]));
+		hi = glm::max(hi, float(childBounds[i].m_pMax[axis]));
+	}
+
+	// 254 cells must cover the extent and one cell must span a few ulps of the coordinates,
+	// then widening every box by one cell absorbs any rounding of the dequantization
+	int extentExponent, magnitudeExponent;
+	std::frexp(hi - lo, &extentExponent);
+	std::frexp(glm::max(glm::abs(lo), glm::abs(hi)), &magnitudeExponent);
+	int exponent = clamp(glm::max(extentExponent - 8, magnitudeExponent - 22), -126, 126);
+	if (254.f * quantizationScale(exponent) < hi - lo)
+		++exponent;
+	float scale = quantizationScale(exponent);
+
+	node.m_origin[axis] = lo;
+	node.m_exponent[axis] = int8_t(exponent);
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i >= nChildren)
+		{
+			node.m_qMin[axis][i] = 0;
+			node.m_qMax[axis][i] = 0;
+			continue;
+		}
+		int qMin = int(std::floor((childBounds[i].m_pMin[axis] - lo) / scale)) - 1;
+		int qMax = int(std::ceil((childBounds[i].m_pMax[axis] - lo) / scale)) + 1;
+		node.m_qMin[axis][i] = uint8_t(clamp(qMin, 0, 255));
+		node.m_qMax[axis][i] = uint8_t(clamp(qMax, 0, 255));
+	}
+}
+
+CompressedBVHAccel::CompressedBVHAccel(const std::vector<Primitive::ptr>& primitives, int maxPrimsInNode/* = 4*/,
+	SplitMethod splitMethod/* = SplitMethod::SAH*/) :
+	BVHAccel(primitives, maxPrimsInNode, splitMethod)
+{
+	if (!m_nodes)
+		return;
+
+	m_worldBound = m_nodes[0].m_bounds;
+
+	// Collapse the binary tree into quantized 4-wide nodes
+	std::vector<CompressedBVHNode> compressedNodes;
+	compressedNodes.reserve(m_totalNodes / 3 + 1);
+	collapseNode(0, compressedNodes);
+
+	m_totalCompressedNodes = compressedNodes.size();
+	m_compressedNodes = AllocAligned<CompressedBVHNode>(m_totalCompressedNodes);
+	memcpy(m_compressedNodes, compressedNodes.data(), m_totalCompressedNodes * sizeof(CompressedBVHNode));
+
+	K_INFO("Compressed BVH: {0} nodes ({1} MB), binary BVH was {2} nodes ({3} MB)", m_totalCompressedNodes,
+		float(m_totalCompressedNodes * sizeof(CompressedBVHNode)) / (1024.f * 1024.f),
+		m_totalNodes, float(m_totalNodes * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
+
+	// The binary nodes are not needed for traversal anymore
+	FreeAligned(m_nodes);
+	m_nodes = nullptr;
+}
+
+CompressedBVHAccel::~CompressedBVHAccel()
+{
+	FreeAligned(m_compressedNodes);
+}
+
+int CompressedBVHAccel::collapseNode(int binaryIndex, std::vector<CompressedBVHNode>& compressedNodes) const
+{
+	const int compressedIndex = compressedNodes.size();
+	compressedNodes.emplace_back();
+	memset(&compressedNodes[compressedIndex], 0, sizeof(CompressedBVHNode));
+
+	// Gather up to 4 binary descendants
+	int children[4];
+	int nChildren = 0;
+	const LinearBVHNode& node = m_nodes[binaryIndex];
+	if (node.m_nPrimitives > 0)
+	{
+		// Note: only happens when the whole tree is a single leaf
+		children[nChildren++] = binaryIndex;
+	}
+	else
+	{
+		children[nChildren++] = binaryIndex + 1;
+		children[nChildren++] = node.m_secondChildOffset;
+		while (nChildren < 4)
+		{
+			// Open the interior child with the largest surface area
+			int best = -1;
+			Float bestArea = -1;
+			for (int i = 0; i < nChildren; ++i)
+			{
+				const LinearBVHNode& child = m_nodes[children[i]];
+				if (child.m_nPrimitives == 0 && child.m_bounds.surfaceArea() > bestArea)
+				{
+					bestArea = child.m_bounds.surfaceArea();
+					best = i;
+				}
+			}
+			if (best == -1)
+				break;
+
+			int opened = children[best];
+			children[best] = opened + 1;
+			children[nChildren++] = m_nodes[opened].m_secondChildOffset;
+		}
+	}
+
+	Bounds3f childBounds[4];
+	for (int i = 0; i < nChildren; ++i)
+		childBounds[i] = m_nodes[children[i]].m_bounds;
+	for (int axis = 0; axis < 3; ++axis)
+		quantizeAxis(compressedNodes[compressedIndex], axis, childBounds, nChildren);
+	compressedNodes[compressedIndex].m_nChildren = uint8_t(nChildren);
+
+	for (int i = 0; i < nChildren; ++i)
+	{
+		const LinearBVHNode& child = m_nodes[children[i]];
+		if (child.m_nPrimitives > 0)
+		{
+			compressedNodes[compressedIndex].m_child[i] = child.m_primitivesOffset;
+			compressedNodes[compressedIndex].m_nPrimitives[i] = child.m_nPrimitives;
+		}
+		else
+		{
+			// Note: the recursion may reallocate compressedNodes, index it again afterwards
+			int childIndex = collapseNode(children[i], compressedNodes);
+			compressedNodes[compressedIndex].m_child[i] = childIndex;
+			compressedNodes[compressedIndex].m_nPrimitives[i] = 0;
+		}
+	}
+
+	return compressedIndex;
+}
+
+int CompressedBVHAccel::intersectChildren(const CompressedBVHNode& node, const Ray& ray, const Vector3f& invDir,
+	const int dirIsNeg[3], float tNear[4]) const
+{
+	typedef WideSimd<4> simd;
+	typedef simd::vfloat vfloat;
+
+	// Dequantize the children slabs
+	float bounds[2][3][4];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float scale = quantizationScale(node.m_exponent[axis]);
+		for (int i = 0; i < 4; ++i)
+		{
+			bounds[0][axis][i] = node.m_origin[axis] + node.m_qMin[axis][i] * scale;
+			bounds[1][axis][i] = node.m_origin[axis] + node.m_qMax[axis][i] * scale;
+		}
+	}
+
+	// Near and far planes of each axis are selected by the ray direction sign
+	vfloat tMin = simd::set1(0.f);
+	vfloat tMax = simd::set1(float(ray.m_tMax));
+	const vfloat robust = simd::set1(float(1 + 2 * gamma(3)));
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const vfloat origin = simd::set1(float(ray.m_origin[axis]));
+		const vfloat inv = simd::set1(float(invDir[axis]));
+		vfloat tAxisMin = simd::mul(simd::sub(simd::load(bounds[dirIsNeg[axis]][axis]), origin), inv);
+		vfloat tAxisMax = simd::mul(simd::sub(simd::load(bounds[1 - dirIsNeg[axis]][axis]), origin), inv);
+		// Same conservative scaling as Bounds3::hit
+		tAxisMax = simd::mul(tAxisMax, robust);
+		tMin = simd::max(tAxisMin, tMin);
+		tMax = simd::min(tAxisMax, tMax);
+	}
+
+	simd::store(tNear, tMin);
+	return simd::lessEqualMask(tMin, tMax) & ((1 << node.m_nChildren) - 1);
+}
+
+bool CompressedBVHAccel::hit(const Ray& ray) const
+{
+	if (!m_compressedNodes)
+		return false;
+
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	constexpr int maxTodo = 64 * 4;
+	CompressedBVHToDo todo[maxTodo];
+	int todoPos = 0;
+	todo[todoPos++] = { 0, 0, 0.f };
+
+	float tNear[4];
+	while (todoPos > 0)
+	{
+		const CompressedBVHToDo current = todo[--todoPos];
+		if (current.m_nPrimitives > 0)
+		{
+			// Note: shadow rays can terminate at the first occluder found
+			for (int i = 0; i < current.m_nPrimitives; ++i)
+			{
+				if (m_primitives[current.m_index + i]->hit(ray))
+					return true;
+			}
+			continue;
+		}
+
+		// Any-hit query doesn't need front-to-back ordering
+		const CompressedBVHNode& node = m_compressedNodes[current.m_index];
+		int mask = intersectChildren(node, ray, invDir, dirIsNeg, tNear);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (mask & (1 << i))
+			{
+				todo[todoPos++] = { node.m_child[i], node.m_nPrimitives[i], tNear[i] };
+			}
+		}
+	}
+	return false;
+}
+
+bool CompressedBVHAccel::hit(const Ray& ray, HitRecord& record) const
+{
+	if (!m_compressedNodes)
+		return false;
+
+	bool hit = false;
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	constexpr int maxTodo = 64 * 4;
+	CompressedBVHToDo todo[maxTodo];
+	int todoPos = 0;
+	todo[todoPos++] = { 0, 0, 0.f };
+
+	float tNear[4];
+	while (todoPos > 0)
+	{
+		const CompressedBVHToDo current = todo[--todoPos];
+
+		// Note: ray.m_tMax shrinks on every hit, entries behind the closest hit are culled
+		if (current.m_tNear > ray.m_tMax)
+			continue;
+
+		if (current.m_nPrimitives > 0)
+		{
+			// Intersect ray with primitives in leaf
+			for (int i = 0; i < current.m_nPrimitives; ++i)
+			{
+				if (m_primitives[current.m_index + i]->hit(ray, record))
+					hit = true;
+			}
+			continue;
+		}
+
+		const CompressedBVHNode& node = m_compressedNodes[current.m_index];
+		int mask = intersectChildren(node, ray, invDir, dirIsNeg, tNear);
+		if (mask == 0)
+			continue;
+
+		// Sort hit children far to near so that the nearest is popped first
+		int hitChildren[4];
+		int nHits = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)))
+				continue;
+			int j = nHits++;
+			while (j > 0 && tNear[hitChildren[j - 1]] < tNear[i])
+			{
+				hitChildren[j] = hitChildren[j - 1];
+				--j;
+			}
+			hitChildren[j] = i;
+		}
+
+		for (int i = 0; i < nHits; ++i)
+		{
+			int c = hitChildren[i];
+			todo[todoPos++] = { node.m_child[c], node.m_nPrimitives[c], tNear[c] };
+		}
+	}
+
+	return hit;
+}
+
+RENDER_END
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "BVH.h"
+
+RENDER_BEGIN
+
+// 4-wide BVH node that fits one 64 byte cache line. Child bounds are quantized to 8 bits
+// on a per node grid: min = origin + qMin * 2^exponent, max = origin + qMax * 2^exponent.
+struct CompressedBVHNode
+{
+	float m_origin[3];
+	int8_t m_exponent[3];
+	uint8_t m_nChildren;
+	uint8_t m_qMin[3][4]; // [axis][child]
+	uint8_t m_qMax[3][4]; // [axis][child]
+	int m_child[4]; // Interior: node index, Leaf: first primitive offset
+	uint16_t m_nPrimitives[4]; // 0 -> interior child
+};
+static_assert(sizeof(CompressedBVHNode) == 64, "CompressedBVHNode should be 64 bytes");
+
+// Memory compact BVH for huge scenes, collapsed from a binary SAH BVH into quantized 4-wide nodes.
+// Note: quantized boxes are rounded outwards, so traversal stays conservative and only visits
+//       slightly more nodes than the full precision bounds would.
+class CompressedBVHAccel : public BVHAccel
+{
+public:
+	typedef std::shared_ptr<CompressedBVHAccel> ptr;
+
+	CompressedBVHAccel(const std::vector<Primitive::ptr>& primitives, int maxPrimsInNode = 4,
+		SplitMethod splitMethod = SplitMethod::SAH);
+	virtual ~CompressedBVHAccel();
+
+	virtual Bounds3f worldBound() const override { return m_worldBound; }
+
+	using PrimitiveAggregate::hit;
+	virtual bool hit(const Ray& ray) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+
+	virtual std::string toString() const override { return "CompressedBVHAccel[]"; }
+
+private:
+	int collapseNode(int binaryIndex, std::vector<CompressedBVHNode>& compressedNodes) const;
+
+	// Test the ray against the dequantized child slabs, returns the hit mask and the entry distances
+	int intersectChildren(const CompressedBVHNode& node, const Ray& ray, const Vector3f& invDir,
+		const int dirIsNeg[3], float tNear[4]) const;
+
+	Bounds3f m_worldBound;
+	CompressedBVHNode* m_compressedNodes = nullptr;
+	int m_totalCompressedNodes = 0;
+};
+
+RENDER_END
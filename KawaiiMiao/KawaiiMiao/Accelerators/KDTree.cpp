@@ -1,5 +1,10 @@
 #include "KDTree.h"
+#include "AcceleratorCache.h"
 #include "../Tool/Memory.h"
+#include "../Tool/Logger.h"
+#include "../Tool/Parallel.h"
+
+#include <tbb/tbb/parallel_sort.h>
 
 RENDER_BEGIN
 
@@ -29,6 +34,21 @@ public:
 	bool isLeaf() const { return (m_flags & 3) == 3; }
 	int aboveChild() const { return m_rightChildIndex >> 2; }
 
+	// Shift child and primitive index references when a subtree built
+	// into separate storage is appended after other nodes
+	void relocate(int nodeOffset, int primitiveIndexOffset)
+	{
+		if (isLeaf())
+		{
+			if (numPrimitives() > 1)
+				m_PrimitiveIndicesOffset += primitiveIndexOffset;
+		}
+		else
+		{
+			m_rightChildIndex += (nodeOffset << 2);
+		}
+	}
+
 	union
 	{
 		Float m_split; // Split position which is for interior nodes
@@ -89,6 +109,25 @@ void KdTreeNode::initLeafNode(int* PrimitiveIndices, int np, std::vector<int>* p
 	}
 }
 
+// Primitives overlapping a node with their split candidates presorted along each axis.
+// Note: m_PrimitiveIndex of the edges is a local index into m_primitives, so every
+//       node owns its own working set and disjoint subtrees can be built concurrently.
+struct KdBuildSet
+{
+	std::vector<int> m_primitives;
+	std::vector<BoundEdge> m_edges[3];
+};
+
+// Nodes and leaf primitive indices emitted by one build task
+struct KdBuildStorage
+{
+	std::vector<KdTreeNode> m_nodes;
+	std::vector<int> m_primitiveIndices;
+};
+
+// Subtrees with fewer primitives are built serially by the task that reached them
+static constexpr int kdParallelBuildThreshold = 4096;
+
 KdTree::KdTree(const std::vector<Primitive::ptr>& Primitives, int isectCost/* = 80*/, int traversalCost/* = 1*/,
 	Float emptyBonus/* = 0.5*/, int maxPrimitives/* = 1*/, int maxDepth/* = -1*/) :
 	m_isectCost(isectCost),
@@ -97,7 +136,8 @@ KdTree::KdTree(const std::vector<Primitive::ptr>& Primitives, int isectCost/* =
 	m_emptyBonus(emptyBonus),
 	m_Primitives(Primitives)
 {
-	m_nextFreeNode = m_nAllocedNodes = 0;
+	m_nodes = nullptr;
+	m_nAllocedNodes = 0;
 
 	// The tree cannot grow without bound in pathological cases. (8 + 1.3log(N))
 	if (maxDepth <= 0)
@@ -115,62 +155,154 @@ KdTree::KdTree(const std::vector<Primitive::ptr>& Primitives, int isectCost/* =
 		PrimitiveBounds.push_back(b);
 	}
 
-	// Allocate working memory for kd-tree construction
-	std::unique_ptr<BoundEdge[]> edges[3];
-	for (int i = 0; i < 3; ++i)
+	// The tree only depends on the build settings and the primitive bounds
+	uint64_t cacheKey = 0;
+	if (AcceleratorCache::isEnabled())
 	{
-		edges[i].reset(new BoundEdge[2 * m_Primitives.size()]);
+		CacheHasher hasher;
+		hasher.update(sizeof(KdTreeNode));
+		hasher.update(m_isectCost);
+		hasher.update(m_traversalCost);
+		hasher.update(m_maxPrimitives);
+		hasher.update(m_emptyBonus);
+		hasher.update(maxDepth);
+		hasher.update(PrimitiveBounds.data(), PrimitiveBounds.size() * sizeof(Bounds3f));
+		cacheKey = hasher.value();
+		if (loadFromCache(cacheKey))
+			return;
 	}
 
-	std::unique_ptr<int[]> leftNodeRoom(new int[m_Primitives.size()]);
-	std::unique_ptr<int[]> rightNodeRoom(new int[(maxDepth + 1) * m_Primitives.size()]);
-
-	// Initialize _primNums_ for kd-tree construction
-	std::unique_ptr<int[]> PrimitiveIndices(new int[m_Primitives.size()]);
+	// Note: the split candidates are sorted only once here. Every node afterwards
+	//       receives its edges already in order, so the build is O(N log N).
+	KdBuildSet rootSet;
+	rootSet.m_primitives.resize(m_Primitives.size());
 	for (size_t i = 0; i < m_Primitives.size(); ++i)
 	{
-		PrimitiveIndices[i] = i;
+		rootSet.m_primitives[i] = i;
 	}
 
+	parallelFor(0, 3, [&](size_t axis)
+	{
+		std::vector<BoundEdge>& edges = rootSet.m_edges[axis];
+		edges.resize(2 * m_Primitives.size());
+		for (size_t i = 0; i < m_Primitives.size(); ++i)
+		{
+			edges[2 * i] = BoundEdge(PrimitiveBounds[i].m_pMin[axis], i, true);
+			edges[2 * i + 1] = BoundEdge(PrimitiveBounds[i].m_pMax[axis], i, false);
+		}
+		tbb::parallel_sort(edges.begin(), edges.end(),
+			[](const BoundEdge& e0, const BoundEdge& e1) -> bool
+			{
+				if (e0.m_t == e1.m_t)
+				{
+					return (int)e0.m_type < (int)e1.m_type;
+				}
+				else
+				{
+					return e0.m_t < e1.m_t;
+				}
+			});
+	});
+
 	// Start recursive construction of kd-tree
-	buildTree(0, m_bounds, PrimitiveBounds, PrimitiveIndices.get(), m_Primitives.size(),
-		maxDepth, edges, leftNodeRoom.get(), rightNodeRoom.get());
+	KdBuildStorage storage;
+	buildTree(storage, m_bounds, rootSet, maxDepth);
+
+	// Compact the node into an array
+	m_nAllocedNodes = storage.m_nodes.size();
+	m_nodes = AllocAligned<KdTreeNode>(m_nAllocedNodes);
+	memcpy(m_nodes, storage.m_nodes.data(), m_nAllocedNodes * sizeof(KdTreeNode));
+	m_PrimitiveIndices.swap(storage.m_primitiveIndices);
+
+	if (AcceleratorCache::isEnabled())
+	{
+		saveToCache(cacheKey);
+	}
+
+	K_INFO("KdTree created with {0} nodes for {1} primitives", m_nAllocedNodes, m_Primitives.size());
 }
 
-void KdTree::buildTree(int nodeIndex, 
-	const Bounds3f& nodeBounds,
-	const std::vector<Bounds3f>& allPrimitiveBounds,
-	int* PrimitiveIndices, 
-	int nPrimitives,
-	int depth,
-	const std::unique_ptr<BoundEdge[]> edges[3],
-	int* leftNodeRoom, 
-	int* rightNodeRoom, 
-	int badRefines)
+bool KdTree::loadFromCache(uint64_t key)
 {
-	CHECK_EQ(nodeIndex, m_nextFreeNode);
+	std::vector<CacheSection> sections;
+	MappedFile::unique_ptr file = AcceleratorCache::load("KdTree", key, sections);
+	if (!file || sections.size() != 2)
+		return false;
 
-	// Get next free node from _nodes_ array
-	if (m_nextFreeNode == m_nAllocedNodes)
+	// Sections: compact nodes, primitive indices of the leaves with more than one primitive
+	const CacheSection& nodes = sections[0];
+	const CacheSection& indices = sections[1];
+	if (nodes.m_size == 0 || nodes.m_size % sizeof(KdTreeNode) != 0 || indices.m_size % sizeof(int) != 0)
+		return false;
+
+	// Note: a corrupted cache must not send the traversal out of the arrays
+	const int nPrimitives = int(m_Primitives.size());
+	const int* primitiveIndices = static_cast<const int*>(indices.m_data);
+	const size_t nPrimitiveIndices = indices.m_size / sizeof(int);
+	for (size_t i = 0; i < nPrimitiveIndices; ++i)
+	{
+		if (primitiveIndices[i] < 0 || primitiveIndices[i] >= nPrimitives)
+			return false;
+	}
+
+	const int nNodes = int(nodes.m_size / sizeof(KdTreeNode));
+	const KdTreeNode* cachedNodes = static_cast<const KdTreeNode*>(nodes.m_data);
+	for (int i = 0; i < nNodes; ++i)
 	{
-		// Note: If all of the allocated nodes have been used up, node memory
-		//		 is reallocated with twice as many entries and the old values are copied.
-		int nNewAllocNodes = glm::max(2 * m_nAllocedNodes, 512);
-		KdTreeNode* n = AllocAligned<KdTreeNode>(nNewAllocNodes);
-		if (m_nAllocedNodes > 0)
+		const KdTreeNode& node = cachedNodes[i];
+		if (node.isLeaf())
+		{
+			const int np = node.numPrimitives();
+			if (np < 0)
+				return false;
+			if (np == 1 && (node.m_onePrimitive < 0 || node.m_onePrimitive >= nPrimitives))
+				return false;
+			if (np > 1 && (node.m_PrimitiveIndicesOffset < 0 ||
+				size_t(node.m_PrimitiveIndicesOffset) + np > nPrimitiveIndices))
+				return false;
+		}
+		else if (i + 1 >= nNodes || node.aboveChild() <= i || node.aboveChild() >= nNodes)
 		{
-			memcpy(n, m_nodes, m_nAllocedNodes * sizeof(KdTreeNode));
-			FreeAligned(m_nodes);
+			return false;
 		}
-		m_nodes = n;
-		m_nAllocedNodes = nNewAllocNodes;
 	}
-	++m_nextFreeNode;
+
+	m_nAllocedNodes = nNodes;
+	m_nodes = AllocAligned<KdTreeNode>(m_nAllocedNodes);
+	memcpy(m_nodes, nodes.m_data, nodes.m_size);
+	m_PrimitiveIndices.assign(primitiveIndices, primitiveIndices + nPrimitiveIndices);
+
+	K_INFO("KdTree loaded with {0} nodes for {1} primitives", m_nAllocedNodes, m_Primitives.size());
+	return true;
+}
+
+void KdTree::saveToCache(uint64_t key) const
+{
+	std::vector<CacheSection> sections(2);
+	sections[0].m_data = m_nodes;
+	sections[0].m_size = m_nAllocedNodes * sizeof(KdTreeNode);
+	sections[1].m_data = m_PrimitiveIndices.data();
+	sections[1].m_size = m_PrimitiveIndices.size() * sizeof(int);
+	AcceleratorCache::store("KdTree", key, sections);
+}
+
+void KdTree::buildTree(KdBuildStorage& storage,
+	const Bounds3f& nodeBounds,
+	KdBuildSet& buildSet,
+	int depth,
+	int badRefines)
+{
+	// Get next free node from node storage
+	const int nodeIndex = storage.m_nodes.size();
+	storage.m_nodes.emplace_back();
+
+	const int nPrimitives = buildSet.m_primitives.size();
 
 	// Initialize leaf node if termination criteria met
 	if (nPrimitives <= m_maxPrimitives || depth == 0)
 	{
-		m_nodes[nodeIndex].initLeafNode(PrimitiveIndices, nPrimitives, &m_PrimitiveIndices);
+		storage.m_nodes[nodeIndex].initLeafNode(buildSet.m_primitives.data(), nPrimitives,
+			&storage.m_primitiveIndices);
 		return;
 	}
 
@@ -185,76 +317,46 @@ void KdTree::buildTree(int nodeIndex,
 	const Float invTotalSA = 1 / nodeBounds.surfaceArea();
 	Vector3f diagonal = nodeBounds.m_pMax - nodeBounds.m_pMin;
 
-	// Choose which axis to split along
-	int axis = nodeBounds.maximumExtent();
-	int retries = 0;
-
-retrySplit:
-	// Initialize edges for _axis_
-	for (int i = 0; i < nPrimitives; ++i)
-	{
-		int hi = PrimitiveIndices[i];
-		const Bounds3f& bounds = allPrimitiveBounds[hi];
-		edges[axis][2 * i] = BoundEdge(bounds.m_pMin[axis], hi, true);
-		edges[axis][2 * i + 1] = BoundEdge(bounds.m_pMax[axis], hi, false);
-	}
-
-	// Sort _edges_ for _axis_
-	std::sort(&edges[axis][0], &edges[axis][2 * nPrimitives],
-		[](const BoundEdge& e0, const BoundEdge& e1) -> bool
-		{
-			if (e0.m_t == e1.m_t)
-			{
-				return (int)e0.m_type < (int)e1.m_type;
-			}
-			else
-			{
-				return e0.m_t < e1.m_t;
-			}
-		});
-
-	// Compute cost of all splits for _axis_ to find best
-	int nBelow = 0, nAbove = nPrimitives;
-	const auto& currentEdge = edges[axis];
-	for (int i = 0; i < 2 * nPrimitives; ++i)
+	// Note: the edges are already sorted, so sweeping every axis is linear
+	//       and the best split over all three axes can be used directly.
+	for (int axis = 0; axis < 3; ++axis)
 	{
-		if (currentEdge[i].m_type == EdgeType::End)
-			--nAbove;
-		Float edgeT = currentEdge[i].m_t;
-		if (edgeT > nodeBounds.m_pMin[axis] && edgeT < nodeBounds.m_pMax[axis])
+		// Compute cost of all splits for _axis_ to find best
+		int nBelow = 0, nAbove = nPrimitives;
+		const auto& currentEdge = buildSet.m_edges[axis];
+		for (int i = 0; i < 2 * nPrimitives; ++i)
 		{
-			// Compute cost for split at _i_th edge
-
-			// Compute child surface areas for split at _edgeT_
-			int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
-			Float belowSA = 2 * (diagonal[otherAxis0] * diagonal[otherAxis1] + (edgeT - nodeBounds.m_pMin[axis]) *
-				(diagonal[otherAxis0] + diagonal[otherAxis1]));
-			Float aboveSA = 2 * (diagonal[otherAxis0] * diagonal[otherAxis1] + (nodeBounds.m_pMax[axis] - edgeT) *
-				(diagonal[otherAxis0] + diagonal[otherAxis1]));
-			Float pBelow = belowSA * invTotalSA;
-			Float pAbove = aboveSA * invTotalSA;
-			Float eb = (nAbove == 0 || nBelow == 0) ? m_emptyBonus : 0;
-			Float cost = m_traversalCost + m_isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
-
-			// Update best split if this is lowest cost so far
-			if (cost < bestCost)
+			if (currentEdge[i].m_type == EdgeType::End)
+				--nAbove;
+			Float edgeT = currentEdge[i].m_t;
+			if (edgeT > nodeBounds.m_pMin[axis] && edgeT < nodeBounds.m_pMax[axis])
 			{
-				bestCost = cost;
-				bestAxis = axis;
-				bestOffset = i;
+				// Compute cost for split at _i_th edge
+
+				// Compute child surface areas for split at _edgeT_
+				int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
+				Float belowSA = 2 * (diagonal[otherAxis0] * diagonal[otherAxis1] + (edgeT - nodeBounds.m_pMin[axis]) *
+					(diagonal[otherAxis0] + diagonal[otherAxis1]));
+				Float aboveSA = 2 * (diagonal[otherAxis0] * diagonal[otherAxis1] + (nodeBounds.m_pMax[axis] - edgeT) *
+					(diagonal[otherAxis0] + diagonal[otherAxis1]));
+				Float pBelow = belowSA * invTotalSA;
+				Float pAbove = aboveSA * invTotalSA;
+				Float eb = (nAbove == 0 || nBelow == 0) ? m_emptyBonus : 0;
+				Float cost = m_traversalCost + m_isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
+
+				// Update best split if this is lowest cost so far
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestOffset = i;
+				}
 			}
+			if (currentEdge[i].m_type == EdgeType::Start)
+				++nBelow;
 		}
-		if (currentEdge[i].m_type == EdgeType::Start)
-			++nBelow;
-	}
-
-	DCHECK(nBelow == nPrimitives && nAbove == 0);
 
-	if (bestAxis == -1 && retries < 2)
-	{
-		++retries;
-		axis = (axis + 1) % 3;
-		goto retrySplit;
+		DCHECK(nBelow == nPrimitives && nAbove == 0);
 	}
 
 	// Create leaf if no good splits were found
@@ -262,38 +364,103 @@ retrySplit:
 		++badRefines;
 	if ((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 || badRefines == 3)
 	{
-		m_nodes[nodeIndex].initLeafNode(PrimitiveIndices, nPrimitives, &m_PrimitiveIndices);
+		storage.m_nodes[nodeIndex].initLeafNode(buildSet.m_primitives.data(), nPrimitives,
+			&storage.m_primitiveIndices);
 		return;
 	}
 
 	// Classify primitives with respect to split
-	int lnPrimitives = 0, rnPrimitives = 0;
+	// Note: bit 0 marks the below side and bit 1 the above side, straddling primitives go to both
+	std::vector<uint8_t> side(nPrimitives, 0);
+	const auto& splitEdges = buildSet.m_edges[bestAxis];
 	for (int i = 0; i < bestOffset; ++i)
 	{
-		if (edges[bestAxis][i].m_type == EdgeType::Start)
-			leftNodeRoom[lnPrimitives++] = edges[bestAxis][i].m_PrimitiveIndex;
+		if (splitEdges[i].m_type == EdgeType::Start)
+			side[splitEdges[i].m_PrimitiveIndex] |= 1;
 	}
 	for (int i = bestOffset + 1; i < 2 * nPrimitives; ++i)
 	{
-		if (edges[bestAxis][i].m_type == EdgeType::End)
-			rightNodeRoom[rnPrimitives++] = edges[bestAxis][i].m_PrimitiveIndex;
+		if (splitEdges[i].m_type == EdgeType::End)
+			side[splitEdges[i].m_PrimitiveIndex] |= 2;
 	}
+	Float tSplit = splitEdges[bestOffset].m_t;
+
+	// Assign the children local primitive indices
+	KdBuildSet belowSet, aboveSet;
+	std::vector<int> belowIndex(nPrimitives, -1), aboveIndex(nPrimitives, -1);
+	for (int i = 0; i < nPrimitives; ++i)
+	{
+		if (side[i] & 1)
+		{
+			belowIndex[i] = belowSet.m_primitives.size();
+			belowSet.m_primitives.push_back(buildSet.m_primitives[i]);
+		}
+		if (side[i] & 2)
+		{
+			aboveIndex[i] = aboveSet.m_primitives.size();
+			aboveSet.m_primitives.push_back(buildSet.m_primitives[i]);
+		}
+	}
+
+	// Distribute the sorted edges linearly, the order is preserved for both children
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		belowSet.m_edges[axis].reserve(2 * belowSet.m_primitives.size());
+		aboveSet.m_edges[axis].reserve(2 * aboveSet.m_primitives.size());
+		for (const BoundEdge& edge : buildSet.m_edges[axis])
+		{
+			bool starting = edge.m_type == EdgeType::Start;
+			if (side[edge.m_PrimitiveIndex] & 1)
+				belowSet.m_edges[axis].emplace_back(edge.m_t, belowIndex[edge.m_PrimitiveIndex], starting);
+			if (side[edge.m_PrimitiveIndex] & 2)
+				aboveSet.m_edges[axis].emplace_back(edge.m_t, aboveIndex[edge.m_PrimitiveIndex], starting);
+		}
+		// The parent edges are no longer needed, release them before descending
+		std::vector<BoundEdge>().swap(buildSet.m_edges[axis]);
+	}
+	std::vector<int>().swap(buildSet.m_primitives);
 
 	// Recursively initialize children nodes
-	Float tSplit = edges[bestAxis][bestOffset].m_t;
 	Bounds3f bounds0 = nodeBounds, bounds1 = nodeBounds;
 	bounds0.m_pMax[bestAxis] = bounds1.m_pMin[bestAxis] = tSplit;
 
-	// below subtree node
-	buildTree(nodeIndex + 1, bounds0, allPrimitiveBounds, leftNodeRoom, lnPrimitives, depth - 1, edges,
-		leftNodeRoom, rightNodeRoom + nPrimitives, badRefines);
-	int aboveChildIndex = m_nextFreeNode;
+	if (belowSet.m_primitives.size() < kdParallelBuildThreshold &&
+		aboveSet.m_primitives.size() < kdParallelBuildThreshold)
+	{
+		// below subtree node
+		buildTree(storage, bounds0, belowSet, depth - 1, badRefines);
+		int aboveChildIndex = storage.m_nodes.size();
+
+		storage.m_nodes[nodeIndex].initInteriorNode(bestAxis, aboveChildIndex, tSplit);
+
+		// above subtree node
+		buildTree(storage, bounds1, aboveSet, depth - 1, badRefines);
+		return;
+	}
 
-	m_nodes[nodeIndex].initInteriorNode(bestAxis, aboveChildIndex, tSplit);
+	// Build both subtrees as parallel tasks into separate storage, then merge them
+	KdBuildStorage belowStorage, aboveStorage;
+	parallelInvoke(
+		[&]() { buildTree(belowStorage, bounds0, belowSet, depth - 1, badRefines); },
+		[&]() { buildTree(aboveStorage, bounds1, aboveSet, depth - 1, badRefines); });
+
+	auto mergeStorage = [&storage](KdBuildStorage& subtree)
+	{
+		int nodeOffset = storage.m_nodes.size();
+		int primitiveIndexOffset = storage.m_primitiveIndices.size();
+		for (KdTreeNode& node : subtree.m_nodes)
+		{
+			node.relocate(nodeOffset, primitiveIndexOffset);
+			storage.m_nodes.push_back(node);
+		}
+		storage.m_primitiveIndices.insert(storage.m_primitiveIndices.end(),
+			subtree.m_primitiveIndices.begin(), subtree.m_primitiveIndices.end());
+	};
 
-	// above subtree node
-	buildTree(aboveChildIndex, bounds1, allPrimitiveBounds, rightNodeRoom, rnPrimitives, depth - 1, edges,
-		leftNodeRoom, rightNodeRoom + nPrimitives, badRefines);
+	mergeStorage(belowStorage);
+	int aboveChildIndex = storage.m_nodes.size();
+	storage.m_nodes[nodeIndex].initInteriorNode(bestAxis, aboveChildIndex, tSplit);
+	mergeStorage(aboveStorage);
 }
 
 KdTree::~KdTree() 
@@ -402,7 +569,7 @@ bool KdTree::hit(const Ray& ray) const
 	return false;
 }
 
-bool KdTree::hit(const Ray& ray, SurfaceInteraction& isect) const
+bool KdTree::hit(const Ray& ray, HitRecord& record) const
 {
 	// Compute initial parametric range of ray inside kd-tree extent
 	Float tMin, tMax;
@@ -476,7 +643,7 @@ bool KdTree::hit(const Ray& ray, SurfaceInteraction& isect) const
 			{
 				const Primitive::ptr& p = m_Primitives[currNode->m_onePrimitive];
 				// Check one Primitive inside leaf node
-				if (p->hit(ray, isect))
+				if (p->hit(ray, record))
 					hit = true;
 			}
 			else
@@ -486,7 +653,7 @@ bool KdTree::hit(const Ray& ray, SurfaceInteraction& isect) const
 					int index = m_PrimitiveIndices[currNode->m_PrimitiveIndicesOffset + i];
 					const Primitive::ptr& p = m_Primitives[index];
 					// Check one Primitive inside leaf node
-					if (p->hit(ray, isect))
+					if (p->hit(ray, record))
 						hit = true;
 				}
 			}
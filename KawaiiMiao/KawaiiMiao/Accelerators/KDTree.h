@@ -8,6 +8,8 @@ RENDER_BEGIN
 
 class KdTreeNode;
 class BoundEdge;
+struct KdBuildSet;
+struct KdBuildStorage;
 
 class KdTree : public PrimitiveAggregate
 {
@@ -20,18 +22,20 @@ public:
 	virtual Bounds3f worldBound() const override { return m_bounds; }
 	~KdTree();
 
+	using PrimitiveAggregate::hit;
 	virtual bool hit(const Ray& ray) const override;
-	virtual bool hit(const Ray& ray, SurfaceInteraction& iset) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
 
 	virtual std::string toString() const override { return "KdTree[]"; }
 
 private:
 
-	void buildTree(int nodeNum, const Bounds3f& bounds,
-		const std::vector<Bounds3f>& primBounds, int* primNums,
-		int nprims, int depth,
-		const std::unique_ptr<BoundEdge[]> edges[3], int* prims0,
-		int* prims1, int badRefines = 0);
+	void buildTree(KdBuildStorage& storage, const Bounds3f& nodeBounds,
+		KdBuildSet& buildSet, int depth, int badRefines = 0);
+
+	// On-disk cache of the compact nodes, see AcceleratorCache
+	bool loadFromCache(uint64_t key);
+	void saveToCache(uint64_t key) const;
 
 	// SAH split measurement
 	const Float m_emptyBonus;
@@ -39,7 +43,7 @@ private:
 
 	// Compact the node into an array
 	KdTreeNode* m_nodes;
-	int m_nAllocedNodes, m_nextFreeNode;
+	int m_nAllocedNodes;
 
 	Bounds3f m_bounds;
 	std::vector<Primitive::ptr> m_Primitives;
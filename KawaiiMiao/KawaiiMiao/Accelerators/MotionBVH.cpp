@@ -0,0 +1,182 @@
+#include "MotionBVH.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Logger.h"
+#include "../Tool/Parallel.h"
+
+RENDER_BEGIN
+
+MotionBVHAccel::MotionBVHAccel(const std::vector<Primitive::ptr>& primitives, int timeSegments/* = 4*/,
+	Float startTime/* = 0.f*/, Float endTime/* = 1.f*/, int maxPrimsInNode/* = 4*/,
+	SplitMethod splitMethod/* = SplitMethod::SAH*/) :
+	BVHAccel(primitives, maxPrimsInNode, splitMethod),
+	m_timeSegments(glm::max(1, timeSegments)),
+	m_startTime(startTime),
+	m_endTime(endTime)
+{
+	if (!m_nodes)
+		return;
+
+	// Bounds of every primitive during every time segment
+	// Note: the first and last segments are open ended, rays outside of the shutter interval
+	//       see the primitives at the start and end transforms.
+	std::vector<Bounds3f> primitiveBounds(m_primitives.size() * m_timeSegments);
+	parallelFor((size_t)0, m_primitives.size(), [&](const size_t& i)
+	{
+		for (int s = 0; s < m_timeSegments; ++s)
+		{
+			Float time0 = s == 0 ? -Infinity : lerp(Float(s) / m_timeSegments, m_startTime, m_endTime);
+			Float time1 = s == m_timeSegments - 1 ? Infinity : lerp(Float(s + 1) / m_timeSegments, m_startTime, m_endTime);
+			primitiveBounds[i * m_timeSegments + s] = m_primitives[i]->worldBound(time0, time1);
+		}
+	});
+
+	// Children always follow their parent in the depth-first layout, so a reverse sweep is bottom-up
+	m_segmentBounds = AllocAligned<Bounds3f>(m_totalNodes * m_timeSegments);
+	for (int index = m_totalNodes - 1; index >= 0; --index)
+	{
+		const LinearBVHNode& node = m_nodes[index];
+		Bounds3f* bounds = &m_segmentBounds[index * m_timeSegments];
+		for (int s = 0; s < m_timeSegments; ++s)
+		{
+			if (node.m_nPrimitives > 0)
+			{
+				bounds[s] = Bounds3f();
+				for (int i = 0; i < node.m_nPrimitives; ++i)
+					bounds[s] = unionBounds(bounds[s], primitiveBounds[(node.m_primitivesOffset + i) * m_timeSegments + s]);
+			}
+			else
+			{
+				bounds[s] = unionBounds(m_segmentBounds[(index + 1) * m_timeSegments + s],
+					m_segmentBounds[node.m_secondChildOffset * m_timeSegments + s]);
+			}
+		}
+	}
+
+	K_INFO("Motion BVH created with {0} time segments ({1} MB of segment bounds)", m_timeSegments,
+		float(m_totalNodes * m_timeSegments * sizeof(Bounds3f)) / (1024.f * 1024.f));
+}
+
+MotionBVHAccel::~MotionBVHAccel()
+{
+	FreeAligned(m_segmentBounds);
+}
+
+int MotionBVHAccel::getTimeSegment(Float time) const
+{
+	Float u = (time - m_startTime) / (m_endTime - m_startTime);
+	return clamp(int(u * m_timeSegments), 0, m_timeSegments - 1);
+}
+
+bool MotionBVHAccel::hit(const Ray& ray) const
+{
+	if (!m_nodes)
+		return false;
+
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+	const int segment = getTimeSegment(ray.m_time);
+
+	// Follow ray through BVH nodes to find primitive intersections
+	constexpr int maxTodo = 64;
+	int nodesToVisit[maxTodo];
+	int toVisitOffset = 0, currentNodeIndex = 0;
+	while (true)
+	{
+		const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+		if (m_segmentBounds[currentNodeIndex * m_timeSegments + segment].hit(ray, invDir, dirIsNeg))
+		{
+			if (node->m_nPrimitives > 0)
+			{
+				// Note: shadow rays can terminate at the first occluder found
+				for (int i = 0; i < node->m_nPrimitives; ++i)
+				{
+					if (m_primitives[node->m_primitivesOffset + i]->hit(ray))
+						return true;
+				}
+				if (toVisitOffset == 0)
+					break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			else
+			{
+				// Visit the near child first, push the far child
+				if (dirIsNeg[node->m_axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node->m_secondChildOffset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node->m_secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+		else
+		{
+			if (toVisitOffset == 0)
+				break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+	}
+	return false;
+}
+
+bool MotionBVHAccel::hit(const Ray& ray, HitRecord& record) const
+{
+	if (!m_nodes)
+		return false;
+
+	bool hit = false;
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+	const int segment = getTimeSegment(ray.m_time);
+
+	// Follow ray through BVH nodes to find primitive intersections
+	constexpr int maxTodo = 64;
+	int nodesToVisit[maxTodo];
+	int toVisitOffset = 0, currentNodeIndex = 0;
+	while (true)
+	{
+		const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+		// Note: ray.m_tMax shrinks on every hit, so far nodes get culled by the slab test
+		if (m_segmentBounds[currentNodeIndex * m_timeSegments + segment].hit(ray, invDir, dirIsNeg))
+		{
+			if (node->m_nPrimitives > 0)
+			{
+				// Intersect ray with primitives in leaf BVH node
+				for (int i = 0; i < node->m_nPrimitives; ++i)
+				{
+					if (m_primitives[node->m_primitivesOffset + i]->hit(ray, record))
+						hit = true;
+				}
+				if (toVisitOffset == 0)
+					break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			else
+			{
+				// Visit the near child first, push the far child
+				if (dirIsNeg[node->m_axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node->m_secondChildOffset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node->m_secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+		else
+		{
+			if (toVisitOffset == 0)
+				break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+	}
+	return hit;
+}
+
+RENDER_END
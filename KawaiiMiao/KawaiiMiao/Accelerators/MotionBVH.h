@@ -0,0 +1,35 @@
+#pragma once
+
+#include "BVH.h"
+
+RENDER_BEGIN
+
+// BVH for scenes with moving primitives. The shutter interval is split into equal time segments
+// and every node stores one box per segment, so a ray only tests the bounds swept during its own
+// segment instead of the bounds swept over the whole shutter interval.
+// Note: the topology is the one of the binary SAH BVH over the full motion bounds.
+class MotionBVHAccel : public BVHAccel
+{
+public:
+	typedef std::shared_ptr<MotionBVHAccel> ptr;
+
+	MotionBVHAccel(const std::vector<Primitive::ptr>& primitives, int timeSegments = 4,
+		Float startTime = 0.f, Float endTime = 1.f, int maxPrimsInNode = 4,
+		SplitMethod splitMethod = SplitMethod::SAH);
+	virtual ~MotionBVHAccel();
+
+	using PrimitiveAggregate::hit;
+	virtual bool hit(const Ray& ray) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+
+	virtual std::string toString() const override { return "MotionBVHAccel[]"; }
+
+private:
+	int getTimeSegment(Float time) const;
+
+	const int m_timeSegments;
+	const Float m_startTime, m_endTime;
+	Bounds3f* m_segmentBounds = nullptr; // [node * m_timeSegments + segment]
+};
+
+RENDER_END
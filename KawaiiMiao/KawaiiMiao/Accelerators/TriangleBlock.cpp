@@ -0,0 +1,197 @@
+#include "TriangleBlock.h"
+#include "WideSimd.h"
+
+RENDER_BEGIN
+
+TriangleRay::TriangleRay(const Ray& ray)
+{
+	m_origin = ray.m_origin;
+
+	// Permute components of triangle vertices and ray direction
+	m_kz = maxDimension(abs(ray.m_dir));
+	m_kx = m_kz + 1;
+	if (m_kx == 3) m_kx = 0;
+	m_ky = m_kx + 1;
+	if (m_ky == 3) m_ky = 0;
+	Vector3f d = permute(ray.m_dir, m_kx, m_ky, m_kz);
+
+	// Shear transformation which aligns the ray direction with +z
+	m_Sx = -d.x / d.z;
+	m_Sy = -d.y / d.z;
+	m_Sz = 1.f / d.z;
+
+	// Note: spawned rays start on the surface they leave without any offset, see TriangleShape::hit
+	m_tMin = RayEpsilon * maxComponent(abs(ray.m_origin));
+}
+
+// Transformed vertices and edge functions of every lane
+template <int N>
+struct TriangleBlockLanes
+{
+	float m_x[3][N], m_y[3][N], m_z[3][N];
+	float m_e[3][N];
+};
+
+// SIMD part of the test: transform the vertices to ray space and evaluate the edge functions.
+// Returns the lanes that may still hit after the edge sign test.
+template <int N>
+static int transformTriangleBlock(const TriangleBlock<N>& block, const TriangleRay& ray, TriangleBlockLanes<N>& lanes)
+{
+	typedef WideSimd<N> simd;
+	typedef typename simd::vfloat vfloat;
+
+	const vfloat ox = simd::set1(float(ray.m_origin[ray.m_kx]));
+	const vfloat oy = simd::set1(float(ray.m_origin[ray.m_ky]));
+	const vfloat oz = simd::set1(float(ray.m_origin[ray.m_kz]));
+	const vfloat Sx = simd::set1(float(ray.m_Sx));
+	const vfloat Sy = simd::set1(float(ray.m_Sy));
+	const vfloat Sz = simd::set1(float(ray.m_Sz));
+
+	vfloat x[3], y[3], z[3];
+	for (int v = 0; v < 3; ++v)
+	{
+		// Translate vertices based on ray origin and apply shear transformation
+		z[v] = simd::sub(simd::load(block.m_p[v][ray.m_kz]), oz);
+		x[v] = simd::add(simd::sub(simd::load(block.m_p[v][ray.m_kx]), ox), simd::mul(Sx, z[v]));
+		y[v] = simd::add(simd::sub(simd::load(block.m_p[v][ray.m_ky]), oy), simd::mul(Sy, z[v]));
+		simd::store(lanes.m_x[v], x[v]);
+		simd::store(lanes.m_y[v], y[v]);
+		simd::store(lanes.m_z[v], simd::mul(z[v], Sz));
+	}
+
+	// Compute edge function coefficients _e0_, _e1_, and _e2_
+	vfloat e0 = simd::sub(simd::mul(x[1], y[2]), simd::mul(y[1], x[2]));
+	vfloat e1 = simd::sub(simd::mul(x[2], y[0]), simd::mul(y[2], x[0]));
+	vfloat e2 = simd::sub(simd::mul(x[0], y[1]), simd::mul(y[0], x[1]));
+	simd::store(lanes.m_e[0], e0);
+	simd::store(lanes.m_e[1], e1);
+	simd::store(lanes.m_e[2], e2);
+
+	// Note: lanes with a zero edge function are re-evaluated in double precision
+	const vfloat zero = simd::set1(0.f);
+	int negative = simd::lessMask(e0, zero) | simd::lessMask(e1, zero) | simd::lessMask(e2, zero);
+	int positive = simd::lessMask(zero, e0) | simd::lessMask(zero, e1) | simd::lessMask(zero, e2);
+	int onEdge = simd::equalMask(e0, zero) | simd::equalMask(e1, zero) | simd::equalMask(e2, zero);
+
+	int occupied = 0;
+	for (int i = 0; i < N; ++i)
+	{
+		if (block.m_primitiveIndex[i] >= 0)
+			occupied |= (1 << i);
+	}
+
+	return (~(negative & positive) | onEdge) & occupied;
+}
+
+// Scalar remainder of the watertight test for one lane, see TriangleShape::hit
+template <int N>
+static bool finishTriangleLane(const TriangleBlockLanes<N>& lanes, int i, Float tMin, Float tMax,
+	Float& t, Float& b0, Float& b1, Float& b2)
+{
+	Vector3f p0t(lanes.m_x[0][i], lanes.m_y[0][i], lanes.m_z[0][i]);
+	Vector3f p1t(lanes.m_x[1][i], lanes.m_y[1][i], lanes.m_z[1][i]);
+	Vector3f p2t(lanes.m_x[2][i], lanes.m_y[2][i], lanes.m_z[2][i]);
+	Float e0 = lanes.m_e[0][i];
+	Float e1 = lanes.m_e[1][i];
+	Float e2 = lanes.m_e[2][i];
+
+	// Fall back to double precision test at triangle edges
+	if (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)
+	{
+		double p2txp1ty = (double)p2t.x * (double)p1t.y;
+		double p2typ1tx = (double)p2t.y * (double)p1t.x;
+		e0 = (float)(p2typ1tx - p2txp1ty);
+		double p0txp2ty = (double)p0t.x * (double)p2t.y;
+		double p0typ2tx = (double)p0t.y * (double)p2t.x;
+		e1 = (float)(p0typ2tx - p0txp2ty);
+		double p1txp0ty = (double)p1t.x * (double)p0t.y;
+		double p1typ0tx = (double)p1t.y * (double)p0t.x;
+		e2 = (float)(p1typ0tx - p1txp0ty);
+	}
+
+	// Perform triangle edge and determinant tests
+	if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+		return false;
+	Float det = e0 + e1 + e2;
+	if (det == 0)
+		return false;
+
+	// Compute scaled hit distance to triangle and test against ray $t$ range
+	Float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
+	if (det < 0 && (tScaled >= 0 || tScaled < tMax * det))
+		return false;
+	else if (det > 0 && (tScaled <= 0 || tScaled > tMax * det))
+		return false;
+
+	// Compute barycentric coordinates and $t$ value for triangle intersection
+	Float invDet = 1 / det;
+	b0 = e0 * invDet;
+	b1 = e1 * invDet;
+	b2 = e2 * invDet;
+	t = tScaled * invDet;
+
+	// Ensure that computed triangle $t$ is conservatively greater than zero
+	Float maxZt = maxComponent(abs(Vector3f(p0t.z, p1t.z, p2t.z)));
+	Float deltaZ = gamma(3) * maxZt;
+	Float maxXt = maxComponent(abs(Vector3f(p0t.x, p1t.x, p2t.x)));
+	Float maxYt = maxComponent(abs(Vector3f(p0t.y, p1t.y, p2t.y)));
+	Float deltaX = gamma(5) * (maxXt + maxZt);
+	Float deltaY = gamma(5) * (maxYt + maxZt);
+	Float deltaE = 2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+	Float maxE = maxComponent(abs(Vector3f(e0, e1, e2)));
+	Float deltaT = 3 * (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) * glm::abs(invDet);
+	return t > deltaT && t > tMin;
+}
+
+template <int N>
+bool intersectTriangleBlock(const TriangleBlock<N>& block, const TriangleRay& ray, Float tMax, TriangleHit& hit)
+{
+	TriangleBlockLanes<N> lanes;
+	int candidates = transformTriangleBlock(block, ray, lanes);
+
+	bool found = false;
+	for (int i = 0; i < N; ++i)
+	{
+		if (!(candidates & (1 << i)))
+			continue;
+
+		Float t, b0, b1, b2;
+		if (finishTriangleLane(lanes, i, ray.m_tMin, tMax, t, b0, b1, b2))
+		{
+			// Note: shrink the range so farther lanes of the same block are rejected
+			tMax = t;
+			hit.m_primitiveIndex = block.m_primitiveIndex[i];
+			hit.m_t = t;
+			hit.m_b0 = b0;
+			hit.m_b1 = b1;
+			hit.m_b2 = b2;
+			found = true;
+		}
+	}
+	return found;
+}
+
+template <int N>
+bool intersectTriangleBlockP(const TriangleBlock<N>& block, const TriangleRay& ray, Float tMax)
+{
+	TriangleBlockLanes<N> lanes;
+	int candidates = transformTriangleBlock(block, ray, lanes);
+
+	for (int i = 0; i < N; ++i)
+	{
+		if (!(candidates & (1 << i)))
+			continue;
+
+		Float t, b0, b1, b2;
+		if (finishTriangleLane(lanes, i, ray.m_tMin, tMax, t, b0, b1, b2))
+			return true;
+	}
+	return false;
+}
+
+template bool intersectTriangleBlock<4>(const TriangleBlock<4>&, const TriangleRay&, Float, TriangleHit&);
+template bool intersectTriangleBlock<8>(const TriangleBlock<8>&, const TriangleRay&, Float, TriangleHit&);
+template bool intersectTriangleBlockP<4>(const TriangleBlock<4>&, const TriangleRay&, Float);
+template bool intersectTriangleBlockP<8>(const TriangleBlock<8>&, const TriangleRay&, Float);
+
+RENDER_END
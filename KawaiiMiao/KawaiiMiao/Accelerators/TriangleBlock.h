@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../Core/Rendering.h"
+#include "../Math/KMathUtil.h"
+
+RENDER_BEGIN
+
+// N triangles of an accelerator leaf stored contiguously as SoA,
+// so that the whole block is intersected with one SIMD pass.
+template <int N>
+struct TriangleBlock
+{
+	float m_p[3][3][N]; // [vertex][axis][lane]
+	int m_primitiveIndex[N]; // -1 -> empty lane
+};
+
+// Compact result of a triangle block test
+struct TriangleHit
+{
+	int m_primitiveIndex = -1;
+	Float m_t = Infinity;
+	Float m_b0 = 0, m_b1 = 0, m_b2 = 0;
+};
+
+// Per ray setup of the watertight ray-triangle test, shared by all blocks a ray visits
+struct TriangleRay
+{
+	explicit TriangleRay(const Ray& ray);
+
+	Vector3f m_origin;
+	int m_kx, m_ky, m_kz;
+	Float m_Sx, m_Sy, m_Sz;
+	// Hits closer than this are the surface the ray was spawned from
+	Float m_tMin;
+};
+
+// Closest hit inside the block with t < tMax. Same watertight test and self-hit rejection as TriangleShape::hit.
+template <int N>
+bool intersectTriangleBlock(const TriangleBlock<N>& block, const TriangleRay& ray, Float tMax, TriangleHit& hit);
+
+// Any hit inside the block with t < tMax
+template <int N>
+bool intersectTriangleBlockP(const TriangleBlock<N>& block, const TriangleRay& ray, Float tMax);
+
+RENDER_END
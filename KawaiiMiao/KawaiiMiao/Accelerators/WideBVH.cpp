@@ -0,0 +1,390 @@
+#include "WideBVH.h"
+#include "WideSimd.h"
+#include "../Shapes/TriangleShape.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Logger.h"
+
+RENDER_BEGIN
+
+// Pending subtree or leaf on the traversal stack
+struct WideBVHToDo
+{
+	int m_index; // Node index or first primitive offset
+	int m_nPrimitives; // 0 -> interior node
+	float m_tNear;
+};
+
+// The triangle shape of a primitive, nullptr if it is anything else
+static const TriangleShape* getTriangleShape(const Primitive* primitive)
+{
+	const PrimitiveObject* object = dynamic_cast<const PrimitiveObject*>(primitive);
+	if (object == nullptr)
+		return nullptr;
+	return dynamic_cast<const TriangleShape*>(object->getShape());
+}
+
+template <int N>
+WideBVHAccel<N>::WideBVHAccel(const std::vector<Primitive::ptr>& primitives, int maxPrimsInNode/* = 4*/,
+	SplitMethod splitMethod/* = SplitMethod::SAH*/) :
+	BVHAccel(primitives, maxPrimsInNode, splitMethod)
+{
+	if (!m_nodes)
+		return;
+
+	m_worldBound = m_nodes[0].m_bounds;
+
+	// Collapse the binary tree into wide nodes
+	std::vector<WideBVHNode<N>> wideNodes;
+	std::vector<TriangleBlock<N>> triangleBlocks;
+	wideNodes.reserve(m_totalNodes / 2 + 1);
+	collapseNode(0, wideNodes, triangleBlocks);
+
+	m_totalWideNodes = wideNodes.size();
+	m_wideNodes = AllocAligned<WideBVHNode<N>>(m_totalWideNodes);
+	memcpy(m_wideNodes, wideNodes.data(), m_totalWideNodes * sizeof(WideBVHNode<N>));
+
+	m_totalTriangleBlocks = triangleBlocks.size();
+	if (m_totalTriangleBlocks > 0)
+	{
+		m_triangleBlocks = AllocAligned<TriangleBlock<N>>(m_totalTriangleBlocks);
+		memcpy(m_triangleBlocks, triangleBlocks.data(), m_totalTriangleBlocks * sizeof(TriangleBlock<N>));
+	}
+
+	// The binary nodes are not needed for traversal anymore
+	FreeAligned(m_nodes);
+	m_nodes = nullptr;
+
+	K_INFO("{0}-wide BVH collapsed to {1} nodes and {2} triangle blocks ({3} MB)", N, m_totalWideNodes,
+		m_totalTriangleBlocks, float(m_totalWideNodes * sizeof(WideBVHNode<N>) +
+			m_totalTriangleBlocks * sizeof(TriangleBlock<N>)) / (1024.f * 1024.f));
+}
+
+template <int N>
+WideBVHAccel<N>::~WideBVHAccel()
+{
+	FreeAligned(m_wideNodes);
+	FreeAligned(m_triangleBlocks);
+}
+
+template <int N>
+int WideBVHAccel<N>::collapseNode(int binaryIndex, std::vector<WideBVHNode<N>>& wideNodes,
+	std::vector<TriangleBlock<N>>& triangleBlocks) const
+{
+	const int wideIndex = wideNodes.size();
+	wideNodes.emplace_back();
+	for (int i = 0; i < N; ++i)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			wideNodes[wideIndex].m_bounds[0][axis][i] = std::numeric_limits<float>::infinity();
+			wideNodes[wideIndex].m_bounds[1][axis][i] = -std::numeric_limits<float>::infinity();
+		}
+		wideNodes[wideIndex].m_child[i] = 0;
+		wideNodes[wideIndex].m_nPrimitives[i] = -1;
+	}
+
+	// Gather up to N binary descendants
+	int children[N];
+	int nChildren = 0;
+	const LinearBVHNode& node = m_nodes[binaryIndex];
+	if (node.m_nPrimitives > 0)
+	{
+		// Note: only happens when the whole tree is a single leaf
+		children[nChildren++] = binaryIndex;
+	}
+	else
+	{
+		children[nChildren++] = binaryIndex + 1;
+		children[nChildren++] = node.m_secondChildOffset;
+		while (nChildren < N)
+		{
+			// Open the interior child with the largest surface area
+			int best = -1;
+			Float bestArea = -1;
+			for (int i = 0; i < nChildren; ++i)
+			{
+				const LinearBVHNode& child = m_nodes[children[i]];
+				if (child.m_nPrimitives == 0 && child.m_bounds.surfaceArea() > bestArea)
+				{
+					bestArea = child.m_bounds.surfaceArea();
+					best = i;
+				}
+			}
+			if (best == -1)
+				break;
+
+			int opened = children[best];
+			children[best] = opened + 1;
+			children[nChildren++] = m_nodes[opened].m_secondChildOffset;
+		}
+	}
+
+	for (int i = 0; i < nChildren; ++i)
+	{
+		const LinearBVHNode& child = m_nodes[children[i]];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			wideNodes[wideIndex].m_bounds[0][axis][i] = child.m_bounds.m_pMin[axis];
+			wideNodes[wideIndex].m_bounds[1][axis][i] = child.m_bounds.m_pMax[axis];
+		}
+
+		// Small triangle subtrees are flattened into a single leaf so that their blocks are fully occupied
+		int offset = child.m_primitivesOffset, count = child.m_nPrimitives;
+		if (child.m_nPrimitives == 0)
+			subtreePrimitives(children[i], offset, count);
+		if (child.m_nPrimitives > 0 || count <= N)
+		{
+			LinearBVHNode leaf = child;
+			leaf.m_primitivesOffset = offset;
+			leaf.m_nPrimitives = count;
+			int firstBlock = triangleBlocks.size();
+			if (packTriangleLeaf(leaf, triangleBlocks))
+			{
+				wideNodes[wideIndex].m_child[i] = firstBlock;
+				wideNodes[wideIndex].m_nPrimitives[i] = (int(triangleBlocks.size()) - firstBlock) | WideBVHTriangleLeaf;
+				continue;
+			}
+		}
+
+		if (child.m_nPrimitives > 0)
+		{
+			wideNodes[wideIndex].m_child[i] = child.m_primitivesOffset;
+			wideNodes[wideIndex].m_nPrimitives[i] = child.m_nPrimitives;
+		}
+		else
+		{
+			// Note: the recursion may reallocate wideNodes, index it again afterwards
+			int childIndex = collapseNode(children[i], wideNodes, triangleBlocks);
+			wideNodes[wideIndex].m_child[i] = childIndex;
+			wideNodes[wideIndex].m_nPrimitives[i] = 0;
+		}
+	}
+
+	return wideIndex;
+}
+
+template <int N>
+void WideBVHAccel<N>::subtreePrimitives(int binaryIndex, int& offset, int& count) const
+{
+	// Note: a subtree always covers a contiguous primitive range, but the order in which the
+	//       two children were emitted depends on argument evaluation, so check both ends
+	int first = binaryIndex, last = binaryIndex;
+	while (m_nodes[first].m_nPrimitives == 0)
+		first = first + 1;
+	while (m_nodes[last].m_nPrimitives == 0)
+		last = m_nodes[last].m_secondChildOffset;
+	offset = std::min(m_nodes[first].m_primitivesOffset, m_nodes[last].m_primitivesOffset);
+	int end = std::max(m_nodes[first].m_primitivesOffset + m_nodes[first].m_nPrimitives,
+		m_nodes[last].m_primitivesOffset + m_nodes[last].m_nPrimitives);
+	count = end - offset;
+}
+
+template <int N>
+bool WideBVHAccel<N>::packTriangleLeaf(const LinearBVHNode& leaf, std::vector<TriangleBlock<N>>& triangleBlocks) const
+{
+	for (int i = 0; i < leaf.m_nPrimitives; ++i)
+	{
+		if (getTriangleShape(m_primitives[leaf.m_primitivesOffset + i].get()) == nullptr)
+			return false;
+	}
+
+	for (int i = 0; i < leaf.m_nPrimitives; ++i)
+	{
+		int lane = i % N;
+		if (lane == 0)
+		{
+			// Unused lanes of the last block are flagged by a negative primitive index
+			triangleBlocks.emplace_back();
+			TriangleBlock<N>& block = triangleBlocks.back();
+			memset(block.m_p, 0, sizeof(block.m_p));
+			for (int j = 0; j < N; ++j)
+				block.m_primitiveIndex[j] = -1;
+		}
+
+		int primitiveIndex = leaf.m_primitivesOffset + i;
+		const TriangleShape* triangle = getTriangleShape(m_primitives[primitiveIndex].get());
+		TriangleBlock<N>& block = triangleBlocks.back();
+		for (int v = 0; v < 3; ++v)
+		{
+			const Vector3f& p = triangle->getVertex(v);
+			block.m_p[v][0][lane] = p.x;
+			block.m_p[v][1][lane] = p.y;
+			block.m_p[v][2][lane] = p.z;
+		}
+		block.m_primitiveIndex[lane] = primitiveIndex;
+	}
+	return true;
+}
+
+template <int N>
+int WideBVHAccel<N>::intersectChildren(const WideBVHNode<N>& node, const Ray& ray, const Vector3f& invDir,
+	const int dirIsNeg[3], float tNear[N]) const
+{
+	typedef WideSimd<N> simd;
+	typedef typename simd::vfloat vfloat;
+
+	// Near and far planes of each axis are selected by the ray direction sign
+	vfloat tMin = simd::set1(0.f);
+	vfloat tMax = simd::set1(float(ray.m_tMax));
+	const vfloat robust = simd::set1(float(1 + 2 * gamma(3)));
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const vfloat origin = simd::set1(float(ray.m_origin[axis]));
+		const vfloat inv = simd::set1(float(invDir[axis]));
+		vfloat tAxisMin = simd::mul(simd::sub(simd::load(node.m_bounds[dirIsNeg[axis]][axis]), origin), inv);
+		vfloat tAxisMax = simd::mul(simd::sub(simd::load(node.m_bounds[1 - dirIsNeg[axis]][axis]), origin), inv);
+		// Same conservative scaling as Bounds3::hit
+		tAxisMax = simd::mul(tAxisMax, robust);
+		tMin = simd::max(tAxisMin, tMin);
+		tMax = simd::min(tAxisMax, tMax);
+	}
+
+	simd::store(tNear, tMin);
+	return simd::lessEqualMask(tMin, tMax);
+}
+
+template <int N>
+bool WideBVHAccel<N>::hit(const Ray& ray) const
+{
+	if (!m_wideNodes)
+		return false;
+
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	constexpr int maxTodo = 64 * N;
+	WideBVHToDo todo[maxTodo];
+	int todoPos = 0;
+	todo[todoPos++] = { 0, 0, 0.f };
+
+	const TriangleRay triangleRay(ray);
+	float tNear[N];
+	while (todoPos > 0)
+	{
+		const WideBVHToDo current = todo[--todoPos];
+		if (current.m_nPrimitives & WideBVHTriangleLeaf)
+		{
+			int nBlocks = current.m_nPrimitives & ~WideBVHTriangleLeaf;
+			for (int i = 0; i < nBlocks; ++i)
+			{
+				if (intersectTriangleBlockP(m_triangleBlocks[current.m_index + i], triangleRay, ray.m_tMax))
+					return true;
+			}
+			continue;
+		}
+
+		if (current.m_nPrimitives > 0)
+		{
+			// Note: shadow rays can terminate at the first occluder found
+			for (int i = 0; i < current.m_nPrimitives; ++i)
+			{
+				if (m_primitives[current.m_index + i]->hit(ray))
+					return true;
+			}
+			continue;
+		}
+
+		// Any-hit query doesn't need front-to-back ordering
+		const WideBVHNode<N>& node = m_wideNodes[current.m_index];
+		int mask = intersectChildren(node, ray, invDir, dirIsNeg, tNear);
+		for (int i = 0; i < N; ++i)
+		{
+			if (mask & (1 << i))
+			{
+				todo[todoPos++] = { node.m_child[i], node.m_nPrimitives[i], tNear[i] };
+			}
+		}
+	}
+	return false;
+}
+
+template <int N>
+bool WideBVHAccel<N>::hit(const Ray& ray, HitRecord& record) const
+{
+	if (!m_wideNodes)
+		return false;
+
+	bool hit = false;
+	Vector3f invDir(1.f / ray.m_dir.x, 1.f / ray.m_dir.y, 1.f / ray.m_dir.z);
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	constexpr int maxTodo = 64 * N;
+	WideBVHToDo todo[maxTodo];
+	int todoPos = 0;
+	todo[todoPos++] = { 0, 0, 0.f };
+
+	const TriangleRay triangleRay(ray);
+	float tNear[N];
+	while (todoPos > 0)
+	{
+		const WideBVHToDo current = todo[--todoPos];
+
+		// Note: ray.m_tMax shrinks on every hit, entries behind the closest hit are culled
+		if (current.m_tNear > ray.m_tMax)
+			continue;
+
+		if (current.m_nPrimitives & WideBVHTriangleLeaf)
+		{
+			int nBlocks = current.m_nPrimitives & ~WideBVHTriangleLeaf;
+			for (int i = 0; i < nBlocks; ++i)
+			{
+				TriangleHit triangleHit;
+				if (intersectTriangleBlock(m_triangleBlocks[current.m_index + i], triangleRay, ray.m_tMax, triangleHit))
+				{
+					ray.m_tMax = triangleHit.m_t;
+					record.m_primitive = m_primitives[triangleHit.m_primitiveIndex].get();
+					record.m_instance = nullptr;
+					record.m_tHit = triangleHit.m_t;
+					record.m_coords = Vector3f(triangleHit.m_b0, triangleHit.m_b1, triangleHit.m_b2);
+					hit = true;
+				}
+			}
+			continue;
+		}
+
+		if (current.m_nPrimitives > 0)
+		{
+			// Intersect ray with primitives in leaf
+			for (int i = 0; i < current.m_nPrimitives; ++i)
+			{
+				if (m_primitives[current.m_index + i]->hit(ray, record))
+					hit = true;
+			}
+			continue;
+		}
+
+		const WideBVHNode<N>& node = m_wideNodes[current.m_index];
+		int mask = intersectChildren(node, ray, invDir, dirIsNeg, tNear);
+		if (mask == 0)
+			continue;
+
+		// Sort hit children far to near so that the nearest is popped first
+		int hitChildren[N];
+		int nHits = 0;
+		for (int i = 0; i < N; ++i)
+		{
+			if (!(mask & (1 << i)))
+				continue;
+			int j = nHits++;
+			while (j > 0 && tNear[hitChildren[j - 1]] < tNear[i])
+			{
+				hitChildren[j] = hitChildren[j - 1];
+				--j;
+			}
+			hitChildren[j] = i;
+		}
+
+		for (int i = 0; i < nHits; ++i)
+		{
+			int c = hitChildren[i];
+			todo[todoPos++] = { node.m_child[c], node.m_nPrimitives[c], tNear[c] };
+		}
+	}
+
+	return hit;
+}
+
+template class WideBVHAccel<4>;
+template class WideBVHAccel<8>;
+
+RENDER_END
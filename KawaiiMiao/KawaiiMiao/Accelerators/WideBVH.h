@@ -0,0 +1,65 @@
+#pragma once
+
+#include "BVH.h"
+#include "TriangleBlock.h"
+
+RENDER_BEGIN
+
+// N-wide BVH node, the bounds of all children are stored as SoA so that
+// one SIMD slab test handles every child of the node at once.
+template <int N>
+struct WideBVHNode
+{
+	float m_bounds[2][3][N]; // [min/max][axis][child]
+	int m_child[N]; // Interior: node index, Leaf: first primitive offset
+	int m_nPrimitives[N]; // 0 -> interior child, -1 -> empty slot
+};
+
+// Leaf children whose primitives are all triangles keep them as SoA triangle blocks:
+// m_child is then the first block index and m_nPrimitives the block count with this flag set.
+static constexpr int WideBVHTriangleLeaf = 1 << 30;
+
+// Wide BVH (QBVH for N = 4, OBVH for N = 8) collapsed from a binary SAH BVH.
+// Note: empty child slots hold inverted bounds, so they never pass the slab test.
+//       Triangle leaves are packed into blocks of N and intersected with one SIMD test.
+template <int N>
+class WideBVHAccel : public BVHAccel
+{
+public:
+	typedef std::shared_ptr<WideBVHAccel> ptr;
+
+	static_assert(N == 4 || N == 8, "WideBVHAccel only supports 4-wide or 8-wide nodes");
+
+	WideBVHAccel(const std::vector<Primitive::ptr>& primitives, int maxPrimsInNode = 4,
+		SplitMethod splitMethod = SplitMethod::SAH);
+	virtual ~WideBVHAccel();
+
+	virtual Bounds3f worldBound() const override { return m_worldBound; }
+
+	using PrimitiveAggregate::hit;
+	virtual bool hit(const Ray& ray) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+
+	virtual std::string toString() const override { return N == 4 ? "QBVHAccel[]" : "OBVHAccel[]"; }
+
+private:
+	int collapseNode(int binaryIndex, std::vector<WideBVHNode<N>>& wideNodes,
+		std::vector<TriangleBlock<N>>& triangleBlocks) const;
+	void subtreePrimitives(int binaryIndex, int& offset, int& count) const;
+	bool packTriangleLeaf(const LinearBVHNode& leaf, std::vector<TriangleBlock<N>>& triangleBlocks) const;
+
+	// Test the ray against all children slabs, returns the hit mask and the entry distances
+	int intersectChildren(const WideBVHNode<N>& node, const Ray& ray, const Vector3f& invDir,
+		const int dirIsNeg[3], float tNear[N]) const;
+
+	Bounds3f m_worldBound;
+	WideBVHNode<N>* m_wideNodes = nullptr;
+	int m_totalWideNodes = 0;
+	TriangleBlock<N>* m_triangleBlocks = nullptr;
+	int m_totalTriangleBlocks = 0;
+};
+
+typedef WideBVHAccel<4> QBVHAccel;
+typedef WideBVHAccel<8> OBVHAccel;
+
+RENDER_END
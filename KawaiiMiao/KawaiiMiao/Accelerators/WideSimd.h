@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../Core/Rendering.h"
+
+#include <immintrin.h>
+
+RENDER_BEGIN
+
+// Thin wrappers so the wide kernels can be written once for both widths.
+// Comparisons return a lane bit mask, combine them with integer & and |.
+template <int N>
+struct WideSimd;
+
+template <>
+struct WideSimd<4>
+{
+	typedef __m128 vfloat;
+
+	static vfloat load(const float* p) { return _mm_loadu_ps(p); }
+	static vfloat set1(float v) { return _mm_set1_ps(v); }
+	static vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+	static vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+	static vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+	static vfloat div(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+	static vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+	static vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+	static void store(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+	static int lessMask(vfloat a, vfloat b) { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+	static int lessEqualMask(vfloat a, vfloat b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+	static int equalMask(vfloat a, vfloat b) { return _mm_movemask_ps(_mm_cmpeq_ps(a, b)); }
+};
+
+template <>
+struct WideSimd<8>
+{
+#if defined(__AVX__)
+	typedef __m256 vfloat;
+
+	static vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+	static vfloat set1(float v) { return _mm256_set1_ps(v); }
+	static vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+	static vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+	static vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+	static vfloat div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+	static vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+	static vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+	static void store(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+	static int lessMask(vfloat a, vfloat b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+	static int lessEqualMask(vfloat a, vfloat b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+	static int equalMask(vfloat a, vfloat b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+#else
+	// Note: without AVX the 8 lanes are processed as two SSE halves
+	struct vfloat { __m128 lo, hi; };
+
+	static vfloat load(const float* p) { return { _mm_loadu_ps(p), _mm_loadu_ps(p + 4) }; }
+	static vfloat set1(float v) { return { _mm_set1_ps(v), _mm_set1_ps(v) }; }
+	static vfloat add(vfloat a, vfloat b) { return { _mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi) }; }
+	static vfloat sub(vfloat a, vfloat b) { return { _mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi) }; }
+	static vfloat mul(vfloat a, vfloat b) { return { _mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi) }; }
+	static vfloat div(vfloat a, vfloat b) { return { _mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi) }; }
+	static vfloat min(vfloat a, vfloat b) { return { _mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi) }; }
+	static vfloat max(vfloat a, vfloat b) { return { _mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi) }; }
+	static void store(float* p, vfloat a) { _mm_storeu_ps(p, a.lo); _mm_storeu_ps(p + 4, a.hi); }
+	static int lessMask(vfloat a, vfloat b)
+	{
+		return _mm_movemask_ps(_mm_cmplt_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmplt_ps(a.hi, b.hi)) << 4);
+	}
+	static int lessEqualMask(vfloat a, vfloat b)
+	{
+		return _mm_movemask_ps(_mm_cmple_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmple_ps(a.hi, b.hi)) << 4);
+	}
+	static int equalMask(vfloat a, vfloat b)
+	{
+		return _mm_movemask_ps(_mm_cmpeq_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmpeq_ps(a.hi, b.hi)) << 4);
+	}
+#endif
+};
+
+RENDER_END
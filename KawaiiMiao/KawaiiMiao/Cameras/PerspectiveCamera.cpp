@@ -1,5 +1,7 @@
 #include "PerspectiveCamera.h"
 
+#include "../Core/Light.h"
+
 RENDER_BEGIN
 
 RENDER_REGISTER_CLASS(PerspectiveCamera, "Perspective");
@@ -13,6 +15,8 @@ PerspectiveCamera::PerspectiveCamera(const APropertyTreeNode& node)
 	auto _up = props.getVector3f("WorldUp", Vector3f(0.f, 1.f, 0.f));
 	m_cameraToWorld = inverse(lookAt(_eye, _focus, _up));
 	m_cameraToScreen = perspective(_fov, 1e-2f, 1000.f);
+	m_shutterOpen = props.getFloat("ShutterOpen", 0.f);
+	m_shutterClose = props.getFloat("ShutterClose", 1.f);
 
 	// Film 
 	{
@@ -20,6 +24,13 @@ PerspectiveCamera::PerspectiveCamera(const APropertyTreeNode& node)
 		m_film = Film::ptr(static_cast<Film*>(AObjectFactory::createInstance(filmNode.getTypeName(), filmNode)));
 	}
 
+	// Medium
+	if (node.hasPropertyChild("Medium"))
+	{
+		const auto& mediumNode = node.getPropertyChild("Medium");
+		m_medium = Medium::ptr(static_cast<Medium*>(AObjectFactory::createInstance(mediumNode.getTypeName(), mediumNode)));
+	}
+
 	activate();
 }
 
@@ -31,6 +42,9 @@ PerspectiveCamera::PerspectiveCamera(const Transform& CameraToWorld, Float fov,
 
 void PerspectiveCamera::initialize()
 {
+	// Note: the image plane bounds need _m_rasterToCamera_, computed by the projective camera
+	ProjectiveCamera::initialize();
+
 	// Compute image plane bounds at $z=1$ for _PerspectiveCamera_
 	Vector2i res = m_film->getResolution();
 	Vector3f pMin = m_rasterToCamera(Vector3f(0, 0, 0), 1.0f);
@@ -38,8 +52,6 @@ void PerspectiveCamera::initialize()
 	pMin /= pMin.z;
 	pMax /= pMax.z;
 	A = glm::abs((pMax.x - pMin.x) * (pMax.y - pMin.y));
-
-	ProjectiveCamera::initialize();
 }
 
 Float PerspectiveCamera::castingRay(const CameraSample& sample, Ray& ray) const
@@ -48,8 +60,80 @@ Float PerspectiveCamera::castingRay(const CameraSample& sample, Ray& ray) const
 	Vector3f pFilm = Vector3f(sample.pFilm.x, sample.pFilm.y, 0);
 	Vector3f pCamera = m_rasterToCamera(pFilm, 1.0f);
 	ray = Ray(Vector3f(0, 0, 0), normalize(Vector3f(pCamera)));
+	ray.m_time = lerp(sample.time, m_shutterOpen, m_shutterClose);
 	ray = m_cameraToWorld(ray);
+	ray.m_medium = m_medium.get();
 	return 1.f;
 }
 
+Spectrum PerspectiveCamera::We(const Ray& ray, Vector2f* pRaster2) const
+{
+	// Check that the ray points along the viewing direction
+	Vector3f viewDir = normalize(m_cameraToWorld(Vector3f(0, 0, 1), 0.0f));
+	Float cosTheta = dot(ray.direction(), viewDir);
+	if (cosTheta <= 0)
+		return Spectrum(0.f);
+
+	// Map the ray's point on the plane of focus to the raster
+	Vector3f pFocus = ray(1 / cosTheta);
+	Vector3f pRaster = inverse(m_rasterToCamera)(inverse(m_cameraToWorld)(pFocus, 1.0f), 1.0f);
+	if (pRaster2)
+		*pRaster2 = Vector2f(pRaster.x, pRaster.y);
+
+	// Return zero importance for rays leaving the raster
+	Bounds2i sampleBounds = m_film->getSampleBounds();
+	if (pRaster.x < sampleBounds.m_pMin.x || pRaster.x >= sampleBounds.m_pMax.x ||
+		pRaster.y < sampleBounds.m_pMin.y || pRaster.y >= sampleBounds.m_pMax.y)
+		return Spectrum(0.f);
+
+	// Note: a pinhole has unit lens area, the importance integrates to one over the image plane
+	Float cos2Theta = cosTheta * cosTheta;
+	return Spectrum(1 / (A * cos2Theta * cos2Theta));
+}
+
+void PerspectiveCamera::pdf_We(const Ray& ray, Float& pdfPos, Float& pdfDir) const
+{
+	Vector3f viewDir = normalize(m_cameraToWorld(Vector3f(0, 0, 1), 0.0f));
+	Float cosTheta = dot(ray.direction(), viewDir);
+	pdfPos = pdfDir = 0;
+	if (cosTheta <= 0)
+		return;
+
+	Vector3f pFocus = ray(1 / cosTheta);
+	Vector3f pRaster = inverse(m_rasterToCamera)(inverse(m_cameraToWorld)(pFocus, 1.0f), 1.0f);
+	Bounds2i sampleBounds = m_film->getSampleBounds();
+	if (pRaster.x < sampleBounds.m_pMin.x || pRaster.x >= sampleBounds.m_pMax.x ||
+		pRaster.y < sampleBounds.m_pMin.y || pRaster.y >= sampleBounds.m_pMax.y)
+		return;
+
+	pdfPos = 1;
+	pdfDir = 1 / (A * cosTheta * cosTheta * cosTheta);
+}
+
+Spectrum PerspectiveCamera::sample_Wi(const Interaction& ref, const Vector2f& u, Vector3f& wi, Float& pdf,
+	Vector2f& pRaster, VisibilityTester& vis) const
+{
+	// The pinhole is the only point of the lens
+	Vector3f pLens = m_cameraToWorld(Vector3f(0, 0, 0), 1.0f);
+	Vector3f viewDir = normalize(m_cameraToWorld(Vector3f(0, 0, 1), 0.0f));
+	Interaction lensIntr(pLens);
+	lensIntr.normal = viewDir;
+	lensIntr.time = ref.time;
+
+	// Populate arguments and compute the importance value
+	vis = VisibilityTester(ref, lensIntr);
+	wi = lensIntr.p - ref.p;
+	Float dist = length(wi);
+	if (dist == 0)
+	{
+		pdf = 0;
+		return Spectrum(0.f);
+	}
+	wi /= dist;
+
+	// Convert the lens area density to solid angle at _ref_
+	pdf = (dist * dist) / absDot(lensIntr.normal, wi);
+	return We(Ray(lensIntr.p, -wi, Infinity, ref.time), &pRaster);
+}
+
 RENDER_END
\ No newline at end of file
@@ -14,6 +14,11 @@ public:
 
 	virtual Float castingRay(const CameraSample& sample, Ray& ray) const override;
 
+	virtual Spectrum We(const Ray& ray, Vector2f* pRaster2 = nullptr) const override;
+	virtual void pdf_We(const Ray& ray, Float& pdfPos, Float& pdfDir) const override;
+	virtual Spectrum sample_Wi(const Interaction& ref, const Vector2f& u, Vector3f& wi, Float& pdf,
+		Vector2f& pRaster, VisibilityTester& vis) const override;
+
 	virtual void activate() override { initialize(); }
 
 	virtual std::string toString() const override { return "PerspectiveCamera[]"; }
@@ -23,6 +28,7 @@ protected:
 
 private:
 	//Vector3f dxCamera, dyCamera;
+	// Note: area of the image plane at z = 1, in camera space
 	Float A;
 };
 
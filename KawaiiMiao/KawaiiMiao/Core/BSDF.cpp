@@ -96,10 +96,7 @@ Spectrum BSDF::sample_f(const Vector3f& woWorld, Vector3f& wiWorld, const Vector
 	if (matchingComps == 0)
 	{
 		pdf = 0;
-		if (sampledType)
-		{
-			sampledType = BxDFType(0);
-		}
+		sampledType = BxDFType(0);
 		return Spectrum(0);
 	}
 	int comp = glm::min((int)glm::floor(u[0] * matchingComps), matchingComps - 1);
@@ -121,25 +118,21 @@ Spectrum BSDF::sample_f(const Vector3f& woWorld, Vector3f& wiWorld, const Vector
 	Vector2f uRemapped(glm::min(u[0] * matchingComps - comp, aOneMinusEpsilon), u[1]); 
 
 	// Sample chosen _BxDF_
+	// Note: _sampledType_ is always written, callers don't initialize it
 	Vector3f wi, wo = worldToLocal(woWorld);
+	pdf = 0;
+	sampledType = BxDFType(0);
 	if (wo.z == 0)
 	{
 		return 0.f;
 	}
 
-	pdf = 0;
-	if (sampledType)
-	{
-		sampledType = bxdf->m_type;
-	}
+	sampledType = bxdf->m_type;
 	Spectrum f = bxdf->sample_f(wo, wi, uRemapped, pdf, sampledType);
 
 	if (pdf == 0)
 	{
-		if (sampledType)
-		{
-			sampledType = BxDFType(0);
-		}
+		sampledType = BxDFType(0);
 		return 0;
 	}
 
@@ -1,4 +1,6 @@
 #include "Camera.h"
+#include "Light.h"
+#include "../Tool/Logger.h"
 
 RENDER_BEGIN
 
@@ -11,6 +13,26 @@ Camera::Camera(const Transform& cameraToWorld, Film::ptr film)
 
 Camera::~Camera() {}
 
+Spectrum Camera::We(const Ray& ray, Vector2f* pRaster2) const
+{
+	K_ERROR("Camera::We() is not implemented by {0}", toString());
+	return Spectrum(0.f);
+}
+
+void Camera::pdf_We(const Ray& ray, Float& pdfPos, Float& pdfDir) const
+{
+	K_ERROR("Camera::pdf_We() is not implemented by {0}", toString());
+	pdfPos = pdfDir = 0;
+}
+
+Spectrum Camera::sample_Wi(const Interaction& ref, const Vector2f& u, Vector3f& wi, Float& pdf,
+	Vector2f& pRaster, VisibilityTester& vis) const
+{
+	K_ERROR("Camera::sample_Wi() is not implemented by {0}", toString());
+	pdf = 0;
+	return Spectrum(0.f);
+}
+
 // ---------------------- Projective Camera ----------------------
 
 void ProjectiveCamera::initialize()
@@ -2,6 +2,7 @@
 
 #include "Rendering.h"
 #include "Film.h"
+#include "Medium.h"
 #include "../Math/Transform.h"
 #include "Rtti.h"
 
@@ -12,12 +13,12 @@ struct CameraSample
 {
 	Vector2f pFilm;
 	//Vector2f pLens;
-	//Float time;
+	Float time;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const CameraSample& cs)
 {
-	os << "[ pFilm: " << cs.pFilm << " ]";
+	os << "[ pFilm: " << cs.pFilm << " , time: " << cs.time << " ]";
 	return os;
 }
 
@@ -31,20 +32,26 @@ public:
 	Camera(const Transform& cameraToWorld, Film::ptr film);
 	virtual ~Camera();
 
-	//Spectrum We(const Ray &ray, Point2f *pRaster2 = nullptr) const;
-	//void Pdf_We(const Ray &ray, Float *pdfPos, Float *pdfDir) const;
-	//Spectrum Sample_Wi(const Interaction &ref, const Point2f &sample,
-	//	Vector3f *wi, Float *pdf, Point2f *pRaster,
-	//	VisibilityTester *vis) const;
-
 	// Compute the ray corresponding to a giving sample
 	virtual Float castingRay(const CameraSample& sample, Ray& ray) const = 0;
 
+	// Importance emitted along _ray_, the raster position the ray goes through is returned in _pRaster2_
+	virtual Spectrum We(const Ray& ray, Vector2f* pRaster2 = nullptr) const;
+	// Spatial and directional densities of castingRay() generating _ray_
+	virtual void pdf_We(const Ray& ray, Float& pdfPos, Float& pdfDir) const;
+	// Sample a point on the lens seen from _ref_, _pdf_ is with respect to solid angle at _ref_
+	virtual Spectrum sample_Wi(const Interaction& ref, const Vector2f& u, Vector3f& wi, Float& pdf,
+		Vector2f& pRaster, VisibilityTester& vis) const;
+
 	virtual ClassType getClassType() const override { return ClassType::RCamera; }
 
 	// Camera Public Data
 	Transform m_cameraToWorld;
 	Film::ptr m_film;
+	// Note: camera rays get a time in [m_shutterOpen, m_shutterClose] for motion blur
+	Float m_shutterOpen = 0.f, m_shutterClose = 1.f;
+	// The medium the camera lies in, e.g. fog filling the scene
+	Medium::ptr m_medium;
 };
 
 class ProjectiveCamera : public Camera
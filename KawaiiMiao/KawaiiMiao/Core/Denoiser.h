@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Rendering.h"
+#include "Rtti.h"
+#include "../Math/KMathUtil.h"
+
+RENDER_BEGIN
+
+// Feature buffers (AOVs) of the first visible surface, averaged over the samples of each pixel.
+// Every buffer holds one value per pixel of the film's cropped bounds, in scanline order.
+struct DenoiserFeatures
+{
+	const Float* m_albedo;	//rgb reflectance
+	const Float* m_normal;	//xyz shading normal facing the camera
+	const Float* m_depth;	//distance along the camera ray
+};
+
+// Image space denoisers run by the film on the final radiance, just before it's written
+class Denoiser : public AObject
+{
+public:
+	typedef std::unique_ptr<Denoiser> unique_ptr;
+
+	virtual ~Denoiser() = default;
+
+	// Filter the linear _rgb_ image of _resolution_ in place
+	virtual void denoise(const Vector2i& resolution, Float* rgb, const DenoiserFeatures& features) const = 0;
+
+	virtual ClassType getClassType() const override { return ClassType::RDenoiser; }
+};
+
+RENDER_END
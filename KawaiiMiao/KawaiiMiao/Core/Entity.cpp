@@ -1,10 +1,62 @@
 #include "Entity.h"
 #include "../Core/Material.h"
 #include "../Core/Light.h"
+#include "../Core/Medium.h"
 #include "../Core/Shape.h"
+#include "../Accelerators/BVH.h"
+
+#include <map>
 
 RENDER_BEGIN
 
+// Parse a transform sequence of the shape node, e.g. [0, tx, ty, tz, 1, sx, sy, sz, 2, rx, ry, rz, angle]
+static Transform parseTransform(const std::vector<Float>& sequence)
+{
+	Transform objectToWorld;
+	std::vector<Transform> transformStack;
+	size_t it = 0;
+	bool undefined = false;
+	while (it < sequence.size() && !undefined)
+	{
+		int token = static_cast<int>(sequence[it]);
+		switch (token)
+		{
+		case 0://translate
+			CHECK_LT(it + 3, sequence.size());
+			Vector3f _trans = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
+			transformStack.push_back(translate(_trans));
+			it += 4;
+			break;
+		case 1://scale
+			CHECK_LT(it + 3, sequence.size());
+			Vector3f _scale = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
+			transformStack.push_back(scale(_scale.x, _scale.y, _scale.z));
+			it += 4;
+			break;
+		case 2://rotate
+			CHECK_LT(it + 4, sequence.size());
+			Vector3f axis = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
+			transformStack.push_back(rotate(sequence[it + 4], axis));
+			it += 5;
+			break;
+		default:
+			undefined = true;
+			K_ERROR("Undefined transform action");
+			break;
+		}
+	}
+
+	//Note: calculate the transform matrix in a first-in-last-out manner
+	if (!undefined)
+	{
+		for (auto it = transformStack.rbegin(); it != transformStack.rend(); ++it)
+		{
+			objectToWorld = objectToWorld * (*it);
+		}
+	}
+	return objectToWorld;
+}
+
 RENDER_REGISTER_CLASS(Entity, "Entity");
 
 Entity::Entity(const APropertyTreeNode& node)
@@ -18,60 +70,28 @@ Entity::Entity(const APropertyTreeNode& node)
 	shape->setTransform(&m_objectToWorld, &m_worldToObject);
 
 	// Transform
-	Transform objectToWrold;
 	const auto& shapeProps = shapeNode.getPropertyList();
+	Transform objectToWrold;
 	if (shapeNode.hasProperty("Transform"))
 	{
-		std::vector<Transform> transformStack;
-		std::vector<Float> sequence = shapeProps.getVectorNf("Transform");
-		size_t it = 0;
-		bool undefined = false;
-		while (it < sequence.size() && !undefined)
-		{
-			int token = static_cast<int>(sequence[it]);
-			switch (token)
-			{
-			case 0://translate
-				CHECK_LT(it + 3, sequence.size());
-				Vector3f _trans = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-				transformStack.push_back(translate(_trans));
-				it += 4;
-				break;
-			case 1://scale
-				CHECK_LT(it + 3, sequence.size());
-				Vector3f _scale = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-				transformStack.push_back(scale(_scale.x, _scale.y, _scale.z));
-				it += 4;
-				break;
-			case 2://rotate
-				CHECK_LT(it + 4, sequence.size());
-				Vector3f axis = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-				transformStack.push_back(rotate(sequence[it + 4], axis));
-				it += 5;
-				break;
-			default:
-				undefined = true;
-				K_ERROR("Undefined transform action");
-				break;
-			}
-		}
+		objectToWrold = parseTransform(shapeProps.getVectorNf("Transform"));
+	}
 
-		//Note: calculate the transform matrix in a first-in-last-out manner
-		if (!undefined)
-		{
-			for (auto it = transformStack.rbegin(); it != transformStack.rend(); ++it)
-			{
-				objectToWrold = objectToWrold * (*it);
-			}
-		}
+	// Note: an end transform makes the entity move during the shutter interval
+	Transform endObjectToWorld = objectToWrold;
+	bool animated = shapeNode.hasProperty("EndTransform");
+	if (animated)
+	{
+		endObjectToWorld = parseTransform(shapeProps.getVectorNf("EndTransform"));
 	}
+	Float startTime = shapeProps.getFloat("StartTime", 0.f);
+	Float endTime = shapeProps.getFloat("EndTime", 1.f);
 	m_objectToWorld = objectToWrold;
 	m_worldToObject = inverse(m_objectToWorld);
 
-	// Material
-	const auto& materialNode = node.getPropertyChild("Material");
-	m_material = Material::ptr(static_cast<Material*>(AObjectFactory::createInstance(
-		materialNode.getTypeName(), materialNode)));
+	// Material and media
+	parseMaterial(node);
+	MediumInterface mediumInterface = parseMediumInterface(node);
 
 	//Area light
 	AreaLight::ptr areaLight = nullptr;
@@ -82,7 +102,92 @@ Entity::Entity(const APropertyTreeNode& node)
 			lightNode.getTypeName(), lightNode)));
 	}
 
-	m_Primitives.push_back(std::make_shared<PrimitiveObject>(shape, m_material.get(), areaLight));
+	if (animated && areaLight != nullptr)
+	{
+		K_WARN("Moving area lights are not supported, the entity stays at its start transform");
+		animated = false;
+	}
+
+	if (animated && mediumInterface.IsMediumTransition())
+	{
+		K_WARN("Moving medium boundaries are not supported, the entity stays at its start transform");
+		animated = false;
+	}
+
+	if (animated)
+	{
+		// The shape stays in object space, the instance moves it
+		m_objectToWorld = m_worldToObject = Transform();
+		Primitive::ptr primitive = std::make_shared<PrimitiveObject>(shape, m_material.get(), nullptr);
+		m_Primitives.push_back(std::make_shared<PrimitiveInstance>(primitive, objectToWrold, startTime,
+			endObjectToWorld, endTime, m_material.get()));
+		return;
+	}
+
+	m_Primitives.push_back(std::make_shared<PrimitiveObject>(shape, m_material.get(), areaLight, mediumInterface));
+}
+
+void Entity::parseMaterial(const APropertyTreeNode& node)
+{
+	if (!node.hasPropertyChild("Material"))
+		return;
+
+	const auto& materialNode = node.getPropertyChild("Material");
+	m_material = Material::ptr(static_cast<Material*>(AObjectFactory::createInstance(
+		materialNode.getTypeName(), materialNode)));
+}
+
+MediumInterface Entity::parseMediumInterface(const APropertyTreeNode& node)
+{
+	auto createMedium = [&node](const std::string& name) -> Medium::ptr
+	{
+		if (!node.hasPropertyChild(name))
+			return nullptr;
+
+		const auto& mediumNode = node.getPropertyChild(name);
+		return Medium::ptr(static_cast<Medium*>(AObjectFactory::createInstance(
+			mediumNode.getTypeName(), mediumNode)));
+	};
+
+	// Note: a missing medium is vacuum
+	m_mediumInside = createMedium("MediumInside");
+	m_mediumOutside = createMedium("MediumOutside");
+	return MediumInterface(m_mediumInside.get(), m_mediumOutside.get());
+}
+
+MeshInstanceGeometry::MeshInstanceGeometry(const std::string& filename)
+{
+	// Note: the vertices stay in object space, instances place them in the world
+	m_mesh = TriangleMesh::unique_ptr(new TriangleMesh(&m_identity, filename));
+
+	std::vector<Primitive::ptr> primitives;
+	const auto& meshIndices = m_mesh->getIndices();
+	primitives.reserve(meshIndices.size() / 3);
+	for (size_t i = 0; i < meshIndices.size(); i += 3)
+	{
+		std::array<int, 3> indices;
+		indices[0] = meshIndices[i + 0];
+		indices[1] = meshIndices[i + 1];
+		indices[2] = meshIndices[i + 2];
+		TriangleShape::ptr triangle = std::make_shared<TriangleShape>(&m_identity, &m_identity, indices, m_mesh.get());
+		primitives.push_back(std::make_shared<PrimitiveObject>(triangle, nullptr, nullptr));
+	}
+
+	m_accelerator = std::make_shared<BVHAccel>(primitives);
+}
+
+MeshInstanceGeometry::ptr MeshInstanceGeometry::get(const std::string& filename)
+{
+	// Note: scene parsing is single threaded, entities keep the geometry alive
+	static std::map<std::string, std::weak_ptr<MeshInstanceGeometry>> loaded;
+
+	MeshInstanceGeometry::ptr geometry = loaded[filename].lock();
+	if (geometry == nullptr)
+	{
+		geometry = std::make_shared<MeshInstanceGeometry>(filename);
+		loaded[filename] = geometry;
+	}
+	return geometry;
 }
 
 RENDER_REGISTER_CLASS(MeshEntity, "MeshEntity")
@@ -96,60 +201,45 @@ MeshEntity::MeshEntity(const APropertyTreeNode& node)
 	const auto& shapeNode = node.getPropertyChild("Shape");
 
 	// Transform
-	Transform objectToWrold;
 	const auto& shapeProps = shapeNode.getPropertyList();
+	Transform objectToWrold;
 	if (shapeNode.hasProperty("Transform"))
 	{
-		std::vector<Transform> transformStack;
-		std::vector<Float> sequence = shapeProps.getVectorNf("Transform");
-		size_t it = 0;
-		bool undefined = false;
-		while (it < sequence.size() && !undefined)
-		{
-			int token = static_cast<int>(sequence[it]);
-			switch (token)
-			{
-			case 0://translate
-				CHECK_LT(it + 3, sequence.size());
-				Vector3f _trans = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-				transformStack.push_back(translate(_trans));
-				it += 4;
-				break;
-			case 1://scale
-				CHECK_LT(it + 3, sequence.size());
-				Vector3f _scale = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-				transformStack.push_back(scale(_scale.x, _scale.y, _scale.z));
-				it += 4;
-				break;
-			case 2://rotate
-				CHECK_LT(it + 4, sequence.size());
-				Vector3f axis = Vector3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-				transformStack.push_back(rotate(sequence[it + 4], axis));
-				it += 5;
-				break;
-			default:
-				undefined = true;
-				K_ERROR("Undefined transform action");
-				break;
-			}
-		}
+		objectToWrold = parseTransform(shapeProps.getVectorNf("Transform"));
+	}
 
-		//Note: calculate the transform matrix in a first-in-last-out manner
-		if (!undefined)
-		{
-			for (auto it = transformStack.rbegin(); it != transformStack.rend(); ++it)
-			{
-				objectToWrold = objectToWrold * (*it);
-			}
-		}
+	// Note: an end transform makes the entity move during the shutter interval
+	Transform endObjectToWorld = objectToWrold;
+	bool animated = shapeNode.hasProperty("EndTransform");
+	if (animated)
+	{
+		endObjectToWorld = parseTransform(shapeProps.getVectorNf("EndTransform"));
 	}
+	Float startTime = shapeProps.getFloat("StartTime", 0.f);
+	Float endTime = shapeProps.getFloat("EndTime", 1.f);
 	m_objectToWorld = objectToWrold;
 	m_worldToObject = inverse(m_objectToWorld);
 
-	//Material
-	const auto& materialNode = node.getPropertyChild("Material");
-	m_material = Material::ptr(static_cast<Material*>(AObjectFactory::createInstance(
-		materialNode.getTypeName(), materialNode)));
+	//Material and media
+	parseMaterial(node);
+	MediumInterface mediumInterface = parseMediumInterface(node);
+
+	//Instanced meshes share one object space geometry and BVH per file
+	//Note: moving meshes are always instanced, the vertices can't be baked into world space
+	bool instanced = props.getBoolean("Instanced", false) || animated;
+	if (instanced && (node.hasPropertyChild("Light") || mediumInterface.IsMediumTransition()))
+	{
+		K_WARN("Instanced or moving mesh {0} can't be an area light or bound media, loading it without instancing", filename);
+		instanced = false;
+	}
+
+	if (instanced)
+	{
+		m_instanceGeometry = MeshInstanceGeometry::get(APropertyTreeNode::m_directory + filename);
+		m_Primitives.push_back(std::make_shared<PrimitiveInstance>(m_instanceGeometry->getAccelerator(),
+			objectToWrold, startTime, endObjectToWorld, endTime, m_material.get()));
+		return;
+	}
 
 	//Load each triangle of the mesh as a PrimitiveEntity
 	m_mesh = TriangleMesh::unique_ptr(new TriangleMesh(&m_objectToWorld, APropertyTreeNode::m_directory + filename));
@@ -170,7 +260,7 @@ MeshEntity::MeshEntity(const APropertyTreeNode& node)
 			areaLight = AreaLight::ptr(static_cast<AreaLight*>(AObjectFactory::createInstance(
 				lightNode.getTypeName(), lightNode)));
 		}
-		m_Primitives.push_back(std::make_shared<PrimitiveObject>(triangle, m_material.get(), areaLight));
+		m_Primitives.push_back(std::make_shared<PrimitiveObject>(triangle, m_material.get(), areaLight, mediumInterface));
 	}
 }
 
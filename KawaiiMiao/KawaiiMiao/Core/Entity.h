@@ -29,11 +29,40 @@ public:
 	virtual ClassType getClassType() const override { return ClassType::RPrimitive; }
 
 protected:
+	// Create the optional "Material" child, an entity without material only bounds media
+	void parseMaterial(const APropertyTreeNode& node);
+	// Create the optional "MediumInside" and "MediumOutside" children
+	MediumInterface parseMediumInterface(const APropertyTreeNode& node);
+
 	Material::ptr m_material;
+	Medium::ptr m_mediumInside, m_mediumOutside;
 	std::vector<Primitive::ptr> m_Primitives;
 	Transform m_objectToWorld, m_worldToObject;
 };
 
+//! @brief Object space triangles and BVH of one mesh file.
+/**
+* Shared by every instanced MeshEntity loading the same file, so the geometry and its
+* acceleration structure only exist once however many times the mesh is placed in the world.
+*/
+class MeshInstanceGeometry
+{
+public:
+	typedef std::shared_ptr<MeshInstanceGeometry> ptr;
+
+	MeshInstanceGeometry(const std::string& filename);
+
+	// Return the geometry of the file, it's only loaded by the first request
+	static ptr get(const std::string& filename);
+
+	const Primitive::ptr& getAccelerator() const { return m_accelerator; }
+
+private:
+	Transform m_identity;
+	TriangleMesh::unique_ptr m_mesh;
+	Primitive::ptr m_accelerator;
+};
+
 class MeshEntity : public Entity
 {
 public:
@@ -45,6 +74,7 @@ public:
 
 private:
 	TriangleMesh::unique_ptr m_mesh;
+	MeshInstanceGeometry::ptr m_instanceGeometry;
 };
 
 
@@ -3,8 +3,26 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../extern/stb_image_write.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
 RENDER_BEGIN
 
+// Header of the accumulation buffer checkpoints
+struct FilmCheckpointHeader
+{
+	char m_magic[8];
+	uint32_t m_version;
+	uint32_t m_floatSize;
+	int32_t m_bounds[4];
+	uint64_t m_key;
+	int64_t m_samplesDone;
+};
+
+static const char filmCheckpointMagic[8] = { 'K', 'A', 'W', 'A', 'I', 'I', 'F', 'C' };
+static constexpr uint32_t filmCheckpointVersion = 2;
+
 RENDER_REGISTER_CLASS(Film, "Film")
 
 Film::Film(const APropertyTreeNode& node)
@@ -35,6 +53,15 @@ Film::Film(const APropertyTreeNode& node)
 			filterNode.getTypeName(), filterNode)));
 	}
 
+	//Denoiser
+	if (node.hasPropertyChild("Denoiser"))
+	{
+		const auto& denoiserNode = node.getPropertyChild("Denoiser");
+		m_denoiser = Denoiser::unique_ptr(static_cast<Denoiser*>(AObjectFactory::createInstance(
+			denoiserNode.getTypeName(), denoiserNode)));
+	}
+	m_writeAOVs = props.getBoolean("WriteAOVs", false);
+
 	activate();
 }
 
@@ -75,6 +102,8 @@ Film::Film(const Vector2i& resolution, const Bounds2f& cropWindow, std::unique_p
 void Film::initialize()
 {
 	m_pixels = std::unique_ptr<APixel[]>(new APixel[m_croppedPixelBounds.area()]);
+	if (m_denoiser != nullptr || m_writeAOVs)
+		m_features = std::unique_ptr<FilmFeaturePixel[]>(new FilmFeaturePixel[m_croppedPixelBounds.area()]);
 
 	//Precompute filter weight table
 	//Note: we assume that filtering function f(x,y)=f(|x|,|y|)
@@ -109,7 +138,7 @@ std::unique_ptr<FilmTile> Film::getFilmTile(const Bounds2i& sampleBounds)
 	Vector2i p1 = (Vector2i)floor(floatBounds.m_pMax - halfPixel + m_filter->m_radius) + Vector2i(1, 1);
 	Bounds2i tilePixelBounds = intersect(Bounds2i(p0, p1), m_croppedPixelBounds);
 	return std::unique_ptr<FilmTile>(new FilmTile(tilePixelBounds, m_filter->m_radius,
-		m_filterTable, filterTableWidth, m_maxSampleLuminance));
+		m_filterTable, filterTableWidth, m_maxSampleLuminance, hasFeatures()));
 }
 
 void Film::mergeFilmTile(std::unique_ptr<FilmTile> tile)
@@ -128,6 +157,24 @@ void Film::mergeFilmTile(std::unique_ptr<FilmTile> tile)
 		}
 		mergePixel.m_filterWeightSum += tilePixel.filterWeightSum;
 	}
+
+	if (!tile->hasFeatures() || m_features == nullptr)
+		return;
+
+	int width = m_croppedPixelBounds.m_pMax.x - m_croppedPixelBounds.m_pMin.x;
+	for (Vector2i pixel : tile->getPixelBounds())
+	{
+		const FilmFeaturePixel& tileFeatures = tile->m_features[tile->getPixelIndex(pixel)];
+		FilmFeaturePixel& mergeFeatures = m_features[(pixel.x - m_croppedPixelBounds.m_pMin.x) +
+			(pixel.y - m_croppedPixelBounds.m_pMin.y) * width];
+		for (int i = 0; i < 3; ++i)
+		{
+			mergeFeatures.albedo[i] += tileFeatures.albedo[i];
+			mergeFeatures.normal[i] += tileFeatures.normal[i];
+		}
+		mergeFeatures.depth += tileFeatures.depth;
+		mergeFeatures.weightSum += tileFeatures.weightSum;
+	}
 }
 
 void Film::writeImageToFile(Float splatScale)
@@ -135,6 +182,7 @@ void Film::writeImageToFile(Float splatScale)
 	std::cout << "Converting image to RGB and computing final weighted pixel values";
 	std::unique_ptr<Float[]> rgb(new Float[3 * m_croppedPixelBounds.area()]);
 	std::unique_ptr<Byte[]>  dst(new Byte[3 * m_croppedPixelBounds.area()]);
+	const int nPixels = m_croppedPixelBounds.area();
 	int offset = 0;
 	for (Vector2i p : m_croppedPixelBounds)
 	{
@@ -165,14 +213,31 @@ void Film::writeImageToFile(Float splatScale)
 		rgb[3 * offset + 1] *= m_scale;
 		rgb[3 * offset + 2] *= m_scale;
 
-#define TO_BYTE(v) (uint8_t) clamp(255.f * gammaCorrect(v) + 0.5f, 0.f, 255.f)
-		dst[3 * offset + 0] = TO_BYTE(rgb[3 * offset + 0]);
-		dst[3 * offset + 1] = TO_BYTE(rgb[3 * offset + 1]);
-		dst[3 * offset + 2] = TO_BYTE(rgb[3 * offset + 2]);
-
 		++offset;
 	}
 
+	if (m_features != nullptr)
+	{
+		std::vector<Float> albedo, normal, depth;
+		resolveFeatures(albedo, normal, depth);
+		if (m_writeAOVs)
+			writeAOVs(albedo, normal, depth);
+
+		// Note: the denoiser runs on the final linear radiance, splats and scale included
+		if (m_denoiser != nullptr)
+		{
+			K_INFO("Denoising image with {0}", m_denoiser->toString());
+			DenoiserFeatures features = { albedo.data(), normal.data(), depth.data() };
+			m_denoiser->denoise(m_croppedPixelBounds.diagonal(), rgb.get(), features);
+		}
+	}
+
+#define TO_BYTE(v) (uint8_t) clamp(255.f * gammaCorrect(v) + 0.5f, 0.f, 255.f)
+	for (int i = 0; i < 3 * nPixels; ++i)
+	{
+		dst[i] = TO_BYTE(rgb[i]);
+	}
+
 	std::cout << "Writing image " << m_filename << " with bounds " << m_croppedPixelBounds;
 	auto extent = m_croppedPixelBounds.diagonal();
 	stbi_write_png(m_filename.c_str(),
@@ -183,6 +248,174 @@ void Film::writeImageToFile(Float splatScale)
 		extent.x * 3);
 }
 
+void Film::resolveFeatures(std::vector<Float>& albedo, std::vector<Float>& normal, std::vector<Float>& depth) const
+{
+	const int nPixels = m_croppedPixelBounds.area();
+	albedo.assign(3 * nPixels, 0.f);
+	normal.assign(3 * nPixels, 0.f);
+	depth.assign(nPixels, 0.f);
+	for (int i = 0; i < nPixels; ++i)
+	{
+		const FilmFeaturePixel& pixel = m_features[i];
+		if (pixel.weightSum == 0)
+			continue;
+
+		Float invWt = (Float)1 / pixel.weightSum;
+		Vector3f n(pixel.normal[0], pixel.normal[1], pixel.normal[2]);
+		if (dot(n, n) > 0)
+			n = normalize(n);
+		for (int c = 0; c < 3; ++c)
+		{
+			albedo[3 * i + c] = pixel.albedo[c] * invWt;
+			normal[3 * i + c] = n[c];
+		}
+		depth[i] = pixel.depth * invWt;
+	}
+}
+
+void Film::writeAOVs(const std::vector<Float>& albedo, const std::vector<Float>& normal,
+	const std::vector<Float>& depth) const
+{
+	const int nPixels = m_croppedPixelBounds.area();
+	auto extent = m_croppedPixelBounds.diagonal();
+	std::unique_ptr<Byte[]> dst(new Byte[3 * nPixels]);
+
+	// Note: the AOVs are written next to the image, "image.png" gets "image_albedo.png" and so on
+	std::string stem = m_filename, extension;
+	size_t dot = m_filename.find_last_of('.');
+	if (dot != std::string::npos && m_filename.find_first_of("/\\", dot) == std::string::npos)
+	{
+		stem = m_filename.substr(0, dot);
+		extension = m_filename.substr(dot);
+	}
+	auto write = [&](const std::string& name)
+	{
+		const std::string filename = stem + "_" + name + (extension.empty() ? ".png" : extension);
+		K_INFO("Writing {0}", filename);
+		stbi_write_png(filename.c_str(), extent.x, extent.y, 3, static_cast<void*>(dst.get()), extent.x * 3);
+	};
+
+	for (int i = 0; i < 3 * nPixels; ++i)
+		dst[i] = TO_BYTE(albedo[i]);
+	write("albedo");
+
+	// Normals are mapped from [-1,1] to [0,1] and stored without gamma
+	for (int i = 0; i < 3 * nPixels; ++i)
+		dst[i] = (Byte)clamp(127.5f * (normal[i] + 1) + 0.5f, 0.f, 255.f);
+	write("normal");
+
+	// Depth is normalized by the farthest hit
+	Float maxDepth = 0;
+	for (int i = 0; i < nPixels; ++i)
+		maxDepth = glm::max(maxDepth, depth[i]);
+	Float invDepth = maxDepth > 0 ? 1 / maxDepth : 0;
+	for (int i = 0; i < nPixels; ++i)
+		dst[3 * i + 0] = dst[3 * i + 1] = dst[3 * i + 2] = (Byte)clamp(255.f * depth[i] * invDepth + 0.5f, 0.f, 255.f);
+	write("depth");
+}
+
+bool Film::writeCheckpoint(const std::string& filename, uint64_t key, int64_t samplesDone)
+{
+	FilmCheckpointHeader header;
+	memcpy(header.m_magic, filmCheckpointMagic, sizeof(filmCheckpointMagic));
+	header.m_version = filmCheckpointVersion;
+	header.m_floatSize = sizeof(Float);
+	header.m_bounds[0] = m_croppedPixelBounds.m_pMin.x;
+	header.m_bounds[1] = m_croppedPixelBounds.m_pMin.y;
+	header.m_bounds[2] = m_croppedPixelBounds.m_pMax.x;
+	header.m_bounds[3] = m_croppedPixelBounds.m_pMax.y;
+	header.m_key = key;
+	header.m_samplesDone = samplesDone;
+
+	// Note: written next to its final name and renamed afterwards, so that
+	//       a render killed while writing keeps the previous checkpoint
+	const std::string tempFilename = filename + ".tmp";
+	{
+		std::ofstream out(tempFilename, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			K_WARN("Could not write the checkpoint {0}", filename);
+			return false;
+		}
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(FilmCheckpointHeader));
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (Vector2i p : m_croppedPixelBounds)
+		{
+			const APixel& pixel = getPixel(p);
+			Float values[7] = { pixel.m_xyz[0], pixel.m_xyz[1], pixel.m_xyz[2], pixel.m_filterWeightSum,
+				pixel.m_splatXYZ[0], pixel.m_splatXYZ[1], pixel.m_splatXYZ[2] };
+			out.write(reinterpret_cast<const char*>(values), sizeof(values));
+		}
+
+		if (!out)
+		{
+			K_WARN("Could not write the checkpoint {0}", filename);
+			out.close();
+			std::remove(tempFilename.c_str());
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempFilename, filename, error);
+	if (error)
+	{
+		std::remove(tempFilename.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Film::readCheckpoint(const std::string& filename, uint64_t key, int64_t& samplesDone)
+{
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+
+	FilmCheckpointHeader header;
+	in.read(reinterpret_cast<char*>(&header), sizeof(FilmCheckpointHeader));
+	if (!in || memcmp(header.m_magic, filmCheckpointMagic, sizeof(filmCheckpointMagic)) != 0 ||
+		header.m_version != filmCheckpointVersion || header.m_floatSize != sizeof(Float) ||
+		header.m_bounds[0] != m_croppedPixelBounds.m_pMin.x || header.m_bounds[1] != m_croppedPixelBounds.m_pMin.y ||
+		header.m_bounds[2] != m_croppedPixelBounds.m_pMax.x || header.m_bounds[3] != m_croppedPixelBounds.m_pMax.y)
+	{
+		K_WARN("Ignoring the checkpoint {0}, it doesn't match the film", filename);
+		return false;
+	}
+	if (header.m_key != key)
+	{
+		K_WARN("Ignoring the checkpoint {0}, it was written for another scene or sampler settings", filename);
+		return false;
+	}
+
+	// Read all the pixels first, a truncated file leaves the film untouched
+	std::vector<Float> values(size_t(m_croppedPixelBounds.area()) * 7);
+	in.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(Float));
+	if (!in)
+	{
+		K_WARN("Ignoring the checkpoint {0}, it is truncated", filename);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t offset = 0;
+	for (Vector2i p : m_croppedPixelBounds)
+	{
+		APixel& pixel = getPixel(p);
+		for (int i = 0; i < 3; ++i)
+			pixel.m_xyz[i] = values[offset + i];
+		pixel.m_filterWeightSum = values[offset + 3];
+		for (int i = 0; i < 3; ++i)
+			pixel.m_splatXYZ[i] = values[offset + 4 + i];
+		offset += 7;
+	}
+
+	samplesDone = header.m_samplesDone;
+	return true;
+}
+
 void Film::setImage(const Spectrum* img) const
 {
 	int nPixels = m_croppedPixelBounds.area();
@@ -195,29 +428,37 @@ void Film::setImage(const Spectrum* img) const
 	}
 }
 
-void Film::addSplat(const Vector2f& p, Spectrum v)
+// Splats with NaN, negative or infinite values are reported and dropped
+static bool checkSplat(const Vector2f& p, const Spectrum& v)
 {
-	//Note:Rather than computing the final pixel value as a weighted
-	//     average of contributing splats, splats are simply summed.
-
 	if (v.hasNaNs())
 	{
 		std::cout << stringPrintf("Ignoring splatted spectrum with NaN values "
 			"at (%f, %f)", p.x, p.y);
-		return;
+		return false;
 	}
 	else if (v.y() < 0.)
 	{
 		std::cout << stringPrintf("Ignoring splatted spectrum with negative "
 			"luminance %f at (%f, %f)", v.y(), p.x, p.y);
-		return;
+		return false;
 	}
 	else if (glm::isinf(v.y()))
 	{
 		std::cout << stringPrintf("Ignoring splatted spectrum with infinite "
 			"luminance at (%f, %f)", p.x, p.y);
-		return;
+		return false;
 	}
+	return true;
+}
+
+void Film::addSplat(const Vector2f& p, Spectrum v)
+{
+	//Note:Rather than computing the final pixel value as a weighted
+	//     average of contributing splats, splats are simply summed.
+
+	if (!checkSplat(p, v))
+		return;
 
 	Vector2i pi = Vector2i(floor(p));
 	if (!insideExclusive(pi, m_croppedPixelBounds))
@@ -238,6 +479,42 @@ void Film::addSplat(const Vector2f& p, Spectrum v)
 	}
 }
 
+std::unique_ptr<FilmSplatBuffer> Film::getSplatBuffer() const
+{
+	return std::unique_ptr<FilmSplatBuffer>(new FilmSplatBuffer(m_croppedPixelBounds, m_maxSampleLuminance));
+}
+
+void Film::mergeSplatBuffer(FilmSplatBuffer& buffer)
+{
+	constexpr int blockSize = FilmSplatBuffer::blockSize;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t b = 0; b < buffer.m_blocks.size(); ++b)
+		{
+			const Float* block = buffer.m_blocks[b].get();
+			if (block == nullptr)
+				continue;
+
+			// Add the block's pixels to the film's splats
+			Vector2i pMin = m_croppedPixelBounds.m_pMin +
+				Vector2i(int(b) % buffer.m_nBlocksX, int(b) / buffer.m_nBlocksX) * blockSize;
+			Vector2i pMax = min(pMin + Vector2i(blockSize, blockSize), m_croppedPixelBounds.m_pMax);
+			for (Vector2i p : Bounds2i(pMin, pMax))
+			{
+				// Note: the film's splats are atomic, since addSplat() may run concurrently
+				const Float* xyz = &block[3 * ((p.y - pMin.y) * blockSize + (p.x - pMin.x))];
+				APixel& pixel = getPixel(p);
+				for (int i = 0; i < 3; ++i)
+				{
+					if (xyz[i] != 0)
+						pixel.m_splatXYZ[i].add(xyz[i]);
+				}
+			}
+		}
+	}
+	buffer.clear();
+}
+
 void Film::clear()
 {
 	for (Vector2i p : m_croppedPixelBounds)
@@ -249,6 +526,63 @@ void Film::clear()
 		}
 		pixel.m_filterWeightSum = 0;
 	}
+
+	if (m_features != nullptr)
+	{
+		std::fill(m_features.get(), m_features.get() + m_croppedPixelBounds.area(), FilmFeaturePixel());
+	}
+}
+
+// ---------------------- Film Splat Buffer ----------------------
+
+FilmSplatBuffer::FilmSplatBuffer(const Bounds2i& pixelBounds, Float maxSampleLuminance)
+	: m_pixelBounds(pixelBounds), m_maxSampleLuminance(maxSampleLuminance)
+{
+	Vector2i extent = pixelBounds.diagonal();
+	m_nBlocksX = (extent.x + blockSize - 1) / blockSize;
+	int nBlocksY = (extent.y + blockSize - 1) / blockSize;
+	m_blocks.resize(glm::max(0, m_nBlocksX * nBlocksY));
+}
+
+void FilmSplatBuffer::addSplat(const Vector2f& p, Spectrum v)
+{
+	if (!checkSplat(p, v))
+		return;
+
+	Vector2i pi = Vector2i(floor(p));
+	if (!insideExclusive(pi, m_pixelBounds))
+		return;
+
+	if (v.y() > m_maxSampleLuminance)
+	{
+		v *= m_maxSampleLuminance / v.y();
+	}
+
+	Float xyz[3];
+	v.toXYZ(xyz);
+
+	// Find the pixel in its block, allocating the block if needed
+	Vector2i pb = pi - m_pixelBounds.m_pMin;
+	std::unique_ptr<Float[]>& block = m_blocks[(pb.y / blockSize) * m_nBlocksX + pb.x / blockSize];
+	if (block == nullptr)
+	{
+		block.reset(new Float[3 * blockSize * blockSize]);
+		std::fill(block.get(), block.get() + 3 * blockSize * blockSize, (Float)0);
+	}
+	Float* pixel = &block[3 * ((pb.y % blockSize) * blockSize + pb.x % blockSize)];
+	for (int i = 0; i < 3; ++i)
+	{
+		pixel[i] += xyz[i];
+	}
+}
+
+void FilmSplatBuffer::clear()
+{
+	for (auto& block : m_blocks)
+	{
+		if (block != nullptr)
+			std::fill(block.get(), block.get() + 3 * blockSize * blockSize, (Float)0);
+	}
 }
 
 RENDER_END
\ No newline at end of file
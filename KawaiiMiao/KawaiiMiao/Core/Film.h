@@ -4,6 +4,7 @@
 #include "Spectrum.h"
 #include "Filter.h"
 #include "Rtti.h"
+#include "Denoiser.h"
 #include "../Tool/Parallel.h"
 #include "../Math/KMathUtil.h"
 
@@ -18,6 +19,15 @@ struct FilmTilePixel
 	Float filterWeightSum = 0.f;
 };
 
+// Sums of the first hit features of the samples falling into a pixel
+struct FilmFeaturePixel
+{
+	Float albedo[3] = { 0.f, 0.f, 0.f };
+	Float normal[3] = { 0.f, 0.f, 0.f };
+	Float depth = 0.f;
+	Float weightSum = 0.f;
+};
+
 class Film final : public AObject
 {
 public:
@@ -29,16 +39,34 @@ public:
 		Float scale = 1.f, Float maxSampleLuminance = Infinity);
 
 	Bounds2i getSampleBounds() const;
+	// Pixels actually written to the image, in the order setImage() expects them
+	const Bounds2i& getCroppedPixelBounds() const { return m_croppedPixelBounds; }
 	const Vector2i getResolution() const { return m_resolution; }
 
 	std::unique_ptr<FilmTile> getFilmTile(const Bounds2i& sampleBounds);
 	void mergeFilmTile(std::unique_ptr<FilmTile> tile);
 
+	// Feature buffers are only kept when the film has a denoiser or writes them out
+	bool hasFeatures() const { return m_features != nullptr; }
+
 	void writeImageToFile(Float splatScale = 1);
 
+	// Save or restore the accumulated pixel sums, so that an interrupted render can resume.
+	// _samplesDone_ is stored along for the integrator to know where to continue from, a checkpoint
+	// is only read back with the same _key_ as it was written with.
+	bool writeCheckpoint(const std::string& filename, uint64_t key, int64_t samplesDone);
+	bool readCheckpoint(const std::string& filename, uint64_t key, int64_t& samplesDone);
+
+	const std::string& getFilename() const { return m_filename; }
+
 	void setImage(const Spectrum* img) const;
 	void addSplat(const Vector2f& p, Spectrum v);
 
+	// Splats can also be gathered by a buffer per thread and merged in bulk, which saves
+	// the atomic updates of addSplat(). mergeSplatBuffer() clears the buffer.
+	std::unique_ptr<FilmSplatBuffer> getSplatBuffer() const;
+	void mergeSplatBuffer(FilmSplatBuffer& buffer);
+
 	void clear();
 
 	virtual void activate() override { initialize(); }
@@ -49,6 +77,11 @@ public:
 private:
 	void initialize();
 
+	// Average the feature sums into the AOV buffers handed to the denoiser
+	void resolveFeatures(std::vector<Float>& albedo, std::vector<Float>& normal, std::vector<Float>& depth) const;
+	void writeAOVs(const std::vector<Float>& albedo, const std::vector<Float>& normal,
+		const std::vector<Float>& depth) const;
+
 private:
 	//Note: XYZ is a display independent representation of color,
 	//      and this is why we choose to use XYZ color herein.
@@ -68,6 +101,10 @@ private:
 	Vector2i m_resolution; //(width, height)
 	std::string m_filename;
 	std::unique_ptr<APixel[]> m_pixels;
+	std::unique_ptr<FilmFeaturePixel[]> m_features;
+
+	Denoiser::unique_ptr m_denoiser;
+	bool m_writeAOVs = false;
 
 	Float m_diagonal;
 	Bounds2i m_croppedPixelBounds;	//actual rendering window
@@ -97,13 +134,37 @@ class FilmTile final
 public:
 	// FilmTile Public Methods
 	FilmTile(const Bounds2i& pixelBounds, const Vector2f& filterRadius, const Float* filterTable,
-		int filterTableSize, Float maxSampleLuminance)
+		int filterTableSize, Float maxSampleLuminance, bool withFeatures = false)
 		: m_pixelBounds(pixelBounds), m_filterRadius(filterRadius),
 		m_invFilterRadius(1 / filterRadius.x, 1 / filterRadius.y),
 		m_filterTable(filterTable), m_filterTableSize(filterTableSize),
 		m_maxSampleLuminance(maxSampleLuminance)
 	{
 		m_pixels = std::vector<FilmTilePixel>(glm::max(0, pixelBounds.area()));
+		if (withFeatures)
+			m_features = std::vector<FilmFeaturePixel>(m_pixels.size());
+	}
+
+	bool hasFeatures() const { return !m_features.empty(); }
+
+	// Note: the features are box filtered, a sample only counts for the pixel it falls into,
+	//       so that the denoiser's edge stopping functions see edges as sharp as they are
+	void addFeatures(const Vector2f& pFilm, const Spectrum& albedo, const Vector3f& normal, Float depth)
+	{
+		Vector2i p = Vector2i(floor(pFilm));
+		if (m_features.empty() || !insideExclusive(p, m_pixelBounds))
+			return;
+
+		Float rgb[3];
+		albedo.toRGB(rgb);
+		FilmFeaturePixel& pixel = m_features[getPixelIndex(p)];
+		for (int i = 0; i < 3; ++i)
+		{
+			pixel.albedo[i] += rgb[i];
+			pixel.normal[i] += normal[i];
+		}
+		pixel.depth += depth;
+		pixel.weightSum += 1;
 	}
 
 	void addSample(const Vector2f& pFilm, Spectrum L, Float sampleWeight = 1.f)
@@ -151,20 +212,14 @@ public:
 		}
 	}
 
-	FilmTilePixel& getPixel(const Vector2i& p)
-	{
-		DCHECK(insideExclusive(p, m_pixelBounds));
-		int width = m_pixelBounds.m_pMax.x - m_pixelBounds.m_pMin.x;
-		int index = (p.x - m_pixelBounds.m_pMin.x) + (p.y - m_pixelBounds.m_pMin.y) * width;
-		return m_pixels[index];
-	}
+	FilmTilePixel& getPixel(const Vector2i& p) { return m_pixels[getPixelIndex(p)]; }
+	const FilmTilePixel& getPixel(const Vector2i& p) const { return m_pixels[getPixelIndex(p)]; }
 
-	const FilmTilePixel& getPixel(const Vector2i& p) const
+	int getPixelIndex(const Vector2i& p) const
 	{
 		DCHECK(insideExclusive(p, m_pixelBounds));
 		int width = m_pixelBounds.m_pMax.x - m_pixelBounds.m_pMin.x;
-		int index = (p.x - m_pixelBounds.m_pMin.x) + (p.y - m_pixelBounds.m_pMin.y) * width;
-		return m_pixels[index];
+		return (p.x - m_pixelBounds.m_pMin.x) + (p.y - m_pixelBounds.m_pMin.y) * width;
 	}
 
 	Bounds2i getPixelBounds() const { return m_pixelBounds; }
@@ -175,7 +230,30 @@ private:
 	const Float* m_filterTable;
 	const int m_filterTableSize;
 	std::vector<FilmTilePixel> m_pixels;
+	std::vector<FilmFeaturePixel> m_features;
+	const Float m_maxSampleLuminance;
+
+	friend class Film;
+};
+
+class FilmSplatBuffer final
+{
+public:
+	FilmSplatBuffer(const Bounds2i& pixelBounds, Float maxSampleLuminance);
+
+	void addSplat(const Vector2f& p, Spectrum v);
+
+	void clear();
+
+private:
+	// Note: the XYZ splats are kept in square blocks of pixels, allocated on first touch,
+	//       so that a thread only pays for the part of the image it splats to
+	static constexpr int blockSize = 32;
+
+	const Bounds2i m_pixelBounds;
 	const Float m_maxSampleLuminance;
+	int m_nBlocksX;
+	std::vector<std::unique_ptr<Float[]>> m_blocks;
 
 	friend class Film;
 };
@@ -7,11 +7,36 @@
 #include "../Tool/Reporter.h"
 #include "BSDF.h"
 #include "LightDistrib.h"
+#include "../Accelerators/AcceleratorCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
 
 RENDER_BEGIN
 
+SamplerIntegrator::SamplerIntegrator(const APropertyList& props)
+	: m_camera(nullptr), m_sampler(nullptr),
+	m_targetError(props.getFloat("TargetError", 0.f)),
+	m_passSamples(glm::max(1, props.getInteger("PassSPP", 16))),
+	m_timeBudget(props.getFloat("TimeBudget", 0.f)),
+	m_checkpointInterval(props.getFloat("CheckpointInterval", 0.f)),
+	m_checkpointFilename(props.getString("Checkpoint", "")) {}
+
 void SamplerIntegrator::render(const Scene& scene)
 {
+	if (m_targetError > 0)
+	{
+		renderAdaptive(scene);
+		return;
+	}
+
+	if (m_timeBudget > 0 || m_checkpointInterval > 0)
+	{
+		renderProgressive(scene);
+		return;
+	}
+
 	Vector2i resolution = m_camera->m_film->getResolution();
 
 	auto& sampler = m_sampler;
@@ -51,55 +76,7 @@ void SamplerIntegrator::render(const Scene& scene)
 
 				do
 				{
-					// Initialize _CameraSample_ for current sample
-					CameraSample cameraSample = tileSampler->getCameraSample(pixel);
-
-					// Generate camera ray for current sample
-					Ray ray;
-					Float rayWeight = m_camera->castingRay(cameraSample, ray);
-
-					// Evaluate radiance along camera ray
-					Spectrum L(0.f);
-					if (rayWeight > 0)
-					{
-						L = Li(ray, scene, *tileSampler, arena);
-					}
-
-					// Issue warning if unexpected radiance value returned
-					if (L.hasNaNs())
-					{
-						K_ERROR(stringPrintf(
-							"Not-a-number radiance value returned "
-							"for pixel (%d, %d), sample %d. Setting to black.",
-							pixel.x, pixel.y,
-							(int)tileSampler->currentSampleNumber()));
-						L = Spectrum(0.f);
-					}
-					else if (L.y() < -1e-5)
-					{
-						K_ERROR(stringPrintf(
-							"Negative luminance value, %f, returned "
-							"for pixel (%d, %d), sample %d. Setting to black.",
-							L.y(), pixel.x, pixel.y,
-							(int)tileSampler->currentSampleNumber()));
-						L = Spectrum(0.f);
-					}
-					else if (std::isinf(L.y()))
-					{
-						K_ERROR(stringPrintf(
-							"Infinite luminance value returned "
-							"for pixel (%d, %d), sample %d. Setting to black.",
-							pixel.x, pixel.y,
-							(int)tileSampler->currentSampleNumber()));
-						L = Spectrum(0.f);
-					}
-					//K_INFO("Camera Sample : {0} {1}", cameraSample.pFilm.x, cameraSample.pFilm.y);
-					// Add camera ray's contribution to image
-					filmTile->addSample(cameraSample.pFilm, L, rayWeight);
-
-					// Free _MemoryArena_ memory from computing image sample value
-					arena.Reset();
-
+					renderSample(scene, pixel, *tileSampler, arena, *filmTile);
 				} while (tileSampler->startNextSample());
 			}
 			//K_INFO("Finished image tile {0}", tileBounds.area());
@@ -117,6 +94,301 @@ void SamplerIntegrator::render(const Scene& scene)
 
 }
 
+Spectrum SamplerIntegrator::renderSample(const Scene& scene, const Vector2i& pixel, Sampler& sampler,
+	MemoryArena& arena, FilmTile& filmTile) const
+{
+	// Initialize _CameraSample_ for current sample
+	CameraSample cameraSample = sampler.getCameraSample(pixel);
+
+	// Generate camera ray for current sample
+	Ray ray;
+	Float rayWeight = m_camera->castingRay(cameraSample, ray);
+
+	// Evaluate radiance along camera ray
+	Spectrum L(0.f);
+	if (rayWeight > 0)
+	{
+		L = Li(ray, scene, sampler, arena);
+	}
+
+	// Issue warning if unexpected radiance value returned
+	if (L.hasNaNs())
+	{
+		K_ERROR(stringPrintf(
+			"Not-a-number radiance value returned "
+			"for pixel (%d, %d), sample %d. Setting to black.",
+			pixel.x, pixel.y,
+			(int)sampler.currentSampleNumber()));
+		L = Spectrum(0.f);
+	}
+	else if (L.y() < -1e-5)
+	{
+		K_ERROR(stringPrintf(
+			"Negative luminance value, %f, returned "
+			"for pixel (%d, %d), sample %d. Setting to black.",
+			L.y(), pixel.x, pixel.y,
+			(int)sampler.currentSampleNumber()));
+		L = Spectrum(0.f);
+	}
+	else if (std::isinf(L.y()))
+	{
+		K_ERROR(stringPrintf(
+			"Infinite luminance value returned "
+			"for pixel (%d, %d), sample %d. Setting to black.",
+			pixel.x, pixel.y,
+			(int)sampler.currentSampleNumber()));
+		L = Spectrum(0.f);
+	}
+	//K_INFO("Camera Sample : {0} {1}", cameraSample.pFilm.x, cameraSample.pFilm.y);
+	// Add camera ray's contribution to image
+	filmTile.addSample(cameraSample.pFilm, L, rayWeight);
+
+	// Add the first hit features for the denoiser
+	if (filmTile.hasFeatures() && rayWeight > 0)
+	{
+		Spectrum albedo;
+		Vector3f normal;
+		Float depth;
+		firstHitFeatures(ray, scene, arena, albedo, normal, depth);
+		filmTile.addFeatures(cameraSample.pFilm, albedo, normal, depth);
+	}
+
+	// Free _MemoryArena_ memory from computing image sample value
+	arena.Reset();
+
+	return L;
+}
+
+void SamplerIntegrator::renderAdaptive(const Scene& scene)
+{
+	// Running luminance statistics of a pixel (Welford's algorithm)
+	struct PixelStatistics
+	{
+		int64_t m_nSamples = 0;
+		double m_mean = 0;
+		double m_m2 = 0;
+		bool m_converged = false;
+
+		void add(Float y)
+		{
+			++m_nSamples;
+			double delta = y - m_mean;
+			m_mean += delta / m_nSamples;
+			m_m2 += delta * (y - m_mean);
+		}
+
+		// Standard error of the mean relative to the mean itself
+		Float relativeError() const
+		{
+			if (m_nSamples < 2)
+				return Infinity;
+			double variance = m_m2 / (m_nSamples - 1);
+			// Note: the offset keeps dark pixels from requiring an absolute precision out of reach
+			return Float(std::sqrt(variance / m_nSamples) / (m_mean + 1e-2));
+		}
+	};
+
+	Bounds2i sampleBounds = m_camera->m_film->getSampleBounds();
+	Vector2i sampleExtent = sampleBounds.diagonal();
+	const int64_t maxSamples = m_sampler->samplesPerPixel;
+	std::vector<PixelStatistics> statistics(size_t(sampleBounds.area()));
+	auto pixelStatistics = [&](const Vector2i& pixel) -> PixelStatistics&
+	{
+		return statistics[(pixel.y - sampleBounds.m_pMin.y) * sampleExtent.x + (pixel.x - sampleBounds.m_pMin.x)];
+	};
+
+	constexpr int tileSize = 16;
+	Vector2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+	const int64_t nTotalTiles = int64_t(nTiles.x) * nTiles.y;
+
+	// Every pass first gives all the pixels still active _m_passSamples_ samples, later passes only
+	// give a pixel the samples its error estimate asks for, so that the budget saved on converged
+	// pixels goes to the noisy ones.
+	int64_t nActive = statistics.size();
+	for (int pass = 0; nActive > 0; ++pass)
+	{
+		K_INFO("Adaptive sampling pass {0}: {1} pixels active", pass, nActive);
+		Reporter reporter(nTotalTiles, "Rendering");
+		std::atomic<int64_t> nStillActive(0);
+		AParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t& t)
+			{
+				Vector2i tile(int(t % nTiles.x), int(t / nTiles.x));
+				int x0 = sampleBounds.m_pMin.x + tile.x * tileSize;
+				int x1 = glm::min(x0 + tileSize, sampleBounds.m_pMax.x);
+				int y0 = sampleBounds.m_pMin.y + tile.y * tileSize;
+				int y1 = glm::min(y0 + tileSize, sampleBounds.m_pMax.y);
+				Bounds2i tileBounds(Vector2i(x0, y0), Vector2i(x1, y1));
+
+				// Skip the tiles whose pixels have all converged
+				bool tileActive = false;
+				for (Vector2i pixel : tileBounds)
+					tileActive |= !pixelStatistics(pixel).m_converged;
+				if (!tileActive)
+				{
+					reporter.update();
+					return;
+				}
+
+				// Note: each pass needs its own seeds, otherwise random samplers would repeat their samples
+				MemoryArena arena;
+				std::unique_ptr<Sampler> tileSampler = m_sampler->clone(int(pass * nTotalTiles + t));
+				std::unique_ptr<FilmTile> filmTile = m_camera->m_film->getFilmTile(tileBounds);
+				int64_t nTileActive = 0;
+				for (Vector2i pixel : tileBounds)
+				{
+					PixelStatistics& stats = pixelStatistics(pixel);
+					if (stats.m_converged)
+						continue;
+
+					// Samples needed to reach the target error, as the error decreases with 1/sqrt(n)
+					int64_t nSamples = m_passSamples;
+					if (pass > 0)
+					{
+						Float ratio = stats.relativeError() / m_targetError;
+						Float nNeeded = std::ceil(stats.m_nSamples * ratio * ratio) - stats.m_nSamples;
+						nSamples = int64_t(clamp(nNeeded, Float(1), Float(m_passSamples)));
+					}
+					nSamples = glm::min(nSamples, maxSamples - stats.m_nSamples);
+
+					// Continue the sample sequence of the pixel where the previous pass stopped
+					tileSampler->startPixel(pixel);
+					for (int64_t i = 0; i < nSamples; ++i)
+					{
+						tileSampler->setSampleNumber(stats.m_nSamples);
+						stats.add(renderSample(scene, pixel, *tileSampler, arena, *filmTile).y());
+					}
+
+					stats.m_converged = stats.m_nSamples >= maxSamples || stats.relativeError() < m_targetError;
+					if (!stats.m_converged)
+						++nTileActive;
+				}
+
+				m_camera->m_film->mergeFilmTile(std::move(filmTile));
+				nStillActive += nTileActive;
+				reporter.update();
+			}, ExecutionPolicy::PARALLEL);
+		reporter.done();
+
+		nActive = nStillActive;
+	}
+
+	int64_t nSamples = 0;
+	for (const PixelStatistics& stats : statistics)
+		nSamples += stats.m_nSamples;
+	K_INFO("Rendering finished, {0} samples per pixel on average (at most {1})",
+		Float(nSamples) / Float(glm::max(size_t(1), statistics.size())), maxSamples);
+
+	m_camera->m_film->writeImageToFile();
+}
+
+void SamplerIntegrator::renderProgressive(const Scene& scene)
+{
+	typedef std::chrono::steady_clock Clock;
+	auto secondsSince = [](const Clock::time_point& start) -> Float
+	{
+		return std::chrono::duration<Float>(Clock::now() - start).count();
+	};
+
+	Film& film = *m_camera->m_film;
+	const std::string checkpointFilename = m_checkpointFilename.empty() ?
+		film.getFilename() + ".ckpt" : m_checkpointFilename;
+
+	// Note: a checkpoint only resumes the same scene with the same sampling
+	CacheHasher keyHasher;
+	keyHasher.update(m_sceneHash);
+	keyHasher.update(m_sampler->toString());
+	keyHasher.update(m_sampler->samplesPerPixel);
+	keyHasher.update(m_passSamples);
+	const uint64_t checkpointKey = keyHasher.value();
+
+	// Resume from the samples of an interrupted render
+	int64_t samplesDone = 0;
+	if (film.readCheckpoint(checkpointFilename, checkpointKey, samplesDone))
+	{
+		K_INFO("Resuming from checkpoint {0} with {1} samples per pixel", checkpointFilename, samplesDone);
+	}
+
+	Bounds2i sampleBounds = film.getSampleBounds();
+	Vector2i sampleExtent = sampleBounds.diagonal();
+	const int64_t targetSamples = m_sampler->samplesPerPixel;
+
+	constexpr int tileSize = 16;
+	Vector2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+	const int64_t nTotalTiles = int64_t(nTiles.x) * nTiles.y;
+
+	const Clock::time_point startTime = Clock::now();
+	Clock::time_point lastCheckpoint = startTime;
+	Float lastPassSeconds = 0;
+	while (samplesDone < targetSamples)
+	{
+		// Note: a pass is never interrupted, stop early if the next one would exceed the budget
+		if (m_timeBudget > 0 && secondsSince(startTime) + lastPassSeconds > m_timeBudget)
+		{
+			K_INFO("Time budget of {0}s reached", m_timeBudget);
+			break;
+		}
+
+		const Clock::time_point passStart = Clock::now();
+		const int64_t passEnd = glm::min(samplesDone + m_passSamples, targetSamples);
+		Reporter reporter(nTotalTiles, "Rendering");
+		AParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t& t)
+			{
+				Vector2i tile(int(t % nTiles.x), int(t / nTiles.x));
+				int x0 = sampleBounds.m_pMin.x + tile.x * tileSize;
+				int x1 = glm::min(x0 + tileSize, sampleBounds.m_pMax.x);
+				int y0 = sampleBounds.m_pMin.y + tile.y * tileSize;
+				int y1 = glm::min(y0 + tileSize, sampleBounds.m_pMax.y);
+				Bounds2i tileBounds(Vector2i(x0, y0), Vector2i(x1, y1));
+
+				// Note: each pass needs its own seeds, otherwise random samplers would repeat their samples
+				MemoryArena arena;
+				std::unique_ptr<Sampler> tileSampler = m_sampler->clone(int(samplesDone / m_passSamples * nTotalTiles + t));
+				std::unique_ptr<FilmTile> filmTile = film.getFilmTile(tileBounds);
+				for (Vector2i pixel : tileBounds)
+				{
+					tileSampler->startPixel(pixel);
+					for (int64_t sampleIndex = samplesDone; sampleIndex < passEnd; ++sampleIndex)
+					{
+						tileSampler->setSampleNumber(sampleIndex);
+						renderSample(scene, pixel, *tileSampler, arena, *filmTile);
+					}
+				}
+
+				film.mergeFilmTile(std::move(filmTile));
+				reporter.update();
+			}, ExecutionPolicy::PARALLEL);
+		reporter.done();
+
+		samplesDone = passEnd;
+		lastPassSeconds = secondsSince(passStart);
+		K_INFO("Finished pass with {0} of {1} samples per pixel in {2}s", samplesDone, targetSamples, lastPassSeconds);
+
+		// Write the intermediate image and the accumulation buffer
+		if (m_checkpointInterval > 0 && secondsSince(lastCheckpoint) >= m_checkpointInterval && samplesDone < targetSamples)
+		{
+			film.writeImageToFile();
+			film.writeCheckpoint(checkpointFilename, checkpointKey, samplesDone);
+			lastCheckpoint = Clock::now();
+		}
+	}
+
+	// Note: the final checkpoint lets a render stopped by its budget continue in a later time slot,
+	//       a completed render has nothing left to resume
+	if (samplesDone < targetSamples)
+	{
+		film.writeCheckpoint(checkpointFilename, checkpointKey, samplesDone);
+	}
+	else
+	{
+		std::error_code error;
+		std::filesystem::remove(checkpointFilename, error);
+	}
+
+	K_INFO("Rendering finished with {0} samples per pixel", samplesDone);
+
+	film.writeImageToFile();
+}
+
 Spectrum SamplerIntegrator::specularReflect(const Ray& ray, const SurfaceInteraction& isect,
 	const Scene& scene, Sampler& sampler, MemoryArena& arena, int depth) const
 {
@@ -200,7 +472,7 @@ Spectrum uiformSampleAllLights(const Interaction& it, const Scene& scene,
 }
 
 Spectrum uniformSampleOneLight(const Interaction& it, const Scene& scene,
-	MemoryArena& arena, Sampler& sampler, const Distribution1D* lightDistrib)
+	MemoryArena& arena, Sampler& sampler, const LightDistribution* lightDistrib, bool handleMedia)
 {
 	// Randomly choose a single light to sample, _light_
 	int nLights = int(scene.m_lights.size());
@@ -213,7 +485,7 @@ Spectrum uniformSampleOneLight(const Interaction& it, const Scene& scene,
 
 	if (lightDistrib != nullptr)
 	{
-		lightNum = lightDistrib->sampleDiscrete(sampler.get1D(), &lightPdf);
+		lightNum = lightDistrib->sample(it, sampler.get1D(), lightPdf);
 		if (lightPdf == 0)
 			return Spectrum(0.f);
 	}
@@ -227,11 +499,64 @@ Spectrum uniformSampleOneLight(const Interaction& it, const Scene& scene,
 	Vector2f uLight = sampler.get2D();
 	Vector2f uScattering = sampler.get2D();
 
-	return estimateDirect(it, uScattering, *light, uLight, scene, sampler, arena) / lightPdf;
+	return estimateDirect(it, uScattering, *light, uLight, scene, sampler, arena, handleMedia) / lightPdf;
+}
+
+void firstHitFeatures(const Ray& r, const Scene& scene, MemoryArena& arena,
+	Spectrum& albedo, Vector3f& normal, Float& depth)
+{
+	albedo = Spectrum(0.f);
+	normal = Vector3f(0.f);
+	depth = 0;
+
+	Ray ray(r);
+	Spectrum throughput(1.f);
+	constexpr int maxBounces = 8;
+	for (int bounces = 0; bounces < maxBounces; ++bounces)
+	{
+		SurfaceInteraction isect;
+		if (!scene.hit(ray, isect))
+		{
+			// Note: the environment is given the throughput as albedo, so that the
+			//       demodulation of the denoiser leaves it as it is
+			albedo = throughput;
+			return;
+		}
+
+		depth += distance(ray.origin(), isect.p);
+		isect.computeScatteringFunctions(ray, arena, true);
+		if (!isect.bsdf)
+		{
+			ray = isect.spawnRay(ray.direction());
+			continue;
+		}
+
+		Vector3f wo = -ray.direction(), wi;
+		normal = faceforward(isect.shading.n, wo);
+
+		// Note: a single BSDF sample is an exact reflectance for diffuse surfaces and a fair one
+		//       for glossy surfaces, the fixed sample keeps the feature noise free
+		Float pdf;
+		BxDFType flags;
+		Spectrum f = isect.bsdf->sample_f(wo, wi, Vector2f(0.5f, 0.5f), pdf, flags, BSDF_ALL);
+		if (f.isBlack() || pdf == 0.f)
+			return;
+		Spectrum reflectance = f * absDot(wi, isect.normal) / pdf;
+
+		// Perfectly specular surfaces show what they reflect or transmit
+		if (isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+		{
+			albedo = throughput * reflectance;
+			return;
+		}
+		throughput *= reflectance;
+		ray = isect.spawnRay(wi);
+	}
 }
 
 Spectrum estimateDirect(const Interaction& it, const Vector2f& uScattering, const Light& light,
-	const Vector2f& uLight, const Scene& scene, Sampler& sampler, MemoryArena& arena, bool specular)
+	const Vector2f& uLight, const Scene& scene, Sampler& sampler, MemoryArena& arena,
+	bool handleMedia, bool specular)
 {
 	BxDFType bsdfFlags = specular ? BSDF_ALL : BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
 
@@ -246,16 +571,30 @@ Spectrum estimateDirect(const Interaction& it, const Vector2f& uScattering, cons
 	{
 		// Compute BSDF or phase function's value for light sample
 		Spectrum f;
-		// Evaluate BSDF for light sampling strategy
-		const SurfaceInteraction& isect = (const SurfaceInteraction&)it;
-		f = isect.bsdf->f(isect.wo, wi, bsdfFlags) * absDot(wi, isect.normal);
-
-		scatteringPdf = isect.bsdf->pdf(isect.wo, wi, bsdfFlags);
+		if (it.isSurfaceInteraction())
+		{
+			// Evaluate BSDF for light sampling strategy
+			const SurfaceInteraction& isect = (const SurfaceInteraction&)it;
+			f = isect.bsdf->f(isect.wo, wi, bsdfFlags) * absDot(wi, isect.normal);
+			scatteringPdf = isect.bsdf->pdf(isect.wo, wi, bsdfFlags);
+		}
+		else
+		{
+			// Evaluate phase function for light sampling strategy
+			const MediumInteraction& mi = (const MediumInteraction&)it;
+			Float p = mi.phase->p(mi.wo, wi);
+			f = Spectrum(p);
+			scatteringPdf = p;
+		}
 
 		if (!f.isBlack())
 		{
 			// Compute effect of visibility for light source sample
-			if (!visibility.unoccluded(scene))
+			if (handleMedia)
+			{
+				Li *= visibility.tr(scene, sampler);
+			}
+			else if (!visibility.unoccluded(scene))
 			{
 				Li = Spectrum(0.f);
 			}
@@ -269,6 +608,8 @@ Spectrum estimateDirect(const Interaction& it, const Vector2f& uScattering, cons
 				}
 				else
 				{
+					// Note: the light selection probability scales both strategies alike, since the
+					//       BSDF sample only counts when it reaches this light, so it cancels out here.
 					Float weight = powerHeuristic(1, lightPdf, 1, scatteringPdf);
 					Ld += f * Li * weight / lightPdf;
 				}
@@ -281,12 +622,23 @@ Spectrum estimateDirect(const Interaction& it, const Vector2f& uScattering, cons
 	{
 		Spectrum f;
 		bool sampledSpecular = false;
-		// Sample scattered direction for surface interactions
-		BxDFType sampledType = BxDFType::BSDF_ALL;
-		const SurfaceInteraction& isect = (const SurfaceInteraction&)it;
-		f = isect.bsdf->sample_f(isect.wo, wi, uScattering, scatteringPdf, bsdfFlags, sampledType);
-		f *= absDot(wi, isect.normal);
-		sampledSpecular = (sampledType & BSDF_SPECULAR) != 0;
+		if (it.isSurfaceInteraction())
+		{
+			// Sample scattered direction for surface interactions
+			BxDFType sampledType = BxDFType(0);
+			const SurfaceInteraction& isect = (const SurfaceInteraction&)it;
+			f = isect.bsdf->sample_f(isect.wo, wi, uScattering, scatteringPdf, sampledType, bsdfFlags);
+			f *= absDot(wi, isect.normal);
+			sampledSpecular = (sampledType & BSDF_SPECULAR) != 0;
+		}
+		else
+		{
+			// Sample scattered direction for medium interactions
+			const MediumInteraction& mi = (const MediumInteraction&)it;
+			Float p = mi.phase->sample_p(mi.wo, wi, uScattering);
+			f = Spectrum(p);
+			scatteringPdf = p;
+		}
 
 		if (!f.isBlack() && scatteringPdf > 0)
 		{
@@ -303,7 +655,8 @@ Spectrum estimateDirect(const Interaction& it, const Vector2f& uScattering, cons
 			SurfaceInteraction lightIsect;
 			Ray ray = it.spawnRay(wi);
 			Spectrum Tr(1.f);
-			bool foundSurfaceInteraction = scene.hit(ray, lightIsect);
+			bool foundSurfaceInteraction = handleMedia ? scene.hitTr(ray, sampler, lightIsect, Tr) :
+				scene.hit(ray, lightIsect);
 
 			// Add light contribution from material sampling
 			Spectrum Li(0.f);
@@ -19,7 +19,13 @@ public:
 	virtual void preprocess(const Scene & scene) = 0;
 	virtual void render(const Scene & scene) = 0;
 
+	// Hash of the scene description the integrator was created from
+	void setSceneHash(uint64_t hash) { m_sceneHash = hash; }
+
 	virtual ClassType getClassType() const override { return ClassType::RIntegrator; }
+
+protected:
+	uint64_t m_sceneHash = 0;
 };
 
 class SamplerIntegrator : public Integrator
@@ -31,6 +37,9 @@ public:
 	SamplerIntegrator(Camera::ptr camera, Sampler::ptr sampler)
 		: m_camera(camera), m_sampler(sampler) {}
 
+	// Read the adaptive sampling settings, the camera and the sampler are left to the derived class
+	SamplerIntegrator(const APropertyList& props);
+
 	virtual void preprocess(const Scene& scene) override {}
 
 	virtual void render(const Scene& scene) override;
@@ -47,16 +56,51 @@ public:
 protected:
 	Camera::ptr m_camera;
 	Sampler::ptr m_sampler;
-};
 
+	// Adaptive sampling: pixels stop once the relative error of their mean drops below
+	// _m_targetError_, the sampler's SPP becomes the maximum per pixel. Zero disables it.
+	Float m_targetError = 0;
+	int m_passSamples = 16;
+
+	// Progressive rendering: the frame is rendered in passes of _m_passSamples_ samples per pixel
+	// until the sampler's SPP or the time budget (in seconds) is reached. Every _m_checkpointInterval_
+	// seconds the image and the accumulation buffer are written, and a render finds its
+	// checkpoint again to resume. Zero budget and interval disable it. The checkpoint is keyed by
+	// the scene, the files it loads and the sampling settings, and deleted once the render completes.
+	Float m_timeBudget = 0;
+	Float m_checkpointInterval = 0;
+	std::string m_checkpointFilename;
+
+private:
+	// Trace one camera sample of _pixel_, add it to _filmTile_ and return its radiance
+	Spectrum renderSample(const Scene& scene, const Vector2i& pixel, Sampler& sampler,
+		MemoryArena& arena, FilmTile& filmTile) const;
+
+	void renderAdaptive(const Scene& scene);
+	void renderProgressive(const Scene& scene);
+};
 
+// Takes _nLightSamples[j]_ samples of the j-th light from two 2D sample arrays per light, light
+// and scattering, which the integrator requests in preprocess() with counts already passed through
+// Sampler::roundCount(). Without them a single sample per light is taken. Note: no integrator
+// requests these arrays yet.
 Spectrum uiformSampleAllLights(const Interaction& it, const Scene& scene,
 	MemoryArena& arena, Sampler& sampler, const std::vector<int>& nLightSamples);
 
+// With _handleMedia_ the shadow rays pass through material-less surfaces and are attenuated by
+// the media they cross, _it_ may then be a MediumInteraction scattering by its phase function.
 Spectrum uniformSampleOneLight(const Interaction& it, const Scene& scene,
-	MemoryArena& arena, Sampler& sampler, const Distribution1D* lightDistrib);
+	MemoryArena& arena, Sampler& sampler, const LightDistribution* lightDistrib, bool handleMedia = false);
+
+// Features of the surface the camera ray shows for the film's denoiser: its reflectance, shading
+// normal facing the ray and distance. Material-less surfaces are passed through and perfectly
+// specular ones followed. A ray escaping to the environment gets its throughput as albedo, and
+// zero normal and depth when it escapes directly.
+void firstHitFeatures(const Ray& ray, const Scene& scene, MemoryArena& arena,
+	Spectrum& albedo, Vector3f& normal, Float& depth);
 
 Spectrum estimateDirect(const Interaction& it, const Vector2f& uShading, const Light& light,
-	const Vector2f& uLight, const Scene& scene, Sampler& sampler, MemoryArena& arena, bool specular = false);
+	const Vector2f& uLight, const Scene& scene, Sampler& sampler, MemoryArena& arena,
+	bool handleMedia = false, bool specular = false);
 
 RENDER_END
\ No newline at end of file
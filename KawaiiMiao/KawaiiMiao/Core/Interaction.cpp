@@ -8,9 +8,15 @@ RENDER_BEGIN
 
 SurfaceInteraction::SurfaceInteraction(const Vector3f& p, const Vector2f& uv, const Vector3f& wo,
 	const Vector3f& dpdu, const Vector3f& dpdv, const Shape* sh)
-	: Interaction(p, normalize(cross(dpdu, dpdv)), wo), uv(uv), dpdu(dpdu), dpdv(dpdv), shape(sh) 
+	: Interaction(p, normalize(cross(dpdu, dpdv)), wo), uv(uv), dpdu(dpdu), dpdv(dpdv),
+	dndu(0.f), dndv(0.f), shape(sh)
 {
-
+	// Initialize shading geometry from true geometry
+	shading.n = normal;
+	shading.dpdu = dpdu;
+	shading.dpdv = dpdv;
+	shading.dndu = dndu;
+	shading.dndv = dndv;
 }
 
 SurfaceInteraction::SurfaceInteraction(const Vector3f& p, const Vector3f& pError,
@@ -36,17 +36,35 @@ public:
 		const MediumInterface& mediumInterface)
 		: p(p), time(time), mediumInterface(mediumInterface) {}
 
+	// Medium interactions have no normal
+	bool isSurfaceInteraction() const { return normal != Vector3f(0.f); }
+
+	// The medium on the side of the surface _w_ points to
+	const Medium* getMedium(const Vector3f& w) const
+	{
+		if (isSurfaceInteraction())
+			return dot(w, normal) > 0 ? mediumInterface.outside : mediumInterface.inside;
+		return mediumInterface.inside;
+	}
+
+	const Medium* getMedium() const
+	{
+		DCHECK(mediumInterface.inside == mediumInterface.outside);
+		return mediumInterface.inside;
+	}
+
 	inline Ray spawnRay(const Vector3f& dir) const
 	{
 		Vector3f origin = p;
-		return Ray(origin, dir, Infinity);
+		return Ray(origin, dir, Infinity, time, getMedium(dir));
 	}
 
 	inline Ray spawnRayTo(const Vector3f& p2) const
 	{
 		Vector3f origin = p;
 		Vector3f dir = p2 - origin;
-		return Ray(origin, dir, 1 - ShadowEpsilon);
+		// Note: the ray direction is normalized, so tMax is a distance
+		return Ray(origin, dir, length(dir) * (1 - ShadowEpsilon), time, getMedium(dir));
 	}
 
 	inline Ray spawnRayTo(const Interaction& it) const
@@ -54,13 +72,13 @@ public:
 		Vector3f origin = p;
 		Vector3f target = it.p;
 		Vector3f d = target - origin;
-		return Ray(origin, d, 1 - ShadowEpsilon);
+		return Ray(origin, d, length(d) * (1 - ShadowEpsilon), time, getMedium(d));
 	}
 
 public:
 	Vector3f p; // surface point
 	Vector3f wo; // outgoing dir
-	Vector3f normal; // normal
+	Vector3f normal = Vector3f(0.f); // normal, zero for points off any surface
 	Vector3f pError;
 	Float time;
 	MediumInterface mediumInterface;
@@ -109,7 +127,10 @@ public:
 class MediumInteraction : public Interaction
 {
 public:
-	MediumInteraction() : phase(nullptr) {}
+	MediumInteraction() : phase(nullptr) { normal = Vector3f(0.f); }
+	MediumInteraction(const Vector3f& p, const Vector3f& wo, Float time,
+		const Medium* medium, const PhaseFunction* phase)
+		: Interaction(p, wo, time, MediumInterface(medium)), phase(phase) { normal = Vector3f(0.f); }
 
 	bool isValid() const 
 	{
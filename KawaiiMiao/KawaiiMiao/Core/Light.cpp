@@ -1,6 +1,7 @@
 #include "Light.h"
 #include "Scene.h"
 #include "Sampling.h"
+#include "Medium.h"
 #include "../Math/Rng.h"
 
 RENDER_BEGIN
@@ -22,6 +23,117 @@ Light::~Light() {}
 
 Spectrum Light::Le(const Ray& ray) const { return Spectrum(0.f); }
 
+// Light bounds
+static inline Float safeSqrt(Float x) { return std::sqrt(glm::max(Float(0), x)); }
+static inline Float safeACos(Float x) { return std::acos(clamp(x, -1, 1)); }
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) of two angles given by their sine and cosine
+static inline Float cosSubClamped(Float sinThetaA, Float cosThetaA, Float sinThetaB, Float cosThetaB)
+{
+	if (cosThetaA > cosThetaB)
+		return 1;
+	return cosThetaA * cosThetaB + sinThetaA * sinThetaB;
+}
+
+static inline Float sinSubClamped(Float sinThetaA, Float cosThetaA, Float sinThetaB, Float cosThetaB)
+{
+	if (cosThetaA > cosThetaB)
+		return 0;
+	return sinThetaA * cosThetaB - cosThetaA * sinThetaB;
+}
+
+Float LightBounds::importance(const Vector3f& p, const Vector3f& n) const
+{
+	// Clamp the squared distance to the bounds center, so that points close to or inside
+	// the bounds don't get an unbounded importance
+	Vector3f pc = centroid();
+	Float d2 = distanceSquared(p, pc);
+	d2 = glm::max(d2, length(m_bounds.diagonal()) / 2);
+
+	// Angle between the cone axis and the direction from the center towards _p_
+	Vector3f wi = distanceSquared(p, pc) > 0 ? normalize(p - pc) : m_w;
+	Float cosThetaW = dot(m_w, wi);
+	if (m_twoSided)
+		cosThetaW = glm::abs(cosThetaW);
+	Float sinThetaW = safeSqrt(1 - cosThetaW * cosThetaW);
+
+	// Half angle of the cone of directions from _p_ towards the bounds, through the bounding sphere
+	Float cosThetaB = -1;
+	Float radius2 = distanceSquared(pc, m_bounds.m_pMax);
+	Float dist2 = distanceSquared(p, pc);
+	if (dist2 > radius2)
+		cosThetaB = safeSqrt(1 - radius2 / dist2);
+	Float sinThetaB = safeSqrt(1 - cosThetaB * cosThetaB);
+
+	// Minimum angle between the emission and the direction towards _p_, compare it with theta_e
+	Float sinThetaO = safeSqrt(1 - m_cosThetaO * m_cosThetaO);
+	Float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, m_cosThetaO);
+	Float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, m_cosThetaO);
+	Float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= m_cosThetaE)
+		return 0;
+
+	Float result = m_phi * cosThetaP / d2;
+
+	// Account for the cosine at the receiving surface
+	if (n != Vector3f(0.f))
+	{
+		Float cosThetaI = absDot(wi, n);
+		Float sinThetaI = safeSqrt(1 - cosThetaI * cosThetaI);
+		result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+
+	return glm::max<Float>(result, 0);
+}
+
+LightBounds unionBounds(const LightBounds& a, const LightBounds& b)
+{
+	if (a.m_phi == 0)
+		return b;
+	if (b.m_phi == 0)
+		return a;
+
+	// Smallest cone containing both normal cones
+	Vector3f w;
+	Float cosThetaO;
+	Float thetaA = safeACos(a.m_cosThetaO), thetaB = safeACos(b.m_cosThetaO);
+	Float thetaD = safeACos(dot(a.m_w, b.m_w));
+	if (glm::min(thetaD + thetaB, Pi) <= thetaA)
+	{
+		w = a.m_w;
+		cosThetaO = a.m_cosThetaO;
+	}
+	else if (glm::min(thetaD + thetaA, Pi) <= thetaB)
+	{
+		w = b.m_w;
+		cosThetaO = b.m_cosThetaO;
+	}
+	else
+	{
+		Float thetaO = (thetaA + thetaD + thetaB) / 2;
+		Vector3f wr = cross(a.m_w, b.m_w);
+		if (thetaO >= Pi || dot(wr, wr) == 0)
+		{
+			// The cone covers the entire sphere of directions
+			w = a.m_w;
+			cosThetaO = -1;
+		}
+		else
+		{
+			// Rotate _a.m_w_ towards _b.m_w_ by thetaO - thetaA around their common normal
+			Float thetaR = thetaO - thetaA;
+			wr = normalize(wr);
+			w = a.m_w * std::cos(thetaR) + cross(wr, a.m_w) * std::sin(thetaR)
+				+ wr * dot(wr, a.m_w) * (1 - std::cos(thetaR));
+			w = normalize(w);
+			cosThetaO = std::cos(thetaO);
+		}
+	}
+
+	return LightBounds(unionBounds(a.m_bounds, b.m_bounds), w, a.m_phi + b.m_phi, cosThetaO,
+		glm::min(a.m_cosThetaE, b.m_cosThetaE), a.m_twoSided || b.m_twoSided);
+}
+
 // Visibility tester
 bool VisibilityTester::unoccluded(const Scene& scene) const
 {
@@ -30,22 +142,25 @@ bool VisibilityTester::unoccluded(const Scene& scene) const
 
 Spectrum VisibilityTester::tr(const Scene& scene, Sampler& sampler) const
 {
-	//ARay ray(p0.SpawnRayTo(p1));
+	Ray ray(m_p0.spawnRayTo(m_p1));
 	Spectrum Tr(1.f);
-	//while (true) {
-	//	ASurfaceInteraction isect;
-	//	bool hitSurface = scene.Intersect(ray, &isect);
-	//	// Handle opaque surface along ray's path
-	//	if (hitSurface && isect.primitive->GetMaterial() != nullptr)
-	//		return ASpectrum(0.0f);
-
-	//	// Update transmittance for current ray segment
-	//	if (ray.medium) Tr *= ray.medium->Tr(ray, sampler);
-
-	//	// Generate next ray segment or return final transmittance
-	//	if (!hitSurface) break;
-	//	ray = isect.SpawnRayTo(p1);
-	//}
+	while (true)
+	{
+		SurfaceInteraction isect;
+		bool hitSurface = scene.hit(ray, isect);
+		// Handle opaque surface along ray's path
+		if (hitSurface && isect.primitive->getMaterial() != nullptr)
+			return Spectrum(0.0f);
+
+		// Update transmittance for current ray segment
+		if (ray.m_medium != nullptr)
+			Tr *= ray.m_medium->Tr(ray, sampler);
+
+		// Generate next ray segment or return final transmittance
+		if (!hitSurface)
+			break;
+		ray = isect.spawnRayTo(m_p1);
+	}
 	return Tr;
 }
 
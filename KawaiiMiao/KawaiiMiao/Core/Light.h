@@ -24,6 +24,30 @@ inline bool isDeltaLight(int flags)
 		|| flags & (int)LightFlags::LightDeltaDirection;
 }
 
+// Bounds on the emission of a light, used to estimate its contribution to a region of space.
+// The emitters lie in _m_bounds_, their normals are within the cone of axis _m_w_ and half angle
+// acos(_m_cosThetaO_), and they emit no further than acos(_m_cosThetaE_) away from their normals.
+struct LightBounds
+{
+	LightBounds() = default;
+	LightBounds(const Bounds3f& b, const Vector3f& w, Float phi, Float cosThetaO, Float cosThetaE, bool twoSided)
+		: m_bounds(b), m_w(w), m_phi(phi), m_cosThetaO(cosThetaO), m_cosThetaE(cosThetaE), m_twoSided(twoSided) {}
+
+	Vector3f centroid() const { return (m_bounds.m_pMin + m_bounds.m_pMax) * 0.5f; }
+
+	// Conservative estimate of the light reaching _p_, _n_ is the surface normal there (zero in media)
+	Float importance(const Vector3f& p, const Vector3f& n) const;
+
+	Bounds3f m_bounds;
+	Vector3f m_w = Vector3f(0, 0, 1);
+	Float m_phi = 0;
+	Float m_cosThetaO = 1;
+	Float m_cosThetaE = 1;
+	bool m_twoSided = false;
+};
+
+LightBounds unionBounds(const LightBounds& a, const LightBounds& b);
+
 class Light : public AObject
 {
 public:
@@ -37,6 +61,9 @@ public:
 
 	virtual void preprocess(const Scene& scene) {}
 
+	// Emission bounds for the light hierarchy, lights without finite bounds return false
+	virtual bool bounds(LightBounds& bounds) const { return false; }
+
 	virtual Spectrum sample_Li(const Interaction& ref, const Vector2f& u,
 		Vector3f& wi, Float& pdf, VisibilityTester& vis) const = 0;
 
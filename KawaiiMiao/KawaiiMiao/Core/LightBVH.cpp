@@ -0,0 +1,254 @@
+#include "LightBVH.h"
+#include "Scene.h"
+#include "../Math/Rng.h"
+
+#include "../Tool/Logger.h"
+
+RENDER_BEGIN
+
+// Marks the lights that aren't leaves of the hierarchy
+static constexpr uint64_t invalidBitTrail = ~uint64_t(0);
+
+LightBVHDistribution::LightBVHDistribution(const Scene& scene)
+	: m_lightToBitTrail(scene.m_lights.size(), invalidBitTrail)
+{
+	std::vector<BVHLight> bvhLights;
+	for (size_t i = 0; i < scene.m_lights.size(); ++i)
+	{
+		LightBounds lightBounds;
+		if (!scene.m_lights[i]->bounds(lightBounds))
+		{
+			m_infiniteLights.push_back(int(i));
+		}
+		else if (lightBounds.m_phi > 0)
+		{
+			// Note: lights that emit nothing are never sampled
+			bvhLights.push_back(std::make_pair(int(i), lightBounds));
+		}
+	}
+
+	if (!bvhLights.empty())
+	{
+		m_nodes.reserve(2 * bvhLights.size() - 1);
+		buildBVH(bvhLights, 0, int(bvhLights.size()), 0, 0);
+	}
+
+	K_INFO("Light BVH created with {0} nodes for {1} lights ({2} infinite lights)",
+		m_nodes.size(), bvhLights.size(), m_infiniteLights.size());
+}
+
+int LightBVHDistribution::buildBVH(std::vector<BVHLight>& bvhLights, int start, int end,
+	uint64_t bitTrail, int depth)
+{
+	CHECK_LT(depth, 64);
+
+	// Initialize leaf node if only a single light remains
+	if (end - start == 1)
+	{
+		int nodeIndex = int(m_nodes.size());
+		m_nodes.push_back({ bvhLights[start].second, bvhLights[start].first, true });
+		m_lightToBitTrail[bvhLights[start].first] = bitTrail;
+		return nodeIndex;
+	}
+
+	// Compute bounds and centroid bounds of the lights
+	Bounds3f bounds, centroidBounds;
+	for (int i = start; i < end; ++i)
+	{
+		const LightBounds& lb = bvhLights[i].second;
+		bounds = unionBounds(bounds, lb.m_bounds);
+		centroidBounds = unionBounds(centroidBounds, lb.centroid());
+	}
+
+	// Find the cheapest bucket split among all dimensions
+	Float minCost = Infinity;
+	int minCostSplitBucket = -1, minCostSplitDim = -1;
+	constexpr int nBuckets = 12;
+	for (int dim = 0; dim < 3; ++dim)
+	{
+		// Note: the lights can't be split along a dimension where all of their centroids coincide
+		if (centroidBounds.m_pMax[dim] == centroidBounds.m_pMin[dim])
+			continue;
+
+		// Compute the light bounds of each bucket
+		LightBounds bucketLightBounds[nBuckets];
+		for (int i = start; i < end; ++i)
+		{
+			Vector3f pc = bvhLights[i].second.centroid();
+			int b = int(nBuckets * centroidBounds.offset(pc)[dim]);
+			if (b == nBuckets)
+				b = nBuckets - 1;
+			bucketLightBounds[b] = unionBounds(bucketLightBounds[b], bvhLights[i].second);
+		}
+
+		// Compute the costs of splitting the lights after each bucket
+		for (int i = 0; i < nBuckets - 1; ++i)
+		{
+			LightBounds b0, b1;
+			for (int j = 0; j <= i; ++j)
+				b0 = unionBounds(b0, bucketLightBounds[j]);
+			for (int j = i + 1; j < nBuckets; ++j)
+				b1 = unionBounds(b1, bucketLightBounds[j]);
+
+			Float cost = evaluateCost(b0, bounds, dim) + evaluateCost(b1, bounds, dim);
+			if (cost > 0 && cost < minCost)
+			{
+				minCost = cost;
+				minCostSplitBucket = i;
+				minCostSplitDim = dim;
+			}
+		}
+	}
+
+	// Partition the lights according to the chosen split
+	int mid;
+	if (minCostSplitDim == -1)
+	{
+		mid = (start + end) / 2;
+	}
+	else
+	{
+		const BVHLight* pmid = std::partition(&bvhLights[start], &bvhLights[end - 1] + 1,
+			[=](const BVHLight& l)
+			{
+				int b = int(nBuckets * centroidBounds.offset(l.second.centroid())[minCostSplitDim]);
+				if (b == nBuckets)
+					b = nBuckets - 1;
+				return b <= minCostSplitBucket;
+			});
+		mid = int(pmid - &bvhLights[0]);
+		if (mid == start || mid == end)
+			mid = (start + end) / 2;
+	}
+
+	// Allocate the interior node and build its children, the first one right after it
+	int nodeIndex = int(m_nodes.size());
+	m_nodes.push_back(LightBVHNode());
+	int child0 = buildBVH(bvhLights, start, mid, bitTrail, depth + 1);
+	CHECK_EQ(child0, nodeIndex + 1);
+	int child1 = buildBVH(bvhLights, mid, end, bitTrail | (uint64_t(1) << depth), depth + 1);
+
+	m_nodes[nodeIndex].m_lightBounds = unionBounds(m_nodes[child0].m_lightBounds, m_nodes[child1].m_lightBounds);
+	m_nodes[nodeIndex].m_childOrLightIndex = child1;
+	m_nodes[nodeIndex].m_isLeaf = false;
+	return nodeIndex;
+}
+
+Float LightBVHDistribution::evaluateCost(const LightBounds& b, const Bounds3f& bounds, int dim) const
+{
+	// Note: empty side of a split
+	if (b.m_phi == 0)
+		return 0;
+
+	// Measure of the solid angle of the emission of the bounds (orientation cone widened by theta_e)
+	Float thetaO = std::acos(clamp(b.m_cosThetaO, -1, 1)), thetaE = std::acos(clamp(b.m_cosThetaE, -1, 1));
+	Float thetaW = glm::min(thetaO + thetaE, Pi);
+	Float sinThetaO = std::sqrt(glm::max(Float(0), 1 - b.m_cosThetaO * b.m_cosThetaO));
+	Float omega = 2 * Pi * (1 - b.m_cosThetaO) +
+		Pi / 2 * (2 * thetaW * sinThetaO - std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + b.m_cosThetaO);
+
+	// Penalize thin bounds along the split dimension
+	Vector3f d = bounds.diagonal();
+	Float kr = glm::max(d.x, glm::max(d.y, d.z)) / d[dim];
+	return b.m_phi * omega * kr * b.m_bounds.surfaceArea();
+}
+
+int LightBVHDistribution::sample(const Interaction& ref, Float u, Float& pmf) const
+{
+	// Choose between the infinite lights and the hierarchy, each infinite light being as likely as the whole tree
+	Float pInfinite = Float(m_infiniteLights.size()) /
+		Float(m_infiniteLights.size() + (m_nodes.empty() ? 0 : 1));
+	if (u < pInfinite)
+	{
+		int index = glm::min(int(u * m_infiniteLights.size()), int(m_infiniteLights.size()) - 1);
+		pmf = pInfinite / m_infiniteLights.size();
+		return m_infiniteLights[index];
+	}
+
+	pmf = 0;
+	if (m_nodes.empty())
+		return -1;
+
+	// Traverse the hierarchy, reusing the sample to choose a child at each interior node
+	u = glm::min((u - pInfinite) / (1 - pInfinite), aOneMinusEpsilon);
+	int nodeIndex = 0;
+	Float nodePmf = 1 - pInfinite;
+	while (true)
+	{
+		const LightBVHNode& node = m_nodes[nodeIndex];
+		if (node.m_isLeaf)
+		{
+			// Note: a single light at the root is returned only if it can contribute at all
+			if (nodeIndex > 0 || node.m_lightBounds.importance(ref.p, ref.normal) > 0)
+			{
+				pmf = nodePmf;
+				return node.m_childOrLightIndex;
+			}
+			return -1;
+		}
+
+		// Compute the importance of both children and randomly pick one
+		const int children[2] = { nodeIndex + 1, node.m_childOrLightIndex };
+		Float ci[2] = {
+			m_nodes[children[0]].m_lightBounds.importance(ref.p, ref.normal),
+			m_nodes[children[1]].m_lightBounds.importance(ref.p, ref.normal) };
+		if (ci[0] == 0 && ci[1] == 0)
+			return -1;
+
+		Float p0 = ci[0] / (ci[0] + ci[1]);
+		if (u < p0)
+		{
+			nodeIndex = children[0];
+			u = glm::min(u / p0, aOneMinusEpsilon);
+			nodePmf *= p0;
+		}
+		else
+		{
+			nodeIndex = children[1];
+			u = glm::min((u - p0) / (1 - p0), aOneMinusEpsilon);
+			nodePmf *= 1 - p0;
+		}
+	}
+}
+
+Float LightBVHDistribution::pmf(const Interaction& ref, int lightIndex) const
+{
+	Float pInfinite = Float(m_infiniteLights.size()) /
+		Float(m_infiniteLights.size() + (m_nodes.empty() ? 0 : 1));
+
+	uint64_t bitTrail = m_lightToBitTrail[lightIndex];
+	if (bitTrail == invalidBitTrail)
+	{
+		bool isInfinite = std::find(m_infiniteLights.begin(), m_infiniteLights.end(), lightIndex)
+			!= m_infiniteLights.end();
+		return isInfinite ? pInfinite / m_infiniteLights.size() : 0;
+	}
+
+	// Replay the branches leading to the light's leaf
+	int nodeIndex = 0;
+	Float pmf = 1 - pInfinite;
+	while (true)
+	{
+		const LightBVHNode& node = m_nodes[nodeIndex];
+		if (node.m_isLeaf)
+		{
+			if (nodeIndex > 0 || node.m_lightBounds.importance(ref.p, ref.normal) > 0)
+				return pmf;
+			return 0;
+		}
+
+		const int children[2] = { nodeIndex + 1, node.m_childOrLightIndex };
+		Float ci[2] = {
+			m_nodes[children[0]].m_lightBounds.importance(ref.p, ref.normal),
+			m_nodes[children[1]].m_lightBounds.importance(ref.p, ref.normal) };
+		int branch = int(bitTrail & 1);
+		if (ci[branch] == 0)
+			return 0;
+		pmf *= ci[branch] / (ci[0] + ci[1]);
+
+		nodeIndex = children[branch];
+		bitTrail >>= 1;
+	}
+}
+
+RENDER_END
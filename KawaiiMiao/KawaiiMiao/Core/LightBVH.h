@@ -0,0 +1,48 @@
+#pragma once
+
+#include "LightDistrib.h"
+#include "Light.h"
+
+RENDER_BEGIN
+
+struct LightBVHNode
+{
+	LightBounds m_lightBounds;
+	// Index of the light for leaves, of the second child for interior nodes (the first one follows the node)
+	int m_childOrLightIndex;
+	bool m_isLeaf;
+};
+
+// Light hierarchy: every bounded light is a leaf of a binary tree whose nodes store the bounds,
+// the normal cone and the total power of their lights. Lights are chosen by a stochastic
+// traversal that descends into each child with a probability proportional to its importance
+// at the shading point, lights without bounds (infinite lights) are sampled uniformly aside.
+class LightBVHDistribution : public LightDistribution
+{
+public:
+
+	LightBVHDistribution(const Scene& scene);
+
+	// Note: the hierarchy has no tabulated distribution, use sample() and pmf() instead
+	virtual const Distribution1D* lookup(const Vector3f& p) const override { return nullptr; }
+
+	virtual int sample(const Interaction& ref, Float u, Float& pmf) const override;
+
+	virtual Float pmf(const Interaction& ref, int lightIndex) const override;
+
+private:
+	typedef std::pair<int, LightBounds> BVHLight;
+
+	// Build the subtree of lights [start, end) and return its root node index, _bitTrail_ records
+	// the branches taken from the root (1 for a second child) so that pmf() can replay them.
+	int buildBVH(std::vector<BVHLight>& bvhLights, int start, int end, uint64_t bitTrail, int depth);
+
+	Float evaluateCost(const LightBounds& b, const Bounds3f& bounds, int dim) const;
+
+	std::vector<LightBVHNode> m_nodes;
+	std::vector<int> m_infiniteLights;
+	// Branches leading to the leaf of each light, indexed as Scene::m_lights
+	std::vector<uint64_t> m_lightToBitTrail;
+};
+
+RENDER_END
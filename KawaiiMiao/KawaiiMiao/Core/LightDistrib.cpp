@@ -1,33 +1,142 @@
 #include "LightDistrib.h"
 #include "Scene.h"
+#include "LightBVH.h"
+#include "LowDiscrepancy.h"
+#include "../Math/Rng.h"
+
+#include "../Tool/Logger.h"
+#include "../Tool/Parallel.h"
+
+#include <numeric>
 
 RENDER_BEGIN
 
+// Note: from this number of values on, the sums and the scaling of a distribution are computed
+//       in parallel over blocks of values, only the pairing of the alias table stays serial
+static constexpr int parallelDistributionSize = 1 << 16;
+static constexpr int distributionBlockSize = 1 << 12;
+
+Distribution1D::Distribution1D(const Float* f, int n) : func(f, f + n), cdf(n + 1), aliases(n)
+{
+	const ExecutionPolicy policy = n >= parallelDistributionSize ? ExecutionPolicy::PARALLEL : ExecutionPolicy::SERIAL;
+	const int nBlocks = (n + distributionBlockSize - 1) / distributionBlockSize;
+
+	// Compute integral of step function at $x_i$, block by block
+	// Note: the sums are accumulated in double so that the probabilities of the alias table
+	//       match discretePDF() even with millions of values
+	std::vector<double> blockSums(nBlocks + 1, 0.0);
+	AParallelUtils::parallelFor((size_t)0, (size_t)nBlocks, [&](const size_t& block)
+	{
+		int begin = int(block) * distributionBlockSize, end = glm::min(begin + distributionBlockSize, n);
+		double sum = 0;
+		for (int i = begin; i < end; ++i)
+			sum += func[i];
+		blockSums[block + 1] = sum;
+	}, policy);
+	for (int block = 1; block <= nBlocks; ++block)
+		blockSums[block] += blockSums[block - 1];
+	const double sum = blockSums[nBlocks];
+	funcInt = Float(sum / n);
+
+	// Transform step function integral into CDF
+	cdf[0] = 0;
+	AParallelUtils::parallelFor((size_t)0, (size_t)nBlocks, [&](const size_t& block)
+	{
+		int begin = int(block) * distributionBlockSize, end = glm::min(begin + distributionBlockSize, n);
+		double partial = blockSums[block];
+		for (int i = begin; i < end; ++i)
+		{
+			partial += func[i];
+			cdf[i + 1] = (sum == 0) ? Float(i + 1) / Float(n) : Float(partial / sum);
+		}
+	}, policy);
+
+	// Probabilities scaled by _n_, the average bin then holds exactly one
+	std::vector<double> p(n);
+	AParallelUtils::parallelFor((size_t)0, (size_t)n, [&](const size_t& i)
+	{
+		p[i] = (sum == 0) ? 1.0 : func[i] * (n / sum);
+	}, policy);
+
+	// Fill the bins below one with the excess of the ones above, one at a time (Vose 1991)
+	std::vector<int> under, over;
+	for (int i = 0; i < n; ++i)
+		(p[i] < 1 ? under : over).push_back(i);
+	while (!under.empty() && !over.empty())
+	{
+		int u = under.back(), o = over.back();
+		under.pop_back();
+		aliases[u] = { Float(p[u]), o };
+		p[o] = (p[o] + p[u]) - 1;
+		if (p[o] < 1)
+		{
+			over.pop_back();
+			under.push_back(o);
+		}
+	}
+
+	// Note: the bins left are one up to round off, they keep all their probability
+	for (int i : over)
+		aliases[i] = { 1, i };
+	for (int i : under)
+		aliases[i] = { 1, i };
+}
+
+Distribution2D::Distribution2D(const Float* func, int nu, int nv) : pConditionalV(nv)
+{
+	// Compute conditional sampling distribution for $\tilde{v}$
+	const ExecutionPolicy policy = size_t(nu) * nv >= parallelDistributionSize ? ExecutionPolicy::PARALLEL : ExecutionPolicy::SERIAL;
+	AParallelUtils::parallelFor((size_t)0, (size_t)nv, [&](const size_t& v)
+	{
+		pConditionalV[v].reset(new Distribution1D(&func[v * nu], nu));
+	}, policy);
+
+	// Compute marginal sampling distribution $p[\tilde{v}]$
+	std::vector<Float> marginalFunc(nv);
+	for (int v = 0; v < nv; ++v)
+		marginalFunc[v] = pConditionalV[v]->funcInt;
+	pMarginal.reset(new Distribution1D(&marginalFunc[0], nv));
+}
+
 std::unique_ptr<LightDistribution> createLightSampleDistribution(
 	const std::string& name, const Scene& scene)
 {
-	//if (name == "uniform" || scene.m_lights.size() == 1)
+	if (name == "uniform" || scene.m_lights.size() == 1)
 	{
 		return std::unique_ptr<LightDistribution>{
 			new UniformLightDistribution(scene)};
 	}
-	//else if (name == "power")
-	//{
-	//	return std::unique_ptr<ALightDistribution>{
-	//		new APowerLightDistribution(scene)};
-	//}
-	//else if (name == "spatial")
-	//{
-	//	return std::unique_ptr<ALightDistribution>{
-	//		new ASpatialLightDistribution(scene)};
-	//}
-	//else 
-	//{
-	//	Error(
-	//		"Light sample distribution type \"%s\" unknown. Using \"spatial\".",
-	//		name.c_str());
-	//	return std::unique_ptr<LightDistribution>{new SpatialLightDistribution(scene)};
-	//}
+	else if (name == "power")
+	{
+		return std::unique_ptr<LightDistribution>{
+			new PowerLightDistribution(scene)};
+	}
+	else if (name == "bvh")
+	{
+		return std::unique_ptr<LightDistribution>{
+			new LightBVHDistribution(scene)};
+	}
+	else if (name == "spatial")
+	{
+		return std::unique_ptr<LightDistribution>{
+			new SpatialLightDistribution(scene)};
+	}
+	else
+	{
+		K_ERROR("Light sample distribution type \"{0}\" unknown. Using \"spatial\".", name);
+		return std::unique_ptr<LightDistribution>{
+			new SpatialLightDistribution(scene)};
+	}
+}
+
+int LightDistribution::sample(const Interaction& ref, Float u, Float& pmf) const
+{
+	return lookup(ref.p)->sampleDiscrete(u, &pmf);
+}
+
+Float LightDistribution::pmf(const Interaction& ref, int lightIndex) const
+{
+	return lookup(ref.p)->discretePDF(lightIndex);
 }
 
 UniformLightDistribution::UniformLightDistribution(const Scene& scene)
@@ -41,4 +150,219 @@ const Distribution1D* UniformLightDistribution::lookup(const Vector3f& p) const
 	return distrib.get();
 }
 
+PowerLightDistribution::PowerLightDistribution(const Scene& scene)
+{
+	if (scene.m_lights.empty())
+		return;
+
+	std::vector<Float> lightPower;
+	for (const auto& light : scene.m_lights)
+		lightPower.push_back(light->power().y());
+	distrib.reset(new Distribution1D(&lightPower[0], int(lightPower.size())));
+}
+
+const Distribution1D* PowerLightDistribution::lookup(const Vector3f& p) const
+{
+	return distrib.get();
+}
+
+// Note: voxel coordinates are packed into a uint64_t for the hash table,
+//       20 bits are allowed for each of the three coordinates.
+static constexpr uint64_t invalidPackedPos = 0xffffffffffffffff;
+
+SpatialLightDistribution::SpatialLightDistribution(const Scene& scene, int maxVoxels)
+	: m_scene(scene)
+{
+	// Compute the number of voxels so that the widest scene bounding box
+	// dimension has maxVoxels voxels and the other dimensions have a number
+	// of voxels so that voxels are roughly cube shaped.
+	Bounds3f b = scene.worldBound();
+	Vector3f diag = b.diagonal();
+	Float bmax = diag[maxDimension(diag)];
+	for (int i = 0; i < 3; ++i)
+	{
+		m_nVoxels[i] = glm::max(1, int(std::round(diag[i] / bmax * maxVoxels)));
+		// In the lookup() method, we require that 20 or fewer bits be
+		// sufficient to represent each coordinate value. It's fairly hard
+		// to imagine that this would ever be a problem.
+		CHECK_LT(m_nVoxels[i], 1 << 20);
+	}
+
+	m_hashTableSize = 4 * m_nVoxels[0] * m_nVoxels[1] * m_nVoxels[2];
+	m_hashTable.reset(new HashEntry[m_hashTableSize]);
+	for (size_t i = 0; i < m_hashTableSize; ++i)
+	{
+		m_hashTable[i].packedPos.store(invalidPackedPos);
+		m_hashTable[i].distribution.store(nullptr);
+	}
+
+	K_INFO("SpatialLightDistribution: scene bounds [{0}, {1}, {2}] - [{3}, {4}, {5}], voxel res ({6}, {7}, {8})",
+		b.m_pMin.x, b.m_pMin.y, b.m_pMin.z, b.m_pMax.x, b.m_pMax.y, b.m_pMax.z,
+		m_nVoxels[0], m_nVoxels[1], m_nVoxels[2]);
+}
+
+SpatialLightDistribution::~SpatialLightDistribution()
+{
+	// Gather statistics about how well the computed distributions are across
+	// the buckets.
+	size_t nEntries = 0;
+	for (size_t i = 0; i < m_hashTableSize; ++i)
+	{
+		HashEntry& entry = m_hashTable[i];
+		if (entry.distribution.load())
+		{
+			delete entry.distribution.load();
+			++nEntries;
+		}
+	}
+	K_INFO("SpatialLightDistribution: {0} of {1} voxel distributions computed", nEntries, m_hashTableSize / 4);
+}
+
+const Distribution1D* SpatialLightDistribution::lookup(const Vector3f& p) const
+{
+	// First, compute integer voxel coordinates for the given point |p|
+	// with respect to the overall voxel grid.
+	Vector3f offset = m_scene.worldBound().offset(p);  // offset in [0,1].
+	Vector3i pi;
+	for (int i = 0; i < 3; ++i)
+		// The clamp should almost never be necessary, but is there to be
+		// robust to computed intersection points being slightly outside
+		// the scene bounds due to floating-point roundoff error.
+		pi[i] = clamp(int(offset[i] * m_nVoxels[i]), 0, m_nVoxels[i] - 1);
+
+	// Pack the 3D integer voxel coordinates into a single 64-bit value.
+	uint64_t packedPos = (uint64_t(pi[0]) << 40) | (uint64_t(pi[1]) << 20) | pi[2];
+	CHECK_NE(packedPos, invalidPackedPos);
+
+	// Compute a hash value from the packed voxel coordinates.  We could
+	// just take packedPos mod the hash table size, but since packedPos
+	// isn't necessarily well distributed on its own, it's worthwhile to do
+	// a little work to make sure that its bits values are individually
+	// fairly random. For details of and motivation for the following, see:
+	// http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
+	uint64_t hash = mixBits(packedPos) % m_hashTableSize;
+
+	// Now, see if the hash table already has an entry for the voxel. We'll
+	// use quadratic probing when the hash table entry is already used for
+	// another value; step stores the square root of the probe step.
+	int step = 1;
+	while (true)
+	{
+		HashEntry& entry = m_hashTable[hash];
+		// Does the hash table entry at offset |hash| match the current point?
+		uint64_t entryPackedPos = entry.packedPos.load(std::memory_order_acquire);
+		if (entryPackedPos == packedPos)
+		{
+			// Yes! Most of the time, there should already by a light
+			// sampling distribution available.
+			Distribution1D* dist = entry.distribution.load(std::memory_order_acquire);
+			if (dist == nullptr)
+			{
+				// Rarely, another thread will have already done a lookup
+				// at this point, found that there isn't a sampling
+				// distribution, and will already be computing the
+				// distribution for the point.  In this case, we spin until
+				// the sampling distribution is ready.  We assume that this
+				// is a rare case, so don't do anything more sophisticated
+				// than spinning.
+				while ((dist = entry.distribution.load(std::memory_order_acquire)) == nullptr)
+					// spin :-(. If we were fancy, we'd have any threads
+					// that hit this instead help out with computing the
+					// distribution for the voxel...
+					;
+			}
+			// We have a valid sampling distribution.
+			return dist;
+		}
+		else if (entryPackedPos != invalidPackedPos)
+		{
+			// The hash table entry we're checking has already been
+			// allocated for another voxel. Advance to the next entry with
+			// quadratic probing.
+			hash += step * step;
+			if (hash >= m_hashTableSize)
+				hash %= m_hashTableSize;
+			++step;
+		}
+		else
+		{
+			// We have found an invalid entry. (Though this may have
+			// changed by the time we get to the code below.) Try to claim it
+			// for the current voxel using an atomic compare-and-swap.
+			uint64_t invalid = invalidPackedPos;
+			if (entry.packedPos.compare_exchange_weak(invalid, packedPos))
+			{
+				// Success; we've claimed this position for this voxel's
+				// distribution. Now compute the sampling distribution and
+				// add it to the hash table. As long as packedPos has been
+				// set but the entry's distribution pointer is nullptr, any
+				// other threads looking up the distribution for this voxel
+				// will spin wait until the distribution pointer is
+				// written.
+				Distribution1D* dist = computeDistribution(pi);
+				entry.distribution.store(dist, std::memory_order_release);
+				return dist;
+			}
+		}
+	}
+}
+
+Distribution1D* SpatialLightDistribution::computeDistribution(const Vector3i& pi) const
+{
+	// Compute the world-space bounding box of the voxel corresponding to
+	// |pi|.
+	Vector3f p0(Float(pi[0]) / Float(m_nVoxels[0]),
+		Float(pi[1]) / Float(m_nVoxels[1]),
+		Float(pi[2]) / Float(m_nVoxels[2]));
+	Vector3f p1(Float(pi[0] + 1) / Float(m_nVoxels[0]),
+		Float(pi[1] + 1) / Float(m_nVoxels[1]),
+		Float(pi[2] + 1) / Float(m_nVoxels[2]));
+	Bounds3f voxelBounds(m_scene.worldBound().lerp(p0), m_scene.worldBound().lerp(p1));
+
+	// Compute the sampling distribution. Sample a number of points inside
+	// voxelBounds using a 3D Halton sequence; at each one, sample each
+	// light source and compute a weight based on Li/pdf for the light's
+	// sample (ignoring visibility between the point in the voxel and the
+	// point on the light source) as an approximation to how much the light
+	// is likely to contribute to illumination in the voxel.
+	const int nSamples = 128;
+	std::vector<Float> lightContrib(m_scene.m_lights.size(), Float(0));
+	for (int i = 0; i < nSamples; ++i)
+	{
+		Vector3f po = voxelBounds.lerp(Vector3f(
+			radicalInverse(0, i), radicalInverse(1, i), radicalInverse(2, i)));
+		Interaction intr(po);
+		intr.time = 0.5f;
+
+		// Use the next two Halton dimensions to sample a point on the
+		// light source.
+		Vector2f u(radicalInverse(3, i), radicalInverse(4, i));
+		for (size_t j = 0; j < m_scene.m_lights.size(); ++j)
+		{
+			Float pdf;
+			Vector3f wi;
+			VisibilityTester vis;
+			Spectrum Li = m_scene.m_lights[j]->sample_Li(intr, u, wi, pdf, vis);
+			// Note: no shadow ray is traced, a light hidden from the whole voxel still
+			//       gets the weight of an unoccluded one
+			if (pdf > 0)
+				lightContrib[j] += Li.y() / pdf;
+		}
+	}
+
+	// We don't want to leave any lights with a zero probability; it's
+	// possible that a light contributes to points in the voxel even though
+	// we didn't find such a point when sampling above.  Therefore, compute
+	// a minimum (small) weight and ensure that all lights are given at
+	// least the corresponding probability.
+	Float sumContrib = std::accumulate(lightContrib.begin(), lightContrib.end(), Float(0));
+	Float avgContrib = sumContrib / (nSamples * lightContrib.size());
+	Float minContrib = (avgContrib > 0) ? .001 * avgContrib : 1;
+	for (size_t i = 0; i < lightContrib.size(); ++i)
+		lightContrib[i] = glm::max(lightContrib[i], minContrib);
+
+	// Compute a sampling distribution from the accumulated contributions.
+	return new Distribution1D(&lightContrib[0], int(lightContrib.size()));
+}
+
 RENDER_END
\ No newline at end of file
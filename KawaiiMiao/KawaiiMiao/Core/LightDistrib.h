@@ -2,32 +2,19 @@
 
 #include "Rendering.h"
 #include "../Math/KMathUtil.h"
+#include "../Math/Rng.h"
+
+#include <atomic>
 
 RENDER_BEGIN
 
+// Piecewise constant distribution of _n_ values over [0, 1). Continuous samples invert the CDF,
+// which keeps the stratification of _u_; discrete samples go through an alias table (Walker 1977,
+// Vose 1991) in constant time, whatever the number of values.
 class Distribution1D
 {
 public:
-	Distribution1D(const Float* f, int n) : func(f, f + n), cdf(n + 1)
-	{
-		// Compute integral of step function at $x_i$
-		cdf[0] = 0;
-		for (int i = 1; i < n + 1; ++i)
-			cdf[i] = cdf[i - 1] + func[i - 1] / n;
-
-		// Transform step function integral into CDF
-		funcInt = cdf[n];
-		if (funcInt == 0)
-		{
-			for (int i = 1; i < n + 1; ++i)
-				cdf[i] = Float(i) / Float(n);
-		}
-		else
-		{
-			for (int i = 1; i < n + 1; ++i)
-				cdf[i] /= funcInt;
-		}
-	}
+	Distribution1D(const Float* f, int n);
 
 	int count() const
 	{
@@ -64,16 +51,27 @@ public:
 
 	int sampleDiscrete(Float u, Float* pdf = nullptr, Float* uRemapped = nullptr) const
 	{
-		// Find surrounding CDF segments and _offset_
-		int offset = findInterval((int)cdf.size(), [&](int index)
-			{
-				return cdf[index] <= u;
-			});
+		// Pick a bin uniformly, then either the bin itself or its alias
+		const int n = count();
+		Float up = u * n;
+		int offset = glm::min(int(up), n - 1);
+		up = glm::min(up - offset, aOneMinusEpsilon);
+
+		const AliasBin& bin = aliases[offset];
+		if (up < bin.q)
+		{
+			if (uRemapped)
+				*uRemapped = glm::min(up / bin.q, aOneMinusEpsilon);
+		}
+		else
+		{
+			if (uRemapped)
+				*uRemapped = glm::min((up - bin.q) / (1 - bin.q), aOneMinusEpsilon);
+			offset = bin.alias;
+		}
 
 		if (pdf)
-			*pdf = (funcInt > 0) ? func[offset] / (funcInt * count()) : 0;
-		if (uRemapped)
-			*uRemapped = (u - cdf[offset]) / (cdf[offset + 1] - cdf[offset]);
+			*pdf = (funcInt > 0) ? func[offset] / (funcInt * n) : 0;
 		if (uRemapped)
 			DCHECK(*uRemapped >= 0.f && *uRemapped <= 1.f);
 		return offset;
@@ -85,10 +83,48 @@ public:
 		return func[index] / (funcInt * count());
 	}
 
+	// Probability of keeping the bin rather than its alias
+	struct AliasBin
+	{
+		Float q;
+		int alias;
+	};
+
 	std::vector<Float> func, cdf;
+	std::vector<AliasBin> aliases;
 	Float funcInt;
 };
 
+// Piecewise constant distribution over [0, 1)^2 of a _nu_ by _nv_ function given in scanline order,
+// such as the luminance of an environment map. A point is drawn from the marginal distribution of
+// the rows, then from the conditional distribution of the chosen row.
+class Distribution2D
+{
+public:
+	Distribution2D(const Float* func, int nu, int nv);
+
+	Vector2f sampleContinuous(const Vector2f& u, Float* pdf) const
+	{
+		Float pdfs[2];
+		int v;
+		Float d1 = pMarginal->sampleContinuous(u[1], &pdfs[1], &v);
+		Float d0 = pConditionalV[v]->sampleContinuous(u[0], &pdfs[0]);
+		*pdf = pdfs[0] * pdfs[1];
+		return Vector2f(d0, d1);
+	}
+
+	Float pdf(const Vector2f& p) const
+	{
+		int iu = clamp(int(p[0] * pConditionalV[0]->count()), 0, pConditionalV[0]->count() - 1);
+		int iv = clamp(int(p[1] * pMarginal->count()), 0, pMarginal->count() - 1);
+		return pConditionalV[iv]->func[iu] / pMarginal->funcInt;
+	}
+
+private:
+	std::vector<std::unique_ptr<Distribution1D>> pConditionalV;
+	std::unique_ptr<Distribution1D> pMarginal;
+};
+
 //LightDistribution defines a general interface for classes that provide
 // probability distributions for sampling light sources at a given point in
 // space.
@@ -100,6 +136,14 @@ public:
 	// Given a point |p| in space, this method returns a (hopefully
 	// effective) sampling distribution for light sources at that point.
 	virtual const Distribution1D* lookup(const Vector3f& p) const = 0;
+
+	// Choose one light for the shading point |ref|, returns its index in
+	// Scene::m_lights and its probability in |pmf|. (pmf is zero if no
+	// light can contribute.) The default samples the lookup() distribution.
+	virtual int sample(const Interaction& ref, Float u, Float& pmf) const;
+
+	// Probability of sample() choosing the light |lightIndex| at |ref|
+	virtual Float pmf(const Interaction& ref, int lightIndex) const;
 };
 
 // The simplest possible implementation of LightDistribution: this returns
@@ -121,6 +165,60 @@ private:
 	std::unique_ptr<Distribution1D> distrib;
 };
 
+// PowerLightDistribution returns a distribution with sampling probability
+// proportional to the total emitted power for each light. (It also ignores
+// the provided point |p|.)  This approach works well for scenes where
+// the most powerful lights are also the most important contributors
+// to lighting in the scene, but doesn't do well if there are many lights
+// and if different lights are relatively important in some areas of the
+// scene and unimportant in others.
+class PowerLightDistribution : public LightDistribution
+{
+public:
+
+	PowerLightDistribution(const Scene& scene);
+
+	virtual const Distribution1D* lookup(const Vector3f& p) const override;
+
+private:
+	std::unique_ptr<Distribution1D> distrib;
+};
+
+// A spatially-varying light distribution that adjusts the probability of
+// sampling a light source based on an estimate of its contribution to a
+// region of space.  A fixed voxel grid is imposed over the scene bounds
+// and a sampling distribution is computed as needed for each voxel.
+class SpatialLightDistribution : public LightDistribution
+{
+public:
+
+	SpatialLightDistribution(const Scene& scene, int maxVoxels = 64);
+	~SpatialLightDistribution();
+
+	virtual const Distribution1D* lookup(const Vector3f& p) const override;
+
+private:
+	// Compute the sampling distribution for the voxel with integer
+	// coordinates given by "pi".
+	Distribution1D* computeDistribution(const Vector3i& pi) const;
+
+	const Scene& m_scene;
+	int m_nVoxels[3];
+
+	// The hash table is a fixed number of HashEntry structs (where we
+	// allocate more than enough entries in the SpatialLightDistribution
+	// constructor). During rendering, the table is allocated without
+	// locks, using atomic operations. (See the lookup() method
+	// implementation for details.)
+	struct HashEntry
+	{
+		std::atomic<uint64_t> packedPos;
+		std::atomic<Distribution1D*> distribution;
+	};
+	mutable std::unique_ptr<HashEntry[]> m_hashTable;
+	size_t m_hashTableSize;
+};
+
 std::unique_ptr<LightDistribution> createLightSampleDistribution(
 	const std::string & name, const Scene & scene);
 
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "Rendering.h"
+#include "../Math/KMathUtil.h"
+#include "../Math/Rng.h"
+
+#include <vector>
+
+RENDER_BEGIN
+
+// The first primes, used as the bases of the radical inverses of the successive dimensions
+static constexpr int PrimeTableSize = 1000;
+extern const int Primes[PrimeTableSize];
+
+// Mirror the base Primes[_baseIndex_] digits of _a_ around the radix point
+Float radicalInverse(int baseIndex, uint64_t a);
+
+// Same as radicalInverse() with every digit mapped through _perm_, a permutation of the digits
+// of the base. The infinite tail of zero digits is permuted as well.
+Float scrambledRadicalInverse(int baseIndex, uint64_t a, const uint16_t* perm);
+
+// Index whose _nDigits_ digits in _base_ reversed give _inverse_
+template <int base>
+inline uint64_t inverseRadicalInverse(uint64_t inverse, int nDigits)
+{
+	uint64_t index = 0;
+	for (int i = 0; i < nDigits; ++i)
+	{
+		uint64_t digit = inverse % base;
+		inverse /= base;
+		index = index * base + digit;
+	}
+	return index;
+}
+
+// Random digit permutations of all the bases of the prime table, laid out one after the other.
+// _offsets_ receives the position of the permutation of each base.
+std::vector<uint16_t> computeRadicalInversePermutations(Rng& rng, std::vector<int>& offsets);
+
+inline uint32_t reverseBits32(uint32_t n)
+{
+	n = (n << 16) | (n >> 16);
+	n = ((n & 0x00ff00ff) << 8) | ((n & 0xff00ff00) >> 8);
+	n = ((n & 0x0f0f0f0f) << 4) | ((n & 0xf0f0f0f0) >> 4);
+	n = ((n & 0x33333333) << 2) | ((n & 0xcccccccc) >> 2);
+	n = ((n & 0x55555555) << 1) | ((n & 0xaaaaaaaa) >> 1);
+	return n;
+}
+
+inline uint64_t reverseBits64(uint64_t n)
+{
+	uint64_t n0 = reverseBits32((uint32_t)n);
+	uint64_t n1 = reverseBits32((uint32_t)(n >> 32));
+	return (n0 << 32) | n1;
+}
+
+// Interleave the low 16 bits of _x_ and _y_, _x_ taking the even bits
+inline uint32_t encodeMorton2(uint32_t x, uint32_t y)
+{
+	uint32_t v[2] = { x & 0xffff, y & 0xffff };
+	for (uint32_t& u : v)
+	{
+		u = (u | (u << 8)) & 0x00ff00ff;
+		u = (u | (u << 4)) & 0x0f0f0f0f;
+		u = (u | (u << 2)) & 0x33333333;
+		u = (u | (u << 1)) & 0x55555555;
+	}
+	return v[0] | (v[1] << 1);
+}
+
+inline bool isPowerOf2(int v) { return v > 0 && (v & (v - 1)) == 0; }
+
+inline int roundUpPow2(int v)
+{
+	v--;
+	v |= v >> 1;
+	v |= v >> 2;
+	v |= v >> 4;
+	v |= v >> 8;
+	v |= v >> 16;
+	return v + 1;
+}
+
+// Inverse of _a_ modulo _n_, _a_ and _n_ being coprime
+int64_t multiplicativeInverse(int64_t a, int64_t n);
+
+// First two dimensions of the Sobol sequence at _index_, as 32 bit fixed point values packed in
+// the low and high halves. The generator matrices are folded into tables of one entry per byte
+// of the index, so that both dimensions come out of four lookups and XORs.
+uint64_t sobolSample2D(uint32_t index);
+
+// Fill _samples_ with _nPixelSamples_ blocks of _nSamplesPerPixelSample_ values taken from the
+// first dimensions of a (0,2)-sequence, both counts being powers of two. The digits are randomly
+// scrambled, then the values are shuffled inside each block and the blocks among themselves, so
+// that every block is well distributed on its own and uncorrelated with the other dimensions.
+void vanDerCorput(int nSamplesPerPixelSample, int nPixelSamples, Float* samples, Rng& rng);
+void sobol2D(int nSamplesPerPixelSample, int nPixelSamples, Vector2f* samples, Rng& rng);
+
+// Owen scrambling of the bits of _v_ by a hash of their prefixes (Burley 2020)
+inline uint32_t fastOwenScramble(uint32_t v, uint32_t seed)
+{
+	v = reverseBits32(v);
+	v ^= v * 0x3d20adea;
+	v += seed;
+	v *= (seed >> 16) | 1;
+	v ^= v * 0x05526c56;
+	v ^= v * 0x53a22864;
+	return reverseBits32(v);
+}
+
+// Element _i_ of a random permutation of [0, _l_) selected by _p_ (Kensler 2013)
+inline uint32_t permutationElement(uint32_t i, uint32_t l, uint32_t p)
+{
+	uint32_t w = l - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do
+	{
+		i ^= p;
+		i *= 0xe170893d;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8;
+		i *= 0x0929eb3f;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | p >> 27;
+		i *= 0x6935fa69;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3df;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= l);
+	return (i + p) % l;
+}
+
+// 64 bit finalizer, to derive seeds from pixel coordinates and dimensions
+inline uint64_t mixBits(uint64_t v)
+{
+	v ^= (v >> 31);
+	v *= 0x7fb5d329728ea185ull;
+	v ^= (v >> 27);
+	v *= 0x81dadef4bc2dd44dull;
+	v ^= (v >> 33);
+	return v;
+}
+
+RENDER_END
@@ -0,0 +1,33 @@
+#include "Medium.h"
+
+RENDER_BEGIN
+
+Float HenyeyGreenstein::p(const Vector3f& wo, const Vector3f& wi) const
+{
+	return phaseHG(dot(wo, wi), m_g);
+}
+
+Float HenyeyGreenstein::sample_p(const Vector3f& wo, Vector3f& wi, const Vector2f& u) const
+{
+	// Compute the cosine between wi and the forward direction -wo
+	Float cosTheta;
+	if (glm::abs(m_g) < 1e-3f)
+	{
+		cosTheta = 1 - 2 * u[0];
+	}
+	else
+	{
+		Float sqrTerm = (1 - m_g * m_g) / (1 - m_g + 2 * m_g * u[0]);
+		cosTheta = (1 + m_g * m_g - sqrTerm * sqrTerm) / (2 * m_g);
+	}
+
+	// Compute direction _wi_ for Henyey--Greenstein sample
+	Float sinTheta = glm::sqrt(glm::max((Float)0, 1 - cosTheta * cosTheta));
+	Float phi = 2 * Pi * u[1];
+	Vector3f v1, v2;
+	coordinateSystem(-wo, v1, v2);
+	wi = sphericalDirection(sinTheta, cosTheta, phi, v1, v2, -wo);
+	return phaseHG(-cosTheta, m_g);
+}
+
+RENDER_END
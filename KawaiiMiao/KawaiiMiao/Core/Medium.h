@@ -1,43 +1,81 @@
 #pragma once
 
 #include "Rendering.h"
+#include "Rtti.h"
+#include "Spectrum.h"
 #include "../Math/KMathUtil.h"
 
 RENDER_BEGIN
 
+// Henyey-Greenstein phase function, _cosTheta_ is the cosine between wo and wi
+inline Float phaseHG(Float cosTheta, Float g)
+{
+	Float denom = 1 + g * g + 2 * g * cosTheta;
+	return Inv4Pi * (1 - g * g) / (denom * glm::sqrt(denom));
+}
+
 // Media Declarations
-class PhaseFunction 
+class PhaseFunction
 {
 public:
-    // PhaseFunction Interface
-    virtual ~PhaseFunction();
-    virtual Float p(const Vector3f& wo, const Vector3f& wi) const = 0;
-    virtual Float Sample_p(const Vector3f& wo, Vector3f* wi, const Vector2f& u) const = 0;
-    virtual std::string ToString() const = 0;
+	// PhaseFunction Interface
+	virtual ~PhaseFunction() = default;
+	virtual Float p(const Vector3f& wo, const Vector3f& wi) const = 0;
+	// Sample wi, the phase function value is returned and is also its pdf
+	virtual Float sample_p(const Vector3f& wo, Vector3f& wi, const Vector2f& u) const = 0;
+	virtual std::string toString() const = 0;
 };
 
-inline std::ostream& operator<<(std::ostream& os, const PhaseFunction& p) {
-    os << p.ToString();
-    return os;
+inline std::ostream& operator<<(std::ostream& os, const PhaseFunction& p)
+{
+	os << p.toString();
+	return os;
 }
 
-class Medium
+class HenyeyGreenstein final : public PhaseFunction
 {
 public:
+	HenyeyGreenstein(Float g) : m_g(g) {}
+
+	virtual Float p(const Vector3f& wo, const Vector3f& wi) const override;
+	virtual Float sample_p(const Vector3f& wo, Vector3f& wi, const Vector2f& u) const override;
+
+	virtual std::string toString() const override { return "HenyeyGreenstein[ g: " + std::to_string(m_g) + " ]"; }
 
 private:
+	// Asymmetry parameter, positive values scatter forward
+	const Float m_g;
+};
+
+// A participating medium. Rays carry the medium their origin lies in, the distances along them
+// are in world space since ray directions are normalized.
+class Medium : public AObject
+{
+public:
+	typedef std::shared_ptr<Medium> ptr;
+
+	virtual ~Medium() = default;
+
+	// Transmittance between the ray origin and ray(tMax)
+	virtual Spectrum Tr(const Ray& ray, Sampler& sampler) const = 0;
+
+	// Sample a scattering point before ray(tMax), filling _mi_ if there is one. The returned weight
+	// is the transmittance times the scattering coefficient divided by the sampling pdf.
+	virtual Spectrum sample(const Ray& ray, Sampler& sampler, MemoryArena& arena,
+		MediumInteraction& mi) const = 0;
 
+	virtual ClassType getClassType() const override { return ClassType::RMedium; }
 };
 
 struct MediumInterface
 {
-    MediumInterface() : inside(nullptr), outside(nullptr) {}
-    // MediumInterface Public Methods
-    MediumInterface(const Medium* medium) : inside(medium), outside(medium) {}
-    MediumInterface(const Medium* inside, const Medium* outside)
-        : inside(inside), outside(outside) {}
-    bool IsMediumTransition() const { return inside != outside; }
-    const Medium* inside, * outside;
+	MediumInterface() : inside(nullptr), outside(nullptr) {}
+	// MediumInterface Public Methods
+	MediumInterface(const Medium* medium) : inside(medium), outside(medium) {}
+	MediumInterface(const Medium* inside, const Medium* outside)
+		: inside(inside), outside(outside) {}
+	bool IsMediumTransition() const { return inside != outside; }
+	const Medium* inside, * outside;
 };
 
-RENDER_END
\ No newline at end of file
+RENDER_END
@@ -5,8 +5,8 @@
 RENDER_BEGIN
 
 PrimitiveObject::PrimitiveObject(const Shape::ptr& shape, const Material* material,
-	const AreaLight::ptr& areaLight)
-	: m_shape(shape), m_material(material), m_areaLight(areaLight) 
+	const AreaLight::ptr& areaLight, const MediumInterface& mediumInterface)
+	: m_shape(shape), m_material(material), m_areaLight(areaLight), m_mediumInterface(mediumInterface) 
 {
 	if (m_areaLight != nullptr)
 	{
@@ -14,16 +14,41 @@ PrimitiveObject::PrimitiveObject(const Shape::ptr& shape, const Material* materi
 	}
 }
 
+bool Primitive::hit(const Ray& ray, SurfaceInteraction& isect) const
+{
+	// Note: the interaction is only computed once, for the closest hit
+	HitRecord record;
+	if (!hit(ray, record))
+		return false;
+	const Primitive* primitive = record.m_instance != nullptr ? record.m_instance : record.m_primitive;
+	if (!primitive->computeSurfaceInteraction(ray, record, isect))
+		return false;
+
+	isect.time = ray.m_time;
+	return true;
+}
+
 bool PrimitiveObject::hit(const Ray& ray) const { return m_shape->hit(ray); }
 
-bool PrimitiveObject::hit(const Ray& ray, SurfaceInteraction& isect) const
+bool PrimitiveObject::hit(const Ray& ray, HitRecord& record) const
 {
-	Float tHit;
-	if (!m_shape->hit(ray, tHit, isect))
+	if (!m_shape->hit(ray, record))
+		return false;
+
+	ray.m_tMax = record.m_tHit;
+	record.m_primitive = this;
+	record.m_instance = nullptr;
+	return true;
+}
+
+bool PrimitiveObject::computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+	SurfaceInteraction& isect) const
+{
+	if (!m_shape->computeSurfaceInteraction(ray, record, isect))
 		return false;
 
-	ray.m_tMax = tHit;
 	isect.primitive = this;
+	isect.mediumInterface = m_mediumInterface.IsMediumTransition() ? m_mediumInterface : MediumInterface(ray.m_medium);
 	return true;
 }
 
@@ -44,7 +69,104 @@ const AreaLight* PrimitiveObject::getAreaLight() const { return m_areaLight.get(
 
 const Material* PrimitiveObject::getMaterial() const { return m_material; }
 
+// ------------------------ Instance ---------------------------------
+PrimitiveInstance::PrimitiveInstance(const Primitive::ptr& primitive, const Transform& objectToWorld,
+	const Material* material)
+	: PrimitiveInstance(primitive, objectToWorld, 0.f, objectToWorld, 1.f, material) {}
+
+PrimitiveInstance::PrimitiveInstance(const Primitive::ptr& primitive, const Transform& startObjectToWorld,
+	Float startTime, const Transform& endObjectToWorld, Float endTime, const Material* material)
+	: m_primitive(primitive), m_objectToWorld{ startObjectToWorld, endObjectToWorld },
+	m_worldToObject(inverse(startObjectToWorld)),
+	m_animatedObjectToWorld(&m_objectToWorld[0], startTime, &m_objectToWorld[1], endTime),
+	m_material(material) {}
+
+Bounds3f PrimitiveInstance::worldBound() const { return m_animatedObjectToWorld.motionAABB(m_primitive->worldBound()); }
+
+Bounds3f PrimitiveInstance::worldBound(Float time0, Float time1) const
+{
+	return m_animatedObjectToWorld.motionAABB(m_primitive->worldBound(), time0, time1);
+}
+
+Transform PrimitiveInstance::getWorldToObject(Float time) const
+{
+	if (!m_animatedObjectToWorld.isAnimated())
+		return m_worldToObject;
+
+	Transform objectToWorld;
+	m_animatedObjectToWorld.interpolate(time, &objectToWorld);
+	return inverse(objectToWorld);
+}
+
+Transform PrimitiveInstance::getObjectToWorld(Float time) const
+{
+	if (!m_animatedObjectToWorld.isAnimated())
+		return m_objectToWorld[0];
+
+	Transform objectToWorld;
+	m_animatedObjectToWorld.interpolate(time, &objectToWorld);
+	return objectToWorld;
+}
+
+Ray PrimitiveInstance::toObjectSpace(const Ray& ray, const Transform& worldToObject, Float& scale) const
+{
+	// Note: rays always have a normalized direction, so distances get scaled by the transform
+	Vector3f dir = worldToObject(ray.m_dir, 0.0f);
+	scale = length(dir);
+	return Ray(worldToObject(ray.m_origin, 1.0f), dir, ray.m_tMax * scale, ray.m_time, ray.m_medium);
+}
+
+bool PrimitiveInstance::hit(const Ray& ray) const
+{
+	Float scale;
+	return m_primitive->hit(toObjectSpace(ray, getWorldToObject(ray.m_time), scale));
+}
+
+bool PrimitiveInstance::hit(const Ray& ray, HitRecord& record) const
+{
+	Float scale;
+	Ray objectRay = toObjectSpace(ray, getWorldToObject(ray.m_time), scale);
+	if (!m_primitive->hit(objectRay, record))
+		return false;
+
+	ray.m_tMax = objectRay.m_tMax / scale;
+	record.m_tHit = ray.m_tMax;
+	record.m_instance = this;
+	return true;
+}
+
+bool PrimitiveInstance::computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+	SurfaceInteraction& isect) const
+{
+	Float scale;
+	const Transform objectToWorld = getObjectToWorld(ray.m_time);
+	if (!record.m_primitive->computeSurfaceInteraction(toObjectSpace(ray, inverse(objectToWorld), scale), record, isect))
+		return false;
+
+	// Note: the normals go through the inverse transpose, which keeps them right under non uniform scales
+	isect = objectToWorld(isect);
+	isect.primitive = this;
+	return true;
+}
+
+void PrimitiveInstance::computeScatteringFunctions(SurfaceInteraction& isect, MemoryArena& arena,
+	TransportMode mode, bool allowMultipleLobes) const
+{
+	if (m_material != nullptr)
+	{
+		m_material->computeScatteringFunctions(isect, arena, mode, allowMultipleLobes);
+	}
+}
+
 // ------------------------ Aggregate ---------------------------------
+bool PrimitiveAggregate::computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+	SurfaceInteraction& isect) const
+{
+	//Note: should not go here at all, records always point to the primitive that was hit.
+	std::cout << "APrimitiveAggregate::computeSurfaceInteraction() shouldn't be ""called";
+	return false;
+}
+
 const AreaLight* PrimitiveAggregate::getAreaLight() const { return nullptr; }
 
 const Material* PrimitiveAggregate::getMaterial() const { return nullptr; }
@@ -4,6 +4,7 @@
 #include "Light.h"
 #include "Shape.h"
 #include "Material.h"
+#include "Medium.h"
 #include "Rtti.h"
 
 RENDER_BEGIN
@@ -18,10 +19,17 @@ public:
 
 	// Ray intersection test
 	virtual bool hit(const Ray & ray) const = 0;
-	virtual bool hit(const Ray & ray, SurfaceInteraction & iset) const = 0;
+	virtual bool hit(const Ray & ray, SurfaceInteraction & iset) const;
+
+	// Closest hit test that only fills a compact record, see HitRecord
+	virtual bool hit(const Ray & ray, HitRecord & record) const = 0;
+	virtual bool computeSurfaceInteraction(const Ray & ray, const HitRecord & record,
+		SurfaceInteraction & iset) const = 0;
 
 	// Return a box that encloses the primitive geometry in world space.
 	virtual Bounds3f worldBound() const = 0;
+	// Return a box that encloses the primitive geometry during [time0, time1], only moving primitives differ
+	virtual Bounds3f worldBound(Float time0, Float time1) const { return worldBound(); }
 
 	virtual const AreaLight* getAreaLight() const = 0;
 	virtual const Material* getMaterial() const = 0;
@@ -38,10 +46,13 @@ public:
 	typedef std::shared_ptr<PrimitiveObject> ptr;
 
 	PrimitiveObject(const Shape::ptr &shape, const Material* material, 
-		const AreaLight::ptr& areaLight);
+		const AreaLight::ptr& areaLight, const MediumInterface& mediumInterface = MediumInterface());
 	virtual Bounds3f worldBound() const;
+	using Primitive::hit;
 	virtual bool hit(const Ray& ray) const override;
-	virtual bool hit(const Ray& ray, SurfaceInteraction& iset) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+	virtual bool computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+		SurfaceInteraction& iset) const override;
 
 	Shape* getShape() const;
 
@@ -58,11 +69,56 @@ private:
 	Shape::ptr m_shape;
 	AreaLight::ptr m_areaLight;
 	const Material* m_material;
+	// Media inside and outside of the shape, a shape separating no media lies in the ray's medium
+	MediumInterface m_mediumInterface;
+};
+
+// A shared primitive (usually the object space accelerator of a mesh) placed in the world by a transform,
+// so that repeated geometry and its acceleration structure are stored only once.
+// The transform may be animated, the instance then moves from start to end transform for motion blur.
+// Note: the instance supplies the material, instanced geometry can't be an area light.
+class PrimitiveInstance : public Primitive
+{
+public:
+	typedef std::shared_ptr<PrimitiveInstance> ptr;
+
+	PrimitiveInstance(const Primitive::ptr& primitive, const Transform& objectToWorld, const Material* material);
+	PrimitiveInstance(const Primitive::ptr& primitive, const Transform& startObjectToWorld, Float startTime,
+		const Transform& endObjectToWorld, Float endTime, const Material* material);
+
+	virtual Bounds3f worldBound() const override;
+	virtual Bounds3f worldBound(Float time0, Float time1) const override;
+	using Primitive::hit;
+	virtual bool hit(const Ray& ray) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+	virtual bool computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+		SurfaceInteraction& iset) const override;
+
+	virtual const AreaLight* getAreaLight() const override { return nullptr; }
+	virtual const Material* getMaterial() const override { return m_material; }
+
+	virtual void computeScatteringFunctions(SurfaceInteraction& isect, MemoryArena& arena,
+		TransportMode mode, bool allowMultipleLobes) const override;
+
+	virtual std::string toString() const override { return "PrimitiveInstance[]"; }
+
+private:
+	Transform getWorldToObject(Float time) const;
+	Transform getObjectToWorld(Float time) const;
+	Ray toObjectSpace(const Ray& ray, const Transform& worldToObject, Float& scale) const;
+
+	Primitive::ptr m_primitive;
+	Transform m_objectToWorld[2], m_worldToObject;
+	AnimatedTransform m_animatedObjectToWorld;
+	const Material* m_material;
 };
 
 class PrimitiveAggregate : public Primitive
 {
 public:
+	virtual bool computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+		SurfaceInteraction& iset) const override;
+
 	virtual const AreaLight* getAreaLight() const override;
 	virtual const Material* getMaterial() const override;
 
@@ -66,8 +66,10 @@ class Shape;
 class Scene;
 class Camera;
 class Primitive;
+struct HitRecord;
 class Medium;
 class FilmTile;
+class FilmSplatBuffer;
 class Sampler;
 class Material; 
 class AreaLight;
@@ -76,6 +78,7 @@ class Integrator;
 class CameraSample;
 class RGBSpectrum;
 class Distribution1D;
+class LightDistribution;
 class VisibilityTester;
 class MemoryArena;
 class MediumInteraction;
@@ -174,6 +174,8 @@ public:
 		RFilter,
 		RFilm,
 		REntity,
+		RMedium,
+		RDenoiser,
 		EClassTypeCount
 	};
 
@@ -229,6 +231,8 @@ public:
 		case RFilter:     return "Filter";
 		case RFilm:       return "Film";
 		case REntity:	   return "Entity";
+		case RMedium:     return "Medium";
+		case RDenoiser:   return "Denoiser";
 		default:           return "Unknown";
 		}
 	}
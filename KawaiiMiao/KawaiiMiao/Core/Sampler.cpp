@@ -22,6 +22,7 @@ CameraSample Sampler::getCameraSample(const Vector2i& pRaster)
 {
 	CameraSample cs;
 	cs.pFilm = (Vector2f)pRaster + get2D();
+	cs.time = get1D();
 	return cs;
 }
 
@@ -44,40 +45,81 @@ bool Sampler::setSampleNumber(int64_t sampleNum)
 {
 	// Reset array offsets for next pixel sample
 	m_array1DOffset = m_array2DOffset = 0;
-	m_currentPixelSampleIndex = sampleNum;
-	return m_currentPixelSampleIndex < samplesPerPixel;
+	// Note: past the samples of the pixel the sequence wraps around, the samplers generating their
+	//       values from the sample number continue it from _sampleNum_ rather
+	m_currentPixelSampleIndex = sampleNum % samplesPerPixel;
+	return sampleNum < samplesPerPixel;
 }
 
 void Sampler::request1DArray(int n)
 {
 	CHECK_EQ(roundCount(n), n);
 	m_samples1DArraySizes.push_back(n);
-	m_sampleArray1D.push_back(std::vector<Float>(n * samplesPerPixel));
+	m_sampleArray1DOffsets.push_back(m_sampleArray1D.size());
+	m_sampleArray1D.resize(m_sampleArray1D.size() + n * samplesPerPixel);
 }
 
 void Sampler::request2DArray(int n)
 {
 	CHECK_EQ(roundCount(n), n);
 	m_samples2DArraySizes.push_back(n);
-	m_sampleArray2D.push_back(std::vector<Vector2f>(n * samplesPerPixel));
+	m_sampleArray2DOffsets.push_back(m_sampleArray2D.size());
+	m_sampleArray2D.resize(m_sampleArray2D.size() + n * samplesPerPixel);
 }
 
 const Float* Sampler::get1DArray(int n)
 {
-	if (m_array1DOffset == m_sampleArray1D.size())
+	if (m_array1DOffset == m_samples1DArraySizes.size())
 		return nullptr;
 	CHECK_EQ(m_samples1DArraySizes[m_array1DOffset], n);
 	CHECK_LT(m_currentPixelSampleIndex, samplesPerPixel);
-	return &m_sampleArray1D[m_array1DOffset++][m_currentPixelSampleIndex * n];
+	return sampleArray1D(m_array1DOffset++) + m_currentPixelSampleIndex * n;
 }
 
 const Vector2f* Sampler::get2DArray(int n)
 {
-	if (m_array2DOffset == m_sampleArray2D.size())
+	if (m_array2DOffset == m_samples2DArraySizes.size())
 		return nullptr;
 	CHECK_EQ(m_samples2DArraySizes[m_array2DOffset], n);
 	CHECK_LT(m_currentPixelSampleIndex, samplesPerPixel);
-	return &m_sampleArray2D[m_array2DOffset++][m_currentPixelSampleIndex * n];
+	return sampleArray2D(m_array2DOffset++) + m_currentPixelSampleIndex * n;
+}
+
+// ---------------------- Pixel Sampler ----------------------
+
+PixelSampler::PixelSampler(int64_t samplesPerPixel, int nSampledDimensions)
+	: Sampler(samplesPerPixel), m_nSampledDimensions(nSampledDimensions),
+	m_samples1D(size_t(nSampledDimensions * samplesPerPixel)),
+	m_samples2D(size_t(nSampledDimensions * samplesPerPixel)) {}
+
+bool PixelSampler::startNextSample()
+{
+	m_current1DDimension = m_current2DDimension = 0;
+	return Sampler::startNextSample();
+}
+
+bool PixelSampler::setSampleNumber(int64_t sampleNum)
+{
+	m_current1DDimension = m_current2DDimension = 0;
+	return Sampler::setSampleNumber(sampleNum);
+}
+
+Float PixelSampler::get1D()
+{
+	CHECK_LT(m_currentPixelSampleIndex, samplesPerPixel);
+	if (m_current1DDimension < m_nSampledDimensions)
+		return samples1D(m_current1DDimension++)[m_currentPixelSampleIndex];
+	else
+		return m_rng.uniformFloat();
+}
+
+Vector2f PixelSampler::get2D()
+{
+	CHECK_LT(m_currentPixelSampleIndex, samplesPerPixel);
+	if (m_current2DDimension < m_nSampledDimensions)
+		return samples2D(m_current2DDimension++)[m_currentPixelSampleIndex];
+	else
+		return Vector2f(m_rng.uniformFloat(), m_rng.uniformFloat());
 }
 
 
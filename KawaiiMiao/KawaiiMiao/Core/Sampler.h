@@ -3,6 +3,7 @@
 #include "Rendering.h"
 #include "../Math/KMathUtil.h"
 #include "Rtti.h"
+#include "../Math/Rng.h"
 
 #include <vector>
 
@@ -22,6 +23,7 @@ public:
 	virtual Vector2f get2D() = 0;
 	CameraSample getCameraSample(const Vector2i& pRaster);
 
+	// Note: arrays must be requested before the sampler is cloned, with a size returned by roundCount()
 	void request1DArray(int n);
 	void request2DArray(int n);
 
@@ -44,15 +46,50 @@ public:
 	virtual ClassType getClassType() const override { return ClassType::RSampler; }
 
 protected:
+	// All the values of the _i_th requested array for the current pixel, the array of
+	// sample _j_ starts at element j * m_samples1DArraySizes[i]
+	Float* sampleArray1D(size_t i) { return &m_sampleArray1D[m_sampleArray1DOffsets[i]]; }
+	Vector2f* sampleArray2D(size_t i) { return &m_sampleArray2D[m_sampleArray2DOffsets[i]]; }
+
 	Vector2f m_currentPixel;
 	int64_t m_currentPixelSampleIndex;
 	std::vector<int> m_samples1DArraySizes, m_samples2DArraySizes;
-	std::vector<std::vector<Float>> m_sampleArray1D;
-	std::vector<std::vector<Vector2f>> m_sampleArray2D;
 
 private:
+	// Note: the requested arrays are packed one after the other in a single buffer per dimension
+	std::vector<size_t> m_sampleArray1DOffsets, m_sampleArray2DOffsets;
+	std::vector<Float> m_sampleArray1D;
+	std::vector<Vector2f> m_sampleArray2D;
 	size_t m_array1DOffset, m_array2DOffset;
 };
 
+// Samplers generating all the samples of a pixel at once, for a fixed number of dimensions.
+// The dimensions past them and the sample arrays are left to the derived class to fill,
+// they default to uniform random values.
+class PixelSampler : public Sampler
+{
+public:
+	PixelSampler(int64_t samplesPerPixel, int nSampledDimensions);
+
+	virtual bool startNextSample() override;
+	virtual bool setSampleNumber(int64_t sampleNum) override;
+
+	virtual Float get1D() override;
+	virtual Vector2f get2D() override;
+
+protected:
+	// Values of dimension _dim_ for all the samples of the pixel
+	Float* samples1D(int dim) { return &m_samples1D[dim * samplesPerPixel]; }
+	Vector2f* samples2D(int dim) { return &m_samples2D[dim * samplesPerPixel]; }
+
+	const int m_nSampledDimensions;
+	int m_current1DDimension = 0, m_current2DDimension = 0;
+	Rng m_rng;
+
+private:
+	std::vector<Float> m_samples1D;
+	std::vector<Vector2f> m_samples2D;
+};
+
 
 RENDER_END
\ No newline at end of file
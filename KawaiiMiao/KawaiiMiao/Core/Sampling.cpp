@@ -2,6 +2,56 @@
 
 RENDER_BEGIN
 
+void stratifiedSample1D(Float* samples, int nSamples, Rng& rng, bool jitter)
+{
+	Float invNSamples = (Float)1 / nSamples;
+	for (int i = 0; i < nSamples; ++i)
+	{
+		Float delta = jitter ? rng.uniformFloat() : 0.5f;
+		samples[i] = glm::min((i + delta) * invNSamples, aOneMinusEpsilon);
+	}
+}
+
+void stratifiedSample2D(Vector2f* samples, int nx, int ny, Rng& rng, bool jitter)
+{
+	Float dx = (Float)1 / nx, dy = (Float)1 / ny;
+	for (int y = 0; y < ny; ++y)
+	{
+		for (int x = 0; x < nx; ++x)
+		{
+			Float jx = jitter ? rng.uniformFloat() : 0.5f;
+			Float jy = jitter ? rng.uniformFloat() : 0.5f;
+			samples->x = glm::min((x + jx) * dx, aOneMinusEpsilon);
+			samples->y = glm::min((y + jy) * dy, aOneMinusEpsilon);
+			++samples;
+		}
+	}
+}
+
+void latinHypercube(Float* samples, int nSamples, int nDim, Rng& rng)
+{
+	// Generate LHS samples along diagonal
+	Float invNSamples = (Float)1 / nSamples;
+	for (int i = 0; i < nSamples; ++i)
+	{
+		for (int j = 0; j < nDim; ++j)
+		{
+			Float sj = (i + rng.uniformFloat()) * invNSamples;
+			samples[nDim * i + j] = glm::min(sj, aOneMinusEpsilon);
+		}
+	}
+
+	// Permute LHS samples in each dimension
+	for (int i = 0; i < nDim; ++i)
+	{
+		for (int j = 0; j < nSamples; ++j)
+		{
+			int other = j + rng.uniformUInt32(nSamples - j);
+			std::swap(samples[nDim * j + i], samples[nDim * other + i]);
+		}
+	}
+}
+
 Vector3f uniformSampleHemisphere(const Vector2f& u)
 {
 	Float z = u[0];
@@ -2,9 +2,32 @@
 
 #include "Rendering.h"
 #include "../Math/KMathUtil.h"
+#include "../Math/Rng.h"
 
 RENDER_BEGIN
 
+// One sample in each of the _nSamples_ strata of [0, 1), at their centers unless _jitter_
+void stratifiedSample1D(Float* samples, int nSamples, Rng& rng, bool jitter = true);
+
+// One sample in each cell of a _nx_ by _ny_ grid over [0, 1)^2, in scanline order
+void stratifiedSample2D(Vector2f* samples, int nx, int ny, Rng& rng, bool jitter = true);
+
+// _nSamples_ points of _nDim_ dimensions each stratified on every single dimension,
+// with the strata of the dimensions randomly paired up
+void latinHypercube(Float* samples, int nSamples, int nDim, Rng& rng);
+
+// Random permutation of _count_ blocks of _nDimensions_ consecutive values
+template <typename T>
+void shuffle(T* samples, int count, int nDimensions, Rng& rng)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		int other = i + rng.uniformUInt32(count - i);
+		for (int j = 0; j < nDimensions; ++j)
+			std::swap(samples[nDimensions * i + j], samples[nDimensions * other + j]);
+	}
+}
+
 Vector3f uniformSampleHemisphere(const Vector2f& u);
 
 Float uniformHemispherePdf();
@@ -1,4 +1,6 @@
 #include "Scene.h"
+#include "Interaction.h"
+#include "Medium.h"
 
 RENDER_BEGIN
 
@@ -12,20 +14,39 @@ bool Scene::hit(const Ray& ray, SurfaceInteraction& isect) const
 	return m_aggreShape->hit(ray, isect);
 }
 
+bool Scene::hit(const Ray& ray, HitRecord& record) const
+{
+	return m_aggreShape->hit(ray, record);
+}
+
+bool Scene::computeSurfaceInteraction(const Ray& ray, const HitRecord& record, SurfaceInteraction& isect) const
+{
+	const Primitive* primitive = record.m_instance != nullptr ? record.m_instance : record.m_primitive;
+	if (!primitive->computeSurfaceInteraction(ray, record, isect))
+		return false;
+
+	isect.time = ray.m_time;
+	return true;
+}
+
 bool Scene::hitTr(Ray ray, Sampler& sampler, SurfaceInteraction& isect, Spectrum& Tr) const
 {
+	// Pass through the surfaces without material, they only bound media
 	Tr = Spectrum(1.f);
-	//while (true) {
-	//	bool hitSurface = hit(ray, isect);
-	//	// Accumulate beam transmittance for ray segment
-	//	if (ray.medium) *Tr *= ray.medium->Tr(ray, sampler);
-
-	//	// Initialize next ray segment or terminate transmittance computation
-	//	if (!hitSurface) return false;
-	//	if (isect->primitive->GetMaterial() != nullptr) return true;
-	//	ray = isect->SpawnRay(ray.d);
-	//}
-	return false;
+	while (true)
+	{
+		bool hitSurface = hit(ray, isect);
+		// Accumulate beam transmittance for ray segment
+		if (ray.m_medium != nullptr)
+			Tr *= ray.m_medium->Tr(ray, sampler);
+
+		// Initialize next ray segment or terminate transmittance computation
+		if (!hitSurface)
+			return false;
+		if (isect.primitive->getMaterial() != nullptr)
+			return true;
+		ray = isect.spawnRay(ray.direction());
+	}
 }
 
-RENDER_END
\ No newline at end of file
+RENDER_END
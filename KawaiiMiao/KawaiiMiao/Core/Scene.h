@@ -31,6 +31,9 @@ public:
 
 	bool hit(const Ray& ray) const;
 	bool hit(const Ray& ray, SurfaceInteraction& isect) const;
+	// Closest hit split in two steps, so that the interactions can be computed later in bulk
+	bool hit(const Ray& ray, HitRecord& record) const;
+	bool computeSurfaceInteraction(const Ray& ray, const HitRecord& record, SurfaceInteraction& isect) const;
 	bool hitTr(Ray ray, Sampler& sampler, SurfaceInteraction& isect, Spectrum& transmittance) const;
 
 	std::vector<Light::ptr> m_lights;
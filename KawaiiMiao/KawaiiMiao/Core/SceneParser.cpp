@@ -1,6 +1,8 @@
 #include "SceneParser.h"
 
 #include <fstream>
+#include <filesystem>
+#include <sstream>
 
 #include "Film.h"
 #include "Filter.h"
@@ -10,6 +12,11 @@
 #include "Light.h"
 #include "Entity.h"
 #include "../Accelerators/KDTree.h"
+#include "../Accelerators/BVH.h"
+#include "../Accelerators/WideBVH.h"
+#include "../Accelerators/MotionBVH.h"
+#include "../Accelerators/CompressedBVH.h"
+#include "../Accelerators/AcceleratorCache.h"
 
 #include "../Tool/Logger.h"
 
@@ -17,12 +24,45 @@ using namespace nlohmann;
 
 RENDER_BEGIN
 
+// Hashes the size and modification time of every file a "Filename" property refers to,
+// the output of the film aside
+static void hashSceneAssets(const json& node, CacheHasher& hasher)
+{
+	if (node.is_array())
+	{
+		for (const auto& child : node)
+			hashSceneAssets(child, hasher);
+		return;
+	}
+	if (!node.is_object())
+		return;
+
+	for (auto it = node.begin(); it != node.end(); ++it)
+	{
+		if (it.key() == "Film")
+			continue;
+		if (it.key() == "Filename" && it.value().is_string())
+		{
+			const std::string filename = APropertyTreeNode::m_directory + it.value().get<std::string>();
+			std::error_code error;
+			hasher.update(filename);
+			hasher.update(uint64_t(std::filesystem::file_size(filename, error)));
+			hasher.update(int64_t(std::filesystem::last_write_time(filename, error).time_since_epoch().count()));
+		}
+		else
+		{
+			hashSceneAssets(it.value(), hasher);
+		}
+	}
+}
+
 void SceneParser::parser(const std::string& path, Scene::ptr& _scene, Integrator::ptr& _integrator)
 {
 	_integrator = nullptr;
 	_scene = nullptr;
 
 	json _scene_json;
+	std::string sceneText;
 	{
 		std::ifstream infile(path);
 
@@ -31,7 +71,10 @@ void SceneParser::parser(const std::string& path, Scene::ptr& _scene, Integrator
 			K_ERROR("Could not open the json file: {0}", path);
 		}
 
-		infile >> _scene_json;
+		std::stringstream buffer;
+		buffer << infile.rdbuf();
+		sceneText = buffer.str();
+		_scene_json = json::parse(sceneText);
 		infile.close();
 	}
 
@@ -123,6 +166,29 @@ void SceneParser::parser(const std::string& path, Scene::ptr& _scene, Integrator
 		}
 		APropertyTreeNode integratorNode = build_property_tree_func("Integrator", _scene_json["Integrator"]);
 		_integrator = Integrator::ptr(static_cast<Integrator*>(AObjectFactory::createInstance(integratorNode.getTypeName(), integratorNode)));
+
+		// Note: the render checkpoints are keyed by the scene file and the files it loads,
+		//       any edit invalidates them
+		CacheHasher sceneHasher;
+		sceneHasher.update(sceneText);
+		hashSceneAssets(_scene_json, sceneHasher);
+		_integrator->setSceneHash(sceneHasher.value());
+	}
+
+	//Cache setup
+	{
+		// Note: opt-in, imported meshes and built accelerators are reused across runs
+		std::string cacheDirectory;
+		if (_scene_json.contains("Cache"))
+		{
+			APropertyTreeNode cacheNode = build_property_tree_func("Cache", _scene_json["Cache"]);
+			cacheDirectory = cacheNode.getPropertyList().getString("Directory", "cache");
+			if (std::filesystem::path(cacheDirectory).is_relative())
+			{
+				cacheDirectory = APropertyTreeNode::m_directory + cacheDirectory;
+			}
+		}
+		AcceleratorCache::setDirectory(cacheDirectory);
 	}
 
 	std::vector<Light::ptr> _lights;
@@ -160,9 +226,80 @@ void SceneParser::parser(const std::string& path, Scene::ptr& _scene, Integrator
 		}
 	}
 
-	KdTree::ptr _aggregate = std::make_shared<KdTree>(_Primitives);
+	//Accelerator loading
+	Primitive::ptr _aggregate = nullptr;
+	{
+		if (_scene_json.contains("Accelerator"))
+		{
+			APropertyTreeNode acceleratorNode = build_property_tree_func("Accelerator", _scene_json["Accelerator"]);
+			_aggregate = createAccelerator(acceleratorNode, _Primitives);
+		}
+		else
+		{
+			_aggregate = std::make_shared<KdTree>(_Primitives);
+		}
+	}
+
 	//ALinearAggregate::ptr _aggregate = std::make_shared<ALinearAggregate>(_Primitives);
 	_scene = std::make_shared<Scene>(_entities, _aggregate, _lights);
 }
 
+Primitive::ptr SceneParser::createAccelerator(const APropertyTreeNode& node, const std::vector<Primitive::ptr>& primitives)
+{
+	const auto& props = node.getPropertyList();
+	const std::string type = props.getString("Type", "KdTree");
+
+	if (type == "BVH")
+	{
+		int maxPrimsInNode = props.getInteger("MaxPrimsInNode", 4);
+		BVHAccel::SplitMethod splitMethod = BVHAccel::parseSplitMethod(props.getString("SplitMethod", "SAH"));
+		return std::make_shared<BVHAccel>(primitives, maxPrimsInNode, splitMethod);
+	}
+
+	if (type == "WideBVH")
+	{
+		int width = props.getInteger("Width", 4);
+		int maxPrimsInNode = props.getInteger("MaxPrimsInNode", 4);
+		BVHAccel::SplitMethod splitMethod = BVHAccel::parseSplitMethod(props.getString("SplitMethod", "SAH"));
+		if (width == 8)
+		{
+			return std::make_shared<OBVHAccel>(primitives, maxPrimsInNode, splitMethod);
+		}
+		if (width != 4)
+		{
+			K_WARN("WideBVH width {0} unsupported. Using 4.", width);
+		}
+		return std::make_shared<QBVHAccel>(primitives, maxPrimsInNode, splitMethod);
+	}
+
+	if (type == "CompressedBVH")
+	{
+		int maxPrimsInNode = props.getInteger("MaxPrimsInNode", 4);
+		BVHAccel::SplitMethod splitMethod = BVHAccel::parseSplitMethod(props.getString("SplitMethod", "SAH"));
+		return std::make_shared<CompressedBVHAccel>(primitives, maxPrimsInNode, splitMethod);
+	}
+
+	if (type == "MotionBVH")
+	{
+		int timeSegments = props.getInteger("TimeSegments", 4);
+		Float startTime = props.getFloat("StartTime", 0.f);
+		Float endTime = props.getFloat("EndTime", 1.f);
+		int maxPrimsInNode = props.getInteger("MaxPrimsInNode", 4);
+		BVHAccel::SplitMethod splitMethod = BVHAccel::parseSplitMethod(props.getString("SplitMethod", "SAH"));
+		return std::make_shared<MotionBVHAccel>(primitives, timeSegments, startTime, endTime, maxPrimsInNode, splitMethod);
+	}
+
+	if (type != "KdTree")
+	{
+		K_WARN("Accelerator \"{0}\" unknown. Using \"KdTree\".", type);
+	}
+
+	int isectCost = props.getInteger("IntersectCost", 80);
+	int traversalCost = props.getInteger("TraversalCost", 1);
+	Float emptyBonus = props.getFloat("EmptyBonus", 0.5f);
+	int maxPrims = props.getInteger("MaxPrims", 1);
+	int maxDepth = props.getInteger("MaxDepth", -1);
+	return std::make_shared<KdTree>(primitives, isectCost, traversalCost, emptyBonus, maxPrims, maxDepth);
+}
+
 RENDER_END
\ No newline at end of file
@@ -15,6 +15,8 @@ public:
 	static void parser(const std::string& path, Scene::ptr& _scene, Integrator::ptr& integrator);
 
 private:
+	static Primitive::ptr createAccelerator(const APropertyTreeNode& node, const std::vector<Primitive::ptr>& primitives);
+
 	using json_value_type = nlohmann::basic_json<>::value_type;
 };
 
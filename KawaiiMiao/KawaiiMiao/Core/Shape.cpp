@@ -19,9 +19,18 @@ Shape::Shape(Transform* objectToWorld, Transform* worldToObject)
 
 bool Shape::hit(const Ray& ray) const
 {
-	Float tHit = ray.m_tMax;
-	SurfaceInteraction isect;
-	return hit(ray, tHit, isect);
+	HitRecord record;
+	return hit(ray, record);
+}
+
+bool Shape::hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect) const
+{
+	HitRecord record;
+	if (!hit(ray, record) || !computeSurfaceInteraction(ray, record, isect))
+		return false;
+
+	tHit = record.m_tHit;
+	return true;
 }
 
 Bounds3f Shape::worldBound() const
@@ -8,6 +8,16 @@
 
 RENDER_BEGIN
 
+// Compact result of a ray intersection test. Traversal only keeps the closest record,
+// the full SurfaceInteraction is computed from it once after the traversal ends.
+struct HitRecord
+{
+	const Primitive* m_primitive = nullptr;
+	const Primitive* m_instance = nullptr; // Set when m_primitive was reached through an instance
+	Float m_tHit = Infinity;
+	Vector3f m_coords; // Shape specific: barycentrics of triangles, object space point of spheres
+};
+
 /*
 * The Shape base class defines the general Shape interface. 
 * The shape class is just a shape, not a specific object. 
@@ -33,7 +43,12 @@ public:
 	virtual bool hit(const Ray& ray) const;
 	// Intersection function, fill in SurfaceInteraction data
 	// Almost all calculations for the intersection of shape and ray are performed by converting ray into object space
-	virtual bool hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect) const = 0;
+	virtual bool hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect) const;
+
+	// Deferred intersection: only record the hit distance and the shape specific coordinates
+	virtual bool hit(const Ray& ray, HitRecord& record) const = 0;
+	// Fill in SurfaceInteraction data from a record returned by hit
+	virtual bool computeSurfaceInteraction(const Ray& ray, const HitRecord& record, SurfaceInteraction& isect) const = 0;
 
 	virtual Float area() const = 0;
 
@@ -54,6 +69,10 @@ public:
 	// used in this case.
 	virtual Float solidAngle(const Vector3f& p, int nSamples = 512) const;
 
+	// Bound the surface normals by the cone of axis _w_ and half angle acos(_cosTheta_),
+	// the default covers the entire sphere of directions.
+	virtual void normalBounds(Vector3f& w, Float& cosTheta) const { w = Vector3f(0, 0, 1); cosTheta = -1; }
+
 	virtual ClassType getClassType() const override { return ClassType::RShape; }
 
 public:
@@ -0,0 +1,211 @@
+#include "ATrousDenoiser.h"
+
+#include "../Accelerators/WideSimd.h"
+#include "../Tool/Parallel.h"
+
+#include <vector>
+
+RENDER_BEGIN
+
+RENDER_REGISTER_CLASS(ATrousDenoiser, "ATrous")
+
+ATrousDenoiser::ATrousDenoiser(const APropertyTreeNode& node)
+{
+	const auto& props = node.getPropertyList();
+	m_iterations = glm::clamp(props.getInteger("Iterations", 5), 1, 8);
+	m_sigmaColor = props.getFloat("SigmaColor", 0.2f);
+	m_sigmaNormal = props.getFloat("SigmaNormal", 0.3f);
+	m_sigmaAlbedo = props.getFloat("SigmaAlbedo", 0.1f);
+	m_sigmaDepth = props.getFloat("SigmaDepth", 0.1f);
+	m_clampFireflies = props.getBoolean("ClampFireflies", true);
+	activate();
+}
+
+// Single precision planes with a border wide enough for the widest kernel, so that
+// the filter loop needs no bounds checks. The border pixels are flagged invalid.
+struct ATrousImage
+{
+	ATrousImage(const Vector2i& resolution, int border)
+		: m_width(resolution.x), m_height(resolution.y), m_border(border)
+	{
+		// Note: the last group of four pixels of a row may read three past the border
+		m_stride = (m_width + 2 * border + 3 + 3) & ~3;
+		m_size = size_t(m_stride) * (m_height + 2 * border);
+	}
+
+	std::vector<float> plane() const { return std::vector<float>(m_size, 0.f); }
+	size_t index(int x, int y) const { return size_t(y + m_border) * m_stride + (x + m_border); }
+
+	int m_width, m_height, m_border, m_stride;
+	size_t m_size;
+};
+
+void ATrousDenoiser::denoise(const Vector2i& resolution, Float* rgb, const DenoiserFeatures& features) const
+{
+	typedef WideSimd<4> simd;
+	typedef simd::vfloat vfloat;
+
+	if (resolution.x <= 0 || resolution.y <= 0)
+		return;
+
+	const int border = 2 << (m_iterations - 1);
+	const ATrousImage image(resolution, border);
+	std::vector<float> color[3] = { image.plane(), image.plane(), image.plane() };
+	std::vector<float> filtered[3] = { image.plane(), image.plane(), image.plane() };
+	std::vector<float> tonemapped[3] = { image.plane(), image.plane(), image.plane() };
+	std::vector<float> albedo[3] = { image.plane(), image.plane(), image.plane() };
+	std::vector<float> normal[3] = { image.plane(), image.plane(), image.plane() };
+	std::vector<float> depth = image.plane(), valid = image.plane();
+
+	// Divide the radiance by the albedo, the filter then only sees the lighting
+	const float albedoEpsilon = 1e-2f;
+	for (int y = 0; y < resolution.y; ++y)
+	{
+		for (int x = 0; x < resolution.x; ++x)
+		{
+			const int i = y * resolution.x + x;
+			const size_t j = image.index(x, y);
+			for (int c = 0; c < 3; ++c)
+			{
+				Float a = features.m_albedo != nullptr ? features.m_albedo[3 * i + c] : 1;
+				Float v = rgb[3 * i + c];
+				albedo[c][j] = float(a);
+				color[c][j] = std::isfinite(v) ? float(v / (a + albedoEpsilon)) : 0.f;
+				normal[c][j] = features.m_normal != nullptr ? float(features.m_normal[3 * i + c]) : 0.f;
+			}
+			depth[j] = features.m_depth != nullptr ? float(features.m_depth[i]) : 0.f;
+			valid[j] = 1.f;
+		}
+	}
+
+	// Note: a firefly would leak into the whole neighbourhood even with a tiny weight, every pixel
+	//       is clamped to twice the brightest of its eight neighbours before filtering
+	if (m_clampFireflies)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			std::vector<float> clamped = color[c];
+			for (int y = 0; y < resolution.y; ++y)
+			{
+				for (int x = 0; x < resolution.x; ++x)
+				{
+					const size_t j = image.index(x, y);
+					float maxNeighbour = 0;
+					for (int dy = -1; dy <= 1; ++dy)
+						for (int dx = -1; dx <= 1; ++dx)
+							if (dx != 0 || dy != 0)
+								maxNeighbour = glm::max(maxNeighbour, color[c][j + ptrdiff_t(dy) * image.m_stride + dx]);
+					clamped[j] = glm::min(color[c][j], 2 * maxNeighbour);
+				}
+			}
+			color[c].swap(clamped);
+		}
+	}
+
+	// B3 spline kernel weights by distance to the center tap
+	static const float kernel[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+	const float invSigmaNormal2 = float(1 / (m_sigmaNormal * m_sigmaNormal));
+	const float invSigmaAlbedo2 = float(1 / (m_sigmaAlbedo * m_sigmaAlbedo));
+	const float invSigmaDepth = float(1 / m_sigmaDepth);
+	const int nGroups = (resolution.x + 3) / 4;
+
+	for (int iteration = 0; iteration < m_iterations; ++iteration)
+	{
+		const int step = 1 << iteration;
+
+		// Note: colors are compared after a x / (1 + x) tone mapping, so that fireflies don't
+		//       stand apart from everything, and the color sigma halves at every iteration
+		const float sigmaColor = float(m_sigmaColor) / float(step);
+		const float invSigmaColor2 = 1 / (sigmaColor * sigmaColor);
+		for (int c = 0; c < 3; ++c)
+		{
+			for (size_t j = 0; j < image.m_size; ++j)
+				tonemapped[c][j] = color[c][j] / (1 + color[c][j]);
+		}
+
+		AParallelUtils::parallelFor((size_t)0, (size_t)resolution.y, [&](const size_t& row)
+		{
+			const vfloat zero = simd::set1(0.f), one = simd::set1(1.f);
+			const vfloat sixteenth = simd::set1(1.f / 16.f);
+			for (int group = 0; group < nGroups; ++group)
+			{
+				const size_t p = image.index(4 * group, int(row));
+
+				// Center pixel features of the four lanes
+				vfloat tp[3], np[3], ap[3];
+				for (int c = 0; c < 3; ++c)
+				{
+					tp[c] = simd::load(&tonemapped[c][p]);
+					np[c] = simd::load(&normal[c][p]);
+					ap[c] = simd::load(&albedo[c][p]);
+				}
+				const vfloat zp = simd::load(&depth[p]);
+				const vfloat depthScale = simd::div(simd::set1(invSigmaDepth), simd::max(zp, simd::set1(1e-3f)));
+
+				vfloat sum[3] = { zero, zero, zero };
+				vfloat weightSum = zero;
+				for (int dy = -2; dy <= 2; ++dy)
+				{
+					for (int dx = -2; dx <= 2; ++dx)
+					{
+						const size_t q = p + ptrdiff_t(dy * step) * image.m_stride + dx * step;
+						const vfloat h = simd::set1(kernel[glm::abs(dx)] * kernel[glm::abs(dy)]);
+
+						// Squared distances in color, normal and albedo plus the relative depth difference
+						vfloat dColor = zero, dNormal = zero, dAlbedo = zero;
+						for (int c = 0; c < 3; ++c)
+						{
+							vfloat d = simd::sub(tp[c], simd::load(&tonemapped[c][q]));
+							dColor = simd::add(dColor, simd::mul(d, d));
+							d = simd::sub(np[c], simd::load(&normal[c][q]));
+							dNormal = simd::add(dNormal, simd::mul(d, d));
+							d = simd::sub(ap[c], simd::load(&albedo[c][q]));
+							dAlbedo = simd::add(dAlbedo, simd::mul(d, d));
+						}
+						vfloat dDepth = simd::sub(zp, simd::load(&depth[q]));
+						dDepth = simd::max(dDepth, simd::sub(zero, dDepth));
+
+						vfloat D = simd::mul(dColor, simd::set1(invSigmaColor2));
+						D = simd::add(D, simd::mul(dNormal, simd::set1(invSigmaNormal2)));
+						D = simd::add(D, simd::mul(dAlbedo, simd::set1(invSigmaAlbedo2)));
+						D = simd::add(D, simd::mul(dDepth, depthScale));
+
+						// exp(-D) approximated by (1 + D / 16)^-16, which is cheaper and never underflows
+						vfloat w = simd::div(one, simd::add(one, simd::mul(D, sixteenth)));
+						w = simd::mul(w, w);
+						w = simd::mul(w, w);
+						w = simd::mul(w, w);
+						w = simd::mul(w, w);
+						w = simd::mul(w, simd::mul(h, simd::load(&valid[q])));
+
+						for (int c = 0; c < 3; ++c)
+							sum[c] = simd::add(sum[c], simd::mul(w, simd::load(&color[c][q])));
+						weightSum = simd::add(weightSum, w);
+					}
+				}
+
+				// Note: the lanes past the end of the row land in the border and stay at zero
+				const vfloat scale = simd::div(simd::load(&valid[p]), simd::max(weightSum, simd::set1(1e-20f)));
+				for (int c = 0; c < 3; ++c)
+					simd::store(&filtered[c][p], simd::mul(sum[c], scale));
+			}
+		}, ExecutionPolicy::PARALLEL);
+
+		for (int c = 0; c < 3; ++c)
+			color[c].swap(filtered[c]);
+	}
+
+	// Multiply the albedo back
+	for (int y = 0; y < resolution.y; ++y)
+	{
+		for (int x = 0; x < resolution.x; ++x)
+		{
+			const int i = y * resolution.x + x;
+			const size_t j = image.index(x, y);
+			for (int c = 0; c < 3; ++c)
+				rgb[3 * i + c] = Float(color[c][j] * (albedo[c][j] + albedoEpsilon));
+		}
+	}
+}
+
+RENDER_END
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../Core/Denoiser.h"
+
+RENDER_BEGIN
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010). Every iteration convolves the image
+// with a 5x5 B3 spline kernel whose taps are spread 2^i pixels apart, each tap being weighted down
+// by its distance to the center pixel in color, shading normal, albedo and relative depth. The
+// radiance is divided by the albedo before filtering so that textures are not blurred.
+class ATrousDenoiser final : public Denoiser
+{
+public:
+	typedef std::shared_ptr<ATrousDenoiser> ptr;
+
+	ATrousDenoiser(const APropertyTreeNode& node);
+
+	virtual void denoise(const Vector2i& resolution, Float* rgb, const DenoiserFeatures& features) const override;
+
+	virtual std::string toString() const override { return "ATrousDenoiser[]"; }
+
+private:
+	int m_iterations;
+	Float m_sigmaColor;
+	Float m_sigmaNormal;
+	Float m_sigmaAlbedo;
+	Float m_sigmaDepth;
+	bool m_clampFireflies;
+};
+
+RENDER_END
@@ -0,0 +1,725 @@
+#include "BDPTIntegrator.h"
+
+#include "../Core/BSDF.h"
+#include "../Core/Scene.h"
+#include "../Core/Film.h"
+#include "../Core/Primitive.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Parallel.h"
+#include "../Tool/Reporter.h"
+#include "../Tool/Logger.h"
+
+#include <tbb/tbb/enumerable_thread_specific.h>
+
+#include <unordered_map>
+
+RENDER_BEGIN
+
+typedef std::unordered_map<const Light*, size_t> LightIndexMap;
+
+enum class VertexType { Camera, Light, Surface };
+
+// Vertex of a camera or light subpath. The end points only use the position, normal and time of
+// _m_si_, _m_light_ is null for the vertex of a camera ray escaping to the infinite lights.
+struct PathVertex
+{
+	VertexType m_type = VertexType::Surface;
+	Spectrum m_beta;
+	SurfaceInteraction m_si;
+	const Camera* m_camera = nullptr;
+	const Light* m_light = nullptr;
+	bool m_delta = false;
+	// Densities of sampling the vertex from its predecessor and from its successor, per unit area
+	Float m_pdfFwd = 0, m_pdfRev = 0;
+
+	const Vector3f& p() const { return m_si.p; }
+	const Vector3f& normal() const { return m_si.normal; }
+	bool isOnSurface() const { return m_si.normal != Vector3f(0.f); }
+
+	static PathVertex createCamera(const Camera* camera, const Ray& ray, const Spectrum& beta)
+	{
+		PathVertex v;
+		v.m_type = VertexType::Camera;
+		v.m_camera = camera;
+		v.m_si.p = ray.origin();
+		v.m_si.normal = Vector3f(0.f);
+		v.m_si.time = ray.m_time;
+		v.m_beta = beta;
+		return v;
+	}
+
+	static PathVertex createCamera(const Camera* camera, const Interaction& it, const Spectrum& beta)
+	{
+		PathVertex v;
+		v.m_type = VertexType::Camera;
+		v.m_camera = camera;
+		v.m_si.p = it.p;
+		v.m_si.normal = it.normal;
+		v.m_si.time = it.time;
+		v.m_beta = beta;
+		return v;
+	}
+
+	static PathVertex createLight(const Light* light, const Interaction& it, const Spectrum& Le, Float pdf)
+	{
+		PathVertex v;
+		v.m_type = VertexType::Light;
+		v.m_light = light;
+		v.m_si.p = it.p;
+		v.m_si.normal = it.normal;
+		v.m_si.time = it.time;
+		v.m_beta = Le;
+		v.m_pdfFwd = pdf;
+		return v;
+	}
+
+	// Vertex of a ray leaving the scene, it stands for the infinite lights
+	static PathVertex createEscaped(const Ray& ray, const Spectrum& beta, Float pdf)
+	{
+		PathVertex v;
+		v.m_type = VertexType::Light;
+		v.m_si.p = ray(1);
+		v.m_si.normal = -ray.direction();
+		v.m_si.time = ray.m_time;
+		v.m_beta = beta;
+		v.m_pdfFwd = pdf;
+		return v;
+	}
+
+	static PathVertex createSurface(const SurfaceInteraction& si, const Spectrum& beta, Float pdf,
+		const PathVertex& prev)
+	{
+		PathVertex v;
+		v.m_type = VertexType::Surface;
+		v.m_si = si;
+		v.m_beta = beta;
+		v.m_pdfFwd = prev.convertDensity(pdf, v);
+		return v;
+	}
+
+	Spectrum f(const PathVertex& next) const
+	{
+		Vector3f wi = normalize(next.p() - p());
+		return m_type == VertexType::Surface ? m_si.bsdf->f(m_si.wo, wi) : Spectrum(0.f);
+	}
+
+	bool isConnectible() const
+	{
+		switch (m_type)
+		{
+		case VertexType::Camera:
+			return true;
+		case VertexType::Light:
+			return m_light == nullptr || (m_light->flags & (int)LightFlags::LightDeltaDirection) == 0;
+		default:
+			return m_si.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0;
+		}
+	}
+
+	const Light* areaLight() const
+	{
+		return m_type == VertexType::Surface && m_si.primitive ? m_si.primitive->getAreaLight() : nullptr;
+	}
+
+	bool isLight() const { return m_type == VertexType::Light || areaLight() != nullptr; }
+
+	bool isDeltaLight() const
+	{
+		return m_type == VertexType::Light && m_light != nullptr && Render::isDeltaLight(m_light->flags);
+	}
+
+	bool isInfiniteLight() const
+	{
+		return m_type == VertexType::Light && (m_light == nullptr ||
+			(m_light->flags & (int)LightFlags::LightInfinite) != 0 ||
+			(m_light->flags & (int)LightFlags::LightDeltaDirection) != 0);
+	}
+
+	// Radiance the vertex emits towards _v_
+	Spectrum Le(const Scene& scene, const PathVertex& v) const
+	{
+		if (!isLight())
+			return Spectrum(0.f);
+		Vector3f w = v.p() - p();
+		if (lengthSquared(w) == 0)
+			return Spectrum(0.f);
+		w = normalize(w);
+		if (isInfiniteLight())
+		{
+			Spectrum Le(0.f);
+			for (const auto& light : scene.m_infiniteLights)
+				Le += light->Le(Ray(p(), -w));
+			return Le;
+		}
+		return m_si.Le(w);
+	}
+
+	// Convert the solid angle density _pdf_ of sampling _next_ from this vertex to area density
+	Float convertDensity(Float pdf, const PathVertex& next) const
+	{
+		if (next.isInfiniteLight())
+			return pdf;
+		Vector3f w = next.p() - p();
+		if (lengthSquared(w) == 0)
+			return 0;
+		Float invDist2 = 1 / lengthSquared(w);
+		if (next.isOnSurface())
+			pdf *= absDot(next.normal(), w * std::sqrt(invDist2));
+		return pdf * invDist2;
+	}
+
+	// Area density of sampling _next_ from this vertex, _prev_ being the vertex before it
+	Float pdf(const Scene& scene, const PathVertex* prev, const PathVertex& next) const
+	{
+		if (m_type == VertexType::Light)
+			return pdfLight(scene, next);
+
+		Vector3f wn = next.p() - p();
+		if (lengthSquared(wn) == 0)
+			return 0;
+		wn = normalize(wn);
+		Vector3f wp;
+		if (prev)
+		{
+			wp = prev->p() - p();
+			if (lengthSquared(wp) == 0)
+				return 0;
+			wp = normalize(wp);
+		}
+		else
+			DCHECK(m_type == VertexType::Camera);
+
+		Float pdf = 0, unused;
+		if (m_type == VertexType::Camera)
+			m_camera->pdf_We(Ray(p(), wn, Infinity, m_si.time), unused, pdf);
+		else
+			pdf = m_si.bsdf->pdf(wp, wn);
+
+		return convertDensity(pdf, next);
+	}
+
+	// Area density of a light subpath leaving this light vertex towards _v_
+	Float pdfLight(const Scene& scene, const PathVertex& v) const
+	{
+		Vector3f w = v.p() - p();
+		Float invDist2 = 1 / lengthSquared(w);
+		w *= std::sqrt(invDist2);
+		Float pdf;
+		if (isInfiniteLight())
+		{
+			// Note: infinite lights shoot their rays through a disk facing the scene
+			const Bounds3f& worldBound = scene.worldBound();
+			Float worldRadius = length(worldBound.diagonal()) * 0.5f;
+			pdf = 1 / (Pi * worldRadius * worldRadius);
+		}
+		else
+		{
+			const Light* light = m_type == VertexType::Light ? m_light : areaLight();
+			DCHECK(light != nullptr);
+
+			Float pdfPos, pdfDir;
+			light->pdf_Le(Ray(p(), w, Infinity, m_si.time), normal(), pdfPos, pdfDir);
+			pdf = pdfDir * invDist2;
+		}
+		if (v.isOnSurface())
+			pdf *= absDot(v.normal(), w);
+		return pdf;
+	}
+
+	// Area density of a light subpath starting at this vertex, choice of the light included
+	Float pdfLightOrigin(const Scene& scene, const PathVertex& v, const Distribution1D& lightDistr,
+		const LightIndexMap& lightToIndex) const
+	{
+		Vector3f w = v.p() - p();
+		if (lengthSquared(w) == 0)
+			return 0;
+		w = normalize(w);
+		if (isInfiniteLight())
+			return infiniteLightDensity(scene, lightDistr, lightToIndex, w);
+
+		const Light* light = m_type == VertexType::Light ? m_light : areaLight();
+		DCHECK(light != nullptr);
+
+		Float pdfPos, pdfDir;
+		Float pdfChoice = lightDistr.discretePDF(int(lightToIndex.find(light)->second));
+		light->pdf_Le(Ray(p(), w, Infinity, m_si.time), normal(), pdfPos, pdfDir);
+		return pdfPos * pdfChoice;
+	}
+
+	static Float infiniteLightDensity(const Scene& scene, const Distribution1D& lightDistr,
+		const LightIndexMap& lightToIndex, const Vector3f& w)
+	{
+		Float pdf = 0;
+		for (const auto& light : scene.m_infiniteLights)
+		{
+			DCHECK(lightToIndex.find(light.get()) != lightToIndex.end());
+			size_t index = lightToIndex.find(light.get())->second;
+			pdf += light->pdf_Li(Interaction(), -w) * lightDistr.discretePDF(int(index));
+		}
+		return pdf;
+	}
+};
+
+// Assign a value for the duration of a scope, used to evaluate MIS weights on modified paths
+template <typename Type>
+class ScopedAssignment
+{
+public:
+	ScopedAssignment(Type* target = nullptr, Type value = Type()) : m_target(target)
+	{
+		if (m_target)
+		{
+			m_backup = *m_target;
+			*m_target = value;
+		}
+	}
+	~ScopedAssignment()
+	{
+		if (m_target)
+			*m_target = m_backup;
+	}
+
+	ScopedAssignment(const ScopedAssignment&) = delete;
+	ScopedAssignment& operator=(const ScopedAssignment&) = delete;
+	ScopedAssignment& operator=(ScopedAssignment&& other)
+	{
+		if (m_target)
+			*m_target = m_backup;
+		m_target = other.m_target;
+		m_backup = other.m_backup;
+		other.m_target = nullptr;
+		return *this;
+	}
+
+private:
+	Type* m_target;
+	Type m_backup;
+};
+
+static int randomWalk(const Scene& scene, Ray ray, Sampler& sampler, MemoryArena& arena, Spectrum beta,
+	Float pdf, int maxDepth, TransportMode mode, PathVertex* path)
+{
+	if (maxDepth == 0)
+		return 0;
+
+	int bounces = 0;
+	// Note: densities of the last vertex, in solid angle
+	Float pdfFwd = pdf, pdfRev = 0;
+	while (true)
+	{
+		SurfaceInteraction isect;
+		if (!scene.hit(ray, isect))
+		{
+			// Camera paths escaping the scene end on the infinite lights
+			if (mode == TransportMode::Radiance)
+			{
+				path[bounces] = PathVertex::createEscaped(ray, beta, pdfFwd);
+				++bounces;
+			}
+			break;
+		}
+
+		isect.computeScatteringFunctions(ray, arena, true, mode);
+		if (!isect.bsdf)
+		{
+			ray = isect.spawnRay(ray.direction());
+			continue;
+		}
+
+		PathVertex& vertex = path[bounces];
+		PathVertex& prev = path[bounces - 1];
+		vertex = PathVertex::createSurface(isect, beta, pdfFwd, prev);
+		if (++bounces >= maxDepth)
+			break;
+
+		// Sample the direction of the next vertex
+		Vector3f wi, wo = isect.wo;
+		BxDFType type;
+		Spectrum f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdfFwd, type, BSDF_ALL);
+		if (f.isBlack() || pdfFwd == 0.f)
+			break;
+		beta *= f * absDot(wi, isect.normal) / pdfFwd;
+		pdfRev = isect.bsdf->pdf(wi, wo, BSDF_ALL);
+		if (type & BSDF_SPECULAR)
+		{
+			vertex.m_delta = true;
+			pdfRev = pdfFwd = 0;
+		}
+		ray = isect.spawnRay(wi);
+
+		prev.m_pdfRev = vertex.convertDensity(pdfRev, prev);
+	}
+	return bounces;
+}
+
+static int generateCameraSubpath(const Scene& scene, Sampler& sampler, MemoryArena& arena, int maxDepth,
+	const Camera& camera, const CameraSample& cameraSample, PathVertex* path)
+{
+	if (maxDepth == 0)
+		return 0;
+
+	Ray ray;
+	Spectrum beta(camera.castingRay(cameraSample, ray));
+	if (beta.isBlack())
+		return 0;
+
+	// Generate the first vertex on the camera subpath and start the random walk
+	Float pdfPos, pdfDir;
+	path[0] = PathVertex::createCamera(&camera, ray, beta);
+	camera.pdf_We(ray, pdfPos, pdfDir);
+	return randomWalk(scene, ray, sampler, arena, beta, pdfDir, maxDepth - 1, TransportMode::Radiance,
+		path + 1) + 1;
+}
+
+static int generateLightSubpath(const Scene& scene, Sampler& sampler, MemoryArena& arena, int maxDepth,
+	Float time, const Distribution1D& lightDistr, const LightIndexMap& lightToIndex, PathVertex* path)
+{
+	if (maxDepth == 0)
+		return 0;
+
+	// Sample the initial ray of the light subpath
+	Float lightPdf;
+	int lightNum = lightDistr.sampleDiscrete(sampler.get1D(), &lightPdf);
+	const Light::ptr& light = scene.m_lights[lightNum];
+	Vector2f uLight0 = sampler.get2D();
+	Vector2f uLight1 = sampler.get2D();
+	Ray ray;
+	Vector3f nLight;
+	Float pdfPos, pdfDir;
+	Spectrum Le = light->sample_Le(uLight0, uLight1, ray, nLight, pdfPos, pdfDir);
+	if (pdfPos == 0 || pdfDir == 0 || Le.isBlack())
+		return 0;
+	ray.m_time = time;
+
+	// Generate the first vertex on the light subpath and start the random walk
+	Interaction lightIntr(ray.origin());
+	lightIntr.normal = nLight;
+	lightIntr.time = time;
+	path[0] = PathVertex::createLight(light.get(), lightIntr, Le, pdfPos * lightPdf);
+	Spectrum beta = Le * absDot(nLight, ray.direction()) / (lightPdf * pdfPos * pdfDir);
+	int nVertices = randomWalk(scene, ray, sampler, arena, beta, pdfDir, maxDepth - 1,
+		TransportMode::Importance, path + 1);
+
+	// Correct the densities of the subpaths of infinite lights
+	if (path[0].isInfiniteLight())
+	{
+		// Set the spatial density of _path[1]_ for the infinite light
+		if (nVertices > 0)
+		{
+			path[1].m_pdfFwd = pdfPos;
+			if (path[1].isOnSurface())
+				path[1].m_pdfFwd *= absDot(ray.direction(), path[1].normal());
+		}
+
+		// Set the spatial density of _path[0]_ for the infinite light
+		path[0].m_pdfFwd = PathVertex::infiniteLightDensity(scene, lightDistr, lightToIndex, ray.direction());
+	}
+	return nVertices + 1;
+}
+
+// Generalized geometry term between two vertices, visibility included
+static Spectrum G(const Scene& scene, const PathVertex& v0, const PathVertex& v1)
+{
+	Vector3f d = v0.p() - v1.p();
+	Float g = 1 / lengthSquared(d);
+	d *= std::sqrt(g);
+	if (v0.isOnSurface())
+		g *= absDot(v0.normal(), d);
+	if (v1.isOnSurface())
+		g *= absDot(v1.normal(), d);
+	VisibilityTester vis(v0.m_si, v1.m_si);
+	return vis.unoccluded(scene) ? Spectrum(g) : Spectrum(0.f);
+}
+
+// Balance heuristic weight of the strategy connecting the first _s_ light vertices to the first
+// _t_ camera vertices, _sampled_ is the vertex a strategy with one vertex sampled on its own
+static Float MISWeight(const Scene& scene, PathVertex* lightVertices, PathVertex* cameraVertices,
+	PathVertex& sampled, int s, int t, const Distribution1D& lightDistr, const LightIndexMap& lightToIndex)
+{
+	if (s + t == 2)
+		return 1;
+	Float sumRi = 0;
+	// Note: delta vertices have zero densities, they are mapped to one so that they cancel out
+	auto remap0 = [](Float f) -> Float { return f != 0 ? f : 1; };
+
+	// Temporarily update the vertex properties of the current strategy
+
+	// Look up connection vertices and their predecessors
+	PathVertex* qs = s > 0 ? &lightVertices[s - 1] : nullptr;
+	PathVertex* pt = t > 0 ? &cameraVertices[t - 1] : nullptr;
+	PathVertex* qsMinus = s > 1 ? &lightVertices[s - 2] : nullptr;
+	PathVertex* ptMinus = t > 1 ? &cameraVertices[t - 2] : nullptr;
+
+	// Update the sampled vertex for s = 1 or t = 1
+	ScopedAssignment<PathVertex> a1;
+	if (s == 1)
+		a1 = ScopedAssignment<PathVertex>(qs, sampled);
+	else if (t == 1)
+		a1 = ScopedAssignment<PathVertex>(pt, sampled);
+
+	// Mark the connection vertices as non-degenerate
+	ScopedAssignment<bool> a2, a3;
+	if (pt)
+		a2 = ScopedAssignment<bool>(&pt->m_delta, false);
+	if (qs)
+		a3 = ScopedAssignment<bool>(&qs->m_delta, false);
+
+	// Update the reverse densities of the connection vertices
+	ScopedAssignment<Float> a4;
+	if (pt)
+		a4 = ScopedAssignment<Float>(&pt->m_pdfRev, s > 0 ? qs->pdf(scene, qsMinus, *pt)
+			: pt->pdfLightOrigin(scene, *ptMinus, lightDistr, lightToIndex));
+
+	// Update the reverse densities of the predecessors of the connection vertices
+	ScopedAssignment<Float> a5;
+	if (ptMinus)
+		a5 = ScopedAssignment<Float>(&ptMinus->m_pdfRev, s > 0 ? pt->pdf(scene, qs, *ptMinus)
+			: pt->pdfLight(scene, *ptMinus));
+
+	ScopedAssignment<Float> a6;
+	if (qs)
+		a6 = ScopedAssignment<Float>(&qs->m_pdfRev, pt->pdf(scene, ptMinus, *qs));
+	ScopedAssignment<Float> a7;
+	if (qsMinus)
+		a7 = ScopedAssignment<Float>(&qsMinus->m_pdfRev, qs->pdf(scene, pt, *qsMinus));
+
+	// Consider the hypothetical strategies with more light vertices
+	Float ri = 1;
+	for (int i = t - 1; i > 0; --i)
+	{
+		ri *= remap0(cameraVertices[i].m_pdfRev) / remap0(cameraVertices[i].m_pdfFwd);
+		if (!cameraVertices[i].m_delta && !cameraVertices[i - 1].m_delta)
+			sumRi += ri;
+	}
+
+	// Consider the hypothetical strategies with more camera vertices
+	ri = 1;
+	for (int i = s - 1; i >= 0; --i)
+	{
+		ri *= remap0(lightVertices[i].m_pdfRev) / remap0(lightVertices[i].m_pdfFwd);
+		bool deltaLightVertex = i > 0 ? lightVertices[i - 1].m_delta : lightVertices[0].isDeltaLight();
+		if (!lightVertices[i].m_delta && !deltaLightVertex)
+			sumRi += ri;
+	}
+	return 1 / (1 + sumRi);
+}
+
+// Contribution of the strategy connecting the first _s_ light vertices to the first _t_ camera
+// vertices, _pRaster_ is updated when the strategy samples the camera (t = 1)
+static Spectrum connectBDPT(const Scene& scene, PathVertex* lightVertices, PathVertex* cameraVertices,
+	int s, int t, const Distribution1D& lightDistr, const LightIndexMap& lightToIndex,
+	const Camera& camera, Sampler& sampler, Vector2f& pRaster)
+{
+	Spectrum L(0.f);
+	// Ignore invalid connections related to infinite area lights
+	if (t > 1 && s != 0 && cameraVertices[t - 1].m_type == VertexType::Light)
+		return Spectrum(0.f);
+
+	// Perform the connection and write the contribution to _L_
+	PathVertex sampled;
+	if (s == 0)
+	{
+		// Interpret the camera subpath as a complete path
+		const PathVertex& pt = cameraVertices[t - 1];
+		if (pt.isLight())
+			L = pt.Le(scene, cameraVertices[t - 2]) * pt.m_beta;
+	}
+	else if (t == 1)
+	{
+		// Sample a point on the camera and connect it to the light subpath
+		const PathVertex& qs = lightVertices[s - 1];
+		if (qs.isConnectible())
+		{
+			VisibilityTester vis;
+			Vector3f wi;
+			Float pdf;
+			Spectrum Wi = camera.sample_Wi(qs.m_si, sampler.get2D(), wi, pdf, pRaster, vis);
+			if (pdf > 0 && !Wi.isBlack())
+			{
+				// Initialize the dynamically sampled vertex and _L_ for the t = 1 case
+				sampled = PathVertex::createCamera(&camera, vis.P1(), Wi / pdf);
+				L = qs.m_beta * qs.f(sampled) * sampled.m_beta;
+				if (qs.isOnSurface())
+					L *= absDot(wi, qs.normal());
+				if (!L.isBlack() && !vis.unoccluded(scene))
+					L = Spectrum(0.f);
+			}
+		}
+	}
+	else if (s == 1)
+	{
+		// Sample a point on a light and connect it to the camera subpath
+		const PathVertex& pt = cameraVertices[t - 1];
+		if (pt.isConnectible())
+		{
+			Float lightPdf;
+			VisibilityTester vis;
+			Vector3f wi;
+			Float pdf;
+			int lightNum = lightDistr.sampleDiscrete(sampler.get1D(), &lightPdf);
+			const Light::ptr& light = scene.m_lights[lightNum];
+			Spectrum lightWeight = light->sample_Li(pt.m_si, sampler.get2D(), wi, pdf, vis);
+			if (pdf > 0 && !lightWeight.isBlack())
+			{
+				sampled = PathVertex::createLight(light.get(), vis.P1(), lightWeight / (pdf * lightPdf), 0);
+				sampled.m_pdfFwd = sampled.pdfLightOrigin(scene, pt, lightDistr, lightToIndex);
+				L = pt.m_beta * pt.f(sampled) * sampled.m_beta;
+				if (pt.isOnSurface())
+					L *= absDot(wi, pt.normal());
+				if (!L.isBlack() && !vis.unoccluded(scene))
+					L = Spectrum(0.f);
+			}
+		}
+	}
+	else
+	{
+		// Handle all other bidirectional connection cases
+		const PathVertex& qs = lightVertices[s - 1], & pt = cameraVertices[t - 1];
+		if (qs.isConnectible() && pt.isConnectible())
+		{
+			L = qs.m_beta * qs.f(pt) * pt.f(qs) * pt.m_beta;
+			if (!L.isBlack())
+				L *= G(scene, qs, pt);
+		}
+	}
+
+	// Compute the MIS weight of the connection strategy
+	if (L.isBlack())
+		return Spectrum(0.f);
+	return L * MISWeight(scene, lightVertices, cameraVertices, sampled, s, t, lightDistr, lightToIndex);
+}
+
+RENDER_REGISTER_CLASS(BDPTIntegrator, "BDPT")
+
+BDPTIntegrator::BDPTIntegrator(const APropertyTreeNode& node)
+	: m_maxDepth(node.getPropertyList().getInteger("Depth", 5))
+{
+	//Sampler
+	const auto& samplerNode = node.getPropertyChild("Sampler");
+	m_sampler = Sampler::ptr(static_cast<Sampler*>(AObjectFactory::createInstance(
+		samplerNode.getTypeName(), samplerNode)));
+
+	//Camera
+	const auto& cameraNode = node.getPropertyChild("Camera");
+	m_camera = Camera::ptr(static_cast<Camera*>(AObjectFactory::createInstance(
+		cameraNode.getTypeName(), cameraNode)));
+
+	activate();
+}
+
+BDPTIntegrator::BDPTIntegrator(Camera::ptr camera, Sampler::ptr sampler, int maxDepth)
+	: m_camera(camera), m_sampler(sampler), m_maxDepth(maxDepth) {}
+
+void BDPTIntegrator::preprocess(const Scene& scene)
+{
+	m_lightDistribution = createLightSampleDistribution("power", scene);
+}
+
+void BDPTIntegrator::render(const Scene& scene)
+{
+	const Distribution1D* lightDistr = m_lightDistribution->lookup(Vector3f(0));
+	if (lightDistr == nullptr)
+	{
+		K_WARN("BDPTIntegrator: the scene has no lights, nothing to render");
+		return;
+	}
+
+	// The MIS weights need the index of the lights in the light distribution
+	LightIndexMap lightToIndex;
+	for (size_t i = 0; i < scene.m_lights.size(); ++i)
+		lightToIndex[scene.m_lights[i].get()] = i;
+
+	Film& film = *m_camera->m_film;
+	const Bounds2i sampleBounds = film.getSampleBounds();
+	const Vector2i sampleExtent = sampleBounds.diagonal();
+	constexpr int tileSize = 16;
+	const Vector2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+
+	// Note: the light subpaths splat to any pixel, every thread gathers its splats in its own buffer
+	tbb::enumerable_thread_specific<std::unique_ptr<FilmSplatBuffer>> splatBuffers(
+		[&]() { return film.getSplatBuffer(); });
+
+	K_INFO("Rendering");
+	Reporter reporter(nTiles.x * nTiles.y, "Rendering");
+	AParallelUtils::parallelFor((size_t)0, (size_t)(nTiles.x * nTiles.y), [&](const size_t& t)
+		{
+			Vector2i tile(int(t) % nTiles.x, int(t) / nTiles.x);
+			MemoryArena arena;
+			std::unique_ptr<Sampler> tileSampler = m_sampler->clone(int(t));
+			FilmSplatBuffer& splatBuffer = *splatBuffers.local();
+
+			int x0 = sampleBounds.m_pMin.x + tile.x * tileSize;
+			int x1 = glm::min(x0 + tileSize, sampleBounds.m_pMax.x);
+			int y0 = sampleBounds.m_pMin.y + tile.y * tileSize;
+			int y1 = glm::min(y0 + tileSize, sampleBounds.m_pMax.y);
+			Bounds2i tileBounds(Vector2i(x0, y0), Vector2i(x1, y1));
+			std::unique_ptr<FilmTile> filmTile = film.getFilmTile(tileBounds);
+
+			for (Vector2i pixel : tileBounds)
+			{
+				tileSampler->startPixel(pixel);
+				do
+				{
+					// Generate a single sample using BDPT
+					CameraSample cameraSample = tileSampler->getCameraSample(pixel);
+
+					// Trace the camera and light subpaths
+					PathVertex* cameraVertices = arena.Alloc<PathVertex>(m_maxDepth + 2);
+					PathVertex* lightVertices = arena.Alloc<PathVertex>(m_maxDepth + 1);
+					int nCamera = generateCameraSubpath(scene, *tileSampler, arena, m_maxDepth + 2,
+						*m_camera, cameraSample, cameraVertices);
+					Float time = nCamera > 0 ? cameraVertices[0].m_si.time : 0;
+					int nLight = generateLightSubpath(scene, *tileSampler, arena, m_maxDepth + 1,
+						time, *lightDistr, lightToIndex, lightVertices);
+
+					// Execute all the connection strategies
+					Spectrum L(0.f);
+					for (int t = 1; t <= nCamera; ++t)
+					{
+						for (int s = 0; s <= nLight; ++s)
+						{
+							int depth = t + s - 2;
+							if ((s == 1 && t == 1) || depth < 0 || depth > m_maxDepth)
+								continue;
+
+							Vector2f pFilmNew = cameraSample.pFilm;
+							Spectrum Lpath = connectBDPT(scene, lightVertices, cameraVertices, s, t,
+								*lightDistr, lightToIndex, *m_camera, *tileSampler, pFilmNew);
+							if (t != 1)
+								L += Lpath;
+							else if (!Lpath.isBlack())
+								splatBuffer.addSplat(pFilmNew, Lpath);
+						}
+					}
+					filmTile->addSample(cameraSample.pFilm, L);
+
+					// Note: the camera subpath scatters randomly, the features follow
+					//       their own path from a fresh camera ray
+					Ray ray;
+					if (filmTile->hasFeatures() && m_camera->castingRay(cameraSample, ray) > 0)
+					{
+						Spectrum albedo;
+						Vector3f normal;
+						Float depth;
+						firstHitFeatures(ray, scene, arena, albedo, normal, depth);
+						filmTile->addFeatures(cameraSample.pFilm, albedo, normal, depth);
+					}
+					arena.Reset();
+				} while (tileSampler->startNextSample());
+			}
+
+			film.mergeFilmTile(std::move(filmTile));
+			reporter.update();
+		}, ExecutionPolicy::PARALLEL);
+	reporter.done();
+
+	// Merge the splats gathered by the threads
+	for (auto& splatBuffer : splatBuffers)
+		film.mergeSplatBuffer(*splatBuffer);
+
+	K_INFO("Rendering finished");
+
+	film.writeImageToFile(Float(1) / m_sampler->samplesPerPixel);
+}
+
+RENDER_END
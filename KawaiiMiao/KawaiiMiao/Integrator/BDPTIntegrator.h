@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../Core/Integrator.h"
+#include "../Core/LightDistrib.h"
+
+RENDER_BEGIN
+
+// Bidirectional path tracing (Veach 1997). Every sample traces a subpath from the camera and one
+// from a light, and connects all of their prefixes, the strategies being weighted by multiple
+// importance sampling. Connections of light subpaths to the camera land anywhere on the image,
+// they are splatted into a buffer per thread which is merged into the film after rendering.
+class BDPTIntegrator : public Integrator
+{
+public:
+	typedef std::shared_ptr<BDPTIntegrator> ptr;
+
+	BDPTIntegrator(const APropertyTreeNode& node);
+
+	BDPTIntegrator(Camera::ptr camera, Sampler::ptr sampler, int maxDepth);
+
+	virtual void preprocess(const Scene& scene) override;
+	virtual void render(const Scene& scene) override;
+
+	virtual std::string toString() const override { return "BDPTIntegrator[]"; }
+
+private:
+	Camera::ptr m_camera;
+	Sampler::ptr m_sampler;
+
+	int m_maxDepth;
+
+	// Chooses the lights the light subpaths leave from, by power
+	std::unique_ptr<LightDistribution> m_lightDistribution;
+};
+
+RENDER_END
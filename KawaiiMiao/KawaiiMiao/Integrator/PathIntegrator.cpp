@@ -2,14 +2,23 @@
 
 #include "../Core/BSDF.h"
 #include "../Core/Scene.h"
+#include "../Core/Sampler.h"
+#include "../Math/Rng.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Parallel.h"
+#include "../Tool/Reporter.h"
+#include "../Tool/Logger.h"
 
 RENDER_BEGIN
 
 RENDER_REGISTER_CLASS(PathIntegrator, "Path")
 
 PathIntegrator::PathIntegrator(const APropertyTreeNode& node)
-	: SamplerIntegrator(nullptr, nullptr), m_maxDepth(node.getPropertyList().getInteger("Depth", 2))
-	, m_rrThreshold(1.f), m_lightSampleStrategy("spatial")
+	: SamplerIntegrator(node.getPropertyList()), m_maxDepth(node.getPropertyList().getInteger("Depth", 2))
+	, m_rrThreshold(1.f), m_lightSampleStrategy(node.getPropertyList().getString("LightSampleStrategy", "spatial"))
+	, m_guiding(node.getPropertyList().getBoolean("Guiding", false))
+	, m_guidingTrainingSamples(node.getPropertyList().getInteger("GuidingTrainingSPP", 0))
+	, m_bsdfSamplingFraction(clamp(node.getPropertyList().getFloat("BsdfSamplingFraction", 0.5f), 0, 1))
 {
 	//Sampler
 	const auto& samplerNode = node.getPropertyChild("Sampler");
@@ -34,6 +43,75 @@ void PathIntegrator::preprocess(const Scene& scene)
 	m_lightDistribution = createLightSampleDistribution(m_lightSampleStrategy, scene);
 }
 
+void PathIntegrator::render(const Scene& scene)
+{
+	m_sdTree.reset();
+	if (!m_guiding)
+	{
+		SamplerIntegrator::render(scene);
+		return;
+	}
+
+	m_sdTree.reset(new SDTree(scene.worldBound()));
+
+	// Note: a quarter of the final SPP goes to training by default
+	int trainingSamples = m_guidingTrainingSamples > 0 ? m_guidingTrainingSamples :
+		glm::max(1, int(m_sampler->samplesPerPixel / 4));
+
+	Bounds2i sampleBounds = m_camera->m_film->getSampleBounds();
+	Vector2i sampleExtent = sampleBounds.diagonal();
+	constexpr int tileSize = 16;
+	Vector2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+	const int64_t nTotalTiles = int64_t(nTiles.x) * nTiles.y;
+
+	// Iteration k traces 2^k samples per pixel and learns from the distributions of iteration k-1,
+	// the spatial subdivision threshold grows with sqrt(2^k) so that the leaves hold enough records
+	m_guidingRecord = true;
+	int64_t seedOffset = 0, sampleOffset = 0;
+	for (int iteration = 0, spp = 1; trainingSamples >= spp; ++iteration, spp *= 2)
+	{
+		K_INFO("Path guiding training iteration {0}: {1} spp, {2} spatial leaves", iteration, spp, m_sdTree->numLeaves());
+		Reporter reporter(nTotalTiles, "Training");
+		AParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t& t)
+			{
+				Vector2i tile(int(t % nTiles.x), int(t / nTiles.x));
+				int x0 = sampleBounds.m_pMin.x + tile.x * tileSize;
+				int x1 = glm::min(x0 + tileSize, sampleBounds.m_pMax.x);
+				int y0 = sampleBounds.m_pMin.y + tile.y * tileSize;
+				int y1 = glm::min(y0 + tileSize, sampleBounds.m_pMax.y);
+				Bounds2i tileBounds(Vector2i(x0, y0), Vector2i(x1, y1));
+
+				MemoryArena arena;
+				std::unique_ptr<Sampler> tileSampler = m_sampler->clone(int(seedOffset + t));
+				for (Vector2i pixel : tileBounds)
+				{
+					tileSampler->startPixel(pixel);
+					for (int i = 0; i < spp; ++i)
+					{
+						// Note: every iteration takes the samples following the previous ones, the
+						//       sequence wraps around once they exceed the sampler's own SPP
+						tileSampler->setSampleNumber(sampleOffset + i);
+						CameraSample cameraSample = tileSampler->getCameraSample(pixel);
+						Ray ray;
+						if (m_camera->castingRay(cameraSample, ray) > 0)
+							Li(ray, scene, *tileSampler, arena, 0);
+						arena.Reset();
+					}
+				}
+				reporter.update();
+			}, ExecutionPolicy::PARALLEL);
+		reporter.done();
+
+		seedOffset += nTotalTiles;
+		sampleOffset += spp;
+		trainingSamples -= spp;
+		m_sdTree->refine(12000 * std::sqrt(Float(spp)), 20, 0.01f);
+	}
+	m_guidingRecord = false;
+
+	SamplerIntegrator::render(scene);
+}
+
 Spectrum PathIntegrator::Li(const Ray& r, const Scene& scene, Sampler& sampler,
 	MemoryArena& arena, int depth) const
 {
@@ -51,6 +129,25 @@ Spectrum PathIntegrator::Li(const Ray& r, const Scene& scene, Sampler& sampler,
 	// out of a medium and thus have their beta value increased.
 	Float etaScale = 1;
 
+	// Vertices of the path whose incident radiance is splatted into the SD-tree at the end
+	struct GuidingVertex
+	{
+		DTreeWrapper* m_dTree;
+		Vector3f m_dir;
+		// Path throughput up to and including the scattering at the vertex
+		Spectrum m_throughput;
+		Spectrum m_radiance;
+		Float m_woPdf;
+		bool m_isDelta;
+	};
+	GuidingVertex* vertices = m_guidingRecord ? arena.Alloc<GuidingVertex>(m_maxDepth + 1) : nullptr;
+	int nVertices = 0;
+	auto recordRadiance = [&](const Spectrum& radiance)
+	{
+		for (int i = 0; i < nVertices; ++i)
+			vertices[i].m_radiance += radiance;
+	};
+
 	for (bounces = 0;; ++bounces)
 	{
 		// Find next path vertex and accumulate contribution
@@ -60,17 +157,30 @@ Spectrum PathIntegrator::Li(const Ray& r, const Scene& scene, Sampler& sampler,
 		bool hit = scene.hit(ray, isect);
 
 		// Possibly add emitted light at intersection
-		if (bounces == 0 || specularBounce)
+		if (bounces == 0 || specularBounce || nVertices > 0)
 		{
 			// Add emitted light at path vertex or from the environment
+			Spectrum Le(0.f);
 			if (hit)
 			{
-				L += beta * isect.Le(-ray.direction());
+				Le = beta * isect.Le(-ray.direction());
 			}
 			else
 			{
 				for (const auto& light : scene.m_infiniteLights)
-					L += beta * light->Le(ray);
+					Le += beta * light->Le(ray);
+			}
+
+			if (bounces == 0 || specularBounce)
+			{
+				L += Le;
+				recordRadiance(Le);
+			}
+			else
+			{
+				// Note: this emission is left to the previous vertex's light sample in _L_, but it
+				//       still is radiance arriving at that vertex from its sampled direction
+				vertices[nVertices - 1].m_radiance += Le;
 			}
 		}
 
@@ -91,30 +201,60 @@ Spectrum PathIntegrator::Li(const Ray& r, const Scene& scene, Sampler& sampler,
 			continue;
 		}
 
-		const Distribution1D* distrib = m_lightDistribution->lookup(isect.p);
-
 		// Sample illumination from lights to find path contribution.
 		// (But skip this for perfectly specular BSDFs.)
 		if (isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
 		{
 			//++totalPaths;
-			Spectrum Ld = beta * uniformSampleOneLight(isect, scene, arena, sampler, distrib);
+			Spectrum Ld = beta * uniformSampleOneLight(isect, scene, arena, sampler, m_lightDistribution.get());
 			//if (Ld.isBlack()) 
 			//	++zeroRadiancePaths;
 			CHECK_GE(Ld.y(), 0.f);
 			L += Ld;
+			recordRadiance(Ld);
 		}
 
 		// Sample BSDF to get new path direction
 		Vector3f wo = -ray.direction(), wi;
 		Float pdf;
 		BxDFType flags;
-		Spectrum f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdf, flags, BSDF_ALL);
+		Spectrum f;
+		DTreeWrapper* dTree = m_sdTree ? m_sdTree->dTreeWrapper(isect.p) : nullptr;
+		if (dTree && isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+		{
+			// One-sample MIS of the BSDF and of the learned incident radiance
+			Vector2f u = sampler.get2D();
+			const Float alpha = m_bsdfSamplingFraction;
+			if (u.x < alpha)
+			{
+				u.x = glm::min(u.x / alpha, aOneMinusEpsilon);
+				Float bsdfPdf;
+				f = isect.bsdf->sample_f(wo, wi, u, bsdfPdf, flags, BSDF_ALL);
+				// Note: the guiding distribution can't sample a specular direction
+				pdf = (flags & BSDF_SPECULAR) ? alpha * bsdfPdf :
+					alpha * bsdfPdf + (1 - alpha) * dTree->pdf(wi);
+			}
+			else
+			{
+				u.x = glm::min((u.x - alpha) / (1 - alpha), aOneMinusEpsilon);
+				wi = dTree->sample(u);
+				f = isect.bsdf->f(wo, wi);
+				flags = BxDFType(0);
+				pdf = alpha * isect.bsdf->pdf(wo, wi) + (1 - alpha) * dTree->pdf(wi);
+			}
+		}
+		else
+		{
+			f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdf, flags, BSDF_ALL);
+		}
 
 		if (f.isBlack() || pdf == 0.f)
 			break;
 		beta *= f * absDot(wi, isect.normal) / pdf;
 
+		if (vertices && dTree)
+			vertices[nVertices++] = { dTree, wi, beta, Spectrum(0.f), pdf, (flags & BSDF_SPECULAR) != 0 };
+
 		CHECK_GE(beta.y(), 0.f);
 		DCHECK(!glm::isinf(beta.y()));
 
@@ -143,6 +283,22 @@ Spectrum PathIntegrator::Li(const Ray& r, const Scene& scene, Sampler& sampler,
 		}
 	}
 
+	// Splat the radiance that arrived at each vertex, divided by the pdf of its direction
+	for (int i = 0; i < nVertices; ++i)
+	{
+		const GuidingVertex& vertex = vertices[i];
+		if (vertex.m_isDelta)
+			continue;
+
+		Spectrum incident(0.f);
+		for (int c = 0; c < Spectrum::nSamples; ++c)
+		{
+			if (vertex.m_throughput[c] > 0)
+				incident[c] = vertex.m_radiance[c] / vertex.m_throughput[c];
+		}
+		vertex.m_dTree->record(vertex.m_dir, incident.y() / vertex.m_woPdf, 1);
+	}
+
 	//ReportValue(pathLength, bounces);
 	return L;
 }
@@ -2,6 +2,7 @@
 
 #include "../Core/Integrator.h"
 #include "../Core/LightDistrib.h"
+#include "SDTree.h"
 
 RENDER_BEGIN
 
@@ -16,6 +17,10 @@ public:
 
 	virtual void preprocess(const Scene& scene) override;
 
+	// With guiding enabled, the guiding distributions are first trained over iterations of doubling
+	// SPP whose images are discarded, then the image is rendered with the learned distributions.
+	virtual void render(const Scene& scene) override;
+
 	virtual Spectrum Li(const Ray& ray, const Scene& scene, Sampler& sampler,
 		MemoryArena& arena, int depth) const override;
 
@@ -27,6 +32,15 @@ private:
 	Float m_rrThreshold;
 	std::string m_lightSampleStrategy;
 	std::unique_ptr<LightDistribution> m_lightDistribution;
+
+	// Path guiding ("Practical Path Guiding", Muller et al. 2017): continuation directions are
+	// drawn from a one-sample mixture of the BSDF and the incident radiance learned in _m_sdTree_.
+	bool m_guiding = false;
+	int m_guidingTrainingSamples = 0;
+	Float m_bsdfSamplingFraction = 0.5f;
+	SDTree::ptr m_sdTree;
+	// Splat the radiance estimates of the paths into the SD-tree (training iterations only)
+	bool m_guidingRecord = false;
 };
 
 RENDER_END
\ No newline at end of file
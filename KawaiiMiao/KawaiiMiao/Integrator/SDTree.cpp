@@ -0,0 +1,412 @@
+#include "SDTree.h"
+
+#include "../Math/Rng.h"
+#include "../Tool/Parallel.h"
+
+RENDER_BEGIN
+
+static inline void atomicAdd(std::atomic<Float>& target, Float value)
+{
+	Float current = target.load(std::memory_order_relaxed);
+	while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+		;
+}
+
+Vector3f canonicalToDir(const Vector2f& p)
+{
+	const Float cosTheta = 2 * p.x - 1;
+	const Float phi = 2 * Pi * p.y;
+	const Float sinTheta = std::sqrt(glm::max(Float(0), 1 - cosTheta * cosTheta));
+	return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+Vector2f dirToCanonical(const Vector3f& d)
+{
+	if (!std::isfinite(d.x) || !std::isfinite(d.y) || !std::isfinite(d.z))
+		return Vector2f(0, 0);
+
+	const Float cosTheta = clamp(d.z, -1, 1);
+	Float phi = std::atan2(d.y, d.x);
+	while (phi < 0)
+		phi += 2 * Pi;
+	return Vector2f((cosTheta + 1) / 2, glm::min(phi / (2 * Pi), aOneMinusEpsilon));
+}
+
+//-------------------------------------------QuadTreeNode-------------------------------------
+
+QuadTreeNode::QuadTreeNode()
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		m_sum[i].store(0, std::memory_order_relaxed);
+		m_children[i] = 0;
+	}
+}
+
+QuadTreeNode::QuadTreeNode(const QuadTreeNode& other)
+{
+	*this = other;
+}
+
+QuadTreeNode& QuadTreeNode::operator=(const QuadTreeNode& other)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		setSum(i, other.sum(i));
+		m_children[i] = other.m_children[i];
+	}
+	return *this;
+}
+
+void QuadTreeNode::addSum(int index, Float value)
+{
+	atomicAdd(m_sum[index], value);
+}
+
+int QuadTreeNode::childIndex(Vector2f& p)
+{
+	int index = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		if (p[i] < 0.5f)
+		{
+			p[i] *= 2;
+		}
+		else
+		{
+			p[i] = (p[i] - 0.5f) * 2;
+			index |= 1 << i;
+		}
+	}
+	return index;
+}
+
+//-------------------------------------------DTree-------------------------------------
+
+DTree::DTree()
+{
+	m_nodes.emplace_back();
+	m_sum.store(0, std::memory_order_relaxed);
+	m_statisticalWeight.store(0, std::memory_order_relaxed);
+}
+
+DTree::DTree(const DTree& other)
+{
+	*this = other;
+}
+
+DTree& DTree::operator=(const DTree& other)
+{
+	m_nodes = other.m_nodes;
+	m_sum.store(other.sum(), std::memory_order_relaxed);
+	m_statisticalWeight.store(other.statisticalWeight(), std::memory_order_relaxed);
+	return *this;
+}
+
+void DTree::recordIrradiance(const Vector2f& p, Float irradiance, Float statisticalWeight)
+{
+	if (!std::isfinite(statisticalWeight) || statisticalWeight <= 0)
+		return;
+
+	atomicAdd(m_statisticalWeight, statisticalWeight);
+
+	if (!std::isfinite(irradiance) || irradiance <= 0)
+		return;
+
+	// Note: only the leaves are splatted, build() sums them up
+	Vector2f q = p;
+	int nodeIndex = 0;
+	while (true)
+	{
+		QuadTreeNode& node = m_nodes[nodeIndex];
+		int index = QuadTreeNode::childIndex(q);
+		if (node.isLeaf(index))
+		{
+			node.addSum(index, irradiance * statisticalWeight);
+			return;
+		}
+		nodeIndex = node.child(index);
+	}
+}
+
+Float DTree::pdf(Vector2f p) const
+{
+	// Note: uniform until something has been learned
+	if (!(sum() > 0))
+		return 1;
+
+	Float result = 1;
+	int nodeIndex = 0;
+	while (true)
+	{
+		const QuadTreeNode& node = m_nodes[nodeIndex];
+		int index = QuadTreeNode::childIndex(p);
+		Float total = node.sum(0) + node.sum(1) + node.sum(2) + node.sum(3);
+		if (!(node.sum(index) > 0))
+			return 0;
+
+		result *= 4 * node.sum(index) / total;
+		if (node.isLeaf(index))
+			return result;
+		nodeIndex = node.child(index);
+	}
+}
+
+Vector2f DTree::sample(Vector2f u) const
+{
+	if (!(sum() > 0))
+		return u;
+
+	Vector2f origin(0, 0);
+	Float size = 1;
+	int nodeIndex = 0;
+	while (true)
+	{
+		const QuadTreeNode& node = m_nodes[nodeIndex];
+
+		// Choose the column, then the quadrant within it, remapping the sample each time
+		Float left = node.sum(0) + node.sum(2), right = node.sum(1) + node.sum(3);
+		Float pLeft = left / (left + right);
+		int index = 0;
+		if (u.x < pLeft)
+		{
+			u.x = glm::min(u.x / pLeft, aOneMinusEpsilon);
+		}
+		else
+		{
+			u.x = glm::min((u.x - pLeft) / (1 - pLeft), aOneMinusEpsilon);
+			index |= 1;
+		}
+
+		Float bottom = node.sum(index), top = node.sum(index | 2);
+		Float pBottom = bottom / (bottom + top);
+		if (u.y < pBottom)
+		{
+			u.y = glm::min(u.y / pBottom, aOneMinusEpsilon);
+		}
+		else
+		{
+			u.y = glm::min((u.y - pBottom) / (1 - pBottom), aOneMinusEpsilon);
+			index |= 2;
+		}
+
+		size /= 2;
+		origin += Vector2f(Float(index & 1), Float((index >> 1) & 1)) * size;
+		if (node.isLeaf(index))
+			return origin + u * size;
+		nodeIndex = node.child(index);
+	}
+}
+
+void DTree::buildNode(int nodeIndex)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		if (m_nodes[nodeIndex].isLeaf(i))
+			continue;
+
+		int child = m_nodes[nodeIndex].child(i);
+		buildNode(child);
+		const QuadTreeNode& childNode = m_nodes[child];
+		m_nodes[nodeIndex].setSum(i, childNode.sum(0) + childNode.sum(1) + childNode.sum(2) + childNode.sum(3));
+	}
+}
+
+void DTree::build()
+{
+	buildNode(0);
+	const QuadTreeNode& root = m_nodes[0];
+	m_sum.store(root.sum(0) + root.sum(1) + root.sum(2) + root.sum(3), std::memory_order_relaxed);
+}
+
+void DTree::reset(const DTree& previous, int maxDepth, Float subdivisionThreshold)
+{
+	struct StackNode
+	{
+		int m_nodeIndex;
+		// Node of the source tree matching the new node, in _previous_ or in the new tree itself
+		int m_otherNodeIndex;
+		const DTree* m_otherTree;
+		int m_depth;
+	};
+
+	m_nodes.clear();
+	m_nodes.emplace_back();
+	m_sum.store(0, std::memory_order_relaxed);
+	m_statisticalWeight.store(0, std::memory_order_relaxed);
+
+	const Float total = previous.sum();
+	std::vector<StackNode> stack;
+	stack.push_back({ 0, 0, &previous, 1 });
+	while (!stack.empty())
+	{
+		StackNode sNode = stack.back();
+		stack.pop_back();
+
+		// Note: copied, the new tree may grow and move its nodes
+		const QuadTreeNode otherNode = sNode.m_otherTree->m_nodes[sNode.m_otherNodeIndex];
+		for (int i = 0; i < 4; ++i)
+		{
+			Float fraction = total > 0 ? otherNode.sum(i) / total : Float(0.25) / Float(1 << (2 * (sNode.m_depth - 1)));
+			if (sNode.m_depth < maxDepth && fraction > subdivisionThreshold)
+			{
+				int child = int(m_nodes.size());
+				m_nodes.emplace_back();
+				if (!otherNode.isLeaf(i))
+				{
+					stack.push_back({ child, otherNode.child(i), sNode.m_otherTree, sNode.m_depth + 1 });
+				}
+				else
+				{
+					// A leaf being split: its energy is spread evenly over the new quadrants
+					for (int j = 0; j < 4; ++j)
+						m_nodes[child].setSum(j, otherNode.sum(i) / 4);
+					stack.push_back({ child, child, this, sNode.m_depth + 1 });
+				}
+				m_nodes[sNode.m_nodeIndex].setChild(i, child);
+			}
+		}
+	}
+
+	// The structure is set, the new iteration records from zero
+	for (QuadTreeNode& node : m_nodes)
+	{
+		for (int i = 0; i < 4; ++i)
+			node.setSum(i, 0);
+	}
+}
+
+int DTree::depth() const
+{
+	std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+	int result = 0;
+	while (!stack.empty())
+	{
+		auto entry = stack.back();
+		stack.pop_back();
+		result = glm::max(result, entry.second);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!m_nodes[entry.first].isLeaf(i))
+				stack.push_back({ m_nodes[entry.first].child(i), entry.second + 1 });
+		}
+	}
+	return result;
+}
+
+//-------------------------------------------DTreeWrapper-------------------------------------
+
+void DTreeWrapper::record(const Vector3f& dir, Float irradiance, Float statisticalWeight)
+{
+	m_building.recordIrradiance(dirToCanonical(dir), irradiance, statisticalWeight);
+}
+
+Vector3f DTreeWrapper::sample(const Vector2f& u) const
+{
+	return canonicalToDir(m_sampling.sample(u));
+}
+
+Float DTreeWrapper::pdf(const Vector3f& dir) const
+{
+	// Note: the cylindrical mapping preserves areas, the unit square maps to 4 pi steradians
+	return m_sampling.pdf(dirToCanonical(dir)) * Inv4Pi;
+}
+
+void DTreeWrapper::build(int maxDepth, Float subdivisionThreshold)
+{
+	m_building.build();
+	m_sampling = m_building;
+	m_building.reset(m_sampling, maxDepth, subdivisionThreshold);
+}
+
+//-------------------------------------------SDTree-------------------------------------
+
+SDTree::SDTree(const Bounds3f& bounds)
+{
+	Vector3f diag = bounds.diagonal();
+	Float size = glm::max(diag.x, glm::max(diag.y, diag.z));
+	m_bounds = Bounds3f(bounds.m_pMin, bounds.m_pMin + Vector3f(size));
+
+	m_nodes.emplace_back();
+	m_nodes[0].m_dTreeIndex = 0;
+	m_dTrees.emplace_back();
+}
+
+DTreeWrapper* SDTree::dTreeWrapper(const Vector3f& p)
+{
+	Vector3f q = m_bounds.offset(p);
+	for (int i = 0; i < 3; ++i)
+		q[i] = clamp(q[i], Float(0), aOneMinusEpsilon);
+
+	int nodeIndex = 0;
+	while (m_nodes[nodeIndex].m_children[0] != 0)
+	{
+		const SDTreeNode& node = m_nodes[nodeIndex];
+		Float& x = q[node.m_axis];
+		if (x < 0.5f)
+		{
+			x *= 2;
+			nodeIndex = node.m_children[0];
+		}
+		else
+		{
+			x = (x - 0.5f) * 2;
+			nodeIndex = node.m_children[1];
+		}
+	}
+	return &m_dTrees[m_nodes[nodeIndex].m_dTreeIndex];
+}
+
+void SDTree::subdivide(int nodeIndex, Float sTreeThreshold)
+{
+	std::vector<int> stack = { nodeIndex };
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const int dTreeIndex = m_nodes[index].m_dTreeIndex;
+		if (m_nodes[index].m_children[0] != 0 || m_dTrees[dTreeIndex].statisticalWeight() <= sTreeThreshold)
+			continue;
+
+		// Split the leaf in halves along its axis, both start from its directional distribution
+		// with half of its records
+		DTreeWrapper& dTree = m_dTrees[dTreeIndex];
+		dTree.setStatisticalWeight(dTree.statisticalWeight() / 2);
+		m_dTrees.push_back(m_dTrees[dTreeIndex]);
+
+		const int childAxis = (m_nodes[index].m_axis + 1) % 3;
+		const int child0 = int(m_nodes.size());
+		m_nodes.emplace_back();
+		m_nodes.emplace_back();
+		m_nodes[child0].m_axis = childAxis;
+		m_nodes[child0].m_dTreeIndex = dTreeIndex;
+		m_nodes[child0 + 1].m_axis = childAxis;
+		m_nodes[child0 + 1].m_dTreeIndex = int(m_dTrees.size()) - 1;
+
+		m_nodes[index].m_children[0] = child0;
+		m_nodes[index].m_children[1] = child0 + 1;
+		m_nodes[index].m_dTreeIndex = -1;
+
+		stack.push_back(child0);
+		stack.push_back(child0 + 1);
+	}
+}
+
+void SDTree::refine(Float sTreeThreshold, int maxDTreeDepth, Float dTreeThreshold)
+{
+	// Note: the spatial leaves are all reached from the root
+	const size_t nNodes = m_nodes.size();
+	for (size_t i = 0; i < nNodes; ++i)
+	{
+		if (m_nodes[i].m_children[0] == 0)
+			subdivide(int(i), sTreeThreshold);
+	}
+
+	parallelFor((size_t)0, m_dTrees.size(), [&](const size_t& i)
+	{
+		m_dTrees[i].build(maxDTreeDepth, dTreeThreshold);
+	});
+}
+
+RENDER_END
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "../Core/Rendering.h"
+#include "../Math/KMathUtil.h"
+
+#include <atomic>
+#include <vector>
+
+RENDER_BEGIN
+
+// Structures of "Practical Path Guiding for Efficient Light-Transport Simulation" (Muller et al. 2017):
+// a binary tree over space (SDTree) whose leaves hold a quadtree over directions (DTree), directions
+// being mapped to the unit square through cylindrical coordinates.
+
+// Node of the directional quadtree, the children cover the quadrants of the node's square
+class QuadTreeNode
+{
+public:
+	QuadTreeNode();
+	QuadTreeNode(const QuadTreeNode& other);
+	QuadTreeNode& operator=(const QuadTreeNode& other);
+
+	Float sum(int index) const { return m_sum[index].load(std::memory_order_relaxed); }
+	void setSum(int index, Float value) { m_sum[index].store(value, std::memory_order_relaxed); }
+	void addSum(int index, Float value);
+
+	// Note: the root can't be a child, so zero marks a leaf quadrant
+	int child(int index) const { return m_children[index]; }
+	void setChild(int index, int node) { m_children[index] = node; }
+	bool isLeaf(int index) const { return m_children[index] == 0; }
+
+	// Quadrant holding _p_, _p_ is remapped to the quadrant's own unit square
+	static int childIndex(Vector2f& p);
+
+private:
+	std::atomic<Float> m_sum[4];
+	int m_children[4];
+};
+
+class DTree
+{
+public:
+	DTree();
+
+	// Total recorded irradiance (valid after build()), and number of records since the last reset
+	Float sum() const { return m_sum.load(std::memory_order_relaxed); }
+	Float statisticalWeight() const { return m_statisticalWeight.load(std::memory_order_relaxed); }
+	void setStatisticalWeight(Float weight) { m_statisticalWeight.store(weight, std::memory_order_relaxed); }
+
+	void recordIrradiance(const Vector2f& p, Float irradiance, Float statisticalWeight);
+
+	// Density over the unit square, and sample of it
+	Float pdf(Vector2f p) const;
+	Vector2f sample(Vector2f u) const;
+
+	// Propagate the sums recorded in the leaves up to the root
+	void build();
+
+	// Restructure the tree after _previous_: quadrants holding more than _subdivisionThreshold_ of the
+	// energy are split and the other ones are merged, the sums of the new tree are zero
+	void reset(const DTree& previous, int maxDepth, Float subdivisionThreshold);
+
+	int depth() const;
+
+	DTree(const DTree& other);
+	DTree& operator=(const DTree& other);
+
+private:
+	void buildNode(int nodeIndex);
+
+	std::vector<QuadTreeNode> m_nodes;
+	std::atomic<Float> m_sum;
+	std::atomic<Float> m_statisticalWeight;
+};
+
+// The directional distribution of a spatial leaf: records go into the building tree while the
+// sampling tree, learned by the previous iteration, is the one sampled
+class DTreeWrapper
+{
+public:
+	void record(const Vector3f& dir, Float irradiance, Float statisticalWeight);
+
+	Vector3f sample(const Vector2f& u) const;
+	Float pdf(const Vector3f& dir) const;
+
+	// End of an iteration: the building tree becomes the sampling one and is restructured
+	void build(int maxDepth, Float subdivisionThreshold);
+
+	Float statisticalWeight() const { return m_building.statisticalWeight(); }
+	void setStatisticalWeight(Float weight) { m_building.setStatisticalWeight(weight); }
+
+private:
+	DTree m_building;
+	DTree m_sampling;
+};
+
+struct SDTreeNode
+{
+	int m_axis = 0;
+	// Note: zero marks a leaf, the root can't be a child
+	int m_children[2] = { 0, 0 };
+	int m_dTreeIndex = -1;
+};
+
+class SDTree
+{
+public:
+	typedef std::unique_ptr<SDTree> ptr;
+
+	SDTree(const Bounds3f& bounds);
+
+	// Directional distribution of the spatial leaf holding _p_
+	DTreeWrapper* dTreeWrapper(const Vector3f& p);
+
+	// Split the leaves holding more than _sTreeThreshold_ records, then rebuild every directional tree
+	void refine(Float sTreeThreshold, int maxDTreeDepth, Float dTreeThreshold);
+
+	size_t numLeaves() const { return m_dTrees.size(); }
+
+private:
+	void subdivide(int nodeIndex, Float sTreeThreshold);
+
+	// Note: a cube, so that splitting the axes in turn gives cubes again
+	Bounds3f m_bounds;
+	std::vector<SDTreeNode> m_nodes;
+	std::vector<DTreeWrapper> m_dTrees;
+};
+
+// Cylindrical mapping between directions and the unit square
+Vector3f canonicalToDir(const Vector2f& p);
+Vector2f dirToCanonical(const Vector3f& d);
+
+RENDER_END
@@ -0,0 +1,430 @@
+#include "SPPMIntegrator.h"
+
+#include "../Core/BSDF.h"
+#include "../Core/Scene.h"
+#include "../Core/Film.h"
+#include "../Math/Rng.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Parallel.h"
+#include "../Tool/Reporter.h"
+#include "../Tool/Logger.h"
+
+RENDER_BEGIN
+
+// Photons traced by one task, they share a random sequence and a memory arena
+static constexpr int64_t photonGrain = 4096;
+
+struct SPPMPixel
+{
+	// Current search radius and direct lighting summed over the iterations
+	Float m_radius = 0;
+	Spectrum m_Ld;
+
+	// Visible point of the current iteration, _m_bsdf_ lives in the arena of the pixel's tile
+	struct VisiblePoint
+	{
+		Vector3f m_p;
+		Vector3f m_wo;
+		const BSDF* m_bsdf = nullptr;
+		Spectrum m_beta;
+	} m_vp;
+
+	// Photons gathered by the visible point during the current iteration, updated concurrently
+	// by the photon pass
+	AtomicFloat m_phi[Spectrum::nSamples];
+	std::atomic<int> m_M{ 0 };
+
+	// Photon count and flux of the progressive estimate
+	Float m_N = 0;
+	Spectrum m_tau;
+};
+
+// Node of the list of visible points overlapping a grid cell
+struct SPPMPixelListNode
+{
+	SPPMPixel* m_pixel;
+	SPPMPixelListNode* m_next;
+};
+
+static bool toGrid(const Vector3f& p, const Bounds3f& bounds, const int gridRes[3], Vector3i& pi)
+{
+	bool inBounds = true;
+	Vector3f pg = bounds.offset(p);
+	for (int i = 0; i < 3; ++i)
+	{
+		pi[i] = int(gridRes[i] * pg[i]);
+		inBounds &= (pi[i] >= 0 && pi[i] < gridRes[i]);
+		pi[i] = clamp(pi[i], 0, gridRes[i] - 1);
+	}
+	return inBounds;
+}
+
+static inline unsigned int hashCell(const Vector3i& p, int hashSize)
+{
+	return (unsigned int)((p.x * 73856093) ^ (p.y * 19349663) ^ (p.z * 83492791)) % (unsigned int)hashSize;
+}
+
+RENDER_REGISTER_CLASS(SPPMIntegrator, "SPPM")
+
+SPPMIntegrator::SPPMIntegrator(const APropertyTreeNode& node)
+	: m_nIterations(glm::max(1, node.getPropertyList().getInteger("Iterations", 64))),
+	m_photonsPerIteration(node.getPropertyList().getInteger("PhotonsPerIteration", -1)),
+	m_maxDepth(node.getPropertyList().getInteger("Depth", 5)),
+	m_initialSearchRadius(node.getPropertyList().getFloat("Radius", 1.f)),
+	m_writeFrequency(node.getPropertyList().getInteger("WriteFrequency", 0))
+{
+	//Sampler
+	const auto& samplerNode = node.getPropertyChild("Sampler");
+	m_sampler = Sampler::ptr(static_cast<Sampler*>(AObjectFactory::createInstance(
+		samplerNode.getTypeName(), samplerNode)));
+
+	//Camera
+	const auto& cameraNode = node.getPropertyChild("Camera");
+	m_camera = Camera::ptr(static_cast<Camera*>(AObjectFactory::createInstance(
+		cameraNode.getTypeName(), cameraNode)));
+
+	activate();
+}
+
+SPPMIntegrator::SPPMIntegrator(Camera::ptr camera, Sampler::ptr sampler, int nIterations,
+	int photonsPerIteration, int maxDepth, Float initialSearchRadius, int writeFrequency)
+	: m_camera(camera), m_sampler(sampler), m_nIterations(nIterations),
+	m_photonsPerIteration(photonsPerIteration), m_maxDepth(maxDepth),
+	m_initialSearchRadius(initialSearchRadius), m_writeFrequency(writeFrequency) {}
+
+void SPPMIntegrator::preprocess(const Scene& scene)
+{
+	m_lightDistribution = createLightSampleDistribution("power", scene);
+}
+
+void SPPMIntegrator::render(const Scene& scene)
+{
+	// Initialize the pixels of the cropped image
+	Bounds2i pixelBounds = m_camera->m_film->getCroppedPixelBounds();
+	Vector2i pixelExtent = pixelBounds.diagonal();
+	const int nPixels = pixelBounds.area();
+	std::unique_ptr<SPPMPixel[]> pixels(new SPPMPixel[nPixels]);
+	for (int i = 0; i < nPixels; ++i)
+		pixels[i].m_radius = m_initialSearchRadius;
+
+	const int64_t photonsPerIteration = m_photonsPerIteration > 0 ? m_photonsPerIteration : nPixels;
+	const Distribution1D* lightDistr = m_lightDistribution->lookup(Vector3f(0));
+
+	constexpr int tileSize = 16;
+	Vector2i nTiles((pixelExtent.x + tileSize - 1) / tileSize, (pixelExtent.y + tileSize - 1) / tileSize);
+	const int nTotalTiles = nTiles.x * nTiles.y;
+	auto tileBounds = [&](int t) -> Bounds2i
+	{
+		Vector2i tile(t % nTiles.x, t / nTiles.x);
+		int x0 = pixelBounds.m_pMin.x + tile.x * tileSize;
+		int x1 = glm::min(x0 + tileSize, pixelBounds.m_pMax.x);
+		int y0 = pixelBounds.m_pMin.y + tile.y * tileSize;
+		int y1 = glm::min(y0 + tileSize, pixelBounds.m_pMax.y);
+		return Bounds2i(Vector2i(x0, y0), Vector2i(x1, y1));
+	};
+	auto pixelIndex = [&](const Vector2i& pixel)
+	{
+		return (pixel.y - pixelBounds.m_pMin.y) * pixelExtent.x + (pixel.x - pixelBounds.m_pMin.x);
+	};
+
+	// Note: the visible points' BSDFs and the grid's list nodes stay alive until the end of the
+	//       photon pass, every tile allocates them from its own arena
+	std::unique_ptr<MemoryArena[]> tileArenas(new MemoryArena[nTotalTiles]);
+
+	// The hash grid holds one list of visible points per cell, cells are hashed so that the memory
+	// does not depend on the grid resolution
+	const int hashSize = nPixels;
+	std::vector<std::atomic<SPPMPixelListNode*>> grid(hashSize);
+
+	if (m_sampler->samplesPerPixel < m_nIterations)
+	{
+		K_WARN("SPPM with {0} iterations and a sampler of {1} samples per pixel, the camera samples are only stratified over {1} iterations",
+			m_nIterations, m_sampler->samplesPerPixel);
+	}
+
+	Reporter reporter(m_nIterations, "Rendering");
+	for (int iter = 0; iter < m_nIterations; ++iter)
+	{
+		// Generate the visible points of the iteration
+		AParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t& t)
+			{
+				MemoryArena& arena = tileArenas[t];
+				arena.Reset();
+
+				// Note: each iteration needs its own seeds, otherwise random samplers would repeat their samples
+				std::unique_ptr<Sampler> tileSampler = m_sampler->clone(int(int64_t(iter) * nTotalTiles + t));
+				for (Vector2i pixel : tileBounds(int(t)))
+				{
+					tileSampler->startPixel(pixel);
+					tileSampler->setSampleNumber(iter);
+
+					CameraSample cameraSample = tileSampler->getCameraSample(pixel);
+					Ray ray;
+					Spectrum beta(m_camera->castingRay(cameraSample, ray));
+					if (beta.isBlack())
+						continue;
+
+					// Follow the camera path to its first diffuse vertex
+					SPPMPixel& p = pixels[pixelIndex(pixel)];
+					bool specularBounce = false;
+					for (int depth = 0; depth < m_maxDepth; ++depth)
+					{
+						SurfaceInteraction isect;
+						if (!scene.hit(ray, isect))
+						{
+							for (const auto& light : scene.m_infiniteLights)
+								p.m_Ld += beta * light->Le(ray);
+							break;
+						}
+
+						isect.computeScatteringFunctions(ray, arena, true);
+						if (!isect.bsdf)
+						{
+							ray = isect.spawnRay(ray.direction());
+							--depth;
+							continue;
+						}
+						const BSDF& bsdf = *isect.bsdf;
+
+						// Accumulate the direct lighting at the vertex
+						Vector3f wo = -ray.direction();
+						if (depth == 0 || specularBounce)
+							p.m_Ld += beta * isect.Le(wo);
+						if (bsdf.numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+							p.m_Ld += beta * uniformSampleOneLight(isect, scene, arena, *tileSampler, m_lightDistribution.get());
+
+						// Store the visible point at the first diffuse vertex, or at the last glossy one
+						bool isDiffuse = bsdf.numComponents(BxDFType(BSDF_DIFFUSE | BSDF_REFLECTION | BSDF_TRANSMISSION)) > 0;
+						bool isGlossy = bsdf.numComponents(BxDFType(BSDF_GLOSSY | BSDF_REFLECTION | BSDF_TRANSMISSION)) > 0;
+						if (isDiffuse || (isGlossy && depth == m_maxDepth - 1))
+						{
+							p.m_vp.m_p = isect.p;
+							p.m_vp.m_wo = wo;
+							p.m_vp.m_bsdf = isect.bsdf;
+							p.m_vp.m_beta = beta;
+							break;
+						}
+
+						// Otherwise continue the path through the specular surface
+						if (depth < m_maxDepth - 1)
+						{
+							Float pdf;
+							Vector3f wi;
+							BxDFType type;
+							Spectrum f = bsdf.sample_f(wo, wi, tileSampler->get2D(), pdf, type, BSDF_ALL);
+							if (pdf == 0. || f.isBlack())
+								break;
+							specularBounce = (type & BSDF_SPECULAR) != 0;
+							beta *= f * absDot(wi, isect.normal) / pdf;
+							if (beta.y() < 0.25f)
+							{
+								Float continueProb = glm::min((Float)1, beta.y());
+								if (tileSampler->get1D() > continueProb)
+									break;
+								beta /= continueProb;
+							}
+							ray = isect.spawnRay(wi);
+						}
+					}
+				}
+			}, ExecutionPolicy::PARALLEL);
+
+		// Compute the grid bounds from the visible points and their search radii
+		Bounds3f gridBounds;
+		Float maxRadius = 0;
+		for (int i = 0; i < nPixels; ++i)
+		{
+			const SPPMPixel& p = pixels[i];
+			if (p.m_vp.m_beta.isBlack())
+				continue;
+			Bounds3f vpBound(p.m_vp.m_p - Vector3f(p.m_radius), p.m_vp.m_p + Vector3f(p.m_radius));
+			gridBounds = unionBounds(gridBounds, vpBound);
+			maxRadius = glm::max(maxRadius, p.m_radius);
+		}
+
+		// Choose cells about the size of the largest search radius
+		int gridRes[3];
+		Vector3f diag = gridBounds.diagonal();
+		Float maxDiag = glm::max(diag.x, glm::max(diag.y, diag.z));
+		int baseGridRes = maxRadius > 0 ? int(maxDiag / maxRadius) : 1;
+		for (int i = 0; i < 3; ++i)
+			gridRes[i] = glm::max(int(baseGridRes * diag[i] / maxDiag), 1);
+
+		// Add the visible points to the grid cells they overlap, the lists are lock-free stacks
+		for (int i = 0; i < hashSize; ++i)
+			grid[i].store(nullptr, std::memory_order_relaxed);
+		AParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t& t)
+			{
+				MemoryArena& arena = tileArenas[t];
+				for (Vector2i pixel : tileBounds(int(t)))
+				{
+					SPPMPixel& p = pixels[pixelIndex(pixel)];
+					if (p.m_vp.m_beta.isBlack())
+						continue;
+
+					Float radius = p.m_radius;
+					Vector3i pMin, pMax;
+					toGrid(p.m_vp.m_p - Vector3f(radius), gridBounds, gridRes, pMin);
+					toGrid(p.m_vp.m_p + Vector3f(radius), gridBounds, gridRes, pMax);
+					for (int z = pMin.z; z <= pMax.z; ++z)
+					{
+						for (int y = pMin.y; y <= pMax.y; ++y)
+						{
+							for (int x = pMin.x; x <= pMax.x; ++x)
+							{
+								unsigned int h = hashCell(Vector3i(x, y, z), hashSize);
+								SPPMPixelListNode* node = arena.Alloc<SPPMPixelListNode>();
+								node->m_pixel = &p;
+								node->m_next = grid[h].load(std::memory_order_relaxed);
+								while (!grid[h].compare_exchange_weak(node->m_next, node, std::memory_order_release,
+									std::memory_order_relaxed))
+									;
+							}
+						}
+					}
+				}
+			}, ExecutionPolicy::PARALLEL);
+
+		// Trace the photons and gather them at the visible points
+		const int64_t nPhotonTasks = lightDistr ? (photonsPerIteration + photonGrain - 1) / photonGrain : 0;
+		AParallelUtils::parallelFor((size_t)0, (size_t)nPhotonTasks, [&](const size_t& task)
+			{
+				MemoryArena arena;
+				Rng rng(uint64_t(iter) * uint64_t(nPhotonTasks) + task);
+				const int64_t photonBegin = task * photonGrain;
+				const int64_t photonEnd = glm::min(photonBegin + photonGrain, photonsPerIteration);
+				for (int64_t photonIndex = photonBegin; photonIndex < photonEnd; ++photonIndex)
+				{
+					// Choose a light to shoot the photon from
+					Float lightPdf;
+					int lightNum = lightDistr->sampleDiscrete(rng.uniformFloat(), &lightPdf);
+					const Light::ptr& light = scene.m_lights[lightNum];
+
+					// Sample the photon's ray leaving the light
+					Vector2f uLight0(rng.uniformFloat(), rng.uniformFloat());
+					Vector2f uLight1(rng.uniformFloat(), rng.uniformFloat());
+					Ray photonRay;
+					Vector3f nLight;
+					Float pdfPos, pdfDir;
+					Spectrum Le = light->sample_Le(uLight0, uLight1, photonRay, nLight, pdfPos, pdfDir);
+					if (pdfPos == 0 || pdfDir == 0 || Le.isBlack())
+						continue;
+					Spectrum beta = (absDot(nLight, photonRay.direction()) * Le) / (lightPdf * pdfPos * pdfDir);
+					if (beta.isBlack())
+						continue;
+
+					// Follow the photon path through the scene
+					for (int depth = 0; depth < m_maxDepth; ++depth)
+					{
+						SurfaceInteraction isect;
+						if (!scene.hit(photonRay, isect))
+							break;
+
+						// Note: photons arriving directly from the light are the direct lighting,
+						//       which the camera pass already estimates
+						if (depth > 0)
+						{
+							Vector3i photonGridIndex;
+							if (toGrid(isect.p, gridBounds, gridRes, photonGridIndex))
+							{
+								unsigned int h = hashCell(photonGridIndex, hashSize);
+								for (SPPMPixelListNode* node = grid[h].load(std::memory_order_acquire); node != nullptr;
+									node = node->m_next)
+								{
+									SPPMPixel& p = *node->m_pixel;
+									Float radius = p.m_radius;
+									if (distanceSquared(p.m_vp.m_p, isect.p) > radius * radius)
+										continue;
+
+									// Add the photon's contribution to the visible point
+									Vector3f wi = -photonRay.direction();
+									Spectrum Phi = beta * p.m_vp.m_bsdf->f(p.m_vp.m_wo, wi);
+									for (int i = 0; i < Spectrum::nSamples; ++i)
+										p.m_phi[i].add(Phi[i]);
+									++p.m_M;
+								}
+							}
+						}
+
+						// Sample the new photon direction, with the BSDF's adjoint scattering
+						isect.computeScatteringFunctions(photonRay, arena, true, TransportMode::Importance);
+						if (!isect.bsdf)
+						{
+							--depth;
+							photonRay = isect.spawnRay(photonRay.direction());
+							continue;
+						}
+						const BSDF& photonBSDF = *isect.bsdf;
+
+						Vector3f wi, wo = -photonRay.direction();
+						Float pdf;
+						BxDFType flags;
+						Vector2f bsdfSample(rng.uniformFloat(), rng.uniformFloat());
+						Spectrum fr = photonBSDF.sample_f(wo, wi, bsdfSample, pdf, flags, BSDF_ALL);
+						if (fr.isBlack() || pdf == 0.f)
+							break;
+						Spectrum bnew = beta * fr * absDot(wi, isect.normal) / pdf;
+
+						// Possibly terminate the photon path with Russian roulette
+						Float q = glm::max((Float)0, 1 - bnew.y() / beta.y());
+						if (rng.uniformFloat() < q)
+							break;
+						beta = bnew / (1 - q);
+						photonRay = isect.spawnRay(wi);
+					}
+					arena.Reset();
+				}
+			}, ExecutionPolicy::PARALLEL);
+
+		// Update the progressive estimates and shrink the radii of the pixels that gathered photons
+		AParallelUtils::parallelFor((size_t)0, (size_t)nPixels, [&](const size_t& i)
+			{
+				SPPMPixel& p = pixels[i];
+				const int M = p.m_M.load(std::memory_order_relaxed);
+				if (M > 0)
+				{
+					// Note: gamma is the fraction of the new photons kept, 2/3 as in the paper
+					constexpr Float gamma = (Float)2 / (Float)3;
+					Float Nnew = p.m_N + gamma * M;
+					Float Rnew = p.m_radius * std::sqrt(Nnew / (p.m_N + M));
+					Spectrum Phi;
+					for (int j = 0; j < Spectrum::nSamples; ++j)
+						Phi[j] = p.m_phi[j];
+					p.m_tau = (p.m_tau + p.m_vp.m_beta * Phi) * (Rnew * Rnew) / (p.m_radius * p.m_radius);
+					p.m_N = Nnew;
+					p.m_radius = Rnew;
+					p.m_M = 0;
+					for (int j = 0; j < Spectrum::nSamples; ++j)
+						p.m_phi[j] = (Float)0;
+				}
+
+				// Reset the visible point for the next iteration
+				p.m_vp.m_beta = Spectrum(0.f);
+				p.m_vp.m_bsdf = nullptr;
+			}, ExecutionPolicy::PARALLEL);
+
+		reporter.update();
+
+		// Write the current image, the last iteration always does
+		if (iter + 1 == m_nIterations || (m_writeFrequency > 0 && (iter + 1) % m_writeFrequency == 0))
+		{
+			const int64_t Np = int64_t(iter + 1) * photonsPerIteration;
+			std::unique_ptr<Spectrum[]> image(new Spectrum[nPixels]);
+			for (int i = 0; i < nPixels; ++i)
+			{
+				// Direct lighting estimate plus the photon density estimate
+				const SPPMPixel& p = pixels[i];
+				Spectrum L = p.m_Ld / (iter + 1);
+				L += p.m_tau / (Np * Pi * p.m_radius * p.m_radius);
+				image[i] = L;
+			}
+			m_camera->m_film->setImage(image.get());
+			m_camera->m_film->writeImageToFile();
+		}
+	}
+	reporter.done();
+
+	K_INFO("Rendering finished");
+}
+
+RENDER_END
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../Core/Integrator.h"
+#include "../Core/LightDistrib.h"
+
+RENDER_BEGIN
+
+// Stochastic progressive photon mapping (Hachisuka and Jensen 2009). Every iteration traces one
+// camera path per pixel to its first diffuse vertex (the visible point), stores the visible points
+// in a hash grid and shoots photons from the lights, the photons landing within the radius of a
+// visible point being gathered into its pixel. The radii shrink as photons are gathered, so that
+// the estimate converges, and caustics seen through specular surfaces are captured.
+class SPPMIntegrator : public Integrator
+{
+public:
+	typedef std::shared_ptr<SPPMIntegrator> ptr;
+
+	SPPMIntegrator(const APropertyTreeNode& node);
+
+	SPPMIntegrator(Camera::ptr camera, Sampler::ptr sampler, int nIterations, int photonsPerIteration,
+		int maxDepth, Float initialSearchRadius, int writeFrequency);
+
+	virtual void preprocess(const Scene& scene) override;
+	virtual void render(const Scene& scene) override;
+
+	virtual std::string toString() const override { return "SPPMIntegrator[]"; }
+
+private:
+	Camera::ptr m_camera;
+	Sampler::ptr m_sampler;
+
+	int m_nIterations;
+	// Note: non positive means one photon per pixel
+	int m_photonsPerIteration;
+	int m_maxDepth;
+	Float m_initialSearchRadius;
+	int m_writeFrequency;
+
+	// Chooses the lights the camera paths sample and the lights the photons leave from, by power
+	std::unique_ptr<LightDistribution> m_lightDistribution;
+};
+
+RENDER_END
@@ -0,0 +1,151 @@
+#include "VolPathIntegrator.h"
+
+#include "../Core/BSDF.h"
+#include "../Core/Scene.h"
+#include "../Core/Sampler.h"
+#include "../Core/Medium.h"
+#include "../Tool/Memory.h"
+
+RENDER_BEGIN
+
+RENDER_REGISTER_CLASS(VolPathIntegrator, "VolPath")
+
+VolPathIntegrator::VolPathIntegrator(const APropertyTreeNode& node)
+	: SamplerIntegrator(node.getPropertyList()), m_maxDepth(node.getPropertyList().getInteger("Depth", 5))
+	, m_rrThreshold(1.f), m_lightSampleStrategy(node.getPropertyList().getString("LightSampleStrategy", "spatial"))
+{
+	//Sampler
+	const auto& samplerNode = node.getPropertyChild("Sampler");
+	m_sampler = Sampler::ptr(static_cast<Sampler*>(AObjectFactory::createInstance(
+		samplerNode.getTypeName(), samplerNode)));
+
+	//Camera
+	const auto& cameraNode = node.getPropertyChild("Camera");
+	m_camera = Camera::ptr(static_cast<Camera*>(AObjectFactory::createInstance(
+		cameraNode.getTypeName(), cameraNode)));
+
+	activate();
+}
+
+VolPathIntegrator::VolPathIntegrator(int maxDepth, Camera::ptr camera, Sampler::ptr sampler,
+	Float rrThreshold, const std::string& lightSampleStrategy)
+	: SamplerIntegrator(camera, sampler), m_maxDepth(maxDepth),
+	m_rrThreshold(rrThreshold), m_lightSampleStrategy(lightSampleStrategy) {}
+
+void VolPathIntegrator::preprocess(const Scene& scene)
+{
+	m_lightDistribution = createLightSampleDistribution(m_lightSampleStrategy, scene);
+}
+
+Spectrum VolPathIntegrator::Li(const Ray& r, const Scene& scene, Sampler& sampler,
+	MemoryArena& arena, int depth) const
+{
+	Spectrum L(0.f), beta(1.f);
+	Ray ray(r);
+	bool specularBounce = false;
+	int bounces;
+	// Note: see PathIntegrator::Li, etaScale is factored out of beta for Russian roulette
+	Float etaScale = 1;
+
+	for (bounces = 0;; ++bounces)
+	{
+		// Intersect _ray_ with scene and store intersection in _isect_
+		SurfaceInteraction isect;
+		bool hit = scene.hit(ray, isect);
+
+		// Sample the participating medium, if present
+		MediumInteraction mi;
+		if (ray.m_medium != nullptr)
+			beta *= ray.m_medium->sample(ray, sampler, arena, mi);
+		if (beta.isBlack())
+			break;
+
+		// Handle an interaction with a medium or a surface
+		if (mi.isValid())
+		{
+			// Terminate path if maximum depth reached
+			if (bounces >= m_maxDepth)
+				break;
+
+			// Handle scattering at point in medium for volumetric path tracer
+			L += beta * uniformSampleOneLight(mi, scene, arena, sampler, m_lightDistribution.get(), true);
+
+			// Note: the phase function value equals its pdf, so beta is unchanged
+			Vector3f wo = -ray.direction(), wi;
+			mi.phase->sample_p(wo, wi, sampler.get2D());
+			ray = mi.spawnRay(wi);
+			specularBounce = false;
+		}
+		else
+		{
+			// Possibly add emitted light at intersection
+			if (bounces == 0 || specularBounce)
+			{
+				// Add emitted light at path vertex or from the environment
+				if (hit)
+				{
+					L += beta * isect.Le(-ray.direction());
+				}
+				else
+				{
+					for (const auto& light : scene.m_infiniteLights)
+						L += beta * light->Le(ray);
+				}
+			}
+
+			// Terminate path if ray escaped or _maxDepth_ was reached
+			if (!hit || bounces >= m_maxDepth)
+				break;
+
+			// Compute scattering functions and skip over medium boundaries
+			isect.computeScatteringFunctions(ray, arena, true);
+			if (!isect.bsdf)
+			{
+				ray = isect.spawnRay(ray.direction());
+				bounces--;
+				continue;
+			}
+
+			// Sample illuminance from lights to find attenuated path contribution
+			if (isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+			{
+				Spectrum Ld = beta * uniformSampleOneLight(isect, scene, arena, sampler, m_lightDistribution.get(), true);
+				CHECK_GE(Ld.y(), 0.f);
+				L += Ld;
+			}
+
+			// Sample BSDF to get new path direction
+			Vector3f wo = -ray.direction(), wi;
+			Float pdf;
+			BxDFType flags;
+			Spectrum f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdf, flags, BSDF_ALL);
+			if (f.isBlack() || pdf == 0.f)
+				break;
+			beta *= f * absDot(wi, isect.normal) / pdf;
+			DCHECK(!glm::isinf(beta.y()));
+
+			specularBounce = (flags & BSDF_SPECULAR) != 0;
+			if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION))
+			{
+				Float eta = isect.bsdf->m_eta;
+				etaScale *= (dot(wo, isect.normal) > 0) ? (eta * eta) : 1 / (eta * eta);
+			}
+			ray = isect.spawnRay(wi);
+		}
+
+		// Possibly terminate the path with Russian roulette
+		// Factor out radiance scaling due to refraction in rrBeta.
+		Spectrum rrBeta = beta * etaScale;
+		if (rrBeta.maxComponentValue() < m_rrThreshold && bounces > 3)
+		{
+			Float q = glm::max((Float).05f, 1 - rrBeta.maxComponentValue());
+			if (sampler.get1D() < q)
+				break;
+			beta /= 1 - q;
+			DCHECK(!glm::isinf(beta.y()));
+		}
+	}
+	return L;
+}
+
+RENDER_END
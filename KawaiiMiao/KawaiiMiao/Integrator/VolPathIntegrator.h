@@ -0,0 +1,35 @@
+#pragma once
+
+#include "../Core/Integrator.h"
+#include "../Core/LightDistrib.h"
+
+RENDER_BEGIN
+
+// Path tracing through participating media. The media along each ray segment sample a scattering
+// point or return the transmittance weight of reaching the surface, lights are sampled from both
+// surface and medium vertices with shadow rays attenuated by the media they cross.
+class VolPathIntegrator : public SamplerIntegrator
+{
+public:
+	typedef std::shared_ptr<VolPathIntegrator> ptr;
+
+	VolPathIntegrator(const APropertyTreeNode& node);
+
+	VolPathIntegrator(int maxDepth, Camera::ptr camera, Sampler::ptr sampler,
+		Float rrThreshold = 1, const std::string& lightSampleStrategy = "spatial");
+
+	virtual void preprocess(const Scene& scene) override;
+
+	virtual Spectrum Li(const Ray& ray, const Scene& scene, Sampler& sampler,
+		MemoryArena& arena, int depth) const override;
+
+	virtual std::string toString() const override { return "VolPathIntegrator[]"; }
+
+private:
+	int m_maxDepth;
+	Float m_rrThreshold;
+	std::string m_lightSampleStrategy;
+	std::unique_ptr<LightDistribution> m_lightDistribution;
+};
+
+RENDER_END
@@ -0,0 +1,409 @@
+#include "WavefrontPathIntegrator.h"
+
+#include "../Core/BSDF.h"
+#include "../Core/Scene.h"
+#include "../Core/Film.h"
+#include "../Tool/Memory.h"
+#include "../Tool/Parallel.h"
+#include "../Tool/Reporter.h"
+#include "../Tool/Logger.h"
+
+#include <tbb/tbb/parallel_sort.h>
+
+RENDER_BEGIN
+
+// Paths shaded by one task, they share a memory arena for their BSDFs
+static constexpr size_t wavefrontShadeGrain = 256;
+// Paths processed by one task of the light weight kernels
+static constexpr size_t wavefrontKernelGrain = 1024;
+
+void WavefrontPathPool::resize(size_t size)
+{
+	m_pFilm.resize(size);
+	m_cameraWeight.resize(size);
+	m_ray.resize(size);
+	m_hit.resize(size);
+	m_hitFound.resize(size);
+	m_bounces.resize(size);
+	m_L.resize(size);
+	m_beta.resize(size);
+	m_etaScale.resize(size);
+	m_prevP.resize(size);
+	m_prevNormal.resize(size);
+	m_prevBsdfPdf.resize(size);
+	m_specularBounce.resize(size);
+	m_shadowRay.resize(size);
+	m_shadowLd.resize(size);
+	m_hasShadowRay.resize(size);
+	m_alive.resize(size);
+}
+
+RENDER_REGISTER_CLASS(WavefrontPathIntegrator, "WavefrontPath")
+
+WavefrontPathIntegrator::WavefrontPathIntegrator(const APropertyTreeNode& node)
+	: m_maxDepth(node.getPropertyList().getInteger("Depth", 2)),
+	m_poolSize(glm::max(1, node.getPropertyList().getInteger("PoolSize", 1 << 16))),
+	m_rrThreshold(node.getPropertyList().getFloat("RRThreshold", 1.f)),
+	m_lightSampleStrategy(node.getPropertyList().getString("LightSampleStrategy", "spatial"))
+{
+	//Sampler
+	const auto& samplerNode = node.getPropertyChild("Sampler");
+	m_sampler = Sampler::ptr(static_cast<Sampler*>(AObjectFactory::createInstance(
+		samplerNode.getTypeName(), samplerNode)));
+
+	//Camera
+	const auto& cameraNode = node.getPropertyChild("Camera");
+	m_camera = Camera::ptr(static_cast<Camera*>(AObjectFactory::createInstance(
+		cameraNode.getTypeName(), cameraNode)));
+
+	activate();
+}
+
+WavefrontPathIntegrator::WavefrontPathIntegrator(int maxDepth, Camera::ptr camera, Sampler::ptr sampler,
+	int poolSize, Float rrThreshold, const std::string& lightSampleStrategy)
+	: m_camera(camera), m_sampler(sampler), m_maxDepth(maxDepth), m_poolSize(glm::max(1, poolSize)),
+	m_rrThreshold(rrThreshold), m_lightSampleStrategy(lightSampleStrategy) {}
+
+void WavefrontPathIntegrator::preprocess(const Scene& scene)
+{
+	if (!scene.m_lights.empty())
+	{
+		m_lightDistribution = createLightSampleDistribution(m_lightSampleStrategy, scene);
+	}
+
+	// Emitters found by BSDF sampling need their index for the light selection probability
+	m_lightIndices.clear();
+	for (size_t i = 0; i < scene.m_lights.size(); ++i)
+	{
+		m_lightIndices[scene.m_lights[i].get()] = int(i);
+	}
+}
+
+void WavefrontPathIntegrator::render(const Scene& scene)
+{
+	Bounds2i sampleBounds = m_camera->m_film->getSampleBounds();
+	Vector2i sampleExtent = sampleBounds.diagonal();
+	const int64_t spp = m_sampler->samplesPerPixel;
+	const int64_t totalPixels = int64_t(sampleExtent.x) * int64_t(sampleExtent.y);
+	if (totalPixels <= 0 || spp <= 0)
+		return;
+
+	// Note: every slot owns one pixel of a band of neighbouring pixels, and its sampler walks all
+	//       the samples of that pixel over _spp_ waves, so that the samples of a pixel come from
+	//       one pattern which is generated once. A wave never needs more slots than there are pixels.
+	const int poolSize = int(glm::min(int64_t(m_poolSize), totalPixels));
+	m_paths.resize(poolSize);
+	m_samplers.resize(poolSize);
+	for (int i = 0; i < poolSize; ++i)
+	{
+		m_samplers[i] = m_sampler->clone(i);
+	}
+
+	const int64_t nBands = (totalPixels + poolSize - 1) / poolSize;
+	K_INFO("Wavefront path tracing {0} samples in {1} waves of {2} paths", totalPixels * spp, nBands * spp, poolSize);
+
+	Reporter reporter(nBands * spp, "Rendering");
+	std::vector<int> active;
+	active.reserve(poolSize);
+	for (int64_t firstPixel = 0; firstPixel < totalPixels; firstPixel += poolSize)
+	{
+		const int count = int(glm::min(int64_t(poolSize), totalPixels - firstPixel));
+		for (int64_t sampleNum = 0; sampleNum < spp; ++sampleNum)
+		{
+			generateCameraRays(sampleBounds, firstPixel, sampleNum, count);
+			active.clear();
+			for (int i = 0; i < count; ++i)
+			{
+				if (m_paths.m_alive[i])
+					active.push_back(i);
+			}
+
+			while (!active.empty())
+			{
+				traceClosestHits(scene, active);
+				sortByMaterial(active);
+				shadeHits(scene, active);
+				traceShadowRays(scene, active);
+				compactPaths(active);
+			}
+
+			// Add the radiance of the wave to the film, one tile per row of pixels
+			const int64_t lastPixel = firstPixel + count - 1;
+			const int y0 = int(firstPixel / sampleExtent.x), y1 = int(lastPixel / sampleExtent.x) + 1;
+			parallelFor(size_t(y0), size_t(y1), [&](size_t y)
+			{
+				const int64_t rowBegin = glm::max(int64_t(y) * sampleExtent.x, firstPixel);
+				const int64_t rowEnd = glm::min(int64_t(y + 1) * sampleExtent.x, firstPixel + count);
+				Bounds2i rowBounds(Vector2i(sampleBounds.m_pMin.x, sampleBounds.m_pMin.y + int(y)),
+					Vector2i(sampleBounds.m_pMax.x, sampleBounds.m_pMin.y + int(y) + 1));
+				std::unique_ptr<FilmTile> filmTile = m_camera->m_film->getFilmTile(rowBounds);
+				for (int64_t pixel = rowBegin; pixel < rowEnd; ++pixel)
+				{
+					const int slot = int(pixel - firstPixel);
+					Spectrum L = m_paths.m_L[slot];
+
+					// Issue warning if unexpected radiance value returned
+					if (L.hasNaNs() || L.y() < -1e-5 || std::isinf(L.y()))
+					{
+						K_ERROR(stringPrintf("Invalid radiance value returned for pixel (%d, %d), sample %d. "
+							"Setting to black.", sampleBounds.m_pMin.x + int(pixel % sampleExtent.x),
+							sampleBounds.m_pMin.y + int(pixel / sampleExtent.x), int(sampleNum)));
+						L = Spectrum(0.f);
+					}
+					filmTile->addSample(m_paths.m_pFilm[slot], L, m_paths.m_cameraWeight[slot]);
+				}
+				m_camera->m_film->mergeFilmTile(std::move(filmTile));
+			});
+
+			reporter.update();
+		}
+	}
+
+	reporter.done();
+
+	K_INFO("Rendering finished");
+
+	m_camera->m_film->writeImageToFile();
+}
+
+void WavefrontPathIntegrator::generateCameraRays(const Bounds2i& sampleBounds, int64_t firstPixel,
+	int64_t sampleNum, int count)
+{
+	const int width = sampleBounds.diagonal().x;
+	parallelFor(0, size_t(count), wavefrontKernelGrain, [&](const tbb::blocked_range<size_t>& range)
+	{
+		for (size_t slot = range.begin(); slot < range.end(); ++slot)
+		{
+			const int64_t pixelIndex = firstPixel + int64_t(slot);
+			Vector2i pixel(sampleBounds.m_pMin.x + int(pixelIndex % width),
+				sampleBounds.m_pMin.y + int(pixelIndex / width));
+
+			// Note: the pixel's samples are only generated when the slot moves on to it
+			Sampler& sampler = *m_samplers[slot];
+			if (sampleNum == 0)
+				sampler.startPixel(pixel);
+			sampler.setSampleNumber(sampleNum);
+
+			// Generate camera ray for current sample
+			CameraSample cameraSample = sampler.getCameraSample(pixel);
+			m_paths.m_pFilm[slot] = cameraSample.pFilm;
+			m_paths.m_cameraWeight[slot] = m_camera->castingRay(cameraSample, m_paths.m_ray[slot]);
+
+			m_paths.m_bounces[slot] = 0;
+			m_paths.m_L[slot] = Spectrum(0.f);
+			m_paths.m_beta[slot] = Spectrum(1.f);
+			m_paths.m_etaScale[slot] = 1.f;
+			m_paths.m_specularBounce[slot] = false;
+			m_paths.m_alive[slot] = m_paths.m_cameraWeight[slot] > 0;
+		}
+	});
+}
+
+void WavefrontPathIntegrator::traceClosestHits(const Scene& scene, const std::vector<int>& active)
+{
+	parallelFor(0, active.size(), wavefrontKernelGrain, [&](const tbb::blocked_range<size_t>& range)
+	{
+		for (size_t i = range.begin(); i < range.end(); ++i)
+		{
+			const int slot = active[i];
+			m_paths.m_hit[slot] = HitRecord();
+			m_paths.m_hitFound[slot] = scene.hit(m_paths.m_ray[slot], m_paths.m_hit[slot]);
+		}
+	});
+}
+
+void WavefrontPathIntegrator::sortByMaterial(std::vector<int>& active) const
+{
+	// Note: paths that hit the same material are shaded together, the escaped ones come first.
+	//       Ties keep the slot order, which follows the pixel order.
+	auto materialOf = [&](int slot) -> const Material*
+	{
+		if (!m_paths.m_hitFound[slot])
+			return nullptr;
+		const HitRecord& hit = m_paths.m_hit[slot];
+		return (hit.m_instance != nullptr ? hit.m_instance : hit.m_primitive)->getMaterial();
+	};
+
+	tbb::parallel_sort(active.begin(), active.end(), [&](int a, int b) -> bool
+	{
+		const Material* ma = materialOf(a);
+		const Material* mb = materialOf(b);
+		return ma == mb ? a < b : std::less<const Material*>()(ma, mb);
+	});
+}
+
+void WavefrontPathIntegrator::shadeHits(const Scene& scene, const std::vector<int>& active)
+{
+	parallelFor(0, active.size(), wavefrontShadeGrain, [&](const tbb::blocked_range<size_t>& range)
+	{
+		MemoryArena arena;
+		for (size_t i = range.begin(); i < range.end(); ++i)
+		{
+			shadePath(scene, active[i], arena);
+
+			// Free _MemoryArena_ memory from shading the path vertex
+			arena.Reset();
+		}
+	});
+}
+
+Float WavefrontPathIntegrator::emissionWeight(int slot, const Light* light, const Vector3f& wi) const
+{
+	// Camera rays and specular bounces can't be found by light sampling
+	if (m_paths.m_bounces[slot] == 0 || m_paths.m_specularBounce[slot])
+		return 1.f;
+
+	auto index = m_lightIndices.find(light);
+	if (index == m_lightIndices.end() || m_lightDistribution == nullptr)
+		return 1.f;
+
+	Interaction prev(m_paths.m_prevP[slot]);
+	prev.normal = m_paths.m_prevNormal[slot];
+	prev.time = m_paths.m_ray[slot].m_time;
+	Float lightPdf = light->pdf_Li(prev, wi) * m_lightDistribution->pmf(prev, index->second);
+	return powerHeuristic(1, m_paths.m_prevBsdfPdf[slot], 1, lightPdf);
+}
+
+void WavefrontPathIntegrator::shadePath(const Scene& scene, int slot, MemoryArena& arena)
+{
+	Ray& ray = m_paths.m_ray[slot];
+	Spectrum& L = m_paths.m_L[slot];
+	Spectrum& beta = m_paths.m_beta[slot];
+	int& bounces = m_paths.m_bounces[slot];
+	m_paths.m_hasShadowRay[slot] = false;
+
+	// Add emitted light from the environment and terminate escaped paths
+	if (!m_paths.m_hitFound[slot])
+	{
+		for (const auto& light : scene.m_infiniteLights)
+		{
+			Spectrum Le = light->Le(ray);
+			if (!Le.isBlack())
+				L += beta * Le * emissionWeight(slot, light.get(), ray.direction());
+		}
+		m_paths.m_alive[slot] = false;
+		return;
+	}
+
+	SurfaceInteraction isect;
+	if (!scene.computeSurfaceInteraction(ray, m_paths.m_hit[slot], isect))
+	{
+		m_paths.m_alive[slot] = false;
+		return;
+	}
+
+	// Add emitted light at path vertex
+	Spectrum Le = isect.Le(-ray.direction());
+	if (!Le.isBlack())
+		L += beta * Le * emissionWeight(slot, isect.primitive->getAreaLight(), ray.direction());
+
+	// Terminate path if _maxDepth_ was reached
+	if (bounces >= m_maxDepth)
+	{
+		m_paths.m_alive[slot] = false;
+		return;
+	}
+
+	// Compute scattering functions and skip over medium boundaries
+	isect.computeScatteringFunctions(ray, arena, true);
+	if (!isect.bsdf)
+	{
+		ray = isect.spawnRay(ray.direction());
+		return;
+	}
+
+	Sampler& sampler = *m_samplers[slot];
+
+	// Sample one light, its shadow ray is traced by the next stage
+	// (But skip this for perfectly specular BSDFs.)
+	const BxDFType nonSpecular = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+	if (m_lightDistribution != nullptr && isect.bsdf->numComponents(nonSpecular) > 0)
+	{
+		Float lightPmf;
+		int lightNum = m_lightDistribution->sample(isect, sampler.get1D(), lightPmf);
+		Vector2f uLight = sampler.get2D();
+		if (lightPmf > 0)
+		{
+			const Light& light = *scene.m_lights[lightNum];
+			Vector3f wi;
+			Float lightPdf = 0;
+			VisibilityTester visibility;
+			Spectrum Li = light.sample_Li(isect, uLight, wi, lightPdf, visibility);
+			if (lightPdf > 0 && !Li.isBlack())
+			{
+				Spectrum f = isect.bsdf->f(isect.wo, wi, nonSpecular) * absDot(wi, isect.normal);
+				if (!f.isBlack())
+				{
+					Float weight = 1.f;
+					if (!isDeltaLight(light.flags))
+						weight = powerHeuristic(1, lightPmf * lightPdf, 1, isect.bsdf->pdf(isect.wo, wi, nonSpecular));
+					m_paths.m_shadowRay[slot] = visibility.P0().spawnRayTo(visibility.P1());
+					m_paths.m_shadowLd[slot] = beta * f * Li * weight / (lightPmf * lightPdf);
+					m_paths.m_hasShadowRay[slot] = true;
+				}
+			}
+		}
+	}
+
+	// Sample BSDF to get new path direction
+	Vector3f wo = -ray.direction(), wi;
+	Float pdf;
+	BxDFType flags;
+	Spectrum f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdf, flags, BSDF_ALL);
+	if (f.isBlack() || pdf == 0.f)
+	{
+		m_paths.m_alive[slot] = false;
+		return;
+	}
+	beta *= f * absDot(wi, isect.normal) / pdf;
+
+	m_paths.m_specularBounce[slot] = (flags & BSDF_SPECULAR) != 0;
+	if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION))
+	{
+		// Update the term that tracks radiance scaling for refraction
+		Float eta = isect.bsdf->m_eta;
+		m_paths.m_etaScale[slot] *= (dot(wo, isect.normal) > 0) ? (eta * eta) : 1 / (eta * eta);
+	}
+
+	m_paths.m_prevP[slot] = isect.p;
+	m_paths.m_prevNormal[slot] = isect.normal;
+	m_paths.m_prevBsdfPdf[slot] = pdf;
+	ray = isect.spawnRay(wi);
+
+	// Possibly terminate the path with Russian roulette.
+	// Factor out radiance scaling due to refraction in rrBeta.
+	Spectrum rrBeta = beta * m_paths.m_etaScale[slot];
+	if (rrBeta.maxComponentValue() < m_rrThreshold && bounces > 3)
+	{
+		Float q = glm::max((Float).05f, 1 - rrBeta.maxComponentValue());
+		if (sampler.get1D() < q)
+		{
+			m_paths.m_alive[slot] = false;
+			return;
+		}
+		beta /= 1 - q;
+	}
+	++bounces;
+}
+
+void WavefrontPathIntegrator::traceShadowRays(const Scene& scene, const std::vector<int>& active)
+{
+	parallelFor(0, active.size(), wavefrontKernelGrain, [&](const tbb::blocked_range<size_t>& range)
+	{
+		for (size_t i = range.begin(); i < range.end(); ++i)
+		{
+			const int slot = active[i];
+			if (m_paths.m_hasShadowRay[slot] && !scene.hit(m_paths.m_shadowRay[slot]))
+				m_paths.m_L[slot] += m_paths.m_shadowLd[slot];
+		}
+	});
+}
+
+void WavefrontPathIntegrator::compactPaths(std::vector<int>& active) const
+{
+	// Drop the paths terminated by escaping, absorption, max depth or Russian roulette
+	active.erase(std::remove_if(active.begin(), active.end(),
+		[&](int slot) { return !m_paths.m_alive[slot]; }), active.end());
+}
+
+RENDER_END
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "../Core/Integrator.h"
+#include "../Core/LightDistrib.h"
+#include "../Core/Shape.h"
+
+#include <unordered_map>
+
+RENDER_BEGIN
+
+// State of every in-flight path, stored as one array per field
+struct WavefrontPathPool
+{
+	void resize(size_t size);
+
+	// Camera sample
+	std::vector<Vector2f> m_pFilm;
+	std::vector<Float> m_cameraWeight;
+
+	// Path vertex
+	std::vector<Ray> m_ray;
+	std::vector<HitRecord> m_hit;
+	std::vector<uint8_t> m_hitFound;
+	std::vector<int> m_bounces;
+
+	// Throughput and radiance
+	std::vector<Spectrum> m_L;
+	std::vector<Spectrum> m_beta;
+	std::vector<Float> m_etaScale;
+
+	// Previous scattering vertex, needed to MIS weight emission found by the BSDF sampled ray
+	std::vector<Vector3f> m_prevP;
+	std::vector<Vector3f> m_prevNormal;
+	std::vector<Float> m_prevBsdfPdf;
+	std::vector<uint8_t> m_specularBounce;
+
+	// Pending shadow ray of the current vertex
+	std::vector<Ray> m_shadowRay;
+	std::vector<Spectrum> m_shadowLd;
+	std::vector<uint8_t> m_hasShadowRay;
+
+	std::vector<uint8_t> m_alive;
+};
+
+// Streaming path tracer: a large pool of paths is advanced stage by stage
+// (camera rays, closest hits, shading sorted by material, shadow rays, compaction),
+// every stage being one parallel kernel over all paths still alive.
+class WavefrontPathIntegrator : public Integrator
+{
+public:
+	typedef std::shared_ptr<WavefrontPathIntegrator> ptr;
+
+	WavefrontPathIntegrator(const APropertyTreeNode& node);
+
+	WavefrontPathIntegrator(int maxDepth, Camera::ptr camera, Sampler::ptr sampler,
+		int poolSize = 1 << 16, Float rrThreshold = 1, const std::string& lightSampleStrategy = "spatial");
+
+	virtual void preprocess(const Scene& scene) override;
+	virtual void render(const Scene& scene) override;
+
+	virtual std::string toString() const override { return "WavefrontPathIntegrator[]"; }
+
+private:
+	// Stages of one wave, _active_ holds the pool slots of the paths still alive
+	// Camera rays of sample _sampleNum_ for the _count_ pixels from _firstPixel_ on, in scanline order
+	void generateCameraRays(const Bounds2i& sampleBounds, int64_t firstPixel, int64_t sampleNum, int count);
+	void traceClosestHits(const Scene& scene, const std::vector<int>& active);
+	void sortByMaterial(std::vector<int>& active) const;
+	void shadeHits(const Scene& scene, const std::vector<int>& active);
+	void traceShadowRays(const Scene& scene, const std::vector<int>& active);
+	void compactPaths(std::vector<int>& active) const;
+
+	// Shade a single path vertex
+	void shadePath(const Scene& scene, int slot, MemoryArena& arena);
+	// MIS weighted emission reached by the BSDF sampled ray of the previous vertex
+	Float emissionWeight(int slot, const Light* light, const Vector3f& wi) const;
+
+	Camera::ptr m_camera;
+	Sampler::ptr m_sampler;
+
+	int m_maxDepth;
+	int m_poolSize;
+	Float m_rrThreshold;
+	std::string m_lightSampleStrategy;
+	std::unique_ptr<LightDistribution> m_lightDistribution;
+	std::unordered_map<const Light*, int> m_lightIndices;
+
+	WavefrontPathPool m_paths;
+	std::vector<std::unique_ptr<Sampler>> m_samplers; // One sampler per pool slot
+};
+
+RENDER_END
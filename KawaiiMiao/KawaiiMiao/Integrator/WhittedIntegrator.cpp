@@ -10,7 +10,7 @@ RENDER_REGISTER_CLASS(WhittedIntegrator, "Whitted");
 // AWhittedIntegrator
 
 WhittedIntegrator::WhittedIntegrator(const APropertyTreeNode& node)
-	: SamplerIntegrator(nullptr, nullptr), m_maxDepth(node.getPropertyList().getInteger("Depth", 2))
+	: SamplerIntegrator(node.getPropertyList()), m_maxDepth(node.getPropertyList().getInteger("Depth", 2))
 {
 	//Sampler
 	const auto& samplerNode = node.getPropertyChild("Sampler");
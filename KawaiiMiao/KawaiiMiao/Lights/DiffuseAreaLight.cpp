@@ -49,6 +49,17 @@ Spectrum DiffuseAreaLight::power() const
 	return (m_twoSided ? 2 : 1) * m_Lemit * m_area * Pi;
 }
 
+bool DiffuseAreaLight::bounds(LightBounds& bounds) const
+{
+	// Note: the emission of a diffuse emitter spans the whole hemisphere around the normal
+	Vector3f w;
+	Float cosThetaO;
+	m_shape->normalBounds(w, cosThetaO);
+	Float phi = m_Lemit.maxComponentValue() * m_area * (m_twoSided ? 2 : 1);
+	bounds = LightBounds(m_shape->worldBound(), w, phi, cosThetaO, std::cos(PiOver2), m_twoSided);
+	return true;
+}
+
 Spectrum DiffuseAreaLight::sample_Li(const Interaction& ref, const Vector2f& u, Vector3f& wi,
 	Float& pdf, VisibilityTester& vis) const
 {
@@ -21,6 +21,8 @@ public:
 
 	virtual Spectrum power() const override;
 
+	virtual bool bounds(LightBounds& bounds) const override;
+
 	virtual Spectrum sample_Li(const Interaction& ref, const Vector2f& u, Vector3f& wo,
 		Float& pdf, VisibilityTester& vis) const override;
 
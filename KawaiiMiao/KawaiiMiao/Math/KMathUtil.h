@@ -327,12 +327,12 @@ class Ray
 {
 public:
 
-	Ray() : m_tMax(Infinity) {}
+	Ray() : m_tMax(Infinity), m_time(0.f), m_medium(nullptr) {}
 
 	/*Ray(const Vector3f& o, const Vector3f& d, Float tMax = Infinity)
 		: m_origin(o), m_dir(normalize(d)), m_tMax(tMax) {}*/
 
-	Ray(const Vector3f& o, const Vector3f& d, Float tMax = Infinity, Float time = 0.f, Medium* medium = nullptr)
+	Ray(const Vector3f& o, const Vector3f& d, Float tMax = Infinity, Float time = 0.f, const Medium* medium = nullptr)
 		: m_origin(o), m_dir(normalize(d)), m_tMax(tMax), m_time(time), m_medium(medium) {}
 
 	/*Ray(const Vector3f& o, const Vector3f& d, Float tMax = Infinity,
@@ -359,8 +359,8 @@ public:
 	mutable Float m_tMax;
 	// The time of emission, used to make motion blur
 	Float m_time;
-	// Medium
-	Medium* m_medium;
+	// The medium containing the origin
+	const Medium* m_medium;
 };
 
 // RayDifferential 
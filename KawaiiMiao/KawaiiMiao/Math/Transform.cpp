@@ -102,7 +102,7 @@ SurfaceInteraction Transform::operator()(const SurfaceInteraction& si) const
 
 	// Transform remaining members of _SurfaceInteraction_
 	const Transform& trans = *this;
-	ret.normal = normalize(trans(si.normal, 0.0f));
+	ret.normal = normalize(trans.transformNormal(si.normal));
 	ret.wo = normalize(trans(si.wo, 0.0f));
 	ret.time = si.time;
 	ret.mediumInterface = si.mediumInterface;
@@ -110,14 +110,14 @@ SurfaceInteraction Transform::operator()(const SurfaceInteraction& si) const
 	ret.shape = si.shape;
 	ret.dpdu = trans(si.dpdu, 0.0f);
 	ret.dpdv = trans(si.dpdv, 0.0f);
-	ret.dndu = trans(si.dndu, 0.0f);
-	ret.dndv = trans(si.dndv, 0.0f);
+	ret.dndu = trans.transformNormal(si.dndu);
+	ret.dndv = trans.transformNormal(si.dndv);
 	ret.primitive = si.primitive;
-	ret.shading.n = normalize(trans(si.shading.n, 0.0f));
+	ret.shading.n = normalize(trans.transformNormal(si.shading.n));
 	ret.shading.dpdu = trans(si.shading.dpdu, 0.0f);
 	ret.shading.dpdv = trans(si.shading.dpdv, 0.0f);
-	ret.shading.dndu = trans(si.shading.dndu, 0.0f);
-	ret.shading.dndv = trans(si.shading.dndv, 0.0f);
+	ret.shading.dndu = trans.transformNormal(si.shading.dndu);
+	ret.shading.dndv = trans.transformNormal(si.shading.dndv);
 	ret.dudx = si.dudx;
 	ret.dvdx = si.dvdx;
 	ret.dudy = si.dudy;
@@ -131,4 +131,942 @@ SurfaceInteraction Transform::operator()(const SurfaceInteraction& si) const
 	return ret;
 }
 
+//-------------------------------------------AnimatedTransform-------------------------------------
+
+// Interval arithmetic for the conservative root search of the motion derivative
+struct Interval
+{
+	Interval(Float v) : low(v), high(v) {}
+	Interval(Float v0, Float v1) : low(std::min(v0, v1)), high(std::max(v0, v1)) {}
+
+	Interval operator+(const Interval& i) const { return Interval(low + i.low, high + i.high); }
+	Interval operator-(const Interval& i) const { return Interval(low - i.high, high - i.low); }
+	Interval operator*(const Interval& i) const
+	{
+		return Interval(std::min(std::min(low * i.low, high * i.low), std::min(low * i.high, high * i.high)),
+			std::max(std::max(low * i.low, high * i.low), std::max(low * i.high, high * i.high)));
+	}
+
+	Float low, high;
+};
+
+static Interval sin(const Interval& i)
+{
+	Float sinLow = std::sin(i.low), sinHigh = std::sin(i.high);
+	if (sinLow > sinHigh)
+		std::swap(sinLow, sinHigh);
+	if (i.low < Pi / 2 && i.high > Pi / 2)
+		sinHigh = 1.;
+	if (i.low < (3.f / 2.f) * Pi && i.high > (3.f / 2.f) * Pi)
+		sinLow = -1.;
+	return Interval(sinLow, sinHigh);
+}
+
+static Interval cos(const Interval& i)
+{
+	Float cosLow = std::cos(i.low), cosHigh = std::cos(i.high);
+	if (cosLow > cosHigh)
+		std::swap(cosLow, cosHigh);
+	if (i.low < Pi && i.high > Pi)
+		cosLow = -1.;
+	return Interval(cosLow, cosHigh);
+}
+
+// Find the zeros of c1 + (c2 + c3 t) cos(2 theta t) + (c4 + c5 t) sin(2 theta t) inside tInterval:
+// bisect while the interval bound may contain zero, then refine with Newton's method.
+static void intervalFindZeros(Float c1, Float c2, Float c3, Float c4, Float c5, Float theta,
+	Interval tInterval, Float* zeros, int* zeroCount, int depth = 8)
+{
+	Interval range = Interval(c1) +
+		(Interval(c2) + Interval(c3) * tInterval) * cos(Interval(2 * theta) * tInterval) +
+		(Interval(c4) + Interval(c5) * tInterval) * sin(Interval(2 * theta) * tInterval);
+	if (range.low > 0. || range.high < 0. || range.low == range.high)
+		return;
+
+	if (depth > 0)
+	{
+		Float mid = (tInterval.low + tInterval.high) * 0.5f;
+		intervalFindZeros(c1, c2, c3, c4, c5, theta, Interval(tInterval.low, mid), zeros, zeroCount, depth - 1);
+		intervalFindZeros(c1, c2, c3, c4, c5, theta, Interval(mid, tInterval.high), zeros, zeroCount, depth - 1);
+	}
+	else
+	{
+		Float tNewton = (tInterval.low + tInterval.high) * 0.5f;
+		for (int i = 0; i < 4; ++i)
+		{
+			Float fNewton = c1 + (c2 + c3 * tNewton) * std::cos(2.f * theta * tNewton) +
+				(c4 + c5 * tNewton) * std::sin(2.f * theta * tNewton);
+			Float fPrimeNewton = (c3 + 2 * (c4 + c5 * tNewton) * theta) * std::cos(2.f * tNewton * theta) +
+				(c5 - 2 * (c2 + c3 * tNewton) * theta) * std::sin(2.f * tNewton * theta);
+			if (fNewton == 0 || fPrimeNewton == 0)
+				break;
+			tNewton = tNewton - fNewton / fPrimeNewton;
+		}
+		if (tNewton >= tInterval.low - 1e-3f && tNewton < tInterval.high + 1e-3f)
+		{
+			zeros[*zeroCount] = tNewton;
+			(*zeroCount)++;
+		}
+	}
+}
+
+AnimatedTransform::AnimatedTransform(const Transform* startTransform, Float startTime,
+	const Transform* endTransform, Float endTime)
+	: m_startTransform(startTransform), m_endTransform(endTransform),
+	m_startTime(startTime), m_endTime(endTime),
+	m_actuallyAnimated(*startTransform != *endTransform)
+{
+	if (!m_actuallyAnimated)
+		return;
+
+	decompose(m_startTransform->getMatrix(), &m_T[0], &m_R[0], &m_S[0]);
+	decompose(m_endTransform->getMatrix(), &m_T[1], &m_R[1], &m_S[1]);
+
+	// Flip _R[1]_ if needed to select shortest path
+	if (dot(m_R[0], m_R[1]) < 0)
+		m_R[1] = -m_R[1];
+	m_hasRotation = dot(m_R[0], m_R[1]) < 0.9995f;
+
+	// Compute terms of motion derivative function
+	// Note: the coefficients use row-major indices, s_ij = row i and column j of the scale matrix
+	if (m_hasRotation)
+	{
+		Float cosTheta = dot(m_R[0], m_R[1]);
+		Float theta = std::acos(clamp(cosTheta, -1, 1));
+		Quaternion qperp = normalize(m_R[1] - m_R[0] * cosTheta);
+
+		Float t0x = m_T[0].x;
+		Float t0y = m_T[0].y;
+		Float t0z = m_T[0].z;
+		Float t1x = m_T[1].x;
+		Float t1y = m_T[1].y;
+		Float t1z = m_T[1].z;
+		Float q1x = m_R[0].x;
+		Float q1y = m_R[0].y;
+		Float q1z = m_R[0].z;
+		Float q1w = m_R[0].w;
+		Float qperpx = qperp.x;
+		Float qperpy = qperp.y;
+		Float qperpz = qperp.z;
+		Float qperpw = qperp.w;
+		Float s000 = m_S[0][0][0];
+		Float s001 = m_S[0][1][0];
+		Float s002 = m_S[0][2][0];
+		Float s010 = m_S[0][0][1];
+		Float s011 = m_S[0][1][1];
+		Float s012 = m_S[0][2][1];
+		Float s020 = m_S[0][0][2];
+		Float s021 = m_S[0][1][2];
+		Float s022 = m_S[0][2][2];
+		Float s100 = m_S[1][0][0];
+		Float s101 = m_S[1][1][0];
+		Float s102 = m_S[1][2][0];
+		Float s110 = m_S[1][0][1];
+		Float s111 = m_S[1][1][1];
+		Float s112 = m_S[1][2][1];
+		Float s120 = m_S[1][0][2];
+		Float s121 = m_S[1][1][2];
+		Float s122 = m_S[1][2][2];
+
+		m_c1[0] = DerivativeTerm(
+			-t0x + t1x,
+			(-1 + q1y * q1y + q1z * q1z + qperpy * qperpy + qperpz * qperpz) *
+			s000 +
+			q1w * q1z * s010 - qperpx * qperpy * s010 +
+			qperpw * qperpz * s010 - q1w * q1y * s020 -
+			qperpw * qperpy * s020 - qperpx * qperpz * s020 + s100 -
+			q1y * q1y * s100 - q1z * q1z * s100 - qperpy * qperpy * s100 -
+			qperpz * qperpz * s100 - q1w * q1z * s110 +
+			qperpx * qperpy * s110 - qperpw * qperpz * s110 +
+			q1w * q1y * s120 + qperpw * qperpy * s120 +
+			qperpx * qperpz * s120 +
+			q1x * (-(q1y * s010) - q1z * s020 + q1y * s110 + q1z * s120),
+			(-1 + q1y * q1y + q1z * q1z + qperpy * qperpy + qperpz * qperpz) *
+			s001 +
+			q1w * q1z * s011 - qperpx * qperpy * s011 +
+			qperpw * qperpz * s011 - q1w * q1y * s021 -
+			qperpw * qperpy * s021 - qperpx * qperpz * s021 + s101 -
+			q1y * q1y * s101 - q1z * q1z * s101 - qperpy * qperpy * s101 -
+			qperpz * qperpz * s101 - q1w * q1z * s111 +
+			qperpx * qperpy * s111 - qperpw * qperpz * s111 +
+			q1w * q1y * s121 + qperpw * qperpy * s121 +
+			qperpx * qperpz * s121 +
+			q1x * (-(q1y * s011) - q1z * s021 + q1y * s111 + q1z * s121),
+			(-1 + q1y * q1y + q1z * q1z + qperpy * qperpy + qperpz * qperpz) *
+			s002 +
+			q1w * q1z * s012 - qperpx * qperpy * s012 +
+			qperpw * qperpz * s012 - q1w * q1y * s022 -
+			qperpw * qperpy * s022 - qperpx * qperpz * s022 + s102 -
+			q1y * q1y * s102 - q1z * q1z * s102 - qperpy * qperpy * s102 -
+			qperpz * qperpz * s102 - q1w * q1z * s112 +
+			qperpx * qperpy * s112 - qperpw * qperpz * s112 +
+			q1w * q1y * s122 + qperpw * qperpy * s122 +
+			qperpx * qperpz * s122 +
+			q1x * (-(q1y * s012) - q1z * s022 + q1y * s112 + q1z * s122));
+
+		m_c2[0] = DerivativeTerm(
+			0.,
+			-(qperpy * qperpy * s000) - qperpz * qperpz * s000 +
+			qperpx * qperpy * s010 - qperpw * qperpz * s010 +
+			qperpw * qperpy * s020 + qperpx * qperpz * s020 +
+			q1y * q1y * (s000 - s100) + q1z * q1z * (s000 - s100) +
+			qperpy * qperpy * s100 + qperpz * qperpz * s100 -
+			qperpx * qperpy * s110 + qperpw * qperpz * s110 -
+			qperpw * qperpy * s120 - qperpx * qperpz * s120 +
+			2 * q1x * qperpy * s010 * theta -
+			2 * q1w * qperpz * s010 * theta +
+			2 * q1w * qperpy * s020 * theta +
+			2 * q1x * qperpz * s020 * theta +
+			q1y *
+			(q1x * (-s010 + s110) + q1w * (-s020 + s120) +
+				2 * (-2 * qperpy * s000 + qperpx * s010 + qperpw * s020) *
+				theta) +
+			q1z * (q1w * (s010 - s110) + q1x * (-s020 + s120) -
+				2 * (2 * qperpz * s000 + qperpw * s010 - qperpx * s020) *
+				theta),
+			-(qperpy * qperpy * s001) - qperpz * qperpz * s001 +
+			qperpx * qperpy * s011 - qperpw * qperpz * s011 +
+			qperpw * qperpy * s021 + qperpx * qperpz * s021 +
+			q1y * q1y * (s001 - s101) + q1z * q1z * (s001 - s101) +
+			qperpy * qperpy * s101 + qperpz * qperpz * s101 -
+			qperpx * qperpy * s111 + qperpw * qperpz * s111 -
+			qperpw * qperpy * s121 - qperpx * qperpz * s121 +
+			2 * q1x * qperpy * s011 * theta -
+			2 * q1w * qperpz * s011 * theta +
+			2 * q1w * qperpy * s021 * theta +
+			2 * q1x * qperpz * s021 * theta +
+			q1y *
+			(q1x * (-s011 + s111) + q1w * (-s021 + s121) +
+				2 * (-2 * qperpy * s001 + qperpx * s011 + qperpw * s021) *
+				theta) +
+			q1z * (q1w * (s011 - s111) + q1x * (-s021 + s121) -
+				2 * (2 * qperpz * s001 + qperpw * s011 - qperpx * s021) *
+				theta),
+			-(qperpy * qperpy * s002) - qperpz * qperpz * s002 +
+			qperpx * qperpy * s012 - qperpw * qperpz * s012 +
+			qperpw * qperpy * s022 + qperpx * qperpz * s022 +
+			q1y * q1y * (s002 - s102) + q1z * q1z * (s002 - s102) +
+			qperpy * qperpy * s102 + qperpz * qperpz * s102 -
+			qperpx * qperpy * s112 + qperpw * qperpz * s112 -
+			qperpw * qperpy * s122 - qperpx * qperpz * s122 +
+			2 * q1x * qperpy * s012 * theta -
+			2 * q1w * qperpz * s012 * theta +
+			2 * q1w * qperpy * s022 * theta +
+			2 * q1x * qperpz * s022 * theta +
+			q1y *
+			(q1x * (-s012 + s112) + q1w * (-s022 + s122) +
+				2 * (-2 * qperpy * s002 + qperpx * s012 + qperpw * s022) *
+				theta) +
+			q1z * (q1w * (s012 - s112) + q1x * (-s022 + s122) -
+				2 * (2 * qperpz * s002 + qperpw * s012 - qperpx * s022) *
+				theta));
+
+		m_c3[0] = DerivativeTerm(
+			0.,
+			-2 * (q1x * qperpy * s010 - q1w * qperpz * s010 +
+				q1w * qperpy * s020 + q1x * qperpz * s020 -
+				q1x * qperpy * s110 + q1w * qperpz * s110 -
+				q1w * qperpy * s120 - q1x * qperpz * s120 +
+				q1y * (-2 * qperpy * s000 + qperpx * s010 + qperpw * s020 +
+					2 * qperpy * s100 - qperpx * s110 - qperpw * s120) +
+				q1z * (-2 * qperpz * s000 - qperpw * s010 + qperpx * s020 +
+					2 * qperpz * s100 + qperpw * s110 - qperpx * s120)) *
+			theta,
+			-2 * (q1x * qperpy * s011 - q1w * qperpz * s011 +
+				q1w * qperpy * s021 + q1x * qperpz * s021 -
+				q1x * qperpy * s111 + q1w * qperpz * s111 -
+				q1w * qperpy * s121 - q1x * qperpz * s121 +
+				q1y * (-2 * qperpy * s001 + qperpx * s011 + qperpw * s021 +
+					2 * qperpy * s101 - qperpx * s111 - qperpw * s121) +
+				q1z * (-2 * qperpz * s001 - qperpw * s011 + qperpx * s021 +
+					2 * qperpz * s101 + qperpw * s111 - qperpx * s121)) *
+			theta,
+			-2 * (q1x * qperpy * s012 - q1w * qperpz * s012 +
+				q1w * qperpy * s022 + q1x * qperpz * s022 -
+				q1x * qperpy * s112 + q1w * qperpz * s112 -
+				q1w * qperpy * s122 - q1x * qperpz * s122 +
+				q1y * (-2 * qperpy * s002 + qperpx * s012 + qperpw * s022 +
+					2 * qperpy * s102 - qperpx * s112 - qperpw * s122) +
+				q1z * (-2 * qperpz * s002 - qperpw * s012 + qperpx * s022 +
+					2 * qperpz * s102 + qperpw * s112 - qperpx * s122)) *
+			theta);
+
+		m_c4[0] = DerivativeTerm(
+			0.,
+			-(q1x * qperpy * s010) + q1w * qperpz * s010 - q1w * qperpy * s020 -
+			q1x * qperpz * s020 + q1x * qperpy * s110 -
+			q1w * qperpz * s110 + q1w * qperpy * s120 +
+			q1x * qperpz * s120 + 2 * q1y * q1y * s000 * theta +
+			2 * q1z * q1z * s000 * theta -
+			2 * qperpy * qperpy * s000 * theta -
+			2 * qperpz * qperpz * s000 * theta +
+			2 * qperpx * qperpy * s010 * theta -
+			2 * qperpw * qperpz * s010 * theta +
+			2 * qperpw * qperpy * s020 * theta +
+			2 * qperpx * qperpz * s020 * theta +
+			q1y * (-(qperpx * s010) - qperpw * s020 +
+				2 * qperpy * (s000 - s100) + qperpx * s110 +
+				qperpw * s120 - 2 * q1x * s010 * theta -
+				2 * q1w * s020 * theta) +
+			q1z * (2 * qperpz * s000 + qperpw * s010 - qperpx * s020 -
+				2 * qperpz * s100 - qperpw * s110 + qperpx * s120 +
+				2 * q1w * s010 * theta - 2 * q1x * s020 * theta),
+			-(q1x * qperpy * s011) + q1w * qperpz * s011 - q1w * qperpy * s021 -
+			q1x * qperpz * s021 + q1x * qperpy * s111 -
+			q1w * qperpz * s111 + q1w * qperpy * s121 +
+			q1x * qperpz * s121 + 2 * q1y * q1y * s001 * theta +
+			2 * q1z * q1z * s001 * theta -
+			2 * qperpy * qperpy * s001 * theta -
+			2 * qperpz * qperpz * s001 * theta +
+			2 * qperpx * qperpy * s011 * theta -
+			2 * qperpw * qperpz * s011 * theta +
+			2 * qperpw * qperpy * s021 * theta +
+			2 * qperpx * qperpz * s021 * theta +
+			q1y * (-(qperpx * s011) - qperpw * s021 +
+				2 * qperpy * (s001 - s101) + qperpx * s111 +
+				qperpw * s121 - 2 * q1x * s011 * theta -
+				2 * q1w * s021 * theta) +
+			q1z * (2 * qperpz * s001 + qperpw * s011 - qperpx * s021 -
+				2 * qperpz * s101 - qperpw * s111 + qperpx * s121 +
+				2 * q1w * s011 * theta - 2 * q1x * s021 * theta),
+			-(q1x * qperpy * s012) + q1w * qperpz * s012 - q1w * qperpy * s022 -
+			q1x * qperpz * s022 + q1x * qperpy * s112 -
+			q1w * qperpz * s112 + q1w * qperpy * s122 +
+			q1x * qperpz * s122 + 2 * q1y * q1y * s002 * theta +
+			2 * q1z * q1z * s002 * theta -
+			2 * qperpy * qperpy * s002 * theta -
+			2 * qperpz * qperpz * s002 * theta +
+			2 * qperpx * qperpy * s012 * theta -
+			2 * qperpw * qperpz * s012 * theta +
+			2 * qperpw * qperpy * s022 * theta +
+			2 * qperpx * qperpz * s022 * theta +
+			q1y * (-(qperpx * s012) - qperpw * s022 +
+				2 * qperpy * (s002 - s102) + qperpx * s112 +
+				qperpw * s122 - 2 * q1x * s012 * theta -
+				2 * q1w * s022 * theta) +
+			q1z * (2 * qperpz * s002 + qperpw * s012 - qperpx * s022 -
+				2 * qperpz * s102 - qperpw * s112 + qperpx * s122 +
+				2 * q1w * s012 * theta - 2 * q1x * s022 * theta));
+
+		m_c5[0] = DerivativeTerm(
+			0.,
+			2 * (qperpy * qperpy * s000 + qperpz * qperpz * s000 -
+				qperpx * qperpy * s010 + qperpw * qperpz * s010 -
+				qperpw * qperpy * s020 - qperpx * qperpz * s020 -
+				qperpy * qperpy * s100 - qperpz * qperpz * s100 +
+				q1y * q1y * (-s000 + s100) + q1z * q1z * (-s000 + s100) +
+				qperpx * qperpy * s110 - qperpw * qperpz * s110 +
+				q1y * (q1x * (s010 - s110) + q1w * (s020 - s120)) +
+				qperpw * qperpy * s120 + qperpx * qperpz * s120 +
+				q1z * (-(q1w * s010) + q1x * s020 + q1w * s110 - q1x * s120)) *
+			theta,
+			2 * (qperpy * qperpy * s001 + qperpz * qperpz * s001 -
+				qperpx * qperpy * s011 + qperpw * qperpz * s011 -
+				qperpw * qperpy * s021 - qperpx * qperpz * s021 -
+				qperpy * qperpy * s101 - qperpz * qperpz * s101 +
+				q1y * q1y * (-s001 + s101) + q1z * q1z * (-s001 + s101) +
+				qperpx * qperpy * s111 - qperpw * qperpz * s111 +
+				q1y * (q1x * (s011 - s111) + q1w * (s021 - s121)) +
+				qperpw * qperpy * s121 + qperpx * qperpz * s121 +
+				q1z * (-(q1w * s011) + q1x * s021 + q1w * s111 - q1x * s121)) *
+			theta,
+			2 * (qperpy * qperpy * s002 + qperpz * qperpz * s002 -
+				qperpx * qperpy * s012 + qperpw * qperpz * s012 -
+				qperpw * qperpy * s022 - qperpx * qperpz * s022 -
+				qperpy * qperpy * s102 - qperpz * qperpz * s102 +
+				q1y * q1y * (-s002 + s102) + q1z * q1z * (-s002 + s102) +
+				qperpx * qperpy * s112 - qperpw * qperpz * s112 +
+				q1y * (q1x * (s012 - s112) + q1w * (s022 - s122)) +
+				qperpw * qperpy * s122 + qperpx * qperpz * s122 +
+				q1z * (-(q1w * s012) + q1x * s022 + q1w * s112 - q1x * s122)) *
+			theta);
+
+		m_c1[1] = DerivativeTerm(
+			-t0y + t1y,
+			-(qperpx * qperpy * s000) - qperpw * qperpz * s000 - s010 +
+			q1z * q1z * s010 + qperpx * qperpx * s010 +
+			qperpz * qperpz * s010 - q1y * q1z * s020 +
+			qperpw * qperpx * s020 - qperpy * qperpz * s020 +
+			qperpx * qperpy * s100 + qperpw * qperpz * s100 +
+			q1w * q1z * (-s000 + s100) + q1x * q1x * (s010 - s110) + s110 -
+			q1z * q1z * s110 - qperpx * qperpx * s110 -
+			qperpz * qperpz * s110 +
+			q1x * (q1y * (-s000 + s100) + q1w * (s020 - s120)) +
+			q1y * q1z * s120 - qperpw * qperpx * s120 +
+			qperpy * qperpz * s120,
+			-(qperpx * qperpy * s001) - qperpw * qperpz * s001 - s011 +
+			q1z * q1z * s011 + qperpx * qperpx * s011 +
+			qperpz * qperpz * s011 - q1y * q1z * s021 +
+			qperpw * qperpx * s021 - qperpy * qperpz * s021 +
+			qperpx * qperpy * s101 + qperpw * qperpz * s101 +
+			q1w * q1z * (-s001 + s101) + q1x * q1x * (s011 - s111) + s111 -
+			q1z * q1z * s111 - qperpx * qperpx * s111 -
+			qperpz * qperpz * s111 +
+			q1x * (q1y * (-s001 + s101) + q1w * (s021 - s121)) +
+			q1y * q1z * s121 - qperpw * qperpx * s121 +
+			qperpy * qperpz * s121,
+			-(qperpx * qperpy * s002) - qperpw * qperpz * s002 - s012 +
+			q1z * q1z * s012 + qperpx * qperpx * s012 +
+			qperpz * qperpz * s012 - q1y * q1z * s022 +
+			qperpw * qperpx * s022 - qperpy * qperpz * s022 +
+			qperpx * qperpy * s102 + qperpw * qperpz * s102 +
+			q1w * q1z * (-s002 + s102) + q1x * q1x * (s012 - s112) + s112 -
+			q1z * q1z * s112 - qperpx * qperpx * s112 -
+			qperpz * qperpz * s112 +
+			q1x * (q1y * (-s002 + s102) + q1w * (s022 - s122)) +
+			q1y * q1z * s122 - qperpw * qperpx * s122 +
+			qperpy * qperpz * s122);
+
+		m_c2[1] = DerivativeTerm(
+			0.,
+			qperpx * qperpy * s000 + qperpw * qperpz * s000 + q1z * q1z * s010 -
+			qperpx * qperpx * s010 - qperpz * qperpz * s010 -
+			q1y * q1z * s020 - qperpw * qperpx * s020 +
+			qperpy * qperpz * s020 - qperpx * qperpy * s100 -
+			qperpw * qperpz * s100 + q1x * q1x * (s010 - s110) -
+			q1z * q1z * s110 + qperpx * qperpx * s110 +
+			qperpz * qperpz * s110 + q1y * q1z * s120 +
+			qperpw * qperpx * s120 - qperpy * qperpz * s120 +
+			2 * q1z * qperpw * s000 * theta +
+			2 * q1y * qperpx * s000 * theta -
+			4 * q1z * qperpz * s010 * theta +
+			2 * q1z * qperpy * s020 * theta +
+			2 * q1y * qperpz * s020 * theta +
+			q1x * (q1w * s020 + q1y * (-s000 + s100) - q1w * s120 +
+				2 * qperpy * s000 * theta - 4 * qperpx * s010 * theta -
+				2 * qperpw * s020 * theta) +
+			q1w * (-(q1z * s000) + q1z * s100 + 2 * qperpz * s000 * theta -
+				2 * qperpx * s020 * theta),
+			qperpx * qperpy * s001 + qperpw * qperpz * s001 + q1z * q1z * s011 -
+			qperpx * qperpx * s011 - qperpz * qperpz * s011 -
+			q1y * q1z * s021 - qperpw * qperpx * s021 +
+			qperpy * qperpz * s021 - qperpx * qperpy * s101 -
+			qperpw * qperpz * s101 + q1x * q1x * (s011 - s111) -
+			q1z * q1z * s111 + qperpx * qperpx * s111 +
+			qperpz * qperpz * s111 + q1y * q1z * s121 +
+			qperpw * qperpx * s121 - qperpy * qperpz * s121 +
+			2 * q1z * qperpw * s001 * theta +
+			2 * q1y * qperpx * s001 * theta -
+			4 * q1z * qperpz * s011 * theta +
+			2 * q1z * qperpy * s021 * theta +
+			2 * q1y * qperpz * s021 * theta +
+			q1x * (q1w * s021 + q1y * (-s001 + s101) - q1w * s121 +
+				2 * qperpy * s001 * theta - 4 * qperpx * s011 * theta -
+				2 * qperpw * s021 * theta) +
+			q1w * (-(q1z * s001) + q1z * s101 + 2 * qperpz * s001 * theta -
+				2 * qperpx * s021 * theta),
+			qperpx * qperpy * s002 + qperpw * qperpz * s002 + q1z * q1z * s012 -
+			qperpx * qperpx * s012 - qperpz * qperpz * s012 -
+			q1y * q1z * s022 - qperpw * qperpx * s022 +
+			qperpy * qperpz * s022 - qperpx * qperpy * s102 -
+			qperpw * qperpz * s102 + q1x * q1x * (s012 - s112) -
+			q1z * q1z * s112 + qperpx * qperpx * s112 +
+			qperpz * qperpz * s112 + q1y * q1z * s122 +
+			qperpw * qperpx * s122 - qperpy * qperpz * s122 +
+			2 * q1z * qperpw * s002 * theta +
+			2 * q1y * qperpx * s002 * theta -
+			4 * q1z * qperpz * s012 * theta +
+			2 * q1z * qperpy * s022 * theta +
+			2 * q1y * qperpz * s022 * theta +
+			q1x * (q1w * s022 + q1y * (-s002 + s102) - q1w * s122 +
+				2 * qperpy * s002 * theta - 4 * qperpx * s012 * theta -
+				2 * qperpw * s022 * theta) +
+			q1w * (-(q1z * s002) + q1z * s102 + 2 * qperpz * s002 * theta -
+				2 * qperpx * s022 * theta));
+
+		m_c3[1] = DerivativeTerm(
+			0., 2 * (-(q1x * qperpy * s000) - q1w * qperpz * s000 +
+				2 * q1x * qperpx * s010 + q1x * qperpw * s020 +
+				q1w * qperpx * s020 + q1x * qperpy * s100 +
+				q1w * qperpz * s100 - 2 * q1x * qperpx * s110 -
+				q1x * qperpw * s120 - q1w * qperpx * s120 +
+				q1z * (2 * qperpz * s010 - qperpy * s020 +
+					qperpw * (-s000 + s100) - 2 * qperpz * s110 +
+					qperpy * s120) +
+				q1y * (-(qperpx * s000) - qperpz * s020 + qperpx * s100 +
+					qperpz * s120)) *
+			theta,
+			2 * (-(q1x * qperpy * s001) - q1w * qperpz * s001 +
+				2 * q1x * qperpx * s011 + q1x * qperpw * s021 +
+				q1w * qperpx * s021 + q1x * qperpy * s101 +
+				q1w * qperpz * s101 - 2 * q1x * qperpx * s111 -
+				q1x * qperpw * s121 - q1w * qperpx * s121 +
+				q1z * (2 * qperpz * s011 - qperpy * s021 +
+					qperpw * (-s001 + s101) - 2 * qperpz * s111 +
+					qperpy * s121) +
+				q1y * (-(qperpx * s001) - qperpz * s021 + qperpx * s101 +
+					qperpz * s121)) *
+			theta,
+			2 * (-(q1x * qperpy * s002) - q1w * qperpz * s002 +
+				2 * q1x * qperpx * s012 + q1x * qperpw * s022 +
+				q1w * qperpx * s022 + q1x * qperpy * s102 +
+				q1w * qperpz * s102 - 2 * q1x * qperpx * s112 -
+				q1x * qperpw * s122 - q1w * qperpx * s122 +
+				q1z * (2 * qperpz * s012 - qperpy * s022 +
+					qperpw * (-s002 + s102) - 2 * qperpz * s112 +
+					qperpy * s122) +
+				q1y * (-(qperpx * s002) - qperpz * s022 + qperpx * s102 +
+					qperpz * s122)) *
+			theta);
+
+		m_c4[1] = DerivativeTerm(
+			0.,
+			-(q1x * qperpy * s000) - q1w * qperpz * s000 +
+			2 * q1x * qperpx * s010 + q1x * qperpw * s020 +
+			q1w * qperpx * s020 + q1x * qperpy * s100 +
+			q1w * qperpz * s100 - 2 * q1x * qperpx * s110 -
+			q1x * qperpw * s120 - q1w * qperpx * s120 +
+			2 * qperpx * qperpy * s000 * theta +
+			2 * qperpw * qperpz * s000 * theta +
+			2 * q1x * q1x * s010 * theta + 2 * q1z * q1z * s010 * theta -
+			2 * qperpx * qperpx * s010 * theta -
+			2 * qperpz * qperpz * s010 * theta +
+			2 * q1w * q1x * s020 * theta -
+			2 * qperpw * qperpx * s020 * theta +
+			2 * qperpy * qperpz * s020 * theta +
+			q1y * (-(qperpx * s000) - qperpz * s020 + qperpx * s100 +
+				qperpz * s120 - 2 * q1x * s000 * theta) +
+			q1z * (2 * qperpz * s010 - qperpy * s020 +
+				qperpw * (-s000 + s100) - 2 * qperpz * s110 +
+				qperpy * s120 - 2 * q1w * s000 * theta -
+				2 * q1y * s020 * theta),
+			-(q1x * qperpy * s001) - q1w * qperpz * s001 +
+			2 * q1x * qperpx * s011 + q1x * qperpw * s021 +
+			q1w * qperpx * s021 + q1x * qperpy * s101 +
+			q1w * qperpz * s101 - 2 * q1x * qperpx * s111 -
+			q1x * qperpw * s121 - q1w * qperpx * s121 +
+			2 * qperpx * qperpy * s001 * theta +
+			2 * qperpw * qperpz * s001 * theta +
+			2 * q1x * q1x * s011 * theta + 2 * q1z * q1z * s011 * theta -
+			2 * qperpx * qperpx * s011 * theta -
+			2 * qperpz * qperpz * s011 * theta +
+			2 * q1w * q1x * s021 * theta -
+			2 * qperpw * qperpx * s021 * theta +
+			2 * qperpy * qperpz * s021 * theta +
+			q1y * (-(qperpx * s001) - qperpz * s021 + qperpx * s101 +
+				qperpz * s121 - 2 * q1x * s001 * theta) +
+			q1z * (2 * qperpz * s011 - qperpy * s021 +
+				qperpw * (-s001 + s101) - 2 * qperpz * s111 +
+				qperpy * s121 - 2 * q1w * s001 * theta -
+				2 * q1y * s021 * theta),
+			-(q1x * qperpy * s002) - q1w * qperpz * s002 +
+			2 * q1x * qperpx * s012 + q1x * qperpw * s022 +
+			q1w * qperpx * s022 + q1x * qperpy * s102 +
+			q1w * qperpz * s102 - 2 * q1x * qperpx * s112 -
+			q1x * qperpw * s122 - q1w * qperpx * s122 +
+			2 * qperpx * qperpy * s002 * theta +
+			2 * qperpw * qperpz * s002 * theta +
+			2 * q1x * q1x * s012 * theta + 2 * q1z * q1z * s012 * theta -
+			2 * qperpx * qperpx * s012 * theta -
+			2 * qperpz * qperpz * s012 * theta +
+			2 * q1w * q1x * s022 * theta -
+			2 * qperpw * qperpx * s022 * theta +
+			2 * qperpy * qperpz * s022 * theta +
+			q1y * (-(qperpx * s002) - qperpz * s022 + qperpx * s102 +
+				qperpz * s122 - 2 * q1x * s002 * theta) +
+			q1z * (2 * qperpz * s012 - qperpy * s022 +
+				qperpw * (-s002 + s102) - 2 * qperpz * s112 +
+				qperpy * s122 - 2 * q1w * s002 * theta -
+				2 * q1y * s022 * theta));
+
+		m_c5[1] = DerivativeTerm(
+			0., -2 * (qperpx * qperpy * s000 + qperpw * qperpz * s000 +
+				q1z * q1z * s010 - qperpx * qperpx * s010 -
+				qperpz * qperpz * s010 - q1y * q1z * s020 -
+				qperpw * qperpx * s020 + qperpy * qperpz * s020 -
+				qperpx * qperpy * s100 - qperpw * qperpz * s100 +
+				q1w * q1z * (-s000 + s100) + q1x * q1x * (s010 - s110) -
+				q1z * q1z * s110 + qperpx * qperpx * s110 +
+				qperpz * qperpz * s110 +
+				q1x * (q1y * (-s000 + s100) + q1w * (s020 - s120)) +
+				q1y * q1z * s120 + qperpw * qperpx * s120 -
+				qperpy * qperpz * s120) *
+			theta,
+			-2 * (qperpx * qperpy * s001 + qperpw * qperpz * s001 +
+				q1z * q1z * s011 - qperpx * qperpx * s011 -
+				qperpz * qperpz * s011 - q1y * q1z * s021 -
+				qperpw * qperpx * s021 + qperpy * qperpz * s021 -
+				qperpx * qperpy * s101 - qperpw * qperpz * s101 +
+				q1w * q1z * (-s001 + s101) + q1x * q1x * (s011 - s111) -
+				q1z * q1z * s111 + qperpx * qperpx * s111 +
+				qperpz * qperpz * s111 +
+				q1x * (q1y * (-s001 + s101) + q1w * (s021 - s121)) +
+				q1y * q1z * s121 + qperpw * qperpx * s121 -
+				qperpy * qperpz * s121) *
+			theta,
+			-2 * (qperpx * qperpy * s002 + qperpw * qperpz * s002 +
+				q1z * q1z * s012 - qperpx * qperpx * s012 -
+				qperpz * qperpz * s012 - q1y * q1z * s022 -
+				qperpw * qperpx * s022 + qperpy * qperpz * s022 -
+				qperpx * qperpy * s102 - qperpw * qperpz * s102 +
+				q1w * q1z * (-s002 + s102) + q1x * q1x * (s012 - s112) -
+				q1z * q1z * s112 + qperpx * qperpx * s112 +
+				qperpz * qperpz * s112 +
+				q1x * (q1y * (-s002 + s102) + q1w * (s022 - s122)) +
+				q1y * q1z * s122 + qperpw * qperpx * s122 -
+				qperpy * qperpz * s122) *
+			theta);
+
+		m_c1[2] = DerivativeTerm(
+			-t0z + t1z, (qperpw * qperpy * s000 - qperpx * qperpz * s000 -
+				q1y * q1z * s010 - qperpw * qperpx * s010 -
+				qperpy * qperpz * s010 - s020 + q1y * q1y * s020 +
+				qperpx * qperpx * s020 + qperpy * qperpy * s020 -
+				qperpw * qperpy * s100 + qperpx * qperpz * s100 +
+				q1x * q1z * (-s000 + s100) + q1y * q1z * s110 +
+				qperpw * qperpx * s110 + qperpy * qperpz * s110 +
+				q1w * (q1y * (s000 - s100) + q1x * (-s010 + s110)) +
+				q1x * q1x * (s020 - s120) + s120 - q1y * q1y * s120 -
+				qperpx * qperpx * s120 - qperpy * qperpy * s120),
+			(qperpw * qperpy * s001 - qperpx * qperpz * s001 -
+				q1y * q1z * s011 - qperpw * qperpx * s011 -
+				qperpy * qperpz * s011 - s021 + q1y * q1y * s021 +
+				qperpx * qperpx * s021 + qperpy * qperpy * s021 -
+				qperpw * qperpy * s101 + qperpx * qperpz * s101 +
+				q1x * q1z * (-s001 + s101) + q1y * q1z * s111 +
+				qperpw * qperpx * s111 + qperpy * qperpz * s111 +
+				q1w * (q1y * (s001 - s101) + q1x * (-s011 + s111)) +
+				q1x * q1x * (s021 - s121) + s121 - q1y * q1y * s121 -
+				qperpx * qperpx * s121 - qperpy * qperpy * s121),
+			(qperpw * qperpy * s002 - qperpx * qperpz * s002 -
+				q1y * q1z * s012 - qperpw * qperpx * s012 -
+				qperpy * qperpz * s012 - s022 + q1y * q1y * s022 +
+				qperpx * qperpx * s022 + qperpy * qperpy * s022 -
+				qperpw * qperpy * s102 + qperpx * qperpz * s102 +
+				q1x * q1z * (-s002 + s102) + q1y * q1z * s112 +
+				qperpw * qperpx * s112 + qperpy * qperpz * s112 +
+				q1w * (q1y * (s002 - s102) + q1x * (-s012 + s112)) +
+				q1x * q1x * (s022 - s122) + s122 - q1y * q1y * s122 -
+				qperpx * qperpx * s122 - qperpy * qperpy * s122));
+
+		m_c2[2] = DerivativeTerm(
+			0.,
+			(q1w * q1y * s000 - q1x * q1z * s000 - qperpw * qperpy * s000 +
+				qperpx * qperpz * s000 - q1w * q1x * s010 - q1y * q1z * s010 +
+				qperpw * qperpx * s010 + qperpy * qperpz * s010 +
+				q1x * q1x * s020 + q1y * q1y * s020 - qperpx * qperpx * s020 -
+				qperpy * qperpy * s020 - q1w * q1y * s100 + q1x * q1z * s100 +
+				qperpw * qperpy * s100 - qperpx * qperpz * s100 +
+				q1w * q1x * s110 + q1y * q1z * s110 - qperpw * qperpx * s110 -
+				qperpy * qperpz * s110 - q1x * q1x * s120 - q1y * q1y * s120 +
+				qperpx * qperpx * s120 + qperpy * qperpy * s120 -
+				2 * q1y * qperpw * s000 * theta + 2 * q1z * qperpx * s000 * theta -
+				2 * q1w * qperpy * s000 * theta + 2 * q1x * qperpz * s000 * theta +
+				2 * q1x * qperpw * s010 * theta + 2 * q1w * qperpx * s010 * theta +
+				2 * q1z * qperpy * s010 * theta + 2 * q1y * qperpz * s010 * theta -
+				4 * q1x * qperpx * s020 * theta - 4 * q1y * qperpy * s020 * theta),
+			(q1w * q1y * s001 - q1x * q1z * s001 - qperpw * qperpy * s001 +
+				qperpx * qperpz * s001 - q1w * q1x * s011 - q1y * q1z * s011 +
+				qperpw * qperpx * s011 + qperpy * qperpz * s011 +
+				q1x * q1x * s021 + q1y * q1y * s021 - qperpx * qperpx * s021 -
+				qperpy * qperpy * s021 - q1w * q1y * s101 + q1x * q1z * s101 +
+				qperpw * qperpy * s101 - qperpx * qperpz * s101 +
+				q1w * q1x * s111 + q1y * q1z * s111 - qperpw * qperpx * s111 -
+				qperpy * qperpz * s111 - q1x * q1x * s121 - q1y * q1y * s121 +
+				qperpx * qperpx * s121 + qperpy * qperpy * s121 -
+				2 * q1y * qperpw * s001 * theta + 2 * q1z * qperpx * s001 * theta -
+				2 * q1w * qperpy * s001 * theta + 2 * q1x * qperpz * s001 * theta +
+				2 * q1x * qperpw * s011 * theta + 2 * q1w * qperpx * s011 * theta +
+				2 * q1z * qperpy * s011 * theta + 2 * q1y * qperpz * s011 * theta -
+				4 * q1x * qperpx * s021 * theta - 4 * q1y * qperpy * s021 * theta),
+			(q1w * q1y * s002 - q1x * q1z * s002 - qperpw * qperpy * s002 +
+				qperpx * qperpz * s002 - q1w * q1x * s012 - q1y * q1z * s012 +
+				qperpw * qperpx * s012 + qperpy * qperpz * s012 +
+				q1x * q1x * s022 + q1y * q1y * s022 - qperpx * qperpx * s022 -
+				qperpy * qperpy * s022 - q1w * q1y * s102 + q1x * q1z * s102 +
+				qperpw * qperpy * s102 - qperpx * qperpz * s102 +
+				q1w * q1x * s112 + q1y * q1z * s112 - qperpw * qperpx * s112 -
+				qperpy * qperpz * s112 - q1x * q1x * s122 - q1y * q1y * s122 +
+				qperpx * qperpx * s122 + qperpy * qperpy * s122 -
+				2 * q1y * qperpw * s002 * theta + 2 * q1z * qperpx * s002 * theta -
+				2 * q1w * qperpy * s002 * theta + 2 * q1x * qperpz * s002 * theta +
+				2 * q1x * qperpw * s012 * theta + 2 * q1w * qperpx * s012 * theta +
+				2 * q1z * qperpy * s012 * theta + 2 * q1y * qperpz * s012 * theta -
+				4 * q1x * qperpx * s022 * theta -
+				4 * q1y * qperpy * s022 * theta));
+
+		m_c3[2] = DerivativeTerm(
+			0., -2 * (-(q1w * qperpy * s000) + q1x * qperpz * s000 +
+				q1x * qperpw * s010 + q1w * qperpx * s010 -
+				2 * q1x * qperpx * s020 + q1w * qperpy * s100 -
+				q1x * qperpz * s100 - q1x * qperpw * s110 -
+				q1w * qperpx * s110 +
+				q1z * (qperpx * s000 + qperpy * s010 - qperpx * s100 -
+					qperpy * s110) +
+				2 * q1x * qperpx * s120 +
+				q1y * (qperpz * s010 - 2 * qperpy * s020 +
+					qperpw * (-s000 + s100) - qperpz * s110 +
+					2 * qperpy * s120)) *
+			theta,
+			-2 * (-(q1w * qperpy * s001) + q1x * qperpz * s001 +
+				q1x * qperpw * s011 + q1w * qperpx * s011 -
+				2 * q1x * qperpx * s021 + q1w * qperpy * s101 -
+				q1x * qperpz * s101 - q1x * qperpw * s111 -
+				q1w * qperpx * s111 +
+				q1z * (qperpx * s001 + qperpy * s011 - qperpx * s101 -
+					qperpy * s111) +
+				2 * q1x * qperpx * s121 +
+				q1y * (qperpz * s011 - 2 * qperpy * s021 +
+					qperpw * (-s001 + s101) - qperpz * s111 +
+					2 * qperpy * s121)) *
+			theta,
+			-2 * (-(q1w * qperpy * s002) + q1x * qperpz * s002 +
+				q1x * qperpw * s012 + q1w * qperpx * s012 -
+				2 * q1x * qperpx * s022 + q1w * qperpy * s102 -
+				q1x * qperpz * s102 - q1x * qperpw * s112 -
+				q1w * qperpx * s112 +
+				q1z * (qperpx * s002 + qperpy * s012 - qperpx * s102 -
+					qperpy * s112) +
+				2 * q1x * qperpx * s122 +
+				q1y * (qperpz * s012 - 2 * qperpy * s022 +
+					qperpw * (-s002 + s102) - qperpz * s112 +
+					2 * qperpy * s122)) *
+			theta);
+
+		m_c4[2] = DerivativeTerm(
+			0.,
+			q1w * qperpy * s000 - q1x * qperpz * s000 - q1x * qperpw * s010 -
+			q1w * qperpx * s010 + 2 * q1x * qperpx * s020 -
+			q1w * qperpy * s100 + q1x * qperpz * s100 +
+			q1x * qperpw * s110 + q1w * qperpx * s110 -
+			2 * q1x * qperpx * s120 - 2 * qperpw * qperpy * s000 * theta +
+			2 * qperpx * qperpz * s000 * theta -
+			2 * q1w * q1x * s010 * theta +
+			2 * qperpw * qperpx * s010 * theta +
+			2 * qperpy * qperpz * s010 * theta +
+			2 * q1x * q1x * s020 * theta + 2 * q1y * q1y * s020 * theta -
+			2 * qperpx * qperpx * s020 * theta -
+			2 * qperpy * qperpy * s020 * theta +
+			q1z * (-(qperpx * s000) - qperpy * s010 + qperpx * s100 +
+				qperpy * s110 - 2 * q1x * s000 * theta) +
+			q1y * (-(qperpz * s010) + 2 * qperpy * s020 +
+				qperpw * (s000 - s100) + qperpz * s110 -
+				2 * qperpy * s120 + 2 * q1w * s000 * theta -
+				2 * q1z * s010 * theta),
+			q1w * qperpy * s001 - q1x * qperpz * s001 - q1x * qperpw * s011 -
+			q1w * qperpx * s011 + 2 * q1x * qperpx * s021 -
+			q1w * qperpy * s101 + q1x * qperpz * s101 +
+			q1x * qperpw * s111 + q1w * qperpx * s111 -
+			2 * q1x * qperpx * s121 - 2 * qperpw * qperpy * s001 * theta +
+			2 * qperpx * qperpz * s001 * theta -
+			2 * q1w * q1x * s011 * theta +
+			2 * qperpw * qperpx * s011 * theta +
+			2 * qperpy * qperpz * s011 * theta +
+			2 * q1x * q1x * s021 * theta + 2 * q1y * q1y * s021 * theta -
+			2 * qperpx * qperpx * s021 * theta -
+			2 * qperpy * qperpy * s021 * theta +
+			q1z * (-(qperpx * s001) - qperpy * s011 + qperpx * s101 +
+				qperpy * s111 - 2 * q1x * s001 * theta) +
+			q1y * (-(qperpz * s011) + 2 * qperpy * s021 +
+				qperpw * (s001 - s101) + qperpz * s111 -
+				2 * qperpy * s121 + 2 * q1w * s001 * theta -
+				2 * q1z * s011 * theta),
+			q1w * qperpy * s002 - q1x * qperpz * s002 - q1x * qperpw * s012 -
+			q1w * qperpx * s012 + 2 * q1x * qperpx * s022 -
+			q1w * qperpy * s102 + q1x * qperpz * s102 +
+			q1x * qperpw * s112 + q1w * qperpx * s112 -
+			2 * q1x * qperpx * s122 - 2 * qperpw * qperpy * s002 * theta +
+			2 * qperpx * qperpz * s002 * theta -
+			2 * q1w * q1x * s012 * theta +
+			2 * qperpw * qperpx * s012 * theta +
+			2 * qperpy * qperpz * s012 * theta +
+			2 * q1x * q1x * s022 * theta + 2 * q1y * q1y * s022 * theta -
+			2 * qperpx * qperpx * s022 * theta -
+			2 * qperpy * qperpy * s022 * theta +
+			q1z * (-(qperpx * s002) - qperpy * s012 + qperpx * s102 +
+				qperpy * s112 - 2 * q1x * s002 * theta) +
+			q1y * (-(qperpz * s012) + 2 * qperpy * s022 +
+				qperpw * (s002 - s102) + qperpz * s112 -
+				2 * qperpy * s122 + 2 * q1w * s002 * theta -
+				2 * q1z * s012 * theta));
+
+		m_c5[2] = DerivativeTerm(
+			0., 2 * (qperpw * qperpy * s000 - qperpx * qperpz * s000 +
+				q1y * q1z * s010 - qperpw * qperpx * s010 -
+				qperpy * qperpz * s010 - q1y * q1y * s020 +
+				qperpx * qperpx * s020 + qperpy * qperpy * s020 +
+				q1x * q1z * (s000 - s100) - qperpw * qperpy * s100 +
+				qperpx * qperpz * s100 +
+				q1w * (q1y * (-s000 + s100) + q1x * (s010 - s110)) -
+				q1y * q1z * s110 + qperpw * qperpx * s110 +
+				qperpy * qperpz * s110 + q1y * q1y * s120 -
+				qperpx * qperpx * s120 - qperpy * qperpy * s120 +
+				q1x * q1x * (-s020 + s120)) *
+			theta,
+			2 * (qperpw * qperpy * s001 - qperpx * qperpz * s001 +
+				q1y * q1z * s011 - qperpw * qperpx * s011 -
+				qperpy * qperpz * s011 - q1y * q1y * s021 +
+				qperpx * qperpx * s021 + qperpy * qperpy * s021 +
+				q1x * q1z * (s001 - s101) - qperpw * qperpy * s101 +
+				qperpx * qperpz * s101 +
+				q1w * (q1y * (-s001 + s101) + q1x * (s011 - s111)) -
+				q1y * q1z * s111 + qperpw * qperpx * s111 +
+				qperpy * qperpz * s111 + q1y * q1y * s121 -
+				qperpx * qperpx * s121 - qperpy * qperpy * s121 +
+				q1x * q1x * (-s021 + s121)) *
+			theta,
+			2 * (qperpw * qperpy * s002 - qperpx * qperpz * s002 +
+				q1y * q1z * s012 - qperpw * qperpx * s012 -
+				qperpy * qperpz * s012 - q1y * q1y * s022 +
+				qperpx * qperpx * s022 + qperpy * qperpy * s022 +
+				q1x * q1z * (s002 - s102) - qperpw * qperpy * s102 +
+				qperpx * qperpz * s102 +
+				q1w * (q1y * (-s002 + s102) + q1x * (s012 - s112)) -
+				q1y * q1z * s112 + qperpw * qperpx * s112 +
+				qperpy * qperpz * s112 + q1y * q1y * s122 -
+				qperpx * qperpx * s122 - qperpy * qperpy * s122 +
+				q1x * q1x * (-s022 + s122)) *
+			theta);
+	}
+}
+
+void AnimatedTransform::decompose(const Matrix4x4& m, Vector3f* T, Quaternion* Rquat, Matrix4x4* S)
+{
+	// Extract translation _T_ from transformation matrix
+	//Note: column major matrix
+	T->x = m[3][0];
+	T->y = m[3][1];
+	T->z = m[3][2];
+
+	// Compute new transformation matrix _M_ without translation
+	Matrix4x4 M = m;
+	for (int i = 0; i < 3; ++i)
+		M[i][3] = M[3][i] = 0.f;
+	M[3][3] = 1.f;
+
+	// Extract rotation _R_ from transformation matrix by polar decomposition
+	Float norm;
+	int count = 0;
+	Matrix4x4 R = M;
+	do
+	{
+		// Compute next matrix _Rnext_ in series
+		Matrix4x4 Rnext = 0.5f * (R + inverse(transpose(R)));
+
+		// Compute norm of difference between _R_ and _Rnext_
+		norm = 0;
+		for (int i = 0; i < 3; ++i)
+		{
+			Float n = std::abs(R[0][i] - Rnext[0][i]) + std::abs(R[1][i] - Rnext[1][i]) +
+				std::abs(R[2][i] - Rnext[2][i]);
+			norm = std::max(norm, n);
+		}
+		R = Rnext;
+	} while (++count < 100 && norm > .0001);
+
+	*Rquat = glm::quat_cast(R);
+
+	// Compute scale _S_ using rotation and original matrix
+	*S = inverse(R) * M;
+}
+
+void AnimatedTransform::interpolate(Float time, Transform* t) const
+{
+	// Handle boundary conditions for matrix interpolation
+	if (!m_actuallyAnimated || time <= m_startTime)
+	{
+		*t = *m_startTransform;
+		return;
+	}
+	if (time >= m_endTime)
+	{
+		*t = *m_endTransform;
+		return;
+	}
+
+	Float dt = (time - m_startTime) / (m_endTime - m_startTime);
+
+	// Interpolate translation, rotation and scale at _dt_
+	Vector3f trans = (1 - dt) * m_T[0] + dt * m_T[1];
+	Quaternion rotate = Slerp(dt, m_R[0], m_R[1]);
+	Matrix4x4 scale(1.0f);
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			scale[i][j] = lerp(dt, m_S[0][i][j], m_S[1][i][j]);
+
+	// Compute interpolated matrix as product of interpolated components
+	*t = translate(trans) * Transform(toMatrix4x4(rotate)) * Transform(scale);
+}
+
+Ray AnimatedTransform::operator()(const Ray& r) const
+{
+	if (!m_actuallyAnimated || r.m_time <= m_startTime)
+		return (*m_startTransform)(r);
+	if (r.m_time >= m_endTime)
+		return (*m_endTransform)(r);
+
+	Transform t;
+	interpolate(r.m_time, &t);
+	return t(r);
+}
+
+Vector3f AnimatedTransform::operator()(Float time, const Vector3f& v, const Float& w) const
+{
+	if (!m_actuallyAnimated || time <= m_startTime)
+		return (*m_startTransform)(v, w);
+	if (time >= m_endTime)
+		return (*m_endTransform)(v, w);
+
+	Transform t;
+	interpolate(time, &t);
+	return t(v, w);
+}
+
+Bounds3f AnimatedTransform::motionAABB(const Bounds3f& b) const
+{
+	return motionAABB(b, m_startTime, m_endTime);
+}
+
+Bounds3f AnimatedTransform::motionAABB(const Bounds3f& b, Float time0, Float time1) const
+{
+	if (!m_actuallyAnimated)
+		return (*m_startTransform)(b);
+
+	// Note: without rotation every point moves along a line, the end boxes bound the motion
+	if (!m_hasRotation)
+	{
+		Transform t0, t1;
+		interpolate(time0, &t0);
+		interpolate(time1, &t1);
+		return unionBounds(t0(b), t1(b));
+	}
+
+	// Return motion bounds accounting for animated rotation
+	Bounds3f bounds;
+	for (int corner = 0; corner < 8; ++corner)
+		bounds = unionBounds(bounds, boundPointMotion(b.corner(corner), time0, time1));
+	return bounds;
+}
+
+Bounds3f AnimatedTransform::boundPointMotion(const Vector3f& p, Float time0, Float time1) const
+{
+	if (!m_actuallyAnimated)
+		return Bounds3f((*m_startTransform)(p, 1.0f));
+
+	Bounds3f bounds((*this)(time0, p, 1.0f), (*this)(time1, p, 1.0f));
+	Float cosTheta = dot(m_R[0], m_R[1]);
+	Float theta = std::acos(clamp(cosTheta, -1, 1));
+
+	// The derivative terms are parameterized by the normalized time in [0, 1]
+	Float u0 = clamp((time0 - m_startTime) / (m_endTime - m_startTime), 0, 1);
+	Float u1 = clamp((time1 - m_startTime) / (m_endTime - m_startTime), 0, 1);
+	for (int c = 0; c < 3; ++c)
+	{
+		// Find any motion derivative zeros for the component _c_
+		Float zeros[8];
+		int nZeros = 0;
+		intervalFindZeros(m_c1[c].eval(p), m_c2[c].eval(p), m_c3[c].eval(p), m_c4[c].eval(p),
+			m_c5[c].eval(p), theta, Interval(u0, u1), zeros, &nZeros);
+		CHECK_LE(nZeros, sizeof(zeros) / sizeof(zeros[0]));
+
+		// Expand bounding box for any motion derivative zeros found
+		for (int i = 0; i < nZeros; ++i)
+		{
+			Float time = lerp(clamp(zeros[i], u0, u1), m_startTime, m_endTime);
+			bounds = unionBounds(bounds, (*this)(time, p, 1.0f));
+		}
+	}
+	return bounds;
+}
+
 RENDER_END
\ No newline at end of file
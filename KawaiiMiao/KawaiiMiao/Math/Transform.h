@@ -45,6 +45,10 @@ public:
 	template <typename T>
 	inline Vector3<T> operator()(const Vector3<T>& v, Vector3<T>* vTransError) const;
 
+	//Normal, by the inverse transpose so that it stays perpendicular to the transformed surface
+	template <typename T>
+	inline Vector3<T> transformNormal(const Vector3<T>& n) const;
+
 	template <typename T>
 	inline Vector3<T> operator()(const Ray& r) const;
 
@@ -88,6 +92,14 @@ Transform lookAt(const Vector3f& pos, const Vector3f& look, const Vector3f& up);
 Transform orthographic(Float znear, Float zfar);
 Transform perspective(Float fov, Float znear, Float zfar);
 
+template <typename T>
+inline Vector3<T> Transform::transformNormal(const Vector3<T>& n) const
+{
+	//Note: a row vector times the inverse is the inverse transpose times the column vector
+	glm::vec<4, Float> ret = glm::vec<4, Float>(n.x, n.y, n.z, 0) * m_transInv;
+	return Vector3<T>(ret.x, ret.y, ret.z);
+}
+
 template <typename T>
 inline Vector3<T> Transform::operator()(const Vector3<T>& p, const Float& w) const
 {
@@ -163,46 +175,60 @@ inline Ray Transform::operator()(const Ray& r) const
 	Vector3f d = (*this)(r.m_dir, 0.0f);
 	Float tMax = r.m_tMax;
 
-	return Ray(o, d, tMax);
+	return Ray(o, d, tMax, r.m_time, r.m_medium);
 }
 
-//// AnimatedTransform 
-//class AnimatedTransform
-//{
-//public:
-//	AnimatedTransform(const Transform* startTransform, Float startTime,
-//		const Transform* endTransform, Float endTime);
-//	static void Decompose(const Matrix4x4& m, Vector3f* T, Quaternion* R, Matrix4x4* S);
-//	void Interpolate(Float time, Transform* t) const;
-//	Ray operator()(const Ray& r) const;
-//	RayDifferential operator()(const RayDifferential& r) const;
-//	Vector3f operator()(Float time, const Vector3f& v) const;
-//	bool HasScale() const 
-//	{
-//		return startTransform->HasScale() || endTransform->HasScale();
-//	}
-//	Bounds3f MotionBounds(const Bounds3f& b) const;
-//	Bounds3f BoundPointMotion(const Vector3f& p) const;
-//private:
-//	// AnimatedTransform Private Data
-//	const Transform* startTransform, * endTransform;
-//	const Float startTime, endTime;
-//	const bool actuallyAnimated;
-//	Vector3f T[2];
-//	Quaternion R[2];
-//	Matrix4x4 S[2];
-//	bool hasRotation;
-//	struct DerivativeTerm {
-//		DerivativeTerm() {}
-//		DerivativeTerm(Float c, Float x, Float y, Float z)
-//			: kc(c), kx(x), ky(y), kz(z) {}
-//		Float kc, kx, ky, kz;
-//		Float Eval(const Vector3f& p) const
-//		{
-//			return kc + kx * p.x + ky * p.y + kz * p.z;
-//		}
-//	};
-//	DerivativeTerm c1[3], c2[3], c3[3], c4[3], c5[3];
-//};
+// Interpolation between two transforms over [startTime, endTime], used for motion blur.
+// Note: both transforms are decomposed into translation, rotation and scale (M = TRS),
+//       which are interpolated separately.
+class AnimatedTransform
+{
+public:
+	AnimatedTransform(const Transform* startTransform, Float startTime,
+		const Transform* endTransform, Float endTime);
+
+	static void decompose(const Matrix4x4& m, Vector3f* T, Quaternion* R, Matrix4x4* S);
+
+	void interpolate(Float time, Transform* t) const;
+
+	Ray operator()(const Ray& r) const;
+	//Note: w == 1.f -> point, w == 0.f -> vector
+	Vector3f operator()(Float time, const Vector3f& v, const Float& w) const;
+
+	bool isAnimated() const { return m_actuallyAnimated; }
+	bool hasScale() const { return m_startTransform->HasScale() || m_endTransform->HasScale(); }
+
+	Float getStartTime() const { return m_startTime; }
+	Float getEndTime() const { return m_endTime; }
+
+	// Bounding box of everything the transformed box covers during [startTime, endTime]
+	Bounds3f motionAABB(const Bounds3f& b) const;
+	// Same as above, but only during [time0, time1]
+	Bounds3f motionAABB(const Bounds3f& b, Float time0, Float time1) const;
+	Bounds3f boundPointMotion(const Vector3f& p, Float time0, Float time1) const;
+
+private:
+	const Transform* m_startTransform, * m_endTransform;
+	const Float m_startTime, m_endTime;
+	const bool m_actuallyAnimated;
+	Vector3f m_T[2];
+	Quaternion m_R[2];
+	Matrix4x4 m_S[2];
+	bool m_hasRotation = false;
+
+	// Terms of the derivative of a transformed point over time, see pbrt-v3 2.9.4
+	struct DerivativeTerm
+	{
+		DerivativeTerm() {}
+		DerivativeTerm(Float c, Float x, Float y, Float z)
+			: kc(c), kx(x), ky(y), kz(z) {}
+		Float kc, kx, ky, kz;
+		Float eval(const Vector3f& p) const
+		{
+			return kc + kx * p.x + ky * p.y + kz * p.z;
+		}
+	};
+	DerivativeTerm m_c1[3], m_c2[3], m_c3[3], m_c4[3], m_c5[3];
+};
 
 RENDER_END
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "GridDensityMedium.h"
+
+#include "../Core/Sampler.h"
+#include "../Core/Interaction.h"
+#include "../Tool/Memory.h"
+#include "../Tool/MappedFile.h"
+
+#include <cstring>
+
+RENDER_BEGIN
+
+// Walks the cells of the majorant grid crossed by the ray over [tMin, tMax] in front to back order
+class MajorantIterator
+{
+public:
+	MajorantIterator(const Ray& ray, Float tMin, Float tMax, const Bounds3f& bounds, const Vector3i& res)
+		: m_t(tMin), m_tMax(tMax), m_res(res)
+	{
+		Vector3f cellSize = bounds.diagonal() / Vector3f(res);
+		Vector3f p = ray(tMin);
+		Vector3f pGrid = bounds.offset(p);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_cell[axis] = glm::clamp(int(pGrid[axis] * res[axis]), 0, res[axis] - 1);
+			Float d = ray.m_dir[axis];
+			if (d == 0)
+			{
+				m_nextT[axis] = Infinity;
+				m_deltaT[axis] = 0;
+				m_step[axis] = 0;
+				continue;
+			}
+
+			// Note: a negative direction leaves the cell through its lower face
+			Float face = bounds.m_pMin[axis] + (m_cell[axis] + (d > 0 ? 1 : 0)) * cellSize[axis];
+			m_nextT[axis] = tMin + (face - p[axis]) / d;
+			m_deltaT[axis] = cellSize[axis] / glm::abs(d);
+			m_step[axis] = d > 0 ? 1 : -1;
+		}
+	}
+
+	// Return the next segment and the index of its cell
+	bool next(Float& t0, Float& t1, int& cellIndex)
+	{
+		if (m_t >= m_tMax)
+			return false;
+
+		int axis = 0;
+		if (m_nextT[1] < m_nextT[axis]) axis = 1;
+		if (m_nextT[2] < m_nextT[axis]) axis = 2;
+
+		t0 = m_t;
+		t1 = glm::min(m_nextT[axis], m_tMax);
+		cellIndex = (m_cell.z * m_res.y + m_cell.y) * m_res.x + m_cell.x;
+
+		// Step into the neighbouring cell, the walk ends when it leaves the grid
+		m_t = t1;
+		m_cell[axis] += m_step[axis];
+		if (m_cell[axis] < 0 || m_cell[axis] >= m_res[axis])
+			m_t = m_tMax;
+		m_nextT[axis] += m_deltaT[axis];
+		return true;
+	}
+
+private:
+	Float m_t, m_tMax;
+	Vector3i m_res, m_cell, m_step;
+	Vector3f m_nextT, m_deltaT;
+};
+
+RENDER_REGISTER_CLASS(GridDensityMedium, "GridDensity");
+
+GridDensityMedium::GridDensityMedium(const APropertyTreeNode& node)
+{
+	const auto& props = node.getPropertyList();
+	Float scale = props.getFloat("Scale", 1.f);
+	Vector3f _sa = props.getVector3f("SigmaA", Vector3f(0.f)) * scale;
+	Vector3f _ss = props.getVector3f("SigmaS", Vector3f(1.f)) * scale;
+	Vector3f _st = _sa + _ss;
+	m_sigma_t = glm::max(_st.x, glm::max(_st.y, _st.z));
+	if (_st.x != _st.y || _st.y != _st.z)
+	{
+		K_WARN("GridDensity medium needs a gray extinction, using its maximum {0}", m_sigma_t);
+	}
+	Float _sigma_s[] = { _ss.x, _ss.y, _ss.z };
+	m_sigma_s = Spectrum::fromRGB(_sigma_s);
+	m_g = props.getFloat("G", 0.f);
+
+	m_bounds = Bounds3f(props.getVector3f("Min", Vector3f(0.f)), props.getVector3f("Max", Vector3f(1.f)));
+	Vector3f _res = props.getVector3f("Resolution");
+	m_nx = glm::max(1, int(_res.x));
+	m_ny = glm::max(1, int(_res.y));
+	m_nz = glm::max(1, int(_res.z));
+	const size_t nVoxels = size_t(m_nx) * m_ny * m_nz;
+
+	// Densities are given inline or as a raw file of 32 bit floats, x varying fastest
+	if (node.hasProperty("Filename"))
+	{
+		const std::string filename = APropertyTreeNode::m_directory + props.getString("Filename");
+		MappedFile file;
+		if (!file.open(filename) || file.size() != nVoxels * sizeof(float))
+		{
+			K_ERROR("Failed to load {0} density values from {1}", nVoxels, filename);
+		}
+		else
+		{
+			std::vector<float> values(nVoxels);
+			std::memcpy(values.data(), file.data(), file.size());
+			m_density.assign(values.begin(), values.end());
+		}
+	}
+	else
+	{
+		m_density = props.getVectorNf("Density", std::vector<Float>());
+		if (m_density.size() != nVoxels)
+		{
+			K_ERROR("GridDensity medium expects {0} density values, {1} were given", nVoxels, m_density.size());
+			m_density.clear();
+		}
+	}
+	m_density.resize(nVoxels, 0.f);
+
+	buildMajorantGrid(props.getInteger("MajorantResolution", 16));
+	activate();
+}
+
+void GridDensityMedium::buildMajorantGrid(int resolution)
+{
+	// Note: there is no point in cells smaller than the voxels
+	m_majorantRes = Vector3i(glm::min(resolution, m_nx), glm::min(resolution, m_ny), glm::min(resolution, m_nz));
+	m_majorants.resize(size_t(m_majorantRes.x) * m_majorantRes.y * m_majorantRes.z);
+
+	// Range of the voxels interpolated over [i / cells, (i + 1) / cells] of an axis
+	auto voxelRange = [](int i, int cells, int voxels, int& v0, int& v1)
+	{
+		v0 = glm::max(0, int(glm::floor(Float(i) / cells * voxels - 0.5f)));
+		v1 = glm::min(voxels - 1, int(glm::floor(Float(i + 1) / cells * voxels - 0.5f)) + 1);
+	};
+
+	for (int z = 0; z < m_majorantRes.z; ++z)
+	{
+		int z0, z1;
+		voxelRange(z, m_majorantRes.z, m_nz, z0, z1);
+		for (int y = 0; y < m_majorantRes.y; ++y)
+		{
+			int y0, y1;
+			voxelRange(y, m_majorantRes.y, m_ny, y0, y1);
+			for (int x = 0; x < m_majorantRes.x; ++x)
+			{
+				int x0, x1;
+				voxelRange(x, m_majorantRes.x, m_nx, x0, x1);
+
+				// Note: trilinear interpolation never exceeds the voxels it blends
+				Float maxDensity = 0;
+				for (int vz = z0; vz <= z1; ++vz)
+					for (int vy = y0; vy <= y1; ++vy)
+						for (int vx = x0; vx <= x1; ++vx)
+							maxDensity = glm::max(maxDensity, D(Vector3i(vx, vy, vz)));
+				m_majorants[(z * m_majorantRes.y + y) * m_majorantRes.x + x] = maxDensity;
+			}
+		}
+	}
+}
+
+Float GridDensityMedium::density(const Vector3f& p) const
+{
+	// Compute voxel coordinates and offsets for _p_
+	Vector3f pGrid = m_bounds.offset(p);
+	Vector3f pSamples(pGrid.x * m_nx - .5f, pGrid.y * m_ny - .5f, pGrid.z * m_nz - .5f);
+	Vector3i pi = Vector3i(glm::floor(pSamples));
+	Vector3f d = pSamples - Vector3f(pi);
+
+	// Trilinearly interpolate density values to compute local density
+	Float d00 = lerp(d.x, D(pi), D(pi + Vector3i(1, 0, 0)));
+	Float d10 = lerp(d.x, D(pi + Vector3i(0, 1, 0)), D(pi + Vector3i(1, 1, 0)));
+	Float d01 = lerp(d.x, D(pi + Vector3i(0, 0, 1)), D(pi + Vector3i(1, 0, 1)));
+	Float d11 = lerp(d.x, D(pi + Vector3i(0, 1, 1)), D(pi + Vector3i(1, 1, 1)));
+	Float d0 = lerp(d.y, d00, d10);
+	Float d1 = lerp(d.y, d01, d11);
+	return lerp(d.z, d0, d1);
+}
+
+Spectrum GridDensityMedium::Tr(const Ray& ray, Sampler& sampler) const
+{
+	Float tMin, tMax;
+	if (!m_bounds.hit(ray, tMin, tMax))
+		return Spectrum(1.f);
+
+	// Ratio tracking, every tentative collision scales the transmittance by its null fraction
+	Float Tr = 1;
+	MajorantIterator iter(ray, tMin, tMax, m_bounds, m_majorantRes);
+	Float t0, t1;
+	int cell;
+	while (iter.next(t0, t1, cell))
+	{
+		Float sigmaMaj = m_sigma_t * m_majorants[cell];
+		if (sigmaMaj == 0)
+			continue;
+
+		Float t = t0;
+		while (true)
+		{
+			t -= std::log(1 - sampler.get1D()) / sigmaMaj;
+			if (t >= t1)
+				break;
+			Tr *= 1 - glm::max((Float)0, density(ray(t)) * m_sigma_t / sigmaMaj);
+
+			// Russian roulette on low transmittance
+			const Float rrThreshold = .1;
+			if (Tr < rrThreshold)
+			{
+				Float q = glm::max((Float).05, 1 - Tr);
+				if (sampler.get1D() < q)
+					return Spectrum(0.f);
+				Tr /= 1 - q;
+			}
+		}
+	}
+	return Spectrum(Tr);
+}
+
+Spectrum GridDensityMedium::sample(const Ray& ray, Sampler& sampler, MemoryArena& arena,
+	MediumInteraction& mi) const
+{
+	Float tMin, tMax;
+	if (!m_bounds.hit(ray, tMin, tMax))
+		return Spectrum(1.f);
+
+	// Delta tracking, the flight restarts at each cell boundary since free paths are memoryless
+	MajorantIterator iter(ray, tMin, tMax, m_bounds, m_majorantRes);
+	Float t0, t1;
+	int cell;
+	while (iter.next(t0, t1, cell))
+	{
+		Float sigmaMaj = m_sigma_t * m_majorants[cell];
+		if (sigmaMaj == 0)
+			continue;
+
+		Float t = t0;
+		while (true)
+		{
+			t -= std::log(1 - sampler.get1D()) / sigmaMaj;
+			if (t >= t1)
+				break;
+			if (density(ray(t)) * m_sigma_t / sigmaMaj > sampler.get1D())
+			{
+				// Populate _mi_ with medium interaction information and return
+				mi = MediumInteraction(ray(t), -ray.direction(), ray.m_time, this,
+					ARENA_ALLOC(arena, HenyeyGreenstein)(m_g));
+				return m_sigma_s / m_sigma_t;
+			}
+		}
+	}
+	return Spectrum(1.f);
+}
+
+RENDER_END
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../Core/Medium.h"
+
+#include <vector>
+
+RENDER_BEGIN
+
+// A heterogeneous medium whose density is trilinearly interpolated from a voxel grid filling an
+// axis aligned box. Free flights are sampled by delta tracking and transmittance is estimated by
+// ratio tracking, both against the maximum density of the cells of a coarse majorant grid the
+// ray crosses, so that the empty and thin parts of the volume are skipped with few samples.
+class GridDensityMedium final : public Medium
+{
+public:
+	typedef std::shared_ptr<GridDensityMedium> ptr;
+
+	GridDensityMedium(const APropertyTreeNode& node);
+
+	virtual Spectrum Tr(const Ray& ray, Sampler& sampler) const override;
+	virtual Spectrum sample(const Ray& ray, Sampler& sampler, MemoryArena& arena,
+		MediumInteraction& mi) const override;
+
+	virtual std::string toString() const override { return "GridDensityMedium[]"; }
+
+private:
+	// Density at world space point _p_
+	Float density(const Vector3f& p) const;
+	// Voxel lookup, the density is zero outside of the grid
+	Float D(const Vector3i& p) const
+	{
+		if (p.x < 0 || p.x >= m_nx || p.y < 0 || p.y >= m_ny || p.z < 0 || p.z >= m_nz)
+			return 0;
+		return m_density[(p.z * m_ny + p.y) * m_nx + p.x];
+	}
+
+	void buildMajorantGrid(int resolution);
+
+	Spectrum m_sigma_s;
+	// Note: delta tracking needs a gray extinction coefficient
+	Float m_sigma_t;
+	Float m_g;
+
+	Bounds3f m_bounds;
+	int m_nx, m_ny, m_nz;
+	std::vector<Float> m_density;
+
+	// Maximum density over each cell of the majorant grid
+	Vector3i m_majorantRes;
+	std::vector<Float> m_majorants;
+};
+
+RENDER_END
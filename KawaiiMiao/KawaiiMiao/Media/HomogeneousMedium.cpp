@@ -0,0 +1,62 @@
+#include "HomogeneousMedium.h"
+
+#include "../Core/Sampler.h"
+#include "../Core/Interaction.h"
+#include "../Tool/Memory.h"
+
+RENDER_BEGIN
+
+RENDER_REGISTER_CLASS(HomogeneousMedium, "Homogeneous");
+
+HomogeneousMedium::HomogeneousMedium(const APropertyTreeNode& node)
+{
+	const auto& props = node.getPropertyList();
+	Float scale = props.getFloat("Scale", 1.f);
+	Vector3f _sa = props.getVector3f("SigmaA", Vector3f(0.f)) * scale;
+	Vector3f _ss = props.getVector3f("SigmaS", Vector3f(1.f)) * scale;
+	Float _sigma_a[] = { _sa.x, _sa.y, _sa.z };
+	Float _sigma_s[] = { _ss.x, _ss.y, _ss.z };
+	m_sigma_a = Spectrum::fromRGB(_sigma_a);
+	m_sigma_s = Spectrum::fromRGB(_sigma_s);
+	m_sigma_t = m_sigma_a + m_sigma_s;
+	m_g = props.getFloat("G", 0.f);
+	activate();
+}
+
+Spectrum HomogeneousMedium::Tr(const Ray& ray, Sampler& sampler) const
+{
+	return exp(-m_sigma_t * glm::min(ray.m_tMax, MaxFloat));
+}
+
+Spectrum HomogeneousMedium::sample(const Ray& ray, Sampler& sampler, MemoryArena& arena,
+	MediumInteraction& mi) const
+{
+	// Sample a channel and distance along the ray
+	int channel = glm::min((int)(sampler.get1D() * Spectrum::nSamples), Spectrum::nSamples - 1);
+	Float dist = -std::log(1 - sampler.get1D()) / m_sigma_t[channel];
+	Float t = glm::min(dist, ray.m_tMax);
+	bool sampledMedium = t < ray.m_tMax;
+	if (sampledMedium)
+	{
+		mi = MediumInteraction(ray(t), -ray.direction(), ray.m_time, this,
+			ARENA_ALLOC(arena, HenyeyGreenstein)(m_g));
+	}
+
+	// Compute the transmittance and sampling density
+	Spectrum Tr = exp(-m_sigma_t * glm::min(t, MaxFloat));
+
+	// Note: the pdf is averaged over the channels, each of them may have been sampled
+	Spectrum density = sampledMedium ? (m_sigma_t * Tr) : Tr;
+	Float pdf = 0;
+	for (int i = 0; i < Spectrum::nSamples; ++i)
+		pdf += density[i];
+	pdf *= 1 / (Float)Spectrum::nSamples;
+	if (pdf == 0)
+	{
+		DCHECK(Tr.isBlack());
+		pdf = 1;
+	}
+	return sampledMedium ? (Tr * m_sigma_s / pdf) : (Tr / pdf);
+}
+
+RENDER_END
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../Core/Medium.h"
+
+RENDER_BEGIN
+
+// A medium of constant density, transmittance has the closed form exp(-sigma_t * d)
+class HomogeneousMedium final : public Medium
+{
+public:
+	typedef std::shared_ptr<HomogeneousMedium> ptr;
+
+	HomogeneousMedium(const APropertyTreeNode& node);
+	HomogeneousMedium(const Spectrum& sigma_a, const Spectrum& sigma_s, Float g)
+		: m_sigma_a(sigma_a), m_sigma_s(sigma_s), m_sigma_t(sigma_s + sigma_a), m_g(g) {}
+
+	virtual Spectrum Tr(const Ray& ray, Sampler& sampler) const override;
+	virtual Spectrum sample(const Ray& ray, Sampler& sampler, MemoryArena& arena,
+		MediumInteraction& mi) const override;
+
+	virtual std::string toString() const override { return "HomogeneousMedium[]"; }
+
+private:
+	Spectrum m_sigma_a, m_sigma_s, m_sigma_t;
+	Float m_g;
+};
+
+RENDER_END
@@ -0,0 +1,164 @@
+#include "HaltonSampler.h"
+
+#include "../Core/LowDiscrepancy.h"
+
+RENDER_BEGIN
+
+RENDER_REGISTER_CLASS(HaltonSampler, "Halton");
+
+// Digit permutations of all the bases, read only once built
+struct HaltonPermutations
+{
+	HaltonPermutations()
+	{
+		Rng rng;
+		m_permutations = computeRadicalInversePermutations(rng, m_offsets);
+	}
+
+	std::vector<uint16_t> m_permutations;
+	std::vector<int> m_offsets;
+};
+
+static const HaltonPermutations& haltonPermutations()
+{
+	// Note: built by the first sampler, the initialization of a local static is thread safe
+	static const HaltonPermutations permutations;
+	return permutations;
+}
+
+HaltonSampler::HaltonSampler(const APropertyTreeNode& node)
+	: Sampler(node.getPropertyList())
+{
+	initialize();
+	activate();
+}
+
+HaltonSampler::HaltonSampler(int64_t samplesPerPixel)
+	: Sampler(samplesPerPixel)
+{
+	initialize();
+}
+
+void HaltonSampler::initialize()
+{
+	const HaltonPermutations& permutations = haltonPermutations();
+	m_permutations = permutations.m_permutations.data();
+	m_permutationOffsets = permutations.m_offsets.data();
+
+	// Find the powers of 2 and 3 covering _maxResolution_, a pixel of the block is visited
+	// once by every _m_sampleStride_ consecutive indices
+	for (int i = 0; i < 2; ++i)
+	{
+		int base = (i == 0) ? 2 : 3;
+		int scale = 1, exp = 0;
+		while (scale < maxResolution)
+		{
+			scale *= base;
+			++exp;
+		}
+		m_baseScales[i] = scale;
+		m_baseExponents[i] = exp;
+	}
+	m_sampleStride = int64_t(m_baseScales[0]) * m_baseScales[1];
+	m_multInverse[0] = multiplicativeInverse(m_baseScales[1], m_baseScales[0]);
+	m_multInverse[1] = multiplicativeInverse(m_baseScales[0], m_baseScales[1]);
+}
+
+void HaltonSampler::startPixel(const Vector2i& p)
+{
+	Sampler::startPixel(p);
+
+	// Solve for the first index falling into the pixel with the Chinese remainder theorem,
+	// the pixel's inverted digits give the index modulo each scale
+	const int pm[2] = { ((p.x % maxResolution) + maxResolution) % maxResolution,
+		((p.y % maxResolution) + maxResolution) % maxResolution };
+	m_pixelOffset = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		uint64_t dimOffset = (i == 0) ?
+			inverseRadicalInverse<2>(pm[0], m_baseExponents[0]) :
+			inverseRadicalInverse<3>(pm[1], m_baseExponents[1]);
+		m_pixelOffset += int64_t(dimOffset) * (m_sampleStride / m_baseScales[i]) * m_multInverse[i];
+	}
+	m_pixelOffset %= m_sampleStride;
+
+	// Every element of the sample arrays takes a sample of its own
+	int dim = arrayStartDim;
+	for (size_t i = 0; i < m_samples1DArraySizes.size(); ++i, ++dim)
+	{
+		int64_t nSamples = m_samples1DArraySizes[i] * samplesPerPixel;
+		Float* samples = sampleArray1D(i);
+		for (int64_t j = 0; j < nSamples; ++j)
+			samples[j] = sampleDimension(getIndexForSample(j), dim);
+	}
+	for (size_t i = 0; i < m_samples2DArraySizes.size(); ++i, dim += 2)
+	{
+		int64_t nSamples = m_samples2DArraySizes[i] * samplesPerPixel;
+		Vector2f* samples = sampleArray2D(i);
+		for (int64_t j = 0; j < nSamples; ++j)
+		{
+			int64_t index = getIndexForSample(j);
+			samples[j] = Vector2f(sampleDimension(index, dim), sampleDimension(index, dim + 1));
+		}
+	}
+	m_arrayEndDim = dim;
+
+	m_dimension = 0;
+	m_intervalSampleIndex = getIndexForSample(0);
+}
+
+bool HaltonSampler::startNextSample()
+{
+	m_dimension = 0;
+	m_intervalSampleIndex = getIndexForSample(m_currentPixelSampleIndex + 1);
+	return Sampler::startNextSample();
+}
+
+bool HaltonSampler::setSampleNumber(int64_t sampleNum)
+{
+	m_dimension = 0;
+	m_intervalSampleIndex = getIndexForSample(sampleNum);
+	return Sampler::setSampleNumber(sampleNum);
+}
+
+Float HaltonSampler::get1D()
+{
+	// Skip over the dimensions of the sample arrays, and wrap around past the prime table
+	if (m_dimension >= arrayStartDim && m_dimension < m_arrayEndDim)
+		m_dimension = m_arrayEndDim;
+	if (m_dimension >= PrimeTableSize)
+		m_dimension = m_arrayEndDim;
+	return sampleDimension(m_intervalSampleIndex, m_dimension++);
+}
+
+Vector2f HaltonSampler::get2D()
+{
+	if (m_dimension + 1 >= arrayStartDim && m_dimension < m_arrayEndDim)
+		m_dimension = m_arrayEndDim;
+	if (m_dimension + 1 >= PrimeTableSize)
+		m_dimension = m_arrayEndDim;
+	Vector2f p(sampleDimension(m_intervalSampleIndex, m_dimension),
+		sampleDimension(m_intervalSampleIndex, m_dimension + 1));
+	m_dimension += 2;
+	return p;
+}
+
+Float HaltonSampler::sampleDimension(int64_t index, int dim) const
+{
+	// The first two dimensions only keep the digits past the pixel's, which is the offset in it
+	if (dim == 0)
+		return radicalInverse(dim, index >> m_baseExponents[0]);
+	else if (dim == 1)
+		return radicalInverse(dim, index / m_baseScales[1]);
+	else
+		return scrambledRadicalInverse(dim, index, &m_permutations[m_permutationOffsets[dim]]);
+}
+
+std::unique_ptr<Sampler> HaltonSampler::clone(int seed)
+{
+	// Note: the sequence is deterministic, the seed is not needed. Sample numbers past the SPP
+	//       continue the sequence of the pixel instead of repeating its first samples.
+	return std::unique_ptr<Sampler>(new HaltonSampler(*this));
+}
+
+RENDER_END
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "../Core/Sampler.h"
+
+RENDER_BEGIN
+
+// Samples the Halton sequence over the whole image. The first two dimensions are scaled so that
+// every pixel of a 128x128 block owns the indices whose samples fall into it, the index of the
+// n-th sample of a pixel is then found in constant time. The other dimensions are scrambled by
+// random digit permutations, computed once and shared by all the samplers.
+class HaltonSampler final : public Sampler
+{
+public:
+	typedef std::shared_ptr<HaltonSampler> ptr;
+
+	HaltonSampler(const APropertyTreeNode& node);
+	HaltonSampler(int64_t samplesPerPixel);
+
+	virtual void startPixel(const Vector2i& p) override;
+	virtual bool startNextSample() override;
+	virtual bool setSampleNumber(int64_t sampleNum) override;
+
+	virtual Float get1D() override;
+	virtual Vector2f get2D() override;
+
+	virtual std::unique_ptr<Sampler> clone(int seed) override;
+
+	virtual std::string toString() const override { return "HaltonSampler[]"; }
+
+private:
+	void initialize();
+
+	// Index in the global sequence of the _sampleNum_-th sample of the current pixel
+	int64_t getIndexForSample(int64_t sampleNum) const { return m_pixelOffset + sampleNum * m_sampleStride; }
+	Float sampleDimension(int64_t index, int dimension) const;
+
+	// Note: the camera takes the first dimensions, the sample arrays follow
+	static constexpr int arrayStartDim = 5;
+	static constexpr int maxResolution = 128;
+
+	Vector2i m_baseScales, m_baseExponents;
+	int64_t m_sampleStride;
+	int64_t m_multInverse[2];
+
+	int64_t m_pixelOffset = 0;
+	int64_t m_intervalSampleIndex = 0;
+	int m_dimension = 0;
+	int m_arrayEndDim = arrayStartDim;
+
+	const uint16_t* m_permutations = nullptr;
+	const int* m_permutationOffsets = nullptr;
+};
+
+RENDER_END
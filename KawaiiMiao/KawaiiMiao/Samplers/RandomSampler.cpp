@@ -38,13 +38,19 @@ std::unique_ptr<Sampler> RandomSampler::clone(int seed)
 
 void RandomSampler::startPixel(const Vector2i& p)
 {
-	for (size_t i = 0; i < m_sampleArray1D.size(); ++i)
-		for (size_t j = 0; j < m_sampleArray1D[i].size(); ++j)
-			m_sampleArray1D[i][j] = m_rng.uniformFloat();
-
-	for (size_t i = 0; i < m_sampleArray2D.size(); ++i)
-		for (size_t j = 0; j < m_sampleArray2D[i].size(); ++j)
-			m_sampleArray2D[i][j] = { m_rng.uniformFloat(), m_rng.uniformFloat() };
+	for (size_t i = 0; i < m_samples1DArraySizes.size(); ++i)
+	{
+		Float* samples = sampleArray1D(i);
+		for (int64_t j = 0; j < m_samples1DArraySizes[i] * samplesPerPixel; ++j)
+			samples[j] = m_rng.uniformFloat();
+	}
+
+	for (size_t i = 0; i < m_samples2DArraySizes.size(); ++i)
+	{
+		Vector2f* samples = sampleArray2D(i);
+		for (int64_t j = 0; j < m_samples2DArraySizes[i] * samplesPerPixel; ++j)
+			samples[j] = { m_rng.uniformFloat(), m_rng.uniformFloat() };
+	}
 
 	Sampler::startPixel(p);
 }
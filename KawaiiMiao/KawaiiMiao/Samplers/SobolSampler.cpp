@@ -0,0 +1,178 @@
+#include "SobolSampler.h"
+
+#include "../Core/LowDiscrepancy.h"
+
+RENDER_BEGIN
+
+RENDER_REGISTER_CLASS(SobolSampler, "Sobol");
+
+SobolSampler::SobolSampler(const APropertyTreeNode& node)
+	: Sampler(node.getPropertyList()), m_seed(uint32_t(node.getPropertyList().getInteger("Seed", 0))),
+	m_blueNoise(node.getPropertyList().getBoolean("BlueNoise", false))
+{
+	if ((samplesPerPixel & (samplesPerPixel - 1)) != 0)
+	{
+		K_WARN("Sobol sampler with {0} samples per pixel, a power of two is better stratified", samplesPerPixel);
+	}
+	while ((int64_t(1) << m_log2SamplesPerPixel) < samplesPerPixel)
+		++m_log2SamplesPerPixel;
+	// Note: the Sobol points are indexed on 32 bits, the pixels of a tile take 14 of them
+	if (m_blueNoise && m_log2SamplesPerPixel > 32 - 2 * tileResolutionLog2)
+	{
+		K_WARN("Blue noise Sobol sampler with {0} samples per pixel, falling back to white noise", samplesPerPixel);
+		m_blueNoise = false;
+	}
+	activate();
+}
+
+SobolSampler::SobolSampler(int64_t samplesPerPixel, uint32_t seed, bool blueNoise)
+	: Sampler(samplesPerPixel), m_seed(seed), m_blueNoise(blueNoise)
+{
+	while ((int64_t(1) << m_log2SamplesPerPixel) < samplesPerPixel)
+		++m_log2SamplesPerPixel;
+	if (m_log2SamplesPerPixel > 32 - 2 * tileResolutionLog2)
+		m_blueNoise = false;
+}
+
+uint64_t SobolSampler::dimensionHash(uint32_t dimension) const
+{
+	return mixBits(m_pixelHash ^ m_roundHash ^ (uint64_t(dimension) * 0x9e3779b97f4a7c15ull));
+}
+
+Float SobolSampler::sample1D(uint32_t index, uint32_t count, uint64_t hash) const
+{
+	// Note: the shuffle keeps the dimensions of a sample from being correlated
+	uint32_t shuffled = permutationElement(index, count, uint32_t(hash));
+	uint32_t v = fastOwenScramble(uint32_t(sobolSample2D(shuffled)), uint32_t(hash >> 32));
+	return glm::min(Float(v * 0x1p-32), aOneMinusEpsilon);
+}
+
+Vector2f SobolSampler::sample2D(uint32_t index, uint32_t count, uint64_t hash) const
+{
+	uint32_t shuffled = permutationElement(index, count, uint32_t(hash));
+	uint64_t v = sobolSample2D(shuffled);
+	uint64_t seeds = mixBits(hash);
+	uint32_t x = fastOwenScramble(uint32_t(v), uint32_t(hash >> 32));
+	uint32_t y = fastOwenScramble(uint32_t(v >> 32), uint32_t(seeds));
+	return Vector2f(glm::min(Float(x * 0x1p-32), aOneMinusEpsilon), glm::min(Float(y * 0x1p-32), aOneMinusEpsilon));
+}
+
+uint32_t SobolSampler::zOrderSampleIndex(uint32_t dimension) const
+{
+	// All the permutations of four digits
+	static const uint8_t permutations[24][4] =
+	{
+		{ 0, 1, 2, 3 }, { 0, 1, 3, 2 }, { 0, 2, 1, 3 }, { 0, 2, 3, 1 }, { 0, 3, 2, 1 }, { 0, 3, 1, 2 },
+		{ 1, 0, 2, 3 }, { 1, 0, 3, 2 }, { 1, 2, 0, 3 }, { 1, 2, 3, 0 }, { 1, 3, 2, 0 }, { 1, 3, 0, 2 },
+		{ 2, 1, 0, 3 }, { 2, 1, 3, 0 }, { 2, 0, 1, 3 }, { 2, 0, 3, 1 }, { 2, 3, 0, 1 }, { 2, 3, 1, 0 },
+		{ 3, 1, 2, 0 }, { 3, 1, 0, 2 }, { 3, 2, 1, 0 }, { 3, 2, 0, 1 }, { 3, 0, 2, 1 }, { 3, 0, 1, 2 }
+	};
+
+	// Rank of the sample among all the samples of the tile, the samples of a pixel being consecutive
+	const uint32_t mortonIndex = (m_mortonPixel << m_log2SamplesPerPixel) | uint32_t(m_currentPixelSampleIndex);
+
+	// Note: every base 4 digit is permuted by a hash of the digits above it, so that the sets of
+	//       pixels sharing a prefix still cover the sequence evenly. An odd power of two of samples
+	//       leaves a lowest base 2 digit, which is flipped instead.
+	const uint64_t dimensionSeed = m_tileHash ^ m_roundHash ^ (uint64_t(dimension) * 0x55555555u);
+	const int oddDigit = m_log2SamplesPerPixel & 1;
+	const int nBase4Digits = tileResolutionLog2 + (m_log2SamplesPerPixel + 1) / 2;
+	uint32_t sampleIndex = 0;
+	for (int i = nBase4Digits - 1; i >= oddDigit; --i)
+	{
+		const int digitShift = 2 * i - oddDigit;
+		const uint32_t digit = (mortonIndex >> digitShift) & 3;
+		const uint64_t higherDigits = uint64_t(mortonIndex) >> (digitShift + 2);
+		const int p = int((mixBits(higherDigits ^ dimensionSeed) >> 24) % 24);
+		sampleIndex |= uint32_t(permutations[p][digit]) << digitShift;
+	}
+	if (oddDigit)
+		sampleIndex |= (mortonIndex & 1) ^ uint32_t(mixBits((mortonIndex >> 1) ^ dimensionSeed) & 1);
+	return sampleIndex;
+}
+
+void SobolSampler::startPixel(const Vector2i& p)
+{
+	Sampler::startPixel(p);
+	m_pixelHash = mixBits((uint64_t(uint32_t(p.x)) << 32 | uint32_t(p.y)) ^ mixBits(m_seed));
+	m_roundHash = 0;
+	m_dimension = 0;
+
+	if (m_blueNoise)
+	{
+		const uint32_t mask = (1u << tileResolutionLog2) - 1;
+		const uint32_t tx = uint32_t(p.x) >> tileResolutionLog2, ty = uint32_t(p.y) >> tileResolutionLog2;
+		m_mortonPixel = encodeMorton2(uint32_t(p.x) & mask, uint32_t(p.y) & mask);
+		m_tileHash = mixBits((uint64_t(tx) << 32 | ty) ^ mixBits(~uint64_t(m_seed)));
+	}
+
+	// The elements of all the samples of an array form one padded dimension of their own
+	for (size_t i = 0; i < m_samples1DArraySizes.size(); ++i)
+	{
+		uint64_t hash = dimensionHash(0x10000u + uint32_t(i));
+		uint32_t count = uint32_t(m_samples1DArraySizes[i] * samplesPerPixel);
+		Float* samples = sampleArray1D(i);
+		for (uint32_t j = 0; j < count; ++j)
+			samples[j] = sample1D(j, count, hash);
+	}
+	for (size_t i = 0; i < m_samples2DArraySizes.size(); ++i)
+	{
+		uint64_t hash = dimensionHash(0x20000u + uint32_t(i));
+		uint32_t count = uint32_t(m_samples2DArraySizes[i] * samplesPerPixel);
+		Vector2f* samples = sampleArray2D(i);
+		for (uint32_t j = 0; j < count; ++j)
+			samples[j] = sample2D(j, count, hash);
+	}
+}
+
+bool SobolSampler::startNextSample()
+{
+	m_dimension = 0;
+	return Sampler::startNextSample();
+}
+
+bool SobolSampler::setSampleNumber(int64_t sampleNum)
+{
+	// Note: the same round of all the pixels shares its scramble, which keeps the blue noise
+	const int64_t round = sampleNum / samplesPerPixel;
+	m_roundHash = round > 0 ? mixBits(uint64_t(round) * 0xbf58476d1ce4e5b9ull) : 0;
+	m_dimension = 0;
+	return Sampler::setSampleNumber(sampleNum);
+}
+
+Float SobolSampler::get1D()
+{
+	CHECK_LT(m_currentPixelSampleIndex, samplesPerPixel);
+	if (m_blueNoise)
+	{
+		const uint32_t dimension = m_dimension++;
+		const uint64_t hash = mixBits(m_tileHash ^ m_roundHash ^ (uint64_t(dimension) * 0x9e3779b97f4a7c15ull));
+		uint32_t v = fastOwenScramble(uint32_t(sobolSample2D(zOrderSampleIndex(dimension))), uint32_t(hash));
+		return glm::min(Float(v * 0x1p-32), aOneMinusEpsilon);
+	}
+	return sample1D(uint32_t(m_currentPixelSampleIndex), uint32_t(samplesPerPixel), dimensionHash(m_dimension++));
+}
+
+Vector2f SobolSampler::get2D()
+{
+	CHECK_LT(m_currentPixelSampleIndex, samplesPerPixel);
+	if (m_blueNoise)
+	{
+		const uint32_t dimension = m_dimension++;
+		const uint64_t hash = mixBits(m_tileHash ^ m_roundHash ^ (uint64_t(dimension) * 0x9e3779b97f4a7c15ull));
+		uint64_t v = sobolSample2D(zOrderSampleIndex(dimension));
+		uint32_t x = fastOwenScramble(uint32_t(v), uint32_t(hash));
+		uint32_t y = fastOwenScramble(uint32_t(v >> 32), uint32_t(hash >> 32));
+		return Vector2f(glm::min(Float(x * 0x1p-32), aOneMinusEpsilon), glm::min(Float(y * 0x1p-32), aOneMinusEpsilon));
+	}
+	return sample2D(uint32_t(m_currentPixelSampleIndex), uint32_t(samplesPerPixel), dimensionHash(m_dimension++));
+}
+
+std::unique_ptr<Sampler> SobolSampler::clone(int seed)
+{
+	// Note: the points only depend on the pixel and the sample number, the seed is not needed.
+	//       Sample numbers past the SPP take the points again under another scramble.
+	return std::unique_ptr<Sampler>(new SobolSampler(*this));
+}
+
+RENDER_END
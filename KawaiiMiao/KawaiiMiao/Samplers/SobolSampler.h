@@ -0,0 +1,59 @@
+#pragma once
+
+#include "../Core/Sampler.h"
+
+RENDER_BEGIN
+
+// Owen scrambled Sobol points, padded over the dimensions: every 1D or 2D request takes the first
+// dimensions of the Sobol sequence, with the order of the pixel's samples shuffled and the bits
+// scrambled by hashes of the pixel and the dimension. Any number of dimensions is then as well
+// distributed as the first two, which form a (0,2)-sequence, and neighbouring pixels decorrelate.
+//
+// With _BlueNoise_ on, the pixels of every 128x128 tile rather share one sequence per dimension,
+// each pixel taking its samples at the Z-order rank of the pixel, with the base 4 digits of the
+// rank randomly permuted per dimension (Ahmed and Wonka 2020, Burley's ZSobol). Neighbouring pixels
+// then get complementary points and the error is distributed as blue noise in screen space, which
+// looks far better at low sample counts and is easier to denoise. The sample arrays are unchanged.
+class SobolSampler final : public Sampler
+{
+public:
+	typedef std::shared_ptr<SobolSampler> ptr;
+
+	SobolSampler(const APropertyTreeNode& node);
+	SobolSampler(int64_t samplesPerPixel, uint32_t seed = 0, bool blueNoise = false);
+
+	virtual void startPixel(const Vector2i& p) override;
+	virtual bool startNextSample() override;
+	virtual bool setSampleNumber(int64_t sampleNum) override;
+
+	virtual Float get1D() override;
+	virtual Vector2f get2D() override;
+
+	virtual std::unique_ptr<Sampler> clone(int seed) override;
+
+	virtual std::string toString() const override { return "SobolSampler[]"; }
+
+private:
+	uint64_t dimensionHash(uint32_t dimension) const;
+
+	// Sample _index_ of _count_ in the padded dimension of _hash_
+	Float sample1D(uint32_t index, uint32_t count, uint64_t hash) const;
+	Vector2f sample2D(uint32_t index, uint32_t count, uint64_t hash) const;
+
+	// Index in the sequence of the tile of the current sample for _dimension_, in blue noise mode
+	uint32_t zOrderSampleIndex(uint32_t dimension) const;
+
+	static constexpr int tileResolutionLog2 = 7;
+
+	uint32_t m_seed;
+	bool m_blueNoise;
+	int m_log2SamplesPerPixel = 0;
+	uint64_t m_tileHash = 0;
+	uint32_t m_mortonPixel = 0;
+	uint64_t m_pixelHash = 0;
+	// Scrambles the samples past the SPP, which take the sequence again
+	uint64_t m_roundHash = 0;
+	uint32_t m_dimension = 0;
+};
+
+RENDER_END
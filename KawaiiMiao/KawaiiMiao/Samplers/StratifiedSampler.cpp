@@ -0,0 +1,63 @@
+#include "StratifiedSampler.h"
+
+#include "../Core/Sampling.h"
+
+RENDER_BEGIN
+
+RENDER_REGISTER_CLASS(StratifiedSampler, "Stratified");
+
+StratifiedSampler::StratifiedSampler(const APropertyTreeNode& node)
+	: StratifiedSampler(node.getPropertyList().getInteger("XSamples", 4),
+		node.getPropertyList().getInteger("YSamples", 4),
+		node.getPropertyList().getBoolean("Jitter", true),
+		node.getPropertyList().getInteger("Dimensions", 4))
+{
+	activate();
+}
+
+StratifiedSampler::StratifiedSampler(int xPixelSamples, int yPixelSamples, bool jitterSamples, int nSampledDimensions)
+	: PixelSampler(xPixelSamples * yPixelSamples, nSampledDimensions),
+	m_xPixelSamples(xPixelSamples), m_yPixelSamples(yPixelSamples), m_jitterSamples(jitterSamples) {}
+
+void StratifiedSampler::startPixel(const Vector2i& p)
+{
+	// Generate single stratified samples for the pixel
+	const int nSamples = int(samplesPerPixel);
+	for (int i = 0; i < m_nSampledDimensions; ++i)
+	{
+		stratifiedSample1D(samples1D(i), nSamples, m_rng, m_jitterSamples);
+		shuffle(samples1D(i), nSamples, 1, m_rng);
+		stratifiedSample2D(samples2D(i), m_xPixelSamples, m_yPixelSamples, m_rng, m_jitterSamples);
+		shuffle(samples2D(i), nSamples, 1, m_rng);
+	}
+
+	// Generate arrays of stratified samples for the pixel
+	for (size_t i = 0; i < m_samples1DArraySizes.size(); ++i)
+	{
+		const int count = m_samples1DArraySizes[i];
+		for (int j = 0; j < nSamples; ++j)
+		{
+			Float* samples = sampleArray1D(i) + j * count;
+			stratifiedSample1D(samples, count, m_rng, m_jitterSamples);
+			shuffle(samples, count, 1, m_rng);
+		}
+	}
+	for (size_t i = 0; i < m_samples2DArraySizes.size(); ++i)
+	{
+		// Note: a grid only stratifies square counts, the Latin hypercube fits any of them
+		const int count = m_samples2DArraySizes[i];
+		for (int j = 0; j < nSamples; ++j)
+			latinHypercube(&(sampleArray2D(i) + j * count)->x, count, 2, m_rng);
+	}
+
+	PixelSampler::startPixel(p);
+}
+
+std::unique_ptr<Sampler> StratifiedSampler::clone(int seed)
+{
+	StratifiedSampler* ss = new StratifiedSampler(*this);
+	ss->m_rng.setSequence(seed);
+	return std::unique_ptr<Sampler>(ss);
+}
+
+RENDER_END
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../Core/Sampler.h"
+
+RENDER_BEGIN
+
+// Jittered samples over a _XSamples_ by _YSamples_ grid for every pixel. Each of the first
+// _Dimensions_ 1D and 2D dimensions is stratified on its own, with the strata randomly shuffled
+// among the samples so that the dimensions don't correlate. The elements of a sample array are
+// stratified in 1D and Latin hypercube sampled in 2D, for any array size.
+class StratifiedSampler final : public PixelSampler
+{
+public:
+	typedef std::shared_ptr<StratifiedSampler> ptr;
+
+	StratifiedSampler(const APropertyTreeNode& node);
+	StratifiedSampler(int xPixelSamples, int yPixelSamples, bool jitterSamples, int nSampledDimensions);
+
+	virtual void startPixel(const Vector2i& p) override;
+
+	virtual std::unique_ptr<Sampler> clone(int seed) override;
+
+	virtual std::string toString() const override { return "StratifiedSampler[]"; }
+
+private:
+	const int m_xPixelSamples, m_yPixelSamples;
+	const bool m_jitterSamples;
+};
+
+RENDER_END
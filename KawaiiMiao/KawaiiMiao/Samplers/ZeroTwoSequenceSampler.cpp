@@ -0,0 +1,57 @@
+#include "ZeroTwoSequenceSampler.h"
+
+#include "../Core/LowDiscrepancy.h"
+
+RENDER_BEGIN
+
+RENDER_REGISTER_CLASS(ZeroTwoSequenceSampler, "ZeroTwoSequence");
+
+ZeroTwoSequenceSampler::ZeroTwoSequenceSampler(const APropertyTreeNode& node)
+	: ZeroTwoSequenceSampler(node.getPropertyList().getInteger("SPP", 16),
+		node.getPropertyList().getInteger("Dimensions", 4))
+{
+	activate();
+}
+
+ZeroTwoSequenceSampler::ZeroTwoSequenceSampler(int64_t samplesPerPixel, int nSampledDimensions)
+	: PixelSampler(roundUpPow2(int(samplesPerPixel)), nSampledDimensions)
+{
+	if (!isPowerOf2(int(samplesPerPixel)))
+	{
+		K_WARN("Pixel samples being rounded up to power of 2 (from {0} to {1})",
+			samplesPerPixel, this->samplesPerPixel);
+	}
+}
+
+int ZeroTwoSequenceSampler::roundCount(int count) const
+{
+	return roundUpPow2(count);
+}
+
+void ZeroTwoSequenceSampler::startPixel(const Vector2i& p)
+{
+	// Generate 1D and 2D pixel sample components using (0,2)-sequence
+	const int nSamples = int(samplesPerPixel);
+	for (int i = 0; i < m_nSampledDimensions; ++i)
+	{
+		vanDerCorput(1, nSamples, samples1D(i), m_rng);
+		sobol2D(1, nSamples, samples2D(i), m_rng);
+	}
+
+	// Generate 1D and 2D array samples using (0,2)-sequence
+	for (size_t i = 0; i < m_samples1DArraySizes.size(); ++i)
+		vanDerCorput(m_samples1DArraySizes[i], nSamples, sampleArray1D(i), m_rng);
+	for (size_t i = 0; i < m_samples2DArraySizes.size(); ++i)
+		sobol2D(m_samples2DArraySizes[i], nSamples, sampleArray2D(i), m_rng);
+
+	PixelSampler::startPixel(p);
+}
+
+std::unique_ptr<Sampler> ZeroTwoSequenceSampler::clone(int seed)
+{
+	ZeroTwoSequenceSampler* lds = new ZeroTwoSequenceSampler(*this);
+	lds->m_rng.setSequence(seed);
+	return std::unique_ptr<Sampler>(lds);
+}
+
+RENDER_END
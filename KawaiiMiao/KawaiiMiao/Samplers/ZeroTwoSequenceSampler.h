@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../Core/Sampler.h"
+
+RENDER_BEGIN
+
+// Samples from the first two dimensions of the Sobol (0,2)-sequence, randomly scrambled and
+// shuffled for every pixel. The number of samples per pixel and the array sizes are rounded up
+// to powers of two, so that every sample and every array is an elementary interval stratified
+// set: the elements of an array are well distributed within a sample and across the samples.
+class ZeroTwoSequenceSampler final : public PixelSampler
+{
+public:
+	typedef std::shared_ptr<ZeroTwoSequenceSampler> ptr;
+
+	ZeroTwoSequenceSampler(const APropertyTreeNode& node);
+	ZeroTwoSequenceSampler(int64_t samplesPerPixel, int nSampledDimensions);
+
+	virtual void startPixel(const Vector2i& p) override;
+
+	virtual int roundCount(int count) const override;
+
+	virtual std::unique_ptr<Sampler> clone(int seed) override;
+
+	virtual std::string toString() const override { return "ZeroTwoSequenceSampler[]"; }
+};
+
+RENDER_END
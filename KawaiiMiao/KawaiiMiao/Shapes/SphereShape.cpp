@@ -153,11 +153,14 @@ bool SphereShape::hit(const Ray& r) const
 	if (t0 > t1)
 		std::swap(t0, t1);
 
-	if (t0 > ray.m_tMax || t1 <= 0)
+	// Note: a ray leaving the surface finds it again at t ~ 0 through rounding errors,
+	//       so hits closer than a small fraction of the radius are rejected
+	Float tMin = RayEpsilon * m_radius / glm::sqrt(a);
+	if (t0 > ray.m_tMax || t1 <= tMin)
 		return false;
 
 	Float tShapeHit = t0;
-	if (tShapeHit <= 0)
+	if (tShapeHit <= tMin)
 	{
 		tShapeHit = t1;
 		if (tShapeHit > ray.m_tMax)
@@ -167,9 +170,8 @@ bool SphereShape::hit(const Ray& r) const
 	return true;
 }
 
-bool SphereShape::hit(const Ray& r, Float& tHit, SurfaceInteraction& isect) const
+bool SphereShape::hit(const Ray& r, HitRecord& record) const
 {
-	Float phi;
 	Vector3f pHit;
 
 	// Transform Ray to object space
@@ -191,11 +193,12 @@ bool SphereShape::hit(const Ray& r, Float& tHit, SurfaceInteraction& isect) cons
 	if (t0 > t1)
 		std::swap(t0, t1);
 
-	if (t0 > ray.m_tMax || t1 <= 0)
+	Float tMin = RayEpsilon * m_radius / glm::sqrt(a);
+	if (t0 > ray.m_tMax || t1 <= tMin)
 		return false;
 
 	Float tShapeHit = t0;
-	if (tShapeHit <= 0)
+	if (tShapeHit <= tMin)
 	{
 		tShapeHit = t1;
 		if (tShapeHit > ray.m_tMax)
@@ -209,7 +212,18 @@ bool SphereShape::hit(const Ray& r, Float& tHit, SurfaceInteraction& isect) cons
 	if (pHit.x == 0 && pHit.y == 0)
 		pHit.x = 1e-5f * m_radius;
 
-	phi = std::atan2(pHit.y, pHit.x);
+	record.m_tHit = tShapeHit;
+	record.m_coords = pHit;
+	return true;
+}
+
+bool SphereShape::computeSurfaceInteraction(const Ray& r, const HitRecord& record, SurfaceInteraction& isect) const
+{
+	// Transform Ray to object space
+	Ray ray = (*m_worldToObject)(r);
+	const Vector3f& pHit = record.m_coords;
+
+	Float phi = std::atan2(pHit.y, pHit.x);
 
 	if (phi < 0)
 		phi += 2 * Pi;
@@ -230,9 +244,9 @@ bool SphereShape::hit(const Ray& r, Float& tHit, SurfaceInteraction& isect) cons
 	isect = (*m_objectToWorld)(SurfaceInteraction(pHit, Vector2f(u, v), -ray.direction(),
 		dpdu, dpdv, this));
 
-	isect.normal = faceforward(isect.normal, isect.wo);
-
-	tHit = tShapeHit;
+	// Note: the normal points outwards, it tells the inside and outside media of the sphere apart
+	isect.normal = normalize((*m_objectToWorld)(pHit, 0.0f));
+	isect.shading.n = isect.normal;
 
 	return true;
 }
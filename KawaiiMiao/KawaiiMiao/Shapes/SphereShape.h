@@ -23,8 +23,13 @@ public:
 
 	virtual Bounds3f objectBound() const override;
 
+	using Shape::hit;
 	virtual bool hit(const Ray& ray) const override;
-	virtual bool hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+
+	// The record coordinates are the refined object space hit point
+	virtual bool computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+		SurfaceInteraction& isect) const override;
 
 	virtual Float solidAngle(const Vector3f& p, int nSamples = 512) const override;
 
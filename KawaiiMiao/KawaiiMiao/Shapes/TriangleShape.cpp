@@ -10,19 +10,19 @@
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 
+#include "../Accelerators/AcceleratorCache.h"
 #include "../Tool/Logger.h"
 
+#include <filesystem>
+
 RENDER_BEGIN
 
 //-------------------------------------------TriangleMesh-------------------------------------
 
-TriangleMesh::TriangleMesh(Transform* objectToWorld, const std::string& filename)
+// Import the mesh file through Assimp and merge all of its meshes into one
+static void importMesh(const std::string& filename, std::vector<Vector3f>& gPosition,
+	std::vector<Vector3f>& gNormal, std::vector<Vector2f>& gUV, std::vector<int>& gIndices)
 {
-	std::vector<Vector3f> gPosition;
-	std::vector<Vector3f> gNormal;
-	std::vector<Vector2f> gUV;
-	std::vector<int> gIndices;
-
 	auto process_mesh = [&](aiMesh* mesh, const aiScene* scene) -> void
 	{
 		// Walk through each of the mesh's vertices
@@ -87,6 +87,90 @@ TriangleMesh::TriangleMesh(Transform* objectToWorld, const std::string& filename
 
 	// Process the mesh node
 	process_node(scene->mRootNode, scene);
+}
+
+// Key of the imported mesh data, changes whenever the mesh file is modified
+static uint64_t meshCacheKey(const std::string& filename)
+{
+	std::error_code error;
+	uint64_t fileSize = std::filesystem::file_size(filename, error);
+	int64_t writeTime = std::filesystem::last_write_time(filename, error).time_since_epoch().count();
+
+	CacheHasher hasher;
+	hasher.update(filename);
+	hasher.update(fileSize);
+	hasher.update(writeTime);
+	return hasher.value();
+}
+
+template <typename T>
+static bool copyCacheSection(const CacheSection& section, std::vector<T>& data)
+{
+	if (section.m_size % sizeof(T) != 0)
+		return false;
+	const T* begin = static_cast<const T*>(section.m_data);
+	data.assign(begin, begin + section.m_size / sizeof(T));
+	return true;
+}
+
+// Note: a truncated or stale cache entry must not index past the vertex arrays
+static bool validMeshData(const std::vector<Vector3f>& position, const std::vector<Vector3f>& normal,
+	const std::vector<Vector2f>& uv, const std::vector<int>& indices)
+{
+	if (indices.empty() || indices.size() % 3 != 0)
+		return false;
+	if ((!normal.empty() && normal.size() != position.size()) || (!uv.empty() && uv.size() != position.size()))
+		return false;
+	for (int index : indices)
+	{
+		if (index < 0 || size_t(index) >= position.size())
+			return false;
+	}
+	return true;
+}
+
+TriangleMesh::TriangleMesh(Transform* objectToWorld, const std::string& filename)
+{
+	std::vector<Vector3f> gPosition;
+	std::vector<Vector3f> gNormal;
+	std::vector<Vector2f> gUV;
+	std::vector<int> gIndices;
+
+	// Note: the cache holds the merged object space data, so Assimp is skipped on reload
+	//       while the object to world transform is still free to change
+	bool cached = false;
+	uint64_t cacheKey = 0;
+	if (AcceleratorCache::isEnabled())
+	{
+		cacheKey = meshCacheKey(filename);
+		std::vector<CacheSection> sections;
+		MappedFile::unique_ptr file = AcceleratorCache::load("Mesh", cacheKey, sections);
+		cached = file && sections.size() == 4 &&
+			copyCacheSection(sections[0], gPosition) &&
+			copyCacheSection(sections[1], gNormal) &&
+			copyCacheSection(sections[2], gUV) &&
+			copyCacheSection(sections[3], gIndices) &&
+			validMeshData(gPosition, gNormal, gUV, gIndices);
+	}
+
+	if (!cached)
+	{
+		gPosition.clear();
+		gNormal.clear();
+		gUV.clear();
+		gIndices.clear();
+		importMesh(filename, gPosition, gNormal, gUV, gIndices);
+
+		if (AcceleratorCache::isEnabled() && !gIndices.empty())
+		{
+			std::vector<CacheSection> sections(4);
+			sections[0] = { gPosition.data(), gPosition.size() * sizeof(Vector3f) };
+			sections[1] = { gNormal.data(), gNormal.size() * sizeof(Vector3f) };
+			sections[2] = { gUV.data(), gUV.size() * sizeof(Vector2f) };
+			sections[3] = { gIndices.data(), gIndices.size() * sizeof(int) };
+			AcceleratorCache::store("Mesh", cacheKey, sections);
+		}
+	}
 
 	// Vertex data
 	// Note: we transform the vertex into world space in advance for efficient ray intersection routine
@@ -178,6 +262,16 @@ Interaction TriangleShape::sample(const Vector2f& u, Float& pdf) const
 	return it;
 }
 
+void TriangleShape::normalBounds(Vector3f& w, Float& cosTheta) const
+{
+	// Note: same orientation as the normal of the points returned by sample()
+	const auto& p0 = m_mesh->getPosition(m_indices[0]);
+	const auto& p1 = m_mesh->getPosition(m_indices[1]);
+	const auto& p2 = m_mesh->getPosition(m_indices[2]);
+	w = normalize(Vector3f(cross(p1 - p0, p2 - p0)));
+	cosTheta = 1;
+}
+
 bool TriangleShape::hit(const Ray& ray) const
 {
 	// Get triangle vertices in _p0_, _p1_, and _p2_
@@ -281,10 +375,15 @@ bool TriangleShape::hit(const Ray& ray) const
 	if (t <= deltaT)
 		return false;
 
+	// Note: spawned rays start on the surface they leave without any offset, the rounding of the
+	//       origin lets them find that surface again at t ~ 0, so such hits are rejected as well
+	if (t <= RayEpsilon * maxComponent(abs(ray.origin())))
+		return false;
+
 	return true;
 }
 
-bool TriangleShape::hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect) const
+bool TriangleShape::hit(const Ray& ray, HitRecord& record) const
 {
 	// Get triangle vertices in _p0_, _p1_, and _p2_
 	const auto& p0 = m_mesh->getPosition(m_indices[0]);
@@ -384,9 +483,26 @@ bool TriangleShape::hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect)
 	// Compute $\delta_t$ term for triangle $t$ error bounds and check _t_
 	Float maxE = maxComponent(abs(Vector3f(e0, e1, e2)));
 	Float deltaT = 3 * (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) * glm::abs(invDet);
-	if (t <= deltaT)
+	if (t <= deltaT || t <= RayEpsilon * maxComponent(abs(ray.origin())))
 		return false;
 
+	record.m_tHit = t;
+	record.m_coords = Vector3f(b0, b1, b2);
+	return true;
+}
+
+bool TriangleShape::computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+	SurfaceInteraction& isect) const
+{
+	Float b0 = record.m_coords[0];
+	Float b1 = record.m_coords[1];
+	Float b2 = record.m_coords[2];
+
+	// Get triangle vertices in _p0_, _p1_, and _p2_
+	const auto& p0 = m_mesh->getPosition(m_indices[0]);
+	const auto& p1 = m_mesh->getPosition(m_indices[1]);
+	const auto& p2 = m_mesh->getPosition(m_indices[2]);
+
 	// Compute triangle partial derivatives
 	Vector3f dpdu, dpdv;
 	Vector2f uv[3];
@@ -434,7 +550,6 @@ bool TriangleShape::hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect)
 
 	// Override surface normal in _isect_ for triangle
 	isect.normal = Vector3f(normalize(cross(dp02, dp12)));
-	tHit = t;
 
 	if (m_mesh->hasNormal())
 	{
@@ -452,6 +567,9 @@ bool TriangleShape::hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect)
 		isect.normal = ns;
 	}
 
+	// Note: the interpolated normal is the shading normal as well
+	isect.shading.n = isect.normal;
+
 	return true;
 }
 
@@ -52,11 +52,20 @@ public:
 	virtual Bounds3f objectBound() const override;
 	virtual Bounds3f worldBound() const override;
 
+	using Shape::hit;
 	virtual bool hit(const Ray& ray) const override;
-	virtual bool hit(const Ray& ray, Float& tHit, SurfaceInteraction& isect) const override;
+	virtual bool hit(const Ray& ray, HitRecord& record) const override;
+
+	// The record coordinates are the barycentrics (b0, b1, b2) of the hit
+	virtual bool computeSurfaceInteraction(const Ray& ray, const HitRecord& record,
+		SurfaceInteraction& isect) const override;
+
+	const Vector3f& getVertex(int i) const { return m_mesh->getPosition(m_indices[i]); }
 
 	virtual Float solidAngle(const Vector3f& p, int nSamples = 512) const override;
 
+	virtual void normalBounds(Vector3f& w, Float& cosTheta) const override;
+
 	virtual std::string toString() const override { return "TriangleShape[]"; }
 
 private:
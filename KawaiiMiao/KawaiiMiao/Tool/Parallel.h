@@ -9,6 +9,7 @@
 
 #include <tbb/tbb/spin_mutex.h>
 #include <tbb/tbb/parallel_for.h>
+#include <tbb/tbb/parallel_invoke.h>
 
 RENDER_BEGIN
 
@@ -207,6 +208,12 @@ void parallelFor(size_t start, size_t end, size_t grainSize, const Function& fun
 	}
 }
 
+//run two independent tasks concurrently, returns when both are done
+template <typename Function0, typename Function1>
+void parallelInvoke(const Function0& func0, const Function1& func1)
+{
+	tbb::parallel_invoke(func0, func1);
+}
 
 //inline int numSystemCores() { return std::max(1u, std::thread::hardware_concurrency()); }
 